@@ -15,6 +15,7 @@
  */
 
 #pragma once
+#include "CCircuitTopology.h"
 #include "CUnit.h"
 #include "constants.h"
 #include <algorithm>
@@ -23,8 +24,8 @@
 #include <fstream>
 #include <iomanip>
 #include <iostream>
-#include <queue>
 #include <string>
+#include <utility>
 #include <vector>
 
 // Constants for the circuit outlet destinations
@@ -37,6 +38,31 @@ enum CircuitDestination
     TAILINGS_OUTPUT = -3     // Final tailings output
 };
 
+// Steady-state solvers available to Circuit::run_mass_balance
+enum class MassBalanceSolver
+{
+    FixedPoint, // Successive substitution over all units (original scheme)
+    Newton,     // Newton–Raphson on the unit feed vector with analytic Jacobian
+    Anderson,   // Anderson mixing of the last few fixed-point iterates
+    GaussSeidel // Successive substitution in BFS order from the feed, using fresh feeds at once
+};
+
+// Rule of Circuit::check_validity a circuit fails, numbered as in check_validity
+enum class ValidityReason
+{
+    Valid,
+    Length,        // 1. vector size is not 2n + 1
+    Feed,          // 2. feed unit out of range
+    Index,         // 3. destination out of range
+    SelfLoop,      // 4. unit discharges into itself
+    SameOutput,    // 5. concentrate and tailings go to the same place
+    Unreachable,   // 6. unit not reachable from the feed
+    TwoTerminals,  // 7. unit reaches fewer than two circuit outlets
+    MissingOutlet, // 8. no product, or no tailings, reached at all
+    NotConverged,  // 9. mass balance does not converge
+    UnitParameters // volume parameters of the wrong size or outside [0, 1]
+};
+
 /* ------------------------------------------------------------------ */
 /*                         Circuit class                       */
 /* ------------------------------------------------------------------ */
@@ -60,16 +86,53 @@ public:
     bool initialize_from_vector(int vector_size, const int* circuit_vector, bool testFlag);
     bool initialize_from_vector(int vector_size, const int* circuit_vector, const double* beta, bool testFlag);
 
+    // Initialize the circuit from a compiled topology, which must outlive the
+    // circuit; the circuit only reads it, so it can be shared across threads
+    bool initialize_from_topology(const CircuitTopology& topology, const double* beta, bool testFlag = false);
+
+    // Reinitialise for another circuit vector, keeping all storage (allocation-free once warm)
+    bool reset(int vector_size, const int* circuit_vector, const double* beta, bool testFlag = false);
+    bool reset(const CircuitTopology& topology, const double* beta, bool testFlag = false);
+
+    // Topology the circuit was initialised with
+    const CircuitTopology& get_topology() const;
+
     // Check validity of a circuit vector
     bool check_validity(int vector_size, const int* circuit_vector);
+
+    // Structural rules 1-8 of check_validity, without the mass balance; compiles the topology
+    ValidityReason check_structure(int vector_size, const int* circuit_vector);
     bool check_validity(int vector_size, const int* circuit_vector, int unit_parameters_size, double* unit_parameters);
 
     // Run a mass balance calculation on the circuit
     bool run_mass_balance(double tolerance = 1e-6, int max_iterations = 1000);
 
+    // Run a mass balance with the recycle loops starting from the unit feeds in flow_state (see
+    // get_flow_state), e.g. the converged feeds of a similar circuit; any other size starts cold
+    bool run_mass_balance(const std::vector<double>& flow_state, double tolerance = 1e-6, int max_iterations = 1000);
+
+    // Current feed of every unit (palusznium, gormanium, waste per unit), converged after run_mass_balance
+    void get_flow_state(std::vector<double>& flow_state) const;
+
+    // Change one gene of the circuit vector (0: feed unit, 1 + 2u / 2 + 2u: concentrate / tailings of
+    // unit u) and check and solve the changed circuit. After a converged mass balance only the units
+    // downstream of the change are solved again, from their previous feeds. A circuit that fails a
+    // structural rule is left unchanged.
+    ValidityReason apply_gene_change(int pos, int new_dest, double tolerance = 1e-6, int max_iterations = 1000);
+
+    // Select the steady-state solver used by run_mass_balance
+    void set_solver(MassBalanceSolver kind, int depth = 5);
+
+    // Number of iterations taken by the last run_mass_balance call
+    int get_iterations() const;
+
     // Get the economic value of the circuit
     double get_economic_value() const;
 
+    // Gradient of get_economic_value with respect to the volume parameter β of every unit, from the
+    // adjoint of the converged mass balance (one linear solve per recycle loop); false if not converged
+    bool get_economic_value_gradient(std::vector<double>& gradient);
+
     // Get the recovery of valuable materials
     double get_palusznium_recovery() const;
     double get_gormanium_recovery() const;
@@ -78,6 +141,9 @@ public:
     double get_palusznium_grade() const;
     double get_gormanium_grade() const;
 
+    // Copy of one unit's current state, for output and tests
+    CUnit get_unit(int unit) const;
+
     // Export the circuit to a dot file for visualization
     bool export_to_dot(const std::string& filename) const;
 
@@ -103,8 +169,38 @@ public:
     bool save_output_info(const std::string& filename);
 
 private:
-    // The array of units in the circuit
-    std::vector<CUnit> units;
+    /* --------- unit state (one array entry per unit) --------- */
+    // Topology
+    std::vector<int> conc_num;  // destination of each unit's concentrate stream
+    std::vector<int> tails_num; // destination of each unit's tailings stream
+
+    std::vector<double> volume; // m³
+
+    // Flow state (kg/s)
+    std::vector<double> feed_palusznium, feed_gormanium, feed_waste;
+    std::vector<double> conc_palusznium, conc_gormanium, conc_waste;
+    std::vector<double> tails_palusznium, tails_gormanium, tails_waste;
+
+    // Kinetic and geometry constants shared by all units (CUnit() defaults until initialised)
+    double k_palusznium = Constants::Physical::K_PALUSZNIUM; // s⁻¹
+    double k_gormanium = Constants::Physical::K_GORMANIUM;   // s⁻¹
+    double k_waste = Constants::Physical::K_WASTE;           // s⁻¹
+    double rho = 0.0;                                        // kg/m³
+    double phi = 0.0;                                        // solids fraction
+    double V_min = Constants::Circuit::MIN_UNIT_VOLUME;      // m³
+    double V_max = Constants::Circuit::MAX_UNIT_VOLUME;      // m³
+
+    // Resize all unit arrays, resetting each unit to its default state
+    void resize_units(int num_units);
+
+    // Feed rates and economic parameters: defaults, or the test constants
+    void set_feed_and_prices(bool testFlag);
+
+    // Set up the unit arrays for the current topology
+    void load_topology(const double* beta, bool testFlag);
+
+    // Split the feed of one unit into concentrate and tailings (CUnit::process on the arrays)
+    void process_unit(int unit);
 
     // Circuit vector (for output)
     const int* circuit_vector;
@@ -141,8 +237,59 @@ private:
     double waste_penalty_palusznium;      // £/kg waste in Palusznium stream
     double waste_penalty_gormanium;       // £/kg waste in Gormanium stream
 
-    // Mark units that are accessible from a given unit (for validity checking)
-    void mark_units(int unit_num);
+    /* --------- mass balance solvers --------- */
+    MassBalanceSolver solver = MassBalanceSolver::FixedPoint;
+    int anderson_depth = 5;
+    int iterations = 0;
+
+    bool solved = false; // unit flows are the converged mass balance of the current topology
+
+    // Mass balance with the recycle loops starting from initial_feeds (3 per unit), or from their inflow if
+    // nullptr; with only_affected just the units marked in affected are solved, the others keep their flows
+    bool solve_mass_balance(const double* initial_feeds, double tolerance, int max_iterations,
+                            bool only_affected = false);
+
+    // Iterate one recycle loop (component) to convergence; x holds its unit feeds
+    bool solve_component(int comp, const double* initial_feeds, double tolerance, int max_iterations);
+    bool run_fixed_point(int comp, std::vector<double>& x, double tolerance, int max_iterations);
+    bool run_gauss_seidel(int comp, std::vector<double>& x, bool warm_start, double tolerance, int max_iterations);
+    bool run_newton(int comp, std::vector<double>& x, double tolerance, int max_iterations);
+    bool run_anderson(int comp, std::vector<double>& x, double tolerance, int max_iterations);
+
+    // One sweep of the fixed-point map over a component: process its units at feeds, route outputs
+    void sweep(int comp, const std::vector<double>& feeds, std::vector<double>& next);
+
+    /* --------- circuit topology --------- */
+    CircuitTopology own_topology;                     // compiled by initialize_from_vector / check_validity
+    const CircuitTopology* shared_topology = nullptr; // set by initialize_from_topology, used instead
+
+    std::vector<double> inflow;      // feeds entering the component being solved
+    std::vector<double> slot_volume; // volumes of the component's units, by slot
+    std::vector<double> slot_flows;  // feed, conc and tails blocks (P, G, W by slot) for UnitKernels
+
+    // Compile own_topology from conc_num / tails_num, for a circuit that was never initialised
+    void compile_topology();
+
+    // Gene changes: the changed vector, the units whose flows it changes and the flows before it
+    std::vector<int> changed_vector, affected_queue;
+    std::vector<bool> affected;
+    std::vector<double> previous_feeds;
+
+    // Mark the units reachable from the given units, not following flow into the feed unit
+    void mark_affected(int first, int second);
+
+    /* --------- scratch --------- */
+    // Work arrays of the solvers, kept between calls so that a reused
+    // circuit does not allocate
+    struct Scratch
+    {
+        std::vector<double> feeds, next, routed;                               // loop feeds, fixed point, Gauss–Seidel
+        std::vector<double> r, x_trial, r_trial, dx, J;                        // Newton
+        std::vector<double> g, f, g_prev, f_prev, dG, dF, gram, normal, gamma; // Anderson
+    } scratch;
+
+    // Accumulate the final product streams from the current unit outputs
+    void collect_products();
 
     // Check if all units are accessible from the feed
     bool check_all_units_accessible() const;
@@ -158,8 +305,6 @@ private:
     int n;
     int feed_dest = 0;
     uint8_t outlet_mask(int unit_idx, std::vector<int8_t>& cache) const;
-    uint8_t term_mask(int start) const;
-    void process_destination(int dest, uint8_t& mask, std::vector<bool>& visited, std::queue<int>& q) const;
 
     inline int OUT_P1() const
     {
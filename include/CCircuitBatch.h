@@ -0,0 +1,133 @@
+/**
+ * @file CCircuitBatch.h
+ * @brief Declares the CircuitBatch class – many circuits solved in lockstep
+ *
+ * A batch holds the flow state of up to block_size circuits with the same
+ * number of units. Every per-unit quantity is stored circuit-minor, i.e.
+ * value[slot * block_size + lane], so one unit of all circuits in the block
+ * is processed by a single call of the vectorised unit kernel. The units of
+ * each circuit are relabelled into slots in breadth-first order from the
+ * feed, and all circuits advance through the same Gauss–Seidel sweeps over
+ * the slots. A circuit is retired as soon as it converges and the next one
+ * takes over its lane; once the input runs out, the remaining circuits are
+ * packed to the front so the work per sweep shrinks with them.
+ *
+ * The sweeps stand in for the mass balance of circuit_performance, and the
+ * two differ in how they count iterations: max_iterations bounds the sweeps
+ * over the whole circuit here, but the iterations of every recycle loop
+ * there, with whichever solver Simulator_Parameters names. A circuit the
+ * sweeps have not settled within max_iterations is therefore handed to
+ * circuit_performance, and a batch result of -1e12 for a well-formed vector
+ * is always its verdict. The converse is not checked: Gauss–Seidel sweeps
+ * usually need fewer iterations than the fixed point, so a circuit that
+ * circuit_performance only just fails to converge can still get a value
+ * here.
+ *
+ * Like Circuit, the batch takes the unit model, the feed, the volumes and
+ * the prices from constants.h. Simulator_Parameters that set any of them to
+ * other than their defaults are not honoured by the sweeps, so every circuit
+ * of such an evaluation is solved by circuit_performance instead.
+ *
+ * A vector with the feed unit or a destination out of range is malformed
+ * and gets -1e12, as it fails Circuit::check_validity; circuit_performance
+ * alone would send such flow out of the circuit.
+ */
+
+#pragma once
+
+#include "CSimulator.h"
+#include "unit_kernels.h"
+#include <vector>
+
+class CircuitBatch
+{
+public:
+    // Batch for circuits of num_units units, iterating up to block_size circuits at once
+    explicit CircuitBatch(int num_units, int block_size = 64);
+
+    /**
+     * @brief Evaluate the economic value of a number of circuits.
+     *
+     * Same result as circuit_performance for every well-formed circuit, up
+     * to the convergence tolerance: -1e12 for a malformed vector or a mass
+     * balance that does not converge (see above). If simulator_parameters
+     * changes the model (see supports), circuit_performance solves them all.
+     *
+     * @param count Number of circuits
+     * @param circuit_vectors count circuit vectors of 2 * num_units + 1 entries, one after another
+     * @param betas count sets of num_units volume parameters, or nullptr for the default volume
+     * @param simulator_parameters Simulation parameters (tolerance and iteration limit, solver of the fallback)
+     * @param performances Output, count economic values
+     * @param same_vector circuit_vectors holds a single vector shared by all count circuits
+     */
+    void evaluate(int count, const int* circuit_vectors, const double* betas,
+                  const Simulator_Parameters& simulator_parameters, double* performances, bool same_vector = false);
+
+    // Lockstep sweeps taken by the last evaluate call
+    long get_iterations() const;
+
+    // Whether the unit model, feed, volumes and prices of simulator_parameters are the defaults, the
+    // values of constants.h the sweeps compute with; evaluate falls back to circuit_performance otherwise
+    static bool supports(const Simulator_Parameters& simulator_parameters);
+
+private:
+    int n;          // units per circuit
+    int block_size; // lanes per block (stride of the circuit-minor arrays)
+    int active;     // lanes still iterating, packed at the front
+    long iterations;
+    int vector_stride; // entries between the circuit vectors of the current evaluation (0: shared)
+
+    UnitKernels::Kinetics kinetics;
+
+    /* --------- per lane --------- */
+    std::vector<int> lane_circuit;   // circuit evaluated in each lane
+    std::vector<int> lane_sweeps;    // sweeps done by the circuit in each lane
+    std::vector<double> lane_cost;   // volume cost of each lane (£/s)
+    std::vector<double> lane_change; // largest relative feed change in the current sweep
+
+    /* --------- per slot and lane: [slot * block_size + lane] --------- */
+    // Destination of each outlet: a slot, n / n + 1 for the palusznium /
+    // gormanium product, or n + 2 for the tailings and for flow that enters
+    // the feed unit (slot 0)
+    std::vector<int> conc_dest, tails_dest;
+    std::vector<double> volume; // m³
+
+    /* --------- flows (kg/s): [(3 * destination + component) * block_size + lane] --------- */
+    // Current feeds of the n slots, followed by the two product streams and a
+    // sink for the flow that is not tracked, so routing needs no branches
+    std::vector<double> feed;
+    std::vector<double> last_feed; // feeds at which the units were last processed (n slots)
+
+    // Outputs each unit last routed: [(6 * slot + 3 * outlet + component) * block_size + lane]
+    std::vector<double> routed;
+
+    // Outputs of one slot for all lanes: [component * block_size + lane]
+    std::vector<double> conc, tails;
+
+    // Scratch for relabelling one circuit
+    std::vector<int> slot_of, unit_in;
+
+    // Circuits not settled within the iteration limit, and scratch for solving them one by one
+    std::vector<int> unsettled;
+    std::vector<int> single_vector;
+    std::vector<double> single_beta;
+
+    // Whether the feed unit and every destination of a circuit vector are in range
+    bool well_formed(const int* vec) const;
+
+    // Load circuit k into a lane; false for a malformed circuit vector
+    bool load(int lane, int k, const int* circuit_vectors, const double* betas);
+
+    // circuit_performance of circuit k
+    double solve_single(int k, const int* circuit_vectors, const double* betas,
+                        const Simulator_Parameters& simulator_parameters);
+
+    // One Gauss–Seidel sweep of all active lanes, raising lane_change to the feed changes seen
+    void sweep();
+
+    // Economic value of a lane from its current product flows
+    double economic_value(int lane) const;
+
+    // Move the state of lane from to lane to
+    void move_lane(int from, int to);
+};
@@ -0,0 +1,39 @@
+/**
+ * @file CCircuitCanonical.h
+ * @brief Canonical labelling of circuit vectors under renumbering of their units
+ *
+ * Renumbering the units of a circuit vector (and moving the feed with
+ * them) gives a different vector for the same physical circuit, as long as
+ * every unit keeps its volume. The canonical labelling numbers the units in
+ * breadth-first order from the feed unit, following the concentrate outlet
+ * before the tailings outlet. Every unit has exactly these two ordered
+ * outlets, so all renumberings of a circuit whose units the feed reaches
+ * get the same canonical vector; units the feed does not reach (only in
+ * invalid circuits) keep their relative order after the others.
+ *
+ * Caches and duplicate checks key on the canonical vector, with per-unit
+ * values such as the volume parameters or the flow state moved into the
+ * canonical order alongside it.
+ */
+
+#pragma once
+
+#include <vector>
+
+// Canonical form of a circuit vector and the renumbering that produced it
+struct Circuit_Labelling
+{
+    std::vector<int> circuit_vector; // canonical circuit vector, fed at unit 0
+    std::vector<int> unit_of;        // original unit of every canonical unit
+};
+
+// Renumber the units of a circuit vector canonically. A malformed vector (wrong size, an index out of
+// range) is copied unchanged with the identity renumbering, and false is returned.
+bool canonical_labelling(int vector_size, const int* circuit_vector, Circuit_Labelling& labelling);
+
+// Move per-unit values (values_per_unit per unit, e.g. 1 for volume parameters, 3 for a flow state)
+// into the canonical order of a labelling, and back
+void to_canonical_order(const Circuit_Labelling& labelling, const double* values, int values_per_unit,
+                        double* canonical_values);
+void from_canonical_order(const Circuit_Labelling& labelling, const double* canonical_values, int values_per_unit,
+                          double* values);
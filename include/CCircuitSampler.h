@@ -0,0 +1,46 @@
+/**
+ * @file CCircuitSampler.h
+ * @brief Constructive sampling of structurally valid circuit vectors
+ *
+ * A random circuit vector of ten or more units almost never passes the
+ * structural rules (1 to 8 of Circuit::check_validity), so drawing vectors
+ * and checking them takes many tries per valid circuit. The sampler builds
+ * circuits that pass the rules by construction instead:
+ *
+ *  1. Every outlet that is out of range, discharges into its own unit or
+ *     repeats the other outlet of its unit is drawn again.
+ *  2. A breadth-first tree from the feed unit spans the units it reaches;
+ *     a unit it misses is attached through an outlet outside the tree, of
+ *     which a tree always has one to spare, until every unit is reached.
+ *  3. Every unit reaches the terminals of the leaves of its subtree, so a
+ *     leaf (a unit whose outlets are not tree edges) that reaches fewer
+ *     than two terminals is given two distinct terminals; then every unit
+ *     reaches two. If the tailings are still not reached, a leaf is given
+ *     the tailings and a product.
+ *
+ * Each step only changes outlets outside the tree, so it keeps what the
+ * earlier ones made, and a vector that already passes the rules is left as
+ * it is: every valid circuit can come out of the sampler. The work is a few
+ * passes over the vector, and the random numbers come from a Philox stream
+ * the caller keys, so many circuits can be sampled in parallel.
+ *
+ * The same steps repair a circuit that fails the rules, e.g. a GA child
+ * after crossover and mutation, with few changes: the outlets that break
+ * rules 3 to 5, one outlet for every unit the feed misses, and the outlets
+ * of the leaves short of terminals. The rest of the circuit is kept.
+ */
+
+#pragma once
+
+#include "Philox.h"
+
+// Repair a circuit vector of num_units units in place to pass rules 1 to 8, changing few outlets;
+// a vector that passes them is left unchanged
+void repair_circuit(int num_units, int* circuit_vector, Philox& random);
+
+// Random circuit vector of num_units units (2 * num_units + 1 entries) that passes rules 1 to 8
+void sample_valid_circuit(int num_units, Philox& random, int* circuit_vector);
+
+// Circuit vector near base: changes random outlets of base take random destinations, and the result is
+// completed to pass rules 1 to 8 as in sample_valid_circuit. circuit_vector may be base.
+void vary_valid_circuit(int num_units, const int* base, int changes, Philox& random, int* circuit_vector);
@@ -0,0 +1,71 @@
+/**
+ * @file CCircuitScreen.h
+ * @brief Declares the CircuitScreen class – structural validity of 64 circuits at once
+ *
+ * The screen applies the structural rules of Circuit::check_structure to up
+ * to 64 circuit vectors with the same number of units. The vectors are
+ * stored bit-sliced: for every unit and destination there is one 64-bit
+ * word whose bit k is set if circuit k sends an outlet of the unit there.
+ * Each rule then runs once for all circuits with word-wide bit operations,
+ * and the result is a mask of the circuits that pass. A circuit that is
+ * screened out never reaches the mass balance.
+ *
+ * The work per call grows with the square of the number of units, not with
+ * the number of circuits, so the screen suits the GA's circuit sizes and
+ * full batches; a single circuit is checked faster by check_structure.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+class CircuitScreen
+{
+public:
+    static constexpr int LANES = 64; // circuits per call
+
+    // Screen for circuits of num_units units
+    explicit CircuitScreen(int num_units);
+
+    /**
+     * @brief Check the structure of up to 64 circuit vectors.
+     *
+     * Rules 1 to 8 of Circuit::check_validity (length, feed, index,
+     * self-loop, same output, reachability, two terminals per unit and the
+     * product and tailings outlets); bit k of the result is set exactly if
+     * check_structure accepts vector k.
+     *
+     * @param count Number of circuit vectors, at most LANES
+     * @param vector_size Size of every circuit vector
+     * @param circuit_vectors count circuit vectors of vector_size entries, one after another
+     *
+     * @return Mask of the circuits that pass all rules
+     */
+    uint64_t screen(int count, int vector_size, const int* circuit_vectors);
+
+private:
+    int n;    // units per circuit
+    int dest; // destinations per outlet: the units, the two products and the tailings
+
+    /* --------- one word per unit and destination: [unit * dest + destination] --------- */
+    std::vector<uint64_t> conc_to;  // circuits whose unit sends its concentrate to the destination
+    std::vector<uint64_t> tails_to; // circuits whose unit sends its tailings to the destination
+
+    /* --------- one word per unit --------- */
+    std::vector<uint64_t> feed_at; // circuits fed at the unit
+    std::vector<uint64_t> reached; // circuits in which the feed reaches the unit
+
+    // Circuits in which the unit reaches each outlet: [3 * unit + outlet]
+    std::vector<uint64_t> drains_to;
+
+    // Bit-slice the circuit vectors into conc_to, tails_to and feed_at; returns the circuits
+    // failing the feed or index rule
+    uint64_t load(int count, const int* circuit_vectors);
+
+    // Propagate the feed through the units until no circuit reaches a new unit
+    void propagate_reached();
+
+    // Collect the outlets every unit reaches, backwards along the outlets, until nothing changes
+    void propagate_drains();
+};
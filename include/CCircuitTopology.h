@@ -0,0 +1,99 @@
+/**
+ * @file CCircuitTopology.h
+ * @brief Declares the CircuitTopology class – a compiled circuit vector
+ *
+ * The topology is everything about a circuit that does not depend on the
+ * unit volumes: where every outlet discharges to, the recycle loops
+ * (strongly connected components) in the order they are solved, and the
+ * index lists the mass balance uses to route flows without testing
+ * destinations. It is built once per circuit vector by compile() and only
+ * read afterwards, so one topology can be shared by any number of Circuit
+ * objects, in any number of threads, that evaluate different volumes.
+ *
+ * Nodes are numbered like the circuit vector: units 0..n-1, the palusznium
+ * product n, the gormanium product n + 1 and the tailings n + 2. Node n + 3
+ * collects outlets whose destination is out of range. Outlet 2u is the
+ * concentrate and outlet 2u + 1 the tailings of unit u.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+class CircuitTopology
+{
+public:
+    // Compile a circuit vector; false if its size is not 2n + 1 or the feed unit is out of range.
+    // Reuses the storage of any earlier compile.
+    bool compile(int vector_size, const int* circuit_vector);
+
+    int num_units = 0;
+    int feed_unit = 0;
+    std::vector<int> circuit_vector; // the compiled vector
+
+    inline int palusznium_node() const
+    {
+        return num_units;
+    }
+    inline int gormanium_node() const
+    {
+        return num_units + 1;
+    }
+    inline int tailings_node() const
+    {
+        return num_units + 2;
+    }
+    inline int discard_node() const
+    {
+        return num_units + 3;
+    }
+
+    /* --------- edges --------- */
+    std::vector<int> outlet_node; // node each outlet discharges to
+
+    // Unit successors of every unit (CSR): succ_unit[succ_start[u] .. succ_start[u + 1])
+    std::vector<int> succ_start, succ_unit;
+
+    // Outlets discharging into every node (CSR): in_outlet[in_start[v] .. in_start[v + 1])
+    std::vector<int> in_start, in_outlet;
+
+    /* --------- recycle loops, in topological order --------- */
+    // The mass balance ignores flow into the feed unit, whose feed is fixed
+    std::vector<int> component_units;   // units grouped by component, by BFS distance from the feed within one
+    std::vector<int> component_start;   // offset of each component in component_units (plus end)
+    std::vector<bool> component_cyclic; // component contains a recycle loop
+    std::vector<int> unit_component;    // component of each unit
+    std::vector<int> unit_slot;         // position of each unit within its component
+
+    /* --------- routing indices --------- */
+    // Slot of each outlet's destination within the source's component, or -1
+    // if the flow leaves the component (or enters the feed unit)
+    std::vector<int> outlet_loop_slot;
+
+    // Outlets staying inside each component, with source and destination slots
+    std::vector<int> loop_start, loop_outlet, loop_source, loop_dest;
+
+    // Outlets handing flow from each component on to a unit of a later component
+    std::vector<int> handover_start, handover_outlet, handover_unit;
+
+    /* --------- reachability --------- */
+    // Circuit outlets each unit drains to along any path, flow into the feed unit
+    // included: bit 0 palusznium, bit 1 gormanium, bit 2 tailings
+    std::vector<uint8_t> unit_outlets;
+    std::vector<bool> unit_reachable; // unit is reachable from the feed unit
+    int reachable_units = 0;          // number of units reachable from the feed unit
+
+private:
+    // Scratch of compile()
+    std::vector<int> index, low, stack, order, ends, rank, queue;
+    std::vector<bool> on_stack;
+    std::vector<std::pair<int, int>> frames;
+
+    // Strongly connected components of the unit graph (Tarjan)
+    void build_components();
+
+    // Reachability from the feed and outlet masks, over the components
+    void build_reachability();
+};
@@ -0,0 +1,61 @@
+/**
+ * @file CCompiledCircuit.h
+ * @brief Declares the CompiledCircuit class – one circuit vector, many volume sets
+ *
+ * In continuous optimisation (mode "c", and the second phase of the hybrid
+ * mode) the circuit vector is fixed and only the unit volumes change. A
+ * CompiledCircuit compiles the vector and checks its validity once; after
+ * that, every evaluation only sets the volumes and solves the mass balance.
+ * All const methods may be called from several threads at once.
+ */
+
+#pragma once
+
+#include "CCircuitTopology.h"
+#include "CSimulator.h"
+#include <vector>
+
+class CompiledCircuit
+{
+public:
+    CompiledCircuit() = default;
+    CompiledCircuit(int vector_size, const int* circuit_vector,
+                    Simulator_Parameters simulator_parameters = default_simulator_parameters);
+
+    // Compile another circuit vector, reusing the storage; nothing to do if it is the compiled one
+    void compile(int vector_size, const int* circuit_vector);
+
+    // Is this the compiled circuit vector?
+    bool matches(int vector_size, const int* circuit_vector) const;
+
+    int get_num_units() const;
+
+    // Structural rules of Circuit::check_validity, checked when compiling; convergence depends on the volumes
+    bool is_valid() const;
+
+    // Validity of the circuit with beta_size volume parameters: is_valid() and every beta in [0, 1]
+    bool check_validity(int beta_size, const double* beta) const;
+
+    // Same as circuit_performance(circuit vector, beta), without the setup
+    double evaluate(const double* beta) const;
+
+    // Warm-started evaluate, see circuit_performance with a flow state
+    double evaluate(const double* beta, std::vector<double>& flow_state) const;
+
+    // Validity and value from one mass balance, see the free evaluate_circuit
+    Circuit_Evaluation evaluate_circuit(int beta_size, const double* beta, std::vector<double>& flow_state) const;
+
+    // Evaluate count sets of get_num_units() volume parameters in lockstep batches
+    // (Gauss-Seidel sweeps, see circuit_performance_batch)
+    void evaluate_batch(int count, const double* betas, double* performances) const;
+
+private:
+    // Mass balance on this thread's circuit, warm-started if flow_state is given
+    Circuit_Evaluation solve(const double* beta, std::vector<double>* flow_state) const;
+
+    std::vector<int> circuit_vector;
+    CircuitTopology topology;
+    bool compiled = false;                             // topology holds circuit_vector
+    ValidityReason structure = ValidityReason::Length; // first structural rule failed
+    Simulator_Parameters simulator_parameters = default_simulator_parameters;
+};
@@ -0,0 +1,123 @@
+/**
+ * @file CEvaluationStore.h
+ * @brief Declares the EvaluationStore class – circuit evaluations kept on disk between runs
+ *
+ * Every optimizer run scores many circuits an earlier run has scored
+ * already. The store keeps the Circuit_Evaluation of circuits evaluated
+ * from a cold start in a file that is mapped into memory, so a later run
+ * (or another process running at the same time) finds it again without a
+ * mass balance. Opening the store maps the file and reads nothing else.
+ * With every valid evaluation the store keeps the converged unit feeds,
+ * which a hit hands back like the evaluation would.
+ *
+ * The file is an open-addressing hash table keyed by the canonical circuit
+ * vector (CCircuitCanonical.h) and a hash of the unit parameters in the
+ * same order, so circuits that only differ by the numbering of their units
+ * share an entry; the stored unit feeds are renumbered on the way in and
+ * out. Its name carries a fingerprint of the number of units, the simulator
+ * parameters and the constants of constants.h: when any of them changes,
+ * the optimizer opens a different file and never sees the old entries. FORMAT_VERSION must be raised when
+ * the unit model or the economics change in code rather than in constants.
+ *
+ * A mass balance started from carried flows can converge within the
+ * iteration limit where a cold one does not, and its result depends on the
+ * flows it started from. Only cold evaluations are kept and only cold
+ * lookups are served, so a hit returns exactly what the evaluation would.
+ *
+ * A writer claims a slot with an atomic compare-and-swap of its tag, fills
+ * it in and then publishes the tag, so concurrent processes and threads can
+ * share the file without locks; a reader checks the tag again after copying
+ * an entry and ignores it if the slot was rewritten meanwhile. Every opening
+ * of the file counts as a run, and each slot is stamped with the last run
+ * that stored or found its entry. When a key's probe sequence is full, the
+ * new entry replaces the one with the oldest stamp, so entries no run has
+ * asked for in a while make way for new ones.
+ */
+
+#pragma once
+
+#include "CCircuitCanonical.h"
+#include "CSimulator.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class EvaluationStore
+{
+public:
+    static constexpr uint32_t FORMAT_VERSION = 3;       // raise when evaluations change for the same fingerprint
+    static constexpr size_t DEFAULT_CAPACITY = 1 << 18; // slots of a new store file
+    static constexpr int MAX_PROBES = 32;               // slots tried per lookup
+
+    // Open (or create) the store for circuits of num_units units evaluated with simulator_parameters
+    // in directory; the store stays closed (every lookup misses) if the file cannot be mapped
+    EvaluationStore(const std::string& directory, int num_units,
+                    const Simulator_Parameters& simulator_parameters = default_simulator_parameters,
+                    size_t capacity = DEFAULT_CAPACITY);
+    ~EvaluationStore();
+
+    EvaluationStore(const EvaluationStore&) = delete;
+    EvaluationStore& operator=(const EvaluationStore&) = delete;
+
+    // Evaluation of a circuit with unit_parameters (num_units values, or nullptr for the default volumes)
+    // from a cold start; misses unless flow_state is empty, which a valid hit fills with the converged unit feeds
+    bool find(const int* circuit_vector, const double* unit_parameters, Circuit_Evaluation& evaluation,
+              std::vector<double>& flow_state);
+
+    // Remember the evaluation of a circuit and its converged unit feeds; ignored unless it started cold
+    void insert(const int* circuit_vector, const double* unit_parameters, const Circuit_Evaluation& evaluation,
+                bool cold_start, const std::vector<double>& flow_state);
+
+    bool is_open() const
+    {
+        return slots != nullptr;
+    }
+    const std::string& get_path() const
+    {
+        return path;
+    }
+    long hits() const
+    {
+        return hit_count.load();
+    }
+    long misses() const
+    {
+        return miss_count.load();
+    }
+
+    // Fingerprint of everything an evaluation depends on besides the circuit and its unit parameters
+    static uint64_t fingerprint(int num_units, const Simulator_Parameters& simulator_parameters);
+
+private:
+    int vector_size;
+    size_t vector_offset; // of the circuit vector within a slot, after the unit feeds
+    size_t slot_bytes;    // tag, evaluation, unit feeds and key of one slot
+    size_t capacity;      // slots in the file
+    std::string path;
+    uint64_t run = 0; // number of this opening of the file, stamped on the slots it stores or finds
+
+    void* mapping = nullptr;        // whole file
+    size_t mapping_bytes = 0;       // size of the file
+    unsigned char* slots = nullptr; // first slot, after the header
+
+    std::atomic<long> hit_count{0};
+    std::atomic<long> miss_count{0};
+
+    // Map the file, initialising it if it is new; false if it cannot be used
+    bool open_file(uint64_t print);
+
+    // Hash of a key, never EMPTY or CLAIMED
+    uint64_t hash(const int* circuit_vector, uint64_t parameters_hash) const;
+
+    // Canonical labelling of a circuit; returns the hash of its unit parameters in canonical order
+    uint64_t label(const int* circuit_vector, const double* unit_parameters, Circuit_Labelling& labelling) const;
+
+    // Tag of a slot, shared with the other processes
+    std::atomic<uint64_t>& tag(size_t slot) const;
+
+    // Last run that stored or found the entry of a slot
+    std::atomic<uint64_t>& stamp(size_t slot) const;
+};
@@ -7,7 +7,9 @@
  */
 #pragma once
 
+#include "CCircuit.h"
 #include <string>
+#include <vector>
 
 // Structure to hold the simulation parameters
 struct Simulator_Parameters
@@ -15,6 +17,8 @@ struct Simulator_Parameters
     // Convergence parameters
     double tolerance = 1e-6;
     int max_iterations = 1000;
+    MassBalanceSolver solver = MassBalanceSolver::FixedPoint; // steady-state solver
+    int anderson_depth = 5;                                   // history depth for MassBalanceSolver::Anderson
 
     // Material properties
     double material_density = 3000.0; // kg/m³, density of all solid materials
@@ -72,4 +76,49 @@ double circuit_performance(int vector_size, int* circuit_vector);
 double circuit_performance(int vector_size, int* circuit_vector, bool testFlag);
 
 double circuit_performance(int vector_size, int* circuit_vector, int unit_parameters_size, double* unit_parameters,
-                           bool testFlag);
\ No newline at end of file
+                           bool testFlag);
+
+// Warm-started evaluation: the recycle loops start from the unit feeds in flow_state (3 per unit, e.g. the
+// parent's converged feeds; empty for a cold start), which is replaced by the converged feeds on success
+double circuit_performance(int vector_size, int* circuit_vector, int unit_parameters_size, double* unit_parameters,
+                           Simulator_Parameters simulator_parameters, std::vector<double>& flow_state);
+
+// Economic value of a circuit and, in gradient (one value per unit), its derivative with respect to every
+// unit parameter, from the adjoint of the converged mass balance at the cost of about one more linear
+// solve. The gradient is zero if the circuit does not converge. With a flow_state the mass balance is
+// warm-started as in circuit_performance.
+double circuit_performance_with_gradient(int vector_size, int* circuit_vector, int unit_parameters_size,
+                                         double* unit_parameters, double* gradient,
+                                         Simulator_Parameters simulator_parameters = default_simulator_parameters);
+double circuit_performance_with_gradient(int vector_size, int* circuit_vector, int unit_parameters_size,
+                                         double* unit_parameters, double* gradient,
+                                         Simulator_Parameters simulator_parameters, std::vector<double>& flow_state);
+
+// Validity and economic value of a circuit from one structural check and one mass balance
+struct Circuit_Evaluation
+{
+    bool valid = false;                             // passes every rule of Circuit::check_validity
+    ValidityReason reason = ValidityReason::Length; // first rule failed, ValidityReason::Valid if valid
+    double fitness = -1e12;                         // economic value, -1e12 if not valid
+    int iterations = 0;                             // mass balance iterations (Circuit::get_iterations)
+};
+
+// Check and evaluate a circuit in one go. Unlike check_validity followed by circuit_performance,
+// the convergence rule is decided by the evaluation itself, with the circuit's own volumes and
+// simulator_parameters. With a flow_state the mass balance is warm-started as in circuit_performance.
+Circuit_Evaluation evaluate_circuit(int vector_size, int* circuit_vector, int unit_parameters_size,
+                                    double* unit_parameters,
+                                    Simulator_Parameters simulator_parameters = default_simulator_parameters);
+Circuit_Evaluation evaluate_circuit(int vector_size, int* circuit_vector, int unit_parameters_size,
+                                    double* unit_parameters, Simulator_Parameters simulator_parameters,
+                                    std::vector<double>& flow_state);
+
+// Evaluate count circuit vectors of vector_size entries each (one after another) in lockstep batches.
+// unit_parameters holds count sets of (vector_size - 1) / 2 values, or is nullptr for the default volumes.
+// Gauss-Seidel sweeps in breadth-first order; circuits they do not settle within max_iterations sweeps are
+// solved by circuit_performance with simulator_parameters.solver, as is every circuit if simulator_parameters
+// changes the unit model, feed, volumes or prices (see CircuitBatch::supports). Vectors with the feed unit or a
+// destination out of range get -1e12.
+void circuit_performance_batch(int count, int vector_size, const int* circuit_vectors, const double* unit_parameters,
+                               double* performances, Simulator_Parameters simulator_parameters);
+void circuit_performance_batch(int count, int vector_size, const int* circuit_vectors, double* performances);
@@ -82,6 +82,8 @@ inline void load_parameters(const std::string& file, Algorithm_Parameters& p)
                 p.use_inversion = (val == "true" || val == "1");
             else if (key == "inversion_probability") // Probability of inversion mutation
                 p.inversion_probability = std::stod(val);
+            else if (key == "repair_probability") // Chance an invalid child is repaired, not discarded
+                p.repair_probability = std::stod(val);
             else if (key == "use_scaling_mutation") // Use scaling mutation
                 p.use_scaling_mutation = (val == "true" || val == "1");
             else if (key == "scaling_mutation_prob") // Probability of scaling mutation
@@ -94,6 +96,22 @@ inline void load_parameters(const std::string& file, Algorithm_Parameters& p)
                 p.convergence_threshold = std::stod(val);
             else if (key == "stall_generations") // Max generations with no improvement
                 p.stall_generations = std::stoi(val);
+            else if (key == "fitness_cache_size") // Genomes whose fitness is remembered
+                p.fitness_cache_size = std::stoi(val);
+            else if (key == "fitness_store_directory") // Evaluations kept between runs
+                p.fitness_store_directory = val;
+            else if (key == "island_count") // Sub-populations evolved by thread groups of their own
+                p.island_count = std::stoi(val);
+            else if (key == "migration_interval") // Generations between migrations
+                p.migration_interval = std::stoi(val);
+            else if (key == "migration_count") // Genomes each island sends per migration
+                p.migration_count = std::stoi(val);
+            else if (key == "migration_topology") // Island the migrants go to: ring or random
+                p.migration_topology = val;
+            else if (key == "refine_elite_count") // Best genomes refined by projected L-BFGS
+                p.refine_elite_count = std::stoi(val);
+            else if (key == "refine_iterations") // Quasi-Newton steps per refined genome
+                p.refine_iterations = std::stoi(val);
             else if (key == "verbose") // Print progress information
                 p.verbose = (val == "true" || val == "1");
             else if (key == "log_results") // Log results to file
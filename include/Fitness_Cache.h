@@ -0,0 +1,76 @@
+/**
+ * @file Fitness_Cache.h
+ * @brief Declares the Fitness_Cache class – memoised fitness values of genomes
+ *
+ * The genetic algorithm meets the same genome many times: elites are carried
+ * over, tournaments pick the same parents, children equal a parent when
+ * neither crossover nor mutation fires, and the final pass evaluates the
+ * whole population once more. The cache remembers the fitness of every
+ * genome it was given, keyed by the genome's bytes, so a repeated genome
+ * costs a lookup instead of an evaluation.
+ *
+ * The cache is set-associative with a fixed number of entries: a genome's
+ * hash selects a set of WAYS entries, and a full set evicts by the clock
+ * (second chance) rule. The sets are guarded by a fixed number of mutexes
+ * (lock striping), so threads evaluating a population in parallel rarely
+ * wait for each other.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+class Fitness_Cache
+{
+public:
+    static constexpr int WAYS = 8;     // entries per set
+    static constexpr int STRIPES = 64; // mutexes guarding the sets
+
+    // Cache of up to capacity genomes of key_bytes bytes each; capacity 0 disables it
+    Fitness_Cache(size_t capacity, size_t key_bytes);
+
+    // Fitness of the genome at key, if cached; counts a hit or a miss
+    bool find(const void* key, double& fitness);
+
+    // Remember the fitness of the genome at key, evicting another genome if its set is full
+    void insert(const void* key, double fitness);
+
+    bool enabled() const
+    {
+        return num_sets > 0;
+    }
+    long hits() const
+    {
+        return hit_count.load();
+    }
+    long misses() const
+    {
+        return miss_count.load();
+    }
+
+private:
+    size_t key_bytes;
+    size_t num_sets;
+
+    /* --------- one entry per way of every set: [set * WAYS + way] --------- */
+    std::vector<uint64_t> hashes;    // 0 for an empty entry
+    std::vector<double> fitnesses;   // cached fitness
+    std::vector<uint8_t> referenced; // found since inserted or since the clock hand last passed
+    std::vector<unsigned char> keys; // key_bytes per entry
+
+    std::vector<uint8_t> hands; // clock hand of every set
+    std::mutex stripes[STRIPES];
+
+    std::atomic<long> hit_count{0};
+    std::atomic<long> miss_count{0};
+
+    // Hash of a key, never 0
+    uint64_t hash(const void* key) const;
+
+    // Entry of the key within its set, or -1
+    int lookup(size_t set, uint64_t h, const void* key) const;
+};
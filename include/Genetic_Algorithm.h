@@ -8,8 +8,10 @@
 
 #pragma once
 
+#include <cstdint>
 #include <functional>
 #include <string>
+#include <type_traits>
 #include <vector>
 
 std::vector<int> generate_valid_circuit_template(int num_units);
@@ -46,6 +48,10 @@ struct Algorithm_Parameters
     bool use_inversion = true;           // turn inversion on/off
     double inversion_probability = 0.05; // chance to invert per child
 
+    // Repair of children failing the discrete screen: the chance that one is repaired into a valid
+    // circuit rather than discarded (1 repairs them all); in the last round of a generation all are
+    double repair_probability = 0.05;
+
     // Scaling-mutation parameters
     bool use_scaling_mutation = true;
     double scaling_mutation_prob = 0.2; // how often to apply a scale mutation
@@ -56,6 +62,22 @@ struct Algorithm_Parameters
     double convergence_threshold = 1e-6; // Convergence threshold
     int stall_generations = 50;          // Max generations with no improvement
 
+    // Fitness cache
+    int fitness_cache_size = 65536;          // Genomes whose fitness is remembered, split among the islands (0 off)
+    std::string fitness_store_directory = ""; // Evaluations kept between runs ("" disables the store)
+
+    // Island model: the population split evenly into island_count islands, each evolved by a thread group
+    // of its own; every migration_interval generations each island sends copies of its migration_count best
+    // genomes to another, the next on a ring or a random one (migration_topology "ring" or "random")
+    int island_count = 1;                    // 1 evolves a single population
+    int migration_interval = 10;             // Generations between migrations
+    int migration_count = 2;                 // Genomes each island sends per migration
+    std::string migration_topology = "ring"; // Island the migrants go to: "ring" or "random"
+
+    // Local refinement of the continuous optimum
+    int refine_elite_count = 0; // Best genomes refined by projected L-BFGS at the end (0 disables refinement)
+    int refine_iterations = 50; // Maximum quasi-Newton steps per refined genome
+
     // Debug options
     bool verbose = false;                // Print progress information
     bool log_results = false;            // Log results to file
@@ -71,35 +93,207 @@ bool all_true(int int_vector_size, int* int_vector, int real_vector_size, double
 bool all_true_ints(int int_vector_size, int* vector);
 bool all_true_reals(int real_vector_size, double* vector);
 void set_random_seed(int seed);
+
+// Validity and fitness of a genome from a single evaluation
+struct Genome_Evaluation
+{
+    bool valid;     // invalid genomes get the -1e9 penalty
+    double fitness; // fitness of a valid genome
+};
+
+// Fused validity and fitness functions, warm-started from a state carried along with each genome, e.g. the
+// converged flows of its mass balance. On entry state holds the state of the genome's parent (empty in the
+// first generation, and when a warm verdict is checked from a cold start); the function replaces it with
+// the genome's own state.
+using Discrete_Evaluation = std::function<Genome_Evaluation(int, int*, std::vector<double>& state)>;
+using Continuous_Evaluation = std::function<Genome_Evaluation(int, double*, std::vector<double>& state)>;
+using Mixed_Evaluation = std::function<Genome_Evaluation(int, int*, int, double*, std::vector<double>& state)>;
+
+// Fitness of a whole population: count genomes of size values each, one after another
+using Population_Fitness = std::function<void(int count, int size, const double* genomes, double* fitnesses)>;
+
+// Fitness of a genome and its gradient with respect to every gene, warm-started like Continuous_Evaluation
+using Continuous_Gradient =
+    std::function<Genome_Evaluation(int, double*, double* gradient, std::vector<double>& state)>;
+
+// Screen of new circuits in batches: bit k of the result is set if genome k of the count (at most 64)
+// genomes of size values each, one after another, may enter the population. Called on several threads
+// at once, and must judge every genome on its own, whatever else is in its batch. Built from such a
+// batch function (e.g. with CircuitScreen) or from a check of one genome, bool(int, int*).
+class Discrete_Screen
+{
+public:
+    using Batch = std::function<uint64_t(int count, int size, const int* genomes)>;
+
+    Discrete_Screen() = default;
+
+    template <typename F, std::enable_if_t<std::is_invocable_r_v<uint64_t, F&, int, int, const int*> ||
+                                               std::is_invocable_r_v<bool, F&, int, int*>,
+                                           int> = 0>
+    Discrete_Screen(F screen)
+    {
+        if constexpr (std::is_invocable_r_v<uint64_t, F&, int, int, const int*>)
+            batch = std::move(screen);
+        else
+            batch = each(std::move(screen));
+    }
+
+    uint64_t operator()(int count, int size, const int* genomes) const
+    {
+        return batch(count, size, genomes);
+    }
+    explicit operator bool() const
+    {
+        return static_cast<bool>(batch);
+    }
+
+private:
+    Batch batch;
+
+    // Batch screen calling validity once per genome
+    static Batch each(std::function<bool(int, int*)> validity);
+};
+
+// How optimize scores the genomes of one kind. Built from the fitness function in any of these forms,
+// shown for discrete genomes (continuous and mixed ones take double* and int, int*, int, double*):
+//   double(int, int*)                               fitness of a genome passing the validity check
+//   double(int, int*, std::vector<double>& state)   the same, warm-started from the carried state
+//   Genome_Evaluation(int, int*, std::vector<double>& state)
+//                                                   fused validity and fitness (Discrete_Evaluation); the
+//                                                   validity passed to optimize then only screens new genomes
+// Continuous genomes may also be scored a population at a time (Population_Fitness), and the elites of the
+// final population refined along an analytic gradient; the discrete phase of mixed genomes may screen its
+// circuits in batches.
+struct Discrete_Evaluator
+{
+    Discrete_Evaluation evaluate; // fitness of a genome, from and updating its state
+    bool checks_validity;         // whether evaluate applies the validity rules itself
+
+    template <typename F,
+              std::enable_if_t<std::is_invocable_r_v<Genome_Evaluation, F&, int, int*, std::vector<double>&> ||
+                                   std::is_invocable_r_v<double, F&, int, int*, std::vector<double>&> ||
+                                   std::is_invocable_r_v<double, F&, int, int*>,
+                               int> = 0>
+    Discrete_Evaluator(F func) : checks_validity(false)
+    {
+        if constexpr (std::is_invocable_r_v<Genome_Evaluation, F&, int, int*, std::vector<double>&>)
+        {
+            evaluate = std::move(func);
+            checks_validity = true;
+        }
+        else if constexpr (std::is_invocable_r_v<double, F&, int, int*, std::vector<double>&>)
+        {
+            evaluate = [func](int n, int* v, std::vector<double>& state)
+            { return Genome_Evaluation{true, func(n, v, state)}; };
+        }
+        else
+        {
+            evaluate = [func](int n, int* v, std::vector<double>&) { return Genome_Evaluation{true, func(n, v)}; };
+        }
+    }
+};
+
+struct Continuous_Evaluator
+{
+    Continuous_Evaluation evaluate; // fitness of a genome, from and updating its state; empty if population is set
+    Population_Fitness population;  // fitness of a whole population at once
+    bool checks_validity;           // whether evaluate applies the validity rules itself
+    Continuous_Gradient gradient;   // for the refinement of the final elites; empty for finite differences
+
+    template <typename F,
+              std::enable_if_t<std::is_invocable_r_v<Genome_Evaluation, F&, int, double*, std::vector<double>&> ||
+                                   std::is_invocable_r_v<double, F&, int, double*, std::vector<double>&> ||
+                                   std::is_invocable_r_v<double, F&, int, double*> ||
+                                   std::is_invocable_r_v<void, F&, int, int, const double*, double*>,
+                               int> = 0>
+    Continuous_Evaluator(F func, Continuous_Gradient gradient = {})
+        : checks_validity(false), gradient(std::move(gradient))
+    {
+        if constexpr (std::is_invocable_r_v<Genome_Evaluation, F&, int, double*, std::vector<double>&>)
+        {
+            evaluate = std::move(func);
+            checks_validity = true;
+        }
+        else if constexpr (std::is_invocable_r_v<double, F&, int, double*, std::vector<double>&>)
+        {
+            evaluate = [func](int n, double* r, std::vector<double>& state)
+            { return Genome_Evaluation{true, func(n, r, state)}; };
+        }
+        else if constexpr (std::is_invocable_r_v<double, F&, int, double*>)
+        {
+            evaluate = [func](int n, double* r, std::vector<double>&) { return Genome_Evaluation{true, func(n, r)}; };
+        }
+        else
+            population = std::move(func);
+    }
+};
+
+struct Mixed_Evaluator
+{
+    Mixed_Evaluation evaluate; // fitness of a genome, from and updating its state
+    bool checks_validity;      // whether evaluate applies the validity rules itself
+    Discrete_Screen screen;    // screen of the discrete phase's new circuits; empty to use the validity check
+
+    template <typename F,
+              std::enable_if_t<
+                  std::is_invocable_r_v<Genome_Evaluation, F&, int, int*, int, double*, std::vector<double>&> ||
+                      std::is_invocable_r_v<double, F&, int, int*, int, double*, std::vector<double>&> ||
+                      std::is_invocable_r_v<double, F&, int, int*, int, double*>,
+                  int> = 0>
+    Mixed_Evaluator(F func, Discrete_Screen screen = {}) : checks_validity(false), screen(std::move(screen))
+    {
+        if constexpr (std::is_invocable_r_v<Genome_Evaluation, F&, int, int*, int, double*, std::vector<double>&>)
+        {
+            evaluate = std::move(func);
+            checks_validity = true;
+        }
+        else if constexpr (std::is_invocable_r_v<double, F&, int, int*, int, double*, std::vector<double>&>)
+        {
+            evaluate = [func](int n, int* v, int m, double* r, std::vector<double>& state)
+            { return Genome_Evaluation{true, func(n, v, m, r, state)}; };
+        }
+        else
+        {
+            evaluate = [func](int n, int* v, int m, double* r, std::vector<double>&)
+            { return Genome_Evaluation{true, func(n, v, m, r)}; };
+        }
+    }
+};
+
 // Optimization function for discrete vector
-int optimize(int int_vector_size, int* int_vector, std::function<double(int, int*)> func,
-             std::function<bool(int, int*)> validity = all_true_ints,
+int optimize(int int_vector_size, int* int_vector, Discrete_Evaluator func, Discrete_Screen validity = all_true_ints,
              Algorithm_Parameters algorithm_parameters = DEFAULT_ALGORITHM_PARAMETERS);
 
 // Optimization function for continuous vector
-int optimize(int real_vector_size, double* real_vector, std::function<double(int, double*)> func,
+int optimize(int real_vector_size, double* real_vector, Continuous_Evaluator func,
              std::function<bool(int, double*)> validity = all_true_reals,
              Algorithm_Parameters algorithm_parameters = DEFAULT_ALGORITHM_PARAMETERS);
 
 // Optimization function for mixed discrete-continuous vector
-int optimize(int int_vector_size, int* int_vector, int real_vector_size, double* real_vector,
-             std::function<double(int, int*, int, double*)> func,
+int optimize(int int_vector_size, int* int_vector, int real_vector_size, double* real_vector, Mixed_Evaluator func,
              std::function<bool(int, int*, int, double*)> validity = all_true,
              Algorithm_Parameters algorithm_parameters = DEFAULT_ALGORITHM_PARAMETERS);
 
 // Structure to hold statistics about the optimization process
 struct OptimizationResult
 {
-    double best_fitness; // Best fitness value found
-    int generations;     // Number of generations run
-    double avg_fitness;  // Average fitness of final population
-    double std_fitness;  // Standard deviation of final population fitness
-    double time_taken;   // Time taken for optimization (seconds)
-    bool converged;      // Whether algorithm converged
+    double best_fitness;    // Best fitness value found
+    int generations;        // Number of generations run
+    double avg_fitness;     // Average fitness of final population
+    double std_fitness;     // Standard deviation of final population fitness
+    double time_taken;      // Time taken for optimization (seconds)
+    bool converged;         // Whether algorithm converged
+    long cache_hits;        // Fitness values taken from the cache
+    long cache_misses;      // Fitness values the cache did not hold
+    double refinement_gain; // Best fitness gained by the local refinement
+    long children;          // Children bred by the discrete GA
+    double rejection_rate;  // Fraction of the children failing the screen as bred
+    double repair_rate;     // Fraction of the children failing the screen repaired into valid ones
 
     // Default constructor
     OptimizationResult()
-        : best_fitness(0), generations(0), avg_fitness(0), std_fitness(0), time_taken(0), converged(false)
+        : best_fitness(0), generations(0), avg_fitness(0), std_fitness(0), time_taken(0), converged(false),
+          cache_hits(0), cache_misses(0), refinement_gain(0), children(0), rejection_rate(0), repair_rate(0)
     {
     }
 };
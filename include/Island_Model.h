@@ -0,0 +1,193 @@
+/**
+ * @file Island_Model.h
+ * @brief Declares the Archipelago and Island classes – the migration of genomes between the islands of a GA
+ *
+ * In the island model the population is split into sub-populations, the
+ * islands, each evolved by a thread group of its own without waiting for
+ * the others: there is no barrier between the islands, only within the
+ * parallel loops of one island. Every migration_interval generations an
+ * island sends copies of its best genomes, with their fitness and state,
+ * to another island: the next one on a ring, or one drawn at random. The
+ * migrants arrive whenever their destination next looks at its mailbox,
+ * once a generation, and replace its worst genomes.
+ *
+ * The mailbox of an island is a lock-free stack of batches of migrants.
+ * A sender pushes its batch with a compare-and-swap; the island takes all
+ * batches at once by exchanging the head for null. Neither side waits for
+ * the other, and a batch is only touched by the thread that holds it.
+ *
+ * Islands run at their own pace, so the migrants an island has received by
+ * a given generation depend on the timing of the threads: unlike a single
+ * population, a seeded run with several islands is not repeatable bit for
+ * bit.
+ */
+
+#pragma once
+
+#include "Genetic_Algorithm.h"
+#include "Philox.h"
+#include "Population.h"
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <numeric>
+#include <random>
+#include <vector>
+
+// Which island the migrants of an island go to
+enum class Migration_Topology
+{
+    Ring,  // the next island, the last sending to the first
+    Random // any other island, drawn for every migration
+};
+
+template <typename Gene> class Archipelago
+{
+public:
+    Archipelago(int islands, Migration_Topology topology)
+        : count(islands), topology(topology), mailboxes(new Mailbox[islands])
+    {
+    }
+    Archipelago(const Archipelago&) = delete;
+    Archipelago& operator=(const Archipelago&) = delete;
+
+    // Frees the migrants never received
+    ~Archipelago()
+    {
+        for (int i = 0; i < count; ++i)
+            free(mailboxes[i].head.exchange(nullptr));
+    }
+
+    int size() const
+    {
+        return count;
+    }
+
+    // Island the next migrants of island from go to
+    int destination(int from, Philox& random) const
+    {
+        if (topology == Migration_Topology::Ring || count < 2)
+            return (from + 1) % count;
+        const int to = std::uniform_int_distribution<int>(0, count - 2)(random);
+        return to >= from ? to + 1 : to;
+    }
+
+    // Post a batch of migrants, with their fitness and state, to island to; never waits
+    void send(int to, Population<Gene>&& migrants)
+    {
+        std::atomic<Batch*>& head = mailboxes[to].head;
+        Batch* batch = new Batch{std::move(migrants), head.load(std::memory_order_relaxed)};
+        while (!head.compare_exchange_weak(batch->next, batch, std::memory_order_release, std::memory_order_relaxed))
+        {
+        }
+    }
+
+    // Move the migrants posted to island since the last call into migrants (emptied first), batches in the
+    // order they were posted; false if there were none
+    bool receive(int island, Population<Gene>& migrants)
+    {
+        migrants.clear();
+        Batch* batch = mailboxes[island].head.exchange(nullptr, std::memory_order_acquire);
+
+        // The stack holds the last batch first
+        Batch* oldest = nullptr;
+        while (batch != nullptr)
+        {
+            Batch* next = batch->next;
+            batch->next = oldest;
+            oldest = batch;
+            batch = next;
+        }
+        for (batch = oldest; batch != nullptr; batch = batch->next)
+        {
+            for (size_t i = 0; i < batch->migrants.size(); ++i)
+                migrants.push_back(batch->migrants, i);
+        }
+        free(oldest);
+        return !migrants.empty();
+    }
+
+private:
+    struct Batch
+    {
+        Population<Gene> migrants;
+        Batch* next; // posted before this one
+    };
+
+    // Mailboxes on cache lines of their own, as different islands post to them
+    struct alignas(64) Mailbox
+    {
+        std::atomic<Batch*> head{nullptr}; // last batch posted
+    };
+
+    static void free(Batch* batch)
+    {
+        while (batch != nullptr)
+        {
+            Batch* next = batch->next;
+            delete batch;
+            batch = next;
+        }
+    }
+
+    int count;
+    Migration_Topology topology;
+    std::unique_ptr<Mailbox[]> mailboxes;
+};
+
+// One island of an island-model run, as the GA evolving it sees it
+template <typename Gene> class Island
+{
+public:
+    Island(int index, Archipelago<Gene>& archipelago, int migration_interval, int migration_count, int genome_size)
+        : index(index), archipelago(&archipelago), interval(std::max(1, migration_interval)),
+          migrants(std::max(0, migration_count)), arrived(genome_size)
+    {
+    }
+
+    int index;                 // of the island in its archipelago
+    OptimizationResult result; // of the GA run on the island
+
+    // Exchange migrants after the fitness of generation gen is known: every interval generations, send
+    // copies of the best genomes of population to the next destination (drawn from random); then let the
+    // migrants that have arrived replace the worst genomes, never the best one
+    void migrate(int gen, Population<Gene>& population, Philox& random)
+    {
+        const size_t size = population.size();
+        const bool sending = migrants > 0 && archipelago->size() > 1 && (gen + 1) % interval == 0;
+        const bool receiving = archipelago->receive(index, arrived);
+        if (!sending && !receiving)
+            return;
+
+        // Genomes from the fittest to the least fit
+        order.resize(size);
+        std::iota(order.begin(), order.end(), 0);
+        std::stable_sort(order.begin(), order.end(),
+                         [&](size_t a, size_t b) { return population.fitness(a) > population.fitness(b); });
+
+        if (sending)
+        {
+            Population<Gene> batch(population.genome_size(), migrants);
+            for (size_t k = 0; k < std::min<size_t>(migrants, size); ++k)
+                batch.push_back(population, order[k]);
+            archipelago->send(archipelago->destination(index, random), std::move(batch));
+        }
+
+        const int length = population.genome_size();
+        for (size_t k = 0; k < arrived.size() && k + 1 < size; ++k)
+        {
+            const size_t worst = order[size - 1 - k];
+            std::copy(arrived.genome(k), arrived.genome(k) + length, population.genome(worst));
+            population.fitness(worst) = arrived.fitness(k);
+            population.state(worst).swap(arrived.state(k));
+        }
+    }
+
+private:
+    Archipelago<Gene>* archipelago;
+    int interval; // generations between migrations
+    int migrants; // genomes sent per migration
+
+    Population<Gene> arrived; // migrants received
+    std::vector<size_t> order;
+};
@@ -0,0 +1,37 @@
+/**
+ * @file Local_Refinement.h
+ * @brief Bounded quasi-Newton refinement of continuous genomes
+ *
+ * The continuous GA finds the region of a good optimum quickly but closes
+ * the last few pounds per second slowly, because mutation steps do not
+ * shrink as it approaches the optimum. refine_in_box climbs the rest of the
+ * way from a genome of the GA with a projected L-BFGS method on the box
+ * [0,1]^n: the limited-memory quasi-Newton direction is taken over the
+ * genes that are free to move (those held at a bound by the gradient stay
+ * there), and every trial point is projected back into the box, so the
+ * genome stays a set of valid volume parameters. Points the objective
+ * cannot evaluate bound the search as well.
+ */
+
+#pragma once
+
+#include <functional>
+
+// Objective of a refinement: value at x, to be maximised, and its gradient unless gradient is nullptr;
+// false if x cannot be evaluated
+using Box_Objective = std::function<bool(const double* x, double& value, double* gradient)>;
+
+// Outcome of a refinement
+struct Refinement_Result
+{
+    double value;    // objective at the refined point, lowest double if the start cannot be evaluated
+    int iterations;  // quasi-Newton steps taken
+    int evaluations; // calls of the objective
+};
+
+// Maximise objective over [0,1]^n from x, which is replaced by the best point found. Stops after
+// max_iterations steps, when no step along the search direction improves the value, or when the
+// projected gradient or the relative improvement of a step falls below tolerance. memory is the
+// number of curvature pairs kept.
+Refinement_Result refine_in_box(int n, double* x, const Box_Objective& objective, int max_iterations,
+                                int memory = 5, double tolerance = 1e-6);
@@ -0,0 +1,84 @@
+/**
+ * @file Philox.h
+ * @brief Declares the Philox class – a counter-based random number generator
+ *
+ * Philox4x32-10 (Salmon et al., "Parallel random numbers: as easy as 1, 2,
+ * 3", SC 2011) turns a 128-bit counter and a 64-bit key into four 32-bit
+ * random numbers by ten rounds of multiplications and XORs. Every counter
+ * gives independent numbers, so instead of one generator whose state is
+ * passed from draw to draw, every piece of work that needs random numbers
+ * gets its own stream, named by its position in the computation: the GA
+ * keys a stream by the run and the generation and the child slot. The
+ * numbers a child is bred from then do not depend on the thread that
+ * breeds it or on the order the threads run in.
+ *
+ * A stream is the sequence of counters (0, c1, c2, c3), (1, c1, c2, c3), ...
+ * for a key and three counter words fixed when the generator is made. The
+ * class meets the UniformRandomBitGenerator requirements, so it works with
+ * the standard distributions and std::shuffle.
+ */
+
+#pragma once
+
+#include <cstdint>
+
+class Philox
+{
+public:
+    using result_type = uint32_t;
+
+    // Stream (key, c1, c2, c3)
+    explicit Philox(uint64_t key = 0, uint32_t c1 = 0, uint32_t c2 = 0, uint32_t c3 = 0)
+        : key{static_cast<uint32_t>(key), static_cast<uint32_t>(key >> 32)}, counter{0, c1, c2, c3}
+    {
+    }
+
+    static constexpr result_type min()
+    {
+        return 0;
+    }
+    static constexpr result_type max()
+    {
+        return UINT32_MAX;
+    }
+
+    result_type operator()()
+    {
+        if (used == 4)
+        {
+            block(counter, key, output);
+            ++counter[0];
+            used = 0;
+        }
+        return output[used++];
+    }
+
+    // The four numbers Philox4x32-10 makes from counter and key
+    static void block(const uint32_t counter[4], const uint32_t key[2], uint32_t output[4])
+    {
+        uint32_t c0 = counter[0], c1 = counter[1], c2 = counter[2], c3 = counter[3];
+        uint32_t k0 = key[0], k1 = key[1];
+        for (int round = 0; round < 10; ++round)
+        {
+            const uint64_t p0 = uint64_t(0xD2511F53) * c0, p1 = uint64_t(0xCD9E8D57) * c2;
+            const uint32_t hi0 = static_cast<uint32_t>(p0 >> 32), lo0 = static_cast<uint32_t>(p0);
+            const uint32_t hi1 = static_cast<uint32_t>(p1 >> 32), lo1 = static_cast<uint32_t>(p1);
+            c0 = hi1 ^ c1 ^ k0;
+            c1 = lo1;
+            c2 = hi0 ^ c3 ^ k1;
+            c3 = lo0;
+            k0 += 0x9E3779B9;
+            k1 += 0xBB67AE85;
+        }
+        output[0] = c0;
+        output[1] = c1;
+        output[2] = c2;
+        output[3] = c3;
+    }
+
+private:
+    uint32_t key[2];
+    uint32_t counter[4]; // of the next block
+    uint32_t output[4];  // current block
+    int used = 4;        // numbers of the current block handed out
+};
@@ -0,0 +1,198 @@
+/**
+ * @file Population.h
+ * @brief Declares the Population class – the genomes of one GA generation in a flat buffer
+ *
+ * A population of vectors, one heap block per genome, scatters the genomes
+ * over memory and costs an allocation for every copy: every child, every
+ * elite and every generation built anew. Population keeps the genomes of a
+ * generation one after another in a single buffer aligned to a cache line,
+ * genome i at genome(i), with a parallel array of fitness values and the
+ * state each genome carries for warm-started evaluations. Sweeps over the
+ * population read memory in order, and a block of genomes can be handed to
+ * a batch evaluator as it is.
+ *
+ * The optimizers keep two populations, the current generation and the one
+ * being built, and swap them at the end of every generation. Clearing a
+ * population keeps its storage, including the state vectors, so once both
+ * have grown to the population size a generation is built without touching
+ * the heap. Selection works on indices into the current generation.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <new>
+#include <vector>
+
+// Allocator of storage aligned to Alignment bytes
+template <typename T, size_t Alignment = 64> struct Aligned_Allocator
+{
+    using value_type = T;
+    template <typename U> struct rebind
+    {
+        using other = Aligned_Allocator<U, Alignment>;
+    };
+
+    Aligned_Allocator() = default;
+    template <typename U> Aligned_Allocator(const Aligned_Allocator<U, Alignment>&)
+    {
+    }
+
+    T* allocate(size_t n)
+    {
+        return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t(Alignment)));
+    }
+    void deallocate(T* p, size_t)
+    {
+        ::operator delete(p, std::align_val_t(Alignment));
+    }
+
+    template <typename U> bool operator==(const Aligned_Allocator<U, Alignment>&) const
+    {
+        return true;
+    }
+    template <typename U> bool operator!=(const Aligned_Allocator<U, Alignment>&) const
+    {
+        return false;
+    }
+};
+
+template <typename Gene> class Population
+{
+public:
+    // Empty population of genomes of genome_size genes, with storage for capacity genomes
+    explicit Population(int genome_size = 0, size_t capacity = 0) : length(genome_size)
+    {
+        reserve(capacity);
+    }
+
+    int genome_size() const
+    {
+        return length;
+    }
+    size_t size() const
+    {
+        return count;
+    }
+    bool empty() const
+    {
+        return count == 0;
+    }
+
+    // Make room for capacity genomes
+    void reserve(size_t capacity)
+    {
+        if (capacity * length > genes.size())
+            genes.resize(capacity * length);
+        if (capacity > fitness_values.size())
+        {
+            fitness_values.resize(capacity);
+            state_values.resize(capacity);
+        }
+    }
+
+    // Drop every genome, keeping the storage and the capacity of the states
+    void clear()
+    {
+        count = 0;
+    }
+
+    // Change the number of genomes; new genomes are uninitialised, with whatever state their slot last held
+    void resize(size_t new_count)
+    {
+        if (new_count > fitness_values.size())
+            reserve(std::max(new_count, 2 * fitness_values.size()));
+        count = new_count;
+    }
+
+    // Append a genome with the state it carries; returns its index
+    size_t push_back(const Gene* genome, const std::vector<double>& state)
+    {
+        resize(count + 1);
+        std::copy(genome, genome + length, this->genome(count - 1));
+        state_values[count - 1] = state; // reuses the slot's storage
+        return count - 1;
+    }
+
+    // Append genome i of other with its state and fitness; returns its index
+    size_t push_back(const Population& other, size_t i)
+    {
+        push_back(other.genome(i), other.state(i));
+        fitness_values[count - 1] = other.fitness(i);
+        return count - 1;
+    }
+
+    Gene* genome(size_t i)
+    {
+        return genes.data() + i * length;
+    }
+    const Gene* genome(size_t i) const
+    {
+        return genes.data() + i * length;
+    }
+
+    // First genome; the genomes follow one another with no gaps
+    Gene* genomes()
+    {
+        return genes.data();
+    }
+    const Gene* genomes() const
+    {
+        return genes.data();
+    }
+
+    double& fitness(size_t i)
+    {
+        return fitness_values[i];
+    }
+    double fitness(size_t i) const
+    {
+        return fitness_values[i];
+    }
+    double* fitnesses()
+    {
+        return fitness_values.data();
+    }
+    const double* fitnesses() const
+    {
+        return fitness_values.data();
+    }
+
+    // Index of the fittest genome (the first of equals); the population must not be empty
+    size_t best() const
+    {
+        return std::max_element(fitness_values.begin(), fitness_values.begin() + count) - fitness_values.begin();
+    }
+
+    std::vector<double>& state(size_t i)
+    {
+        return state_values[i];
+    }
+    const std::vector<double>& state(size_t i) const
+    {
+        return state_values[i];
+    }
+    std::vector<double>* states()
+    {
+        return state_values.data();
+    }
+
+    // Exchange the genomes of two populations, e.g. the current and the next generation, without copying
+    void swap(Population& other)
+    {
+        std::swap(length, other.length);
+        std::swap(count, other.count);
+        genes.swap(other.genes);
+        fitness_values.swap(other.fitness_values);
+        state_values.swap(other.state_values);
+    }
+
+private:
+    int length;       // genes per genome
+    size_t count = 0; // genomes in the population
+
+    std::vector<Gene, Aligned_Allocator<Gene>> genes; // genome i at [i * length, (i + 1) * length)
+    std::vector<double> fitness_values;               // fitness of genome i
+    std::vector<std::vector<double>> state_values;    // state carried by genome i
+};
@@ -0,0 +1,65 @@
+/**
+ * @file unit_kernels.h
+ * @brief Vectorised separation-unit kernels with runtime CPU dispatch
+ *
+ * The kernels apply the unit model of CUnit::process to a block of units
+ * stored as contiguous arrays, compute the convergence measure of the mass
+ * balance over a block of flows, and take the flow differences routed by
+ * the Gauss–Seidel sweeps of CircuitBatch. Each kernel has a scalar, an AVX2
+ * (4 units per instruction) and an AVX-512 (8 units per instruction)
+ * implementation; the best one supported by the CPU is selected when the
+ * program starts. The SIMD paths are only built for x86 with GCC or Clang,
+ * other targets always use the scalar path.
+ */
+
+#pragma once
+
+namespace UnitKernels
+{
+// Instruction set used by the kernels
+enum class Isa
+{
+    Scalar,
+    AVX2,
+    AVX512
+};
+
+// Kinetic constants shared by all units of a circuit
+struct Kinetics
+{
+    double k_palusznium; // s⁻¹
+    double k_gormanium;  // s⁻¹
+    double k_waste;      // s⁻¹
+    double rho;          // kg/m³
+    double phi;          // solids fraction
+};
+
+// Best instruction set supported by this CPU (and build)
+Isa best_isa();
+
+// Instruction set currently used by the kernels
+Isa active_isa();
+
+// Select the instruction set, capped at best_isa(); returns the one selected.
+// Not thread-safe: meant for tests and benchmarks before any kernel runs.
+Isa set_isa(Isa isa);
+
+// Name of an instruction set for output ("scalar", "avx2", "avx512")
+const char* isa_name(Isa isa);
+
+// Split the feeds of count units into concentrate and tailings. feed, conc and
+// tails hold three blocks (palusznium, gormanium, waste) of count values each,
+// starting stride values apart.
+void process(const Kinetics& kinetics, int count, int stride, const double* volume, const double* feed, double* conc,
+             double* tails);
+
+// max_k |next[k] - prev[k]| / max(prev[k], 1e-12) over count values
+double max_relative_change(int count, const double* next, const double* prev);
+
+// Element-wise: max_change[k] = max(max_change[k], |next[k] - prev[k]| / max(prev[k], 1e-12)),
+// then prev[k] = next[k]
+void track_relative_change(int count, const double* next, double* prev, double* max_change);
+
+// Element-wise: flow[k] = flow[k] - last[k] and last[k] = old flow[k]
+void exchange_difference(int count, double* flow, double* last);
+} // namespace UnitKernels
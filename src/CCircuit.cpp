@@ -4,16 +4,17 @@
  *
  * This file contains the implementation of the Circuit class, which represents
  * a mineral-processing circuit. The class includes methods for checking
- * the validity of the circuit, marking units, running mass balance
+ * the validity of the circuit, running mass balance
  * calculations, and exporting the circuit to a dot file for visualization.
  *
  */
 #include <cmath>
-#include <queue>
 #include <vector>
 
 #include <CCircuit.h>
+#include <CCircuitTopology.h>
 #include <CUnit.h>
+#include <unit_kernels.h>
 #include <cstdint>
 #include <filesystem>
 #include <iostream>
@@ -24,7 +25,7 @@
  *
  */
 Circuit::Circuit(int num_units)
-    : units(num_units), feed_unit(0), feed_palusznium_rate(Constants::Feed::DEFAULT_PALUSZNIUM_FEED),
+    : feed_unit(0), feed_palusznium_rate(Constants::Feed::DEFAULT_PALUSZNIUM_FEED),
       feed_gormanium_rate(Constants::Feed::DEFAULT_GORMANIUM_FEED),
       feed_waste_rate(Constants::Feed::DEFAULT_WASTE_FEED), palusznium_product_palusznium(0.0),
       palusznium_product_gormanium(0.0), palusznium_product_waste(0.0), gormanium_product_palusznium(0.0),
@@ -32,9 +33,12 @@ Circuit::Circuit(int num_units)
       tailings_waste(0.0), palusznium_value(Constants::Economic::PALUSZNIUM_VALUE_IN_PALUSZNIUM_STREAM),
       gormanium_value(Constants::Economic::GORMANIUM_VALUE_IN_GORMANIUM_STREAM),
       waste_penalty_palusznium(Constants::Economic::WASTE_PENALTY_IN_PALUSZNIUM_STREAM),
-      waste_penalty_gormanium(Constants::Economic::WASTE_PENALTY_IN_GORMANIUM_STREAM), beta(nullptr),
+      waste_penalty_gormanium(Constants::Economic::WASTE_PENALTY_IN_GORMANIUM_STREAM),
+      palusznium_value_in_gormanium(Constants::Economic::PALUSZNIUM_VALUE_IN_GORMANIUM_STREAM),
+      gormanium_value_in_palusznium(Constants::Economic::GORMANIUM_VALUE_IN_PALUSZNIUM_STREAM), beta(nullptr),
       circuit_vector(nullptr), n(num_units)
 {
+    resize_units(num_units);
 }
 
 /**
@@ -45,6 +49,11 @@ Circuit::Circuit(int num_units)
  * self-loop check, same output check, reachability check, terminal check,
  * and mass balance convergence check.
  *
+ * The mass balance must converge within 100 iterations for the whole
+ * circuit. run_mass_balance counts its limit per recycle loop, so the
+ * iterations of all loops are added up and held to the same budget; a
+ * circuit whose loops each settle in time but not together is invalid.
+ *
  * @param vector_size Size of the circuit vector
  * @param vec Circuit vector
  *
@@ -52,29 +61,52 @@ Circuit::Circuit(int num_units)
  *
  */
 bool Circuit::check_validity(int vector_size, const int* vec)
+{
+    if (check_structure(vector_size, vec) != ValidityReason::Valid)
+    {
+        return false;
+    }
+
+    // 9. mass balance check: mass balance must converge, within 100 iterations over all recycle loops
+    const int max_iterations = 100;
+    if (!run_mass_balance(1e-6, max_iterations) || get_iterations() - 1 > max_iterations)
+    {
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Check the structure of a circuit vector
+ *
+ * Rules 1 to 8 of check_validity: everything except the convergence of the
+ * mass balance. Afterwards the circuit's topology is the compiled vector
+ * (it is only recompiled if it holds another one), so a circuit that has
+ * been initialised from the vector can go straight on to run_mass_balance.
+ *
+ * @param vector_size Size of the circuit vector
+ * @param vec Circuit vector
+ *
+ * @return The first rule the circuit fails, or ValidityReason::Valid
+ */
+ValidityReason Circuit::check_structure(int vector_size, const int* vec)
 {
     // 1. length must be 2*n+1
     int expected = 2 * n + 1;
     if (vector_size != expected)
     {
-        return false;
+        return ValidityReason::Length;
     }
 
     // 2. feed check: feed cannot directly feed to terminal
     feed_dest = vec[0]; // feed points to the unit
     if (feed_dest < 0 || feed_dest >= n)
     {
-        return false;
+        return ValidityReason::Feed;
     }
 
     // read each unit's concentrate and tailing and do static check
-    struct Dest
-    {
-        int conc;
-        int tail;
-    };
-    std::vector<Dest> dest(n);
-
     int max_idx = n + 2; // the last valid index
 
     for (int i = 0; i < n; ++i)
@@ -85,75 +117,67 @@ bool Circuit::check_validity(int vector_size, const int* vec)
         // 3. index check: conc must be in (0, n+2), tail must be in (0, n+2)
         if (conc < 0 || conc > max_idx)
         {
-            return false;
+            return ValidityReason::Index;
         }
         if (tail < 0 || tail > max_idx)
         {
-            return false;
+            return ValidityReason::Index;
         }
 
         // 4. no self-loop: conc cannot be equal to i, tail cannot be equal to i
         if (conc == i || tail == i)
         {
-            return false;
+            return ValidityReason::SelfLoop;
         }
 
         // 5. same output: conc cannot be equal to tail
         if (conc == tail)
         {
-            return false;
+            return ValidityReason::SameOutput;
         }
+    }
 
-        dest[i] = {conc, tail};
-
-        units[i].conc_num = conc;
-        units[i].tails_num = tail;
-        units[i].mark = false;
+    // The remaining checks read the reachability of the compiled topology
+    const CircuitTopology* topology = &get_topology();
+    if (topology->num_units != n || !std::equal(vec, vec + vector_size, topology->circuit_vector.begin()))
+    {
+        own_topology.compile(vector_size, vec);
+        shared_topology = nullptr;
+        topology = &own_topology;
+        solved = false;
     }
 
     // 6. reachability check: all units must be reachable from feed
-    this->mark_units(feed_dest);
-
-    for (int i = 0; i < n; ++i)
+    if (topology->reachable_units != n)
     {
-        if (!units[i].mark)
-        {
-            return false;
-        }
+        return ValidityReason::Unreachable;
     }
 
     // 7. two terminals check: each unit must reach at least 2 different terminals
-    std::vector<int8_t> cache(n, -1);
     uint8_t global_mask = 0;
     for (int i = 0; i < n; ++i)
     {
-        uint8_t mask = this->term_mask(i);
+        uint8_t mask = topology->unit_outlets[i];
         global_mask |= mask;
         int cnt = (mask & 1) + ((mask >> 1) & 1) + ((mask >> 2) & 1);
         if (cnt < 2)
         {
-            return false;
+            return ValidityReason::TwoTerminals;
         }
     }
 
     // 8. final terminal check: P1/P2, TA must be present
     if ((global_mask & (0b001 | 0b010)) == 0)
     {
-        return false;
+        return ValidityReason::MissingOutlet;
     }
 
     if ((global_mask & 0b100) == 0)
     {
-        return false;
-    }
-
-    // 9. mass balance check: mass balance must converge
-    if (!run_mass_balance(1e-6, 100))
-    {
-        return false;
+        return ValidityReason::MissingOutlet;
     }
 
-    return true;
+    return ValidityReason::Valid;
 }
 
 /**
@@ -204,42 +228,6 @@ bool Circuit::check_validity(int vector_size, const int* circuit_vector, int uni
     return true;
 }
 
-/**
- * @brief Mark the units in the circuit
- *
- * This function marks the units in the circuit as visited. It recursively
- * traverses the circuit starting from the given unit number and marks each
- * unit as visited.
- *
- * @param unit_num The unit number to start marking from
- */
-void Circuit::mark_units(int unit_num)
-{
-
-    if (this->units[unit_num].mark)
-        return;
-
-    this->units[unit_num].mark = true;
-
-    // If we have seen this unit already exit
-    // Mark that we have now seen the unit
-
-    // If conc_num does not point at a circuit outlet recursively call the
-    // function
-    if (this->units[unit_num].conc_num < this->units.size())
-    {
-        mark_units(this->units[unit_num].conc_num);
-    }
-
-    // If tails_num does not point at a circuit outletrecursively call the
-    // function
-
-    if (this->units[unit_num].tails_num < this->units.size())
-    {
-        mark_units(this->units[unit_num].tails_num);
-    }
-}
-
 /**
  * @brief Constructor for the Circuit class
  *
@@ -250,7 +238,7 @@ void Circuit::mark_units(int unit_num)
  * @param beta Pointer to the beta array
  */
 Circuit::Circuit(int num_units, double* beta)
-    : units(num_units), feed_unit(0), n(num_units),
+    : feed_unit(0), n(num_units),
 
       feed_palusznium_rate(Constants::Feed::DEFAULT_PALUSZNIUM_FEED),
       feed_gormanium_rate(Constants::Feed::DEFAULT_GORMANIUM_FEED),
@@ -264,6 +252,7 @@ Circuit::Circuit(int num_units, double* beta)
       palusznium_value_in_gormanium(Constants::Economic::PALUSZNIUM_VALUE_IN_GORMANIUM_STREAM),
       gormanium_value_in_palusznium(Constants::Economic::GORMANIUM_VALUE_IN_PALUSZNIUM_STREAM)
 {
+    resize_units(num_units);
 }
 
 /**
@@ -277,7 +266,7 @@ Circuit::Circuit(int num_units, double* beta)
  * @param testFlag Test flag to indicate whether to use test parameters
  */
 Circuit::Circuit(int num_units, double* beta, bool testFlag)
-    : units(num_units), feed_unit(0), n(num_units),
+    : feed_unit(0), n(num_units),
 
       feed_palusznium_rate(Constants::Feed::DEFAULT_PALUSZNIUM_FEED),
       feed_gormanium_rate(Constants::Feed::DEFAULT_GORMANIUM_FEED),
@@ -290,6 +279,18 @@ Circuit::Circuit(int num_units, double* beta, bool testFlag)
       waste_penalty_gormanium(Constants::Economic::WASTE_PENALTY_IN_GORMANIUM_STREAM),
       palusznium_value_in_gormanium(Constants::Economic::PALUSZNIUM_VALUE_IN_GORMANIUM_STREAM),
       gormanium_value_in_palusznium(Constants::Economic::GORMANIUM_VALUE_IN_PALUSZNIUM_STREAM)
+{
+    resize_units(num_units);
+    if (testFlag)
+        set_feed_and_prices(true);
+}
+
+/**
+ * @brief Set the feed rates and economic parameters
+ *
+ * @param testFlag Use the test constants instead of the defaults
+ */
+void Circuit::set_feed_and_prices(bool testFlag)
 {
     if (testFlag)
     {
@@ -304,6 +305,69 @@ Circuit::Circuit(int num_units, double* beta, bool testFlag)
         this->palusznium_value_in_gormanium = Constants::Test::PALUSZNIUM_VALUE_IN_GORMANIUM_STREAM;
         this->gormanium_value_in_palusznium = Constants::Test::GORMANIUM_VALUE_IN_PALUSZNIUM_STREAM;
     }
+    else
+    {
+        this->feed_palusznium_rate = Constants::Feed::DEFAULT_PALUSZNIUM_FEED;
+        this->feed_gormanium_rate = Constants::Feed::DEFAULT_GORMANIUM_FEED;
+        this->feed_waste_rate = Constants::Feed::DEFAULT_WASTE_FEED;
+
+        this->palusznium_value = Constants::Economic::PALUSZNIUM_VALUE_IN_PALUSZNIUM_STREAM;
+        this->gormanium_value = Constants::Economic::GORMANIUM_VALUE_IN_GORMANIUM_STREAM;
+        this->waste_penalty_palusznium = Constants::Economic::WASTE_PENALTY_IN_PALUSZNIUM_STREAM;
+        this->waste_penalty_gormanium = Constants::Economic::WASTE_PENALTY_IN_GORMANIUM_STREAM;
+        this->palusznium_value_in_gormanium = Constants::Economic::PALUSZNIUM_VALUE_IN_GORMANIUM_STREAM;
+        this->gormanium_value_in_palusznium = Constants::Economic::GORMANIUM_VALUE_IN_PALUSZNIUM_STREAM;
+    }
+}
+
+/**
+ * @brief Reuse the circuit for another circuit vector
+ *
+ * Leaves the circuit in the state of a new Circuit(num_units, beta, testFlag)
+ * initialised from the vector, except that every array keeps its storage.
+ * Once a circuit has seen circuits of the largest size, reset and
+ * run_mass_balance no longer allocate, which makes one Circuit per thread a
+ * reusable evaluation workspace.
+ *
+ * @param vector_size Size of the circuit vector
+ * @param circuit_vector Circuit vector
+ * @param beta Pointer to the beta array, or nullptr for the default volumes
+ * @param testFlag Test flag to indicate whether to use test parameters
+ *
+ * @return true if initialization is successful, false otherwise
+ */
+bool Circuit::reset(int vector_size, const int* circuit_vector, const double* beta, bool testFlag)
+{
+    set_feed_and_prices(testFlag);
+    solver = MassBalanceSolver::FixedPoint;
+    anderson_depth = 5;
+    iterations = 0;
+    n = (vector_size - 1) / 2;
+    this->beta = const_cast<double*>(beta);
+    return initialize_from_vector(vector_size, circuit_vector, beta, testFlag);
+}
+
+/**
+ * @brief Reuse the circuit for another topology or other volumes
+ *
+ * Like reset() with a circuit vector, but the circuit shares the compiled
+ * topology instead of compiling its own (see initialize_from_topology).
+ *
+ * @param topology Compiled circuit vector
+ * @param beta Pointer to the beta array, or nullptr for the default volumes
+ * @param testFlag Test flag to indicate whether to use test parameters
+ *
+ * @return true if initialization is successful, false otherwise
+ */
+bool Circuit::reset(const CircuitTopology& topology, const double* beta, bool testFlag)
+{
+    set_feed_and_prices(testFlag);
+    solver = MassBalanceSolver::FixedPoint;
+    anderson_depth = 5;
+    iterations = 0;
+    n = topology.num_units;
+    this->beta = const_cast<double*>(beta);
+    return initialize_from_topology(topology, beta, testFlag);
 }
 
 /**
@@ -377,21 +441,91 @@ bool Circuit::initialize_from_vector(int vector_size, const int* circuit_vector,
  */
 bool Circuit::initialize_from_vector(int vector_size, const int* circuit_vector, const double* beta, bool testFlag)
 {
-    // num_units = n
-    int num_units = (vector_size - 1) / 2;
-    if (vector_size != 2 * num_units + 1)
+    if (!own_topology.compile(vector_size, circuit_vector))
         return false;
-    units.resize(num_units);
-    this->circuit_vector = circuit_vector;
+    shared_topology = nullptr;
+    load_topology(beta, testFlag);
+    return true;
+}
+
+/**
+ * @brief Initialize the circuit from a compiled topology
+ *
+ * The circuit keeps a pointer to the topology instead of compiling its
+ * own, so the topology must outlive the circuit (or its next
+ * initialisation). Since the circuit never changes the topology, any number
+ * of circuits in any number of threads can share one.
+ *
+ * @param topology Compiled circuit vector
+ * @param beta Pointer to the beta array, or nullptr for the default volumes
+ * @param testFlag Test flag to indicate whether to use test parameters
+ *
+ * @return true if initialization is successful, false otherwise
+ */
+bool Circuit::initialize_from_topology(const CircuitTopology& topology, const double* beta, bool testFlag)
+{
+    if (topology.num_units <= 0)
+        return false;
+    shared_topology = &topology;
+    load_topology(beta, testFlag);
+    return true;
+}
+
+/**
+ * @brief Get the topology of the circuit
+ *
+ * @return The shared topology if the circuit was initialised from one, its own otherwise
+ */
+const CircuitTopology& Circuit::get_topology() const
+{
+    return shared_topology ? *shared_topology : own_topology;
+}
+
+/**
+ * @brief Set up the unit arrays for the current topology
+ *
+ * Resizes the unit arrays, copies the destinations (circuit outlets as
+ * CircuitDestination codes) and sets the constants and volumes of all units.
+ *
+ * @param beta Pointer to the beta array, or nullptr for the default volumes
+ * @param testFlag Test flag to indicate whether to use test parameters
+ */
+void Circuit::load_topology(const double* beta, bool testFlag)
+{
+    const CircuitTopology& topology = get_topology();
+    const int num_units = topology.num_units;
+    resize_units(num_units);
+    this->circuit_vector = topology.circuit_vector.data();
+    solved = false;
+
+    // Kinetic and geometry constants are the same for every unit
+    k_palusznium = Constants::Physical::K_PALUSZNIUM;
+    k_gormanium = Constants::Physical::K_GORMANIUM;
+    k_waste = Constants::Physical::K_WASTE;
+    rho = Constants::Physical::MATERIAL_DENSITY;
+    phi = Constants::Physical::SOLIDS_CONTENT;
+    V_min = Constants::Circuit::MIN_UNIT_VOLUME;
+    V_max = Constants::Circuit::MAX_UNIT_VOLUME;
+    double default_volume = Constants::Circuit::DEFAULT_UNIT_VOLUME;
+    if (testFlag)
+    {
+        k_palusznium = Constants::Test::K_PALUSZNIUM;
+        k_gormanium = Constants::Test::K_GORMANIUM;
+        k_waste = Constants::Test::K_WASTE;
+        rho = Constants::Test::MATERIAL_DENSITY;
+        phi = Constants::Test::SOLIDS_CONTENT;
+        V_min = Constants::Test::MIN_UNIT_VOLUME;
+        V_max = Constants::Test::MAX_UNIT_VOLUME;
+        default_volume = Constants::Test::DEFAULT_UNIT_VOLUME;
+    }
 
-    // feed_unit is the first element of the circuit vector
-    feed_unit = circuit_vector[0];
+    feed_unit = topology.feed_unit;
 
     // Map the target units to corresponding unit numbers
     for (int i = 0; i < num_units; ++i)
     {
-        int conc = circuit_vector[1 + 2 * i];
-        int tails = circuit_vector[1 + 2 * i + 1];
+        int conc = topology.circuit_vector[1 + 2 * i];
+        int tails = topology.circuit_vector[1 + 2 * i + 1];
 
         // transform the unit numbers from n, n+1, n+2 to -1, -2, -3
         if (conc == num_units)
@@ -408,401 +542,1355 @@ bool Circuit::initialize_from_vector(int vector_size, const int* circuit_vector,
         else if (tails == num_units + 2)
             tails = TAILINGS_OUTPUT;
 
-        units[i] = CUnit(conc, tails, testFlag);
+        conc_num[i] = conc;
+        tails_num[i] = tails;
+        volume[i] = default_volume;
         if (beta != nullptr)
         {
-
-            units[i].update_volume(beta[i]);
+            volume[i] = V_min + (V_max - V_min) * beta[i];
         }
     }
-    return true;
 }
 
 /**
- * @brief Run mass balance calculations for the circuit
- *
- * This function runs mass balance calculations for the circuit. It takes
- * a tolerance and a maximum number of iterations as input parameters.
+ * @brief Compile the topology from the unit destinations
  *
- * @param tolerance Tolerance for convergence
- * @param max_iterations Maximum number of iterations
- *
- * @return true if mass balance converges, false otherwise
+ * For a circuit whose destinations were never set from a circuit vector
+ * (e.g. a default-constructed one): rebuilds the vector from feed_unit,
+ * conc_num and tails_num and compiles it.
  */
-bool Circuit::run_mass_balance(double tolerance, int max_iterations)
+void Circuit::compile_topology()
 {
-    // Initialize feed for all the units
-    for (auto& u : units)
+    const int num_units = static_cast<int>(conc_num.size());
+    auto code = [&](int dest)
     {
-        u.feed_palusznium = 0.0;
-        u.feed_gormanium = 0.0;
-        u.feed_waste = 0.0;
-    }
-    // Initialize feed for the first unit
-    units[feed_unit].feed_palusznium = feed_palusznium_rate;
-    units[feed_unit].feed_gormanium = feed_gormanium_rate;
-    units[feed_unit].feed_waste = feed_waste_rate;
-
-    // Record the last feed for each unit for convergence check
-    std::vector<double> last_feed_p(units.size(), 0.0);
-    std::vector<double> last_feed_g(units.size(), 0.0);
-    std::vector<double> last_feed_w(units.size(), 0.0);
-    // std::cout << "Unit number: " << units.size() << std::endl;
-
-    for (int iter = 0; iter < max_iterations; ++iter)
+        if (dest == PALUSZNIUM_PRODUCT)
+            return num_units;
+        if (dest == GORMANIUM_PRODUCT)
+            return num_units + 1;
+        if (dest == TAILINGS_OUTPUT)
+            return num_units + 2;
+        return dest;
+    };
+    std::vector<int> vec(2 * num_units + 1);
+    vec[0] = feed_unit;
+    for (int i = 0; i < num_units; ++i)
     {
-
-        // Record the current feed
-        // Record the current feed to last_feed and clear the current feed
-        if (iter == 0)
-        {
-            for (size_t i = 0; i < units.size(); ++i)
-            {
-                last_feed_p[i] = units[i].feed_palusznium;
-                last_feed_g[i] = units[i].feed_gormanium;
-                last_feed_w[i] = units[i].feed_waste;
-                // clear the current feed
-                units[i].feed_palusznium = 0.0;
-                units[i].feed_gormanium = 0.0;
-                units[i].feed_waste = 0.0;
-            }
-        }
-        else
-        {
-            for (size_t i = 0; i < units.size(); ++i)
-            {
-                last_feed_p[i] = units[i].feed_palusznium;
-                last_feed_g[i] = units[i].feed_gormanium;
-                last_feed_w[i] = units[i].feed_waste;
-            }
-        }
-        // Initialize feed for the first unit
-        units[feed_unit].feed_palusznium = feed_palusznium_rate;
-        units[feed_unit].feed_gormanium = feed_gormanium_rate;
-        units[feed_unit].feed_waste = feed_waste_rate;
-
-        // Process all units
-        for (size_t i = 0; i < units.size(); ++i)
-        {
-            units[i].process();
-        }
-
-        // This vector is used to mark whether the feed for each unit has been
-        // cleared We need to make sure that the feed for each unit is cleared only
-        // once
-        std::vector<bool> feedCleared(units.size(), false);
-
-        // Initialize the product flow rates
-        palusznium_product_palusznium = palusznium_product_gormanium = palusznium_product_waste = 0.0;
-        gormanium_product_palusznium = gormanium_product_gormanium = gormanium_product_waste = 0.0;
-        tailings_palusznium = tailings_gormanium = tailings_waste = 0.0;
-
-        // "=====Distributing downstream data====="<<std::endl;
-        for (size_t i = 0; i < units.size(); ++i)
-        {
-            // concentrate flow
-            int concDest = units[i].conc_num;
-            if (concDest == PALUSZNIUM_PRODUCT)
-            {
-                palusznium_product_palusznium += units[i].conc_palusznium;
-                palusznium_product_gormanium += units[i].conc_gormanium;
-                palusznium_product_waste += units[i].conc_waste;
-            }
-            else if (concDest == GORMANIUM_PRODUCT)
-            {
-                gormanium_product_palusznium += units[i].conc_palusznium;
-                gormanium_product_gormanium += units[i].conc_gormanium;
-                gormanium_product_waste += units[i].conc_waste;
-            }
-            else if (concDest == TAILINGS_OUTPUT)
-            {
-                tailings_palusznium += units[i].conc_palusznium;
-                tailings_gormanium += units[i].conc_gormanium;
-                tailings_waste += units[i].conc_waste;
-            }
-            else if (concDest >= 0 && concDest < (int)units.size())
-            {
-                if (!feedCleared[concDest])
-                {
-                    feedCleared[concDest] = true;
-                    units[concDest].feed_palusznium = 0.0;
-                    units[concDest].feed_gormanium = 0.0;
-                    units[concDest].feed_waste = 0.0;
-                }
-                units[concDest].feed_palusznium += units[i].conc_palusznium;
-                units[concDest].feed_gormanium += units[i].conc_gormanium;
-                units[concDest].feed_waste += units[i].conc_waste;
-            }
-
-            // tailings flow
-            int tailsDest = units[i].tails_num;
-            if (tailsDest == PALUSZNIUM_PRODUCT)
-            {
-                palusznium_product_palusznium += units[i].tails_palusznium;
-                palusznium_product_gormanium += units[i].tails_gormanium;
-                palusznium_product_waste += units[i].tails_waste;
-            }
-            else if (tailsDest == GORMANIUM_PRODUCT)
-            {
-                gormanium_product_palusznium += units[i].tails_palusznium;
-                gormanium_product_gormanium += units[i].tails_gormanium;
-                gormanium_product_waste += units[i].tails_waste;
-            }
-            else if (tailsDest == TAILINGS_OUTPUT)
-            {
-                tailings_palusznium += units[i].tails_palusznium;
-                tailings_gormanium += units[i].tails_gormanium;
-                tailings_waste += units[i].tails_waste;
-            }
-            else if (tailsDest >= 0 && tailsDest < (int)units.size())
-            {
-                if (!feedCleared[tailsDest])
-                {
-                    feedCleared[tailsDest] = true;
-                    units[tailsDest].feed_palusznium = 0.0;
-                    units[tailsDest].feed_gormanium = 0.0;
-                    units[tailsDest].feed_waste = 0.0;
-                }
-
-                units[tailsDest].feed_palusznium += units[i].tails_palusznium;
-                units[tailsDest].feed_gormanium += units[i].tails_gormanium;
-                units[tailsDest].feed_waste += units[i].tails_waste;
-            }
-        }
-
-        // convergence check
-        double max_rel_change = 0.0;
-        for (size_t i = 0; i < units.size(); ++i)
-        {
-            double rel_p = std::abs(units[i].feed_palusznium - last_feed_p[i]) / std::max(last_feed_p[i], 1e-12);
-            double rel_g = std::abs(units[i].feed_gormanium - last_feed_g[i]) / std::max(last_feed_g[i], 1e-12);
-            double rel_w = std::abs(units[i].feed_waste - last_feed_w[i]) / std::max(last_feed_w[i], 1e-12);
-            max_rel_change = std::max({max_rel_change, rel_p, rel_g, rel_w});
-        }
-
-        if (max_rel_change < tolerance)
-            return true;
+        vec[1 + 2 * i] = code(conc_num[i]);
+        vec[2 + 2 * i] = code(tails_num[i]);
     }
-    return false; // not converged
+    own_topology.compile(static_cast<int>(vec.size()), vec.data());
+    shared_topology = nullptr;
 }
 
 /**
- * @brief Get the economic value of the circuit
+ * @brief Resize the unit arrays
  *
- * This function calculates the economic value of the circuit based on
- * the product flow rates and the values of the materials.
- *
- * @return The economic value of the circuit
+ * Every unit is reset to the state of a default-constructed CUnit: both
+ * streams routed to unit 0, default volume and no flow.
  *
+ * @param num_units Number of units in the circuit
  */
-double Circuit::get_economic_value() const
+void Circuit::resize_units(int num_units)
 {
-    double value = 0.0;
-
-    // Palusznium product
-    value += palusznium_product_palusznium * palusznium_value;
-    value += palusznium_product_gormanium * gormanium_value_in_palusznium;
-    value += palusznium_product_waste * waste_penalty_palusznium;
-
-    // Gormanium product
-    value += gormanium_product_gormanium * gormanium_value;
-    value += gormanium_product_palusznium * palusznium_value_in_gormanium;
-    value += gormanium_product_waste * waste_penalty_gormanium;
-
-    double total_volume = 0.0;
-    for (const auto& u : units)
-        total_volume += u.volume;
-    double cost = 5.0 * std::pow(total_volume, 2.0 / 3.0);
-    if (total_volume >= 150.0)
+    conc_num.assign(num_units, 0);
+    tails_num.assign(num_units, 0);
+    volume.assign(num_units, Constants::Circuit::DEFAULT_UNIT_VOLUME);
+    for (auto* flow : {&feed_palusznium, &feed_gormanium, &feed_waste, &conc_palusznium, &conc_gormanium, &conc_waste,
+                       &tails_palusznium, &tails_gormanium, &tails_waste})
     {
-        cost += 1000.0 * std::pow(total_volume - 150.0, 2.0);
+        flow->assign(num_units, 0.0);
     }
-    value -= cost; // cost of the circuit
-    return value;
 }
 
 /**
- * @brief Get the recovery of valuable materials
- *
- * This function calculates the recovery of valuable materials in the
- * circuit based on the product flow rates and the feed rates.
+ * @brief Process one unit
  *
- * @return The recovery of valuable materials
+ * Same model as CUnit::process, on the unit arrays: the residence time
+ * τ = φV / (ΣF/ρ) gives the recoveries R_i = k_i τ / (1 + k_i τ), which
+ * split the feed into concentrate and tailings.
  *
+ * @param unit Index of the unit
  */
-double Circuit::get_palusznium_recovery() const
+void Circuit::process_unit(int unit)
 {
-
-    double total_feed = feed_palusznium_rate;
-    double recovered = palusznium_product_palusznium;
-    if (total_feed < 1e-12)
-        return 0.0;
-    return recovered / total_feed;
+    const double fp = feed_palusznium[unit];
+    const double fg = feed_gormanium[unit];
+    const double fw = feed_waste[unit];
+
+    // guard against division-by-zero / vanishing flow
+    const double tau = phi * volume[unit] / (std::max(fp + fg + fw, 1e-10) / rho);
+    const double Rp = k_palusznium * tau / (1.0 + k_palusznium * tau);
+    const double Rg = k_gormanium * tau / (1.0 + k_gormanium * tau);
+    const double Rw = k_waste * tau / (1.0 + k_waste * tau);
+
+    conc_palusznium[unit] = fp * Rp;
+    conc_gormanium[unit] = fg * Rg;
+    conc_waste[unit] = fw * Rw;
+    tails_palusznium[unit] = fp - fp * Rp;
+    tails_gormanium[unit] = fg - fg * Rg;
+    tails_waste[unit] = fw - fw * Rw;
 }
 
 /**
- * @brief Get the recovery of gormanium
+ * @brief Run mass balance calculations for the circuit
  *
- * This function calculates the recovery of gormanium in the circuit
- * based on the product flow rates and the feed rates.
+ * This function runs mass balance calculations for the circuit. It takes
+ * a tolerance and a maximum number of iterations as input parameters.
  *
- * @return The recovery of gormanium
+ * The components of the topology are solved in topological order.
+ * A unit outside any recycle loop is processed exactly once, after all
+ * units feeding it; each recycle loop is iterated on its own, with the
+ * solver selected by set_solver(), until its feeds have converged.
  *
+ * @param tolerance Tolerance for convergence
+ * @param max_iterations Maximum number of iterations per recycle loop
+ *
+ * @return true if mass balance converges, false otherwise
  */
-double Circuit::get_gormanium_recovery() const
+bool Circuit::run_mass_balance(double tolerance, int max_iterations)
 {
-    double total_feed = feed_gormanium_rate;
-    double recovered = gormanium_product_gormanium;
-    if (total_feed < 1e-12)
-        return 0.0;
-    return recovered / total_feed;
+    return solve_mass_balance(nullptr, tolerance, max_iterations);
 }
 
 /**
- * @brief Get the grade of palusznium
- *
- * This function calculates the grade of palusznium in the circuit
- * based on the product flow rates.
- *
- * @return The grade of palusznium
+ * @brief Run a warm-started mass balance
+ *
+ * Like run_mass_balance(tolerance, max_iterations), but every recycle loop
+ * starts iterating from the unit feeds in @p flow_state instead of from the
+ * flow handed to it by earlier components. When the state is the converged
+ * solution of a similar circuit (a parent genome, or the same circuit with
+ * slightly different volumes), the loops start close to their steady state
+ * and converge in fewer iterations. Units outside recycle loops are solved
+ * exactly in one pass and do not use the state.
+ *
+ * @param flow_state Unit feeds, three per unit as written by get_flow_state;
+ *        any other size gives a cold start
+ * @param tolerance Tolerance for convergence
+ * @param max_iterations Maximum number of iterations per recycle loop
  *
+ * @return true if mass balance converges, false otherwise
  */
-double Circuit::get_palusznium_grade() const
+bool Circuit::run_mass_balance(const std::vector<double>& flow_state, double tolerance, int max_iterations)
 {
-    double total = palusznium_product_palusznium + palusznium_product_gormanium + palusznium_product_waste;
-    return (total > 0) ? (palusznium_product_palusznium / total) : 0.0;
+    const bool warm = flow_state.size() == 3 * conc_num.size();
+    return solve_mass_balance(warm ? flow_state.data() : nullptr, tolerance, max_iterations);
 }
 
 /**
- * @brief Get the grade of gormanium
+ * @brief Get the flow state of the circuit
  *
- * This function calculates the grade of gormanium in the circuit
- * based on the product flow rates.
+ * After a converged run_mass_balance this is the steady-state feed of every
+ * unit, which can seed the mass balance of a similar circuit.
  *
- * @return The grade of gormanium
+ * @param flow_state Output, palusznium, gormanium and waste feed of every unit in turn (kg/s)
+ */
+void Circuit::get_flow_state(std::vector<double>& flow_state) const
+{
+    const size_t num_units = conc_num.size();
+    flow_state.resize(3 * num_units);
+    for (size_t i = 0; i < num_units; ++i)
+    {
+        flow_state[3 * i + 0] = feed_palusznium[i];
+        flow_state[3 * i + 1] = feed_gormanium[i];
+        flow_state[3 * i + 2] = feed_waste[i];
+    }
+}
+
+/**
+ * @brief Apply a single-gene change and solve the changed circuit
+ *
+ * Meant for mutation and neighbourhood search, where a circuit differs from
+ * an evaluated one in a single gene. The changed vector is checked with
+ * check_structure, which recompiles the topology in linear time. If the
+ * circuit held a converged mass balance, the only units whose steady state
+ * can change are those reachable from the changed unit or from its old
+ * destination (flow into the feed unit is dropped and does not count).
+ * Only their components are solved again, the recycle loops starting from
+ * their previous feeds; all other units keep their flows. A change of the
+ * feed unit moves the external feed, which makes the previous feeds a poor
+ * start; such a change, or a circuit without a converged solution, is
+ * solved in full from a cold start.
+ *
+ * @param pos Position of the gene in the circuit vector
+ * @param new_dest New value of the gene
+ * @param tolerance Tolerance for convergence
+ * @param max_iterations Maximum number of iterations per recycle loop
  *
+ * @return ValidityReason::Valid if the changed circuit is valid and solved. For a structural
+ *         failure the circuit is left as it was; for ValidityReason::NotConverged it holds the
+ *         changed vector, unsolved.
  */
-double Circuit::get_gormanium_grade() const
+ValidityReason Circuit::apply_gene_change(int pos, int new_dest, double tolerance, int max_iterations)
 {
-    double total = gormanium_product_palusznium + gormanium_product_gormanium + gormanium_product_waste;
-    return (total > 0) ? (gormanium_product_gormanium / total) : 0.0;
+    const CircuitTopology& current = get_topology();
+    const int vector_size = 2 * n + 1;
+    if (current.num_units != n || pos < 0 || pos >= vector_size)
+        return ValidityReason::Length;
+    changed_vector.assign(current.circuit_vector.begin(), current.circuit_vector.end());
+    const int old_dest = changed_vector[pos];
+    if (old_dest == new_dest && solved)
+        return ValidityReason::Valid;
+
+    const bool was_solved = solved;
+    get_flow_state(previous_feeds);
+
+    changed_vector[pos] = new_dest;
+    ValidityReason reason = check_structure(vector_size, changed_vector.data());
+    if (reason != ValidityReason::Valid)
+    {
+        // Back to the unchanged circuit (check_structure may have compiled the changed one)
+        changed_vector[pos] = old_dest;
+        if (shared_topology == nullptr && own_topology.circuit_vector != changed_vector)
+            own_topology.compile(vector_size, changed_vector.data());
+        solved = was_solved;
+        return reason;
+    }
+
+    // The unit arrays follow the new topology
+    const CircuitTopology& topology = get_topology();
+    circuit_vector = topology.circuit_vector.data();
+    feed_unit = topology.feed_unit;
+    if (pos > 0)
+    {
+        auto code = [&](int dest)
+        {
+            if (dest == n)
+                return static_cast<int>(PALUSZNIUM_PRODUCT);
+            if (dest == n + 1)
+                return static_cast<int>(GORMANIUM_PRODUCT);
+            if (dest == n + 2)
+                return static_cast<int>(TAILINGS_OUTPUT);
+            return dest;
+        };
+        const int unit = (pos - 1) / 2;
+        (pos % 2 == 1 ? conc_num : tails_num)[unit] = code(new_dest);
+    }
+
+    bool converged;
+    if (was_solved && pos > 0)
+    {
+        mark_affected((pos - 1) / 2, old_dest);
+        converged = solve_mass_balance(previous_feeds.data(), tolerance, max_iterations, true);
+    }
+    else
+    {
+        converged = solve_mass_balance(nullptr, tolerance, max_iterations);
+    }
+    return converged ? ValidityReason::Valid : ValidityReason::NotConverged;
 }
 
 /**
- * @brief Export the circuit to a DOT file
+ * @brief Mark the units downstream of a gene change
  *
- * This function exports the circuit to a DOT file for visualization.
+ * Breadth-first search over the unit successors, leaving out flow into the
+ * feed unit, which the mass balance drops.
  *
- * @param filename The name of the output DOT file
+ * @param first Changed unit
+ * @param second Old destination of the changed outlet; ignored unless it is a unit other than the feed unit
+ */
+void Circuit::mark_affected(int first, int second)
+{
+    const CircuitTopology& topology = get_topology();
+    affected.assign(n, false);
+    affected_queue.clear();
+    affected[first] = true;
+    affected_queue.push_back(first);
+    if (second >= 0 && second < n && second != topology.feed_unit && second != first)
+    {
+        affected[second] = true;
+        affected_queue.push_back(second);
+    }
+    for (size_t head = 0; head < affected_queue.size(); ++head)
+    {
+        const int u = affected_queue[head];
+        for (int k = topology.succ_start[u]; k < topology.succ_start[u + 1]; ++k)
+        {
+            const int w = topology.succ_unit[k];
+            if (w != topology.feed_unit && !affected[w])
+            {
+                affected[w] = true;
+                affected_queue.push_back(w);
+            }
+        }
+    }
+}
+
+/**
+ * @brief Solve the mass balance component by component
  *
- * @return true if export is successful, false otherwise
+ * With @p only_affected the units not marked in affected keep their flows:
+ * their components are not solved again, but still hand their outputs on
+ * to affected units of later components.
+ *
+ * @param initial_feeds Initial unit feeds of the recycle loops (three per unit), or nullptr
+ * @param tolerance Tolerance for convergence
+ * @param max_iterations Maximum number of iterations per recycle loop
+ * @param only_affected Solve only the units marked in affected
+ *
+ * @return true if mass balance converges, false otherwise
  */
-bool Circuit::export_to_dot(const std::string& filename) const
+bool Circuit::solve_mass_balance(const double* initial_feeds, double tolerance, int max_iterations,
+                                 bool only_affected)
 {
-    std::ofstream ofs(filename);
-    if (!ofs)
-        return false;
-    ofs << "digraph Circuit {\n";
-    for (size_t i = 0; i < units.size(); ++i)
+    if (get_topology().num_units != static_cast<int>(conc_num.size()))
+        compile_topology();
+    const CircuitTopology& topology = get_topology();
+    const int feed_unit = topology.feed_unit;
+    auto resolved = [&](int unit) { return !only_affected || affected[unit]; };
+
+    solved = false;
+    for (int i = 0; i < topology.num_units; ++i)
     {
-        ofs << "  unit" << i << " [label=\"Unit " << i << "\"];\n";
-        // concentrate flow
-        if (units[i].conc_num >= 0)
-            ofs << "  unit" << i << " -> unit" << units[i].conc_num << " [label=\"conc\"];\n";
-        else if (units[i].conc_num == PALUSZNIUM_PRODUCT)
-            ofs << "  unit" << i << " -> palusznium_product [label=\"conc\"];\n";
-        else if (units[i].conc_num == GORMANIUM_PRODUCT)
-            ofs << "  unit" << i << " -> gormanium_product [label=\"conc\"];\n";
-        else if (units[i].conc_num == TAILINGS_OUTPUT)
-            ofs << "  unit" << i << " -> tailings [label=\"conc\"];\n";
-        // tailings flow
-        if (units[i].tails_num >= 0)
-            ofs << "  unit" << i << " -> unit" << units[i].tails_num << " [label=\"tails\"];\n";
-        else if (units[i].tails_num == PALUSZNIUM_PRODUCT)
-            ofs << "  unit" << i << " -> palusznium_product [label=\"tails\"];\n";
-        else if (units[i].tails_num == GORMANIUM_PRODUCT)
-            ofs << "  unit" << i << " -> gormanium_product [label=\"tails\"];\n";
-        else if (units[i].tails_num == TAILINGS_OUTPUT)
-            ofs << "  unit" << i << " -> tailings [label=\"tails\"];\n";
+        if (resolved(i))
+            feed_palusznium[i] = feed_gormanium[i] = feed_waste[i] = 0.0;
     }
-    ofs << "  palusznium_product [shape=box, label=\"Palusznium Product\"];\n";
-    ofs << "  gormanium_product [shape=box, label=\"Gormanium Product\"];\n";
-    ofs << "  tailings [shape=box, label=\"Tailings\"];\n";
-    ofs << "}\n";
+    if (resolved(feed_unit))
+    {
+        feed_palusznium[feed_unit] = feed_palusznium_rate;
+        feed_gormanium[feed_unit] = feed_gormanium_rate;
+        feed_waste[feed_unit] = feed_waste_rate;
+    }
+
+    // Outlet flows by outlet index: [outlet & 1][component][outlet >> 1]
+    const double* const outlet_flows[2][3] = {
+        {conc_palusznium.data(), conc_gormanium.data(), conc_waste.data()},
+        {tails_palusznium.data(), tails_gormanium.data(), tails_waste.data()}};
+    double* const feeds[3] = {feed_palusznium.data(), feed_gormanium.data(), feed_waste.data()};
+
+    iterations = 1; // the topological pass itself
+    const int num_components = static_cast<int>(topology.component_start.size()) - 1;
+    for (int comp = 0; comp < num_components; ++comp)
+    {
+        const int first = topology.component_units[topology.component_start[comp]];
+        if (resolved(first))
+        {
+            if (topology.component_cyclic[comp])
+            {
+                if (!solve_component(comp, initial_feeds, tolerance, max_iterations))
+                    return false; // not converged
+            }
+            else
+            {
+                process_unit(first);
+            }
+        }
+
+        // Hand the outputs on to units in later components
+        for (int k = topology.handover_start[comp]; k < topology.handover_start[comp + 1]; ++k)
+        {
+            const int e = topology.handover_outlet[k];
+            const int dest = topology.handover_unit[k];
+            if (!resolved(dest))
+                continue; // already has its feed
+            for (int c = 0; c < 3; ++c)
+                feeds[c][dest] += outlet_flows[e & 1][c][e >> 1];
+        }
+    }
+
+    collect_products();
+    solved = true;
     return true;
 }
 
 /**
- * @brief Get the terminal mask for a given unit
+ * @brief Select the steady-state solver
  *
- * This function calculates the terminal mask for a given unit. It uses
- * breadth-first search to traverse the circuit and find the terminals.
+ * @param kind Solver used by subsequent run_mass_balance calls
+ * @param depth Number of past iterates mixed by the Anderson solver
+ */
+void Circuit::set_solver(MassBalanceSolver kind, int depth)
+{
+    solver = kind;
+    anderson_depth = depth;
+}
+
+/**
+ * @brief Get the iteration count of the last mass balance
+ *
+ * @return One for the topological pass plus the sweeps (fixed point,
+ *         Anderson) and Newton steps spent on recycle loops by the last
+ *         run_mass_balance call
+ */
+int Circuit::get_iterations() const
+{
+    return iterations;
+}
+
+/**
+ * @brief Solve one recycle loop of the circuit
  *
- * @param start The starting unit number
+ * The feeds already handed to the loop's units by earlier components form
+ * the fixed inflow of the loop, which is then solved with the selected
+ * solver. On return the units are processed at the converged feeds.
  *
- * @return The terminal mask
+ * With @p initial_feeds the solver starts from those unit feeds instead of
+ * the inflow; a fallback to the plain loop restarts from the inflow.
+ *
+ * @param comp Index of the component
+ * @param initial_feeds Initial unit feeds (three per unit of the circuit), or nullptr
+ * @param tolerance Tolerance for convergence
+ * @param max_iterations Maximum number of iterations
+ *
+ * @return true if the loop converges, false otherwise
  */
-uint8_t Circuit::term_mask(int start) const
+bool Circuit::solve_component(int comp, const double* initial_feeds, double tolerance, int max_iterations)
 {
-    uint8_t mask = 0;
-    std::vector<bool> visited(n, false);
+    const CircuitTopology& topology = get_topology();
+    const int begin = topology.component_start[comp];
+    const int size = topology.component_start[comp + 1] - begin;
+    inflow.resize(3 * size);
+    slot_volume.resize(size);
+    slot_flows.resize(9 * size);
+    for (int s = 0; s < size; ++s)
+    {
+        const int i = topology.component_units[begin + s];
+        inflow[3 * s + 0] = feed_palusznium[i];
+        inflow[3 * s + 1] = feed_gormanium[i];
+        inflow[3 * s + 2] = feed_waste[i];
+        slot_volume[s] = volume[i];
+    }
 
-    // Use queue for breadth-first search
-    std::queue<int> q;
-    q.push(start);
-    visited[start] = true;
+    std::vector<double>& x = scratch.feeds;
+    x = inflow;
+    if (initial_feeds != nullptr)
+    {
+        for (int s = 0; s < size; ++s)
+        {
+            const int i = topology.component_units[begin + s];
+            for (int c = 0; c < 3; ++c)
+                x[3 * s + c] = initial_feeds[3 * i + c];
+        }
+    }
+    if (solver == MassBalanceSolver::GaussSeidel)
+        return run_gauss_seidel(comp, x, initial_feeds != nullptr, tolerance, max_iterations);
+    if (solver == MassBalanceSolver::Newton)
+    {
+        if (run_newton(comp, x, tolerance, max_iterations))
+            return true;
+        // Singular Jacobian or no convergence: fall back to the plain loop
+        x = inflow;
+    }
+    else if (solver == MassBalanceSolver::Anderson)
+    {
+        if (run_anderson(comp, x, tolerance, max_iterations))
+            return true;
+        // Stagnated or no convergence: fall back to the plain loop
+        x = inflow;
+    }
+    return run_fixed_point(comp, x, tolerance, max_iterations);
+}
 
-    while (!q.empty())
+/**
+ * @brief Solve a recycle loop by successive substitution
+ *
+ * Every unit of the loop is processed with its current feed and the outputs
+ * are routed to their destinations, until the relative change of all unit
+ * feeds drops below the tolerance.
+ *
+ * @param comp Index of the component
+ * @param x Unit feeds of the component: initial guess, converged on return
+ * @param tolerance Tolerance for convergence
+ * @param max_iterations Maximum number of iterations
+ *
+ * @return true if mass balance converges, false otherwise
+ */
+bool Circuit::run_fixed_point(int comp, std::vector<double>& x, double tolerance, int max_iterations)
+{
+    std::vector<double>& next = scratch.next;
+    next.resize(x.size());
+    for (int iter = 0; iter < max_iterations; ++iter)
     {
-        int current = q.front();
-        q.pop();
+        sweep(comp, x, next);
 
-        const int conc_dest = units[current].conc_num;
-        const int tail_dest = units[current].tails_num;
+        // convergence check
+        double max_rel_change = UnitKernels::max_relative_change(static_cast<int>(x.size()), next.data(), x.data());
+        x.swap(next);
 
-        process_destination(conc_dest, mask, visited, q);
-        process_destination(tail_dest, mask, visited, q);
+        if (max_rel_change < tolerance)
+        {
+            iterations += iter + 1;
+            return true;
+        }
+    }
+    iterations += max_iterations;
+    return false; // not converged
+}
 
-        if ((mask & (mask - 1)) >= 3)
-            break;
+/**
+ * @brief Solve a recycle loop by Gauss–Seidel sweeps
+ *
+ * Like run_fixed_point, but the units are visited in breadth-first order
+ * from the feed and each unit's outputs are added to the feeds of its
+ * destinations as soon as it has been processed. A unit later in the same
+ * sweep therefore already sees the new flows, instead of waiting for the
+ * next sweep.
+ *
+ * From a cold start x is the inflow and nothing has been routed yet. A warm
+ * start first processes every unit at its initial feed and routes all
+ * outputs at once (one sweep of the fixed-point map), which makes x and the
+ * routed flows consistent and gives the change to test on the first sweep.
+ *
+ * @param comp Index of the component
+ * @param x Unit feeds of the component: initial guess, converged on return
+ * @param warm_start x holds initial unit feeds rather than the inflow
+ * @param tolerance Tolerance for convergence
+ * @param max_iterations Maximum number of sweeps
+ *
+ * @return true if mass balance converges, false otherwise
+ */
+bool Circuit::run_gauss_seidel(int comp, std::vector<double>& x, bool warm_start, double tolerance,
+                               int max_iterations)
+{
+    const CircuitTopology& topology = get_topology();
+    const int begin = topology.component_start[comp];
+    const int size = topology.component_start[comp + 1] - begin;
+
+    // Concentrate and tailings flows each unit currently adds to the loop
+    std::vector<double>& routed = scratch.routed;
+    routed.assign(6 * size, 0.0);
+    auto route = [&](int outlet, const double* flow, double* last)
+    {
+        const int slot = topology.outlet_loop_slot[outlet];
+        if (slot < 0)
+            return;
+        double* feed = &x[3 * slot];
+        for (int c = 0; c < 3; ++c)
+        {
+            feed[c] += flow[c] - last[c];
+            last[c] = flow[c];
+        }
+    };
+
+    if (warm_start)
+    {
+        std::vector<double>& next = scratch.next;
+        next.resize(x.size());
+        sweep(comp, x, next);
+        x.swap(next);
+        for (int s = 0; s < size; ++s)
+        {
+            const int i = topology.component_units[begin + s];
+            const double flows[6] = {conc_palusznium[i],  conc_gormanium[i],  conc_waste[i],
+                                     tails_palusznium[i], tails_gormanium[i], tails_waste[i]};
+            std::copy(flows, flows + 6, &routed[6 * s]);
+        }
+        ++iterations;
     }
 
-    return mask;
+    for (int iter = 0; iter < max_iterations; ++iter)
+    {
+        double max_rel_change = 0.0;
+        for (int s = 0; s < size; ++s)
+        {
+            const int i = topology.component_units[begin + s];
+            const double* feed = &x[3 * s];
+            if (iter > 0 || warm_start)
+            {
+                max_rel_change = std::max({max_rel_change,
+                                           std::abs(feed[0] - feed_palusznium[i]) / std::max(feed_palusznium[i], 1e-12),
+                                           std::abs(feed[1] - feed_gormanium[i]) / std::max(feed_gormanium[i], 1e-12),
+                                           std::abs(feed[2] - feed_waste[i]) / std::max(feed_waste[i], 1e-12)});
+            }
+            feed_palusznium[i] = feed[0];
+            feed_gormanium[i] = feed[1];
+            feed_waste[i] = feed[2];
+            process_unit(i);
+
+            const double conc[3] = {conc_palusznium[i], conc_gormanium[i], conc_waste[i]};
+            const double tails[3] = {tails_palusznium[i], tails_gormanium[i], tails_waste[i]};
+            route(2 * i, conc, &routed[6 * s]);
+            route(2 * i + 1, tails, &routed[6 * s + 3]);
+        }
+
+        if ((iter > 0 || warm_start) && max_rel_change < tolerance)
+        {
+            iterations += iter + 1;
+            return true;
+        }
+    }
+    iterations += max_iterations;
+    return false; // not converged
 }
 
+namespace
+{
 /**
- * @brief Process the destination unit
+ * @brief Solve the dense system A x = b in place
+ *
+ * Gaussian elimination with partial pivoting. On return b holds x and A
+ * holds the factorised matrix.
  *
- * This function processes the destination unit and updates the mask
- * accordingly. It also adds the destination unit to the queue for further
- * processing.
+ * @param A Row-major m x m matrix
+ * @param b Right-hand side, overwritten with the solution
+ * @param m Dimension of the system
  *
- * @param dest The destination unit number
- * @param mask The terminal mask
- * @param visited Vector to keep track of visited units
- * @param q Queue for breadth-first search
+ * @return false if the matrix is (numerically) singular
  */
-void Circuit::process_destination(int dest, uint8_t& mask, std::vector<bool>& visited, std::queue<int>& q) const
+bool solve_dense(std::vector<double>& A, std::vector<double>& b, int m)
 {
-    if (dest >= n)
+    for (int col = 0; col < m; ++col)
     {
-        if (dest == OUT_P1())
-            mask |= 0b001;
-        else if (dest == OUT_P2())
-            mask |= 0b010;
-        else if (dest == OUT_TA())
-            mask |= 0b100;
+        int pivot = col;
+        double pivot_abs = std::abs(A[col * m + col]);
+        for (int row = col + 1; row < m; ++row)
+        {
+            double v = std::abs(A[row * m + col]);
+            if (v > pivot_abs)
+            {
+                pivot = row;
+                pivot_abs = v;
+            }
+        }
+        if (pivot_abs < 1e-14)
+            return false;
+        if (pivot != col)
+        {
+            for (int k = col; k < m; ++k)
+                std::swap(A[col * m + k], A[pivot * m + k]);
+            std::swap(b[col], b[pivot]);
+        }
+
+        const double inv = 1.0 / A[col * m + col];
+        for (int row = col + 1; row < m; ++row)
+        {
+            const double factor = A[row * m + col] * inv;
+            if (factor == 0.0)
+                continue;
+            for (int k = col + 1; k < m; ++k)
+                A[row * m + k] -= factor * A[col * m + k];
+            b[row] -= factor * b[col];
+        }
     }
-    else
+
+    for (int row = m - 1; row >= 0; --row)
+    {
+        double sum = b[row];
+        for (int k = row + 1; k < m; ++k)
+            sum -= A[row * m + k] * b[k];
+        b[row] = sum / A[row * m + row];
+    }
+    return true;
+}
+} // namespace
+
+/**
+ * @brief Solve a recycle loop using Newton–Raphson
+ *
+ * Solves r(F) = F - F_in - routed_outputs(F) = 0 for the 3 feeds of every
+ * unit in the loop directly. The Jacobian of each unit follows analytically
+ * from CUnit::process: with τ = φVρ/ΣF and R_i = k_i τ / (1 + k_i τ),
+ *
+ *   ∂C_i/∂F_j = δ_ij R_i - F_i k_i τ / ((1 + k_i τ)² ΣF),
+ *   ∂T_i/∂F_j = δ_ij - ∂C_i/∂F_j.
+ *
+ * Newton starts from a few sweeps of the fixed-point loop. Steps are damped
+ * by halving until the residual decreases and feeds are kept non-negative.
+ *
+ * @param comp Index of the component
+ * @param x Unit feeds of the component: initial guess, converged on return
+ * @param tolerance Tolerance on the relative Newton step
+ * @param max_iterations Maximum number of Newton steps
+ *
+ * @return true if mass balance converges, false otherwise
+ */
+bool Circuit::run_newton(int comp, std::vector<double>& x, double tolerance, int max_iterations)
+{
+    const CircuitTopology& topology = get_topology();
+    const int begin = topology.component_start[comp];
+    const int size = topology.component_start[comp + 1] - begin;
+    const int m = 3 * size;
+
+    // Predictor: a few sweeps of the plain loop give Newton a starting point
+    // away from the zero-flow clamp in CUnit::process
+    const int predictor_sweeps = std::min(size + 2, max_iterations);
+    if (run_fixed_point(comp, x, tolerance, predictor_sweeps))
+        return true;
+
+    std::vector<double>& r = scratch.r;
+    std::vector<double>& x_trial = scratch.x_trial;
+    std::vector<double>& r_trial = scratch.r_trial;
+    std::vector<double>& dx = scratch.dx;
+    std::vector<double>& J = scratch.J;
+    for (auto* v : {&r, &x_trial, &r_trial, &dx})
+        v->resize(m);
+    J.resize(static_cast<size_t>(m) * m);
+
+    // Evaluate the residual r = x - G(x); leaves all units processed at x
+    auto residual = [&](const std::vector<double>& feeds, std::vector<double>& res)
     {
-        if (!visited[dest])
+        sweep(comp, feeds, res);
+        double norm = 0.0;
+        for (int k = 0; k < m; ++k)
         {
-            visited[dest] = true;
-            q.push(dest);
+            res[k] = feeds[k] - res[k];
+            norm = std::max(norm, std::abs(res[k]));
         }
+        return norm;
+    };
+
+    double res_norm = residual(x, r);
+
+    for (int iter = 0; iter < max_iterations; ++iter)
+    {
+        // Assemble J = I - dOutputs/dF at the current (processed) state
+        std::fill(J.begin(), J.end(), 0.0);
+        for (int k = 0; k < m; ++k)
+            J[k * m + k] = 1.0;
+
+        for (int p = 0; p < size; ++p)
+        {
+            const int i = topology.component_units[begin + p];
+            const double F[3] = {feed_palusznium[i], feed_gormanium[i], feed_waste[i]};
+            const double k[3] = {k_palusznium, k_gormanium, k_waste};
+            const double Ftot = F[0] + F[1] + F[2];
+            const double tau = phi * volume[i] / (std::max(Ftot, 1e-10) / rho);
+
+            // R_i as in process_unit; g_i = F_i ∂R_i/∂τ ∂τ/∂ΣF, zero where the flow is clamped
+            double R[3], g[3];
+            for (int c = 0; c < 3; ++c)
+            {
+                const double denom = 1.0 + k[c] * tau;
+                R[c] = k[c] * tau / denom;
+                g[c] = (Ftot > 1e-10) ? -F[c] * k[c] * tau / (denom * denom * Ftot) : 0.0;
+            }
+
+            // Only flows staying inside the loop depend on its feeds
+            const int conc = topology.outlet_loop_slot[2 * i];
+            const int tails = topology.outlet_loop_slot[2 * i + 1];
+            for (int c = 0; c < 3; ++c)
+            {
+                for (int d = 0; d < 3; ++d)
+                {
+                    const double dconc = (c == d ? R[c] : 0.0) + g[c];
+                    const double dtails = (c == d ? 1.0 : 0.0) - dconc;
+                    if (conc >= 0)
+                        J[(3 * conc + c) * m + 3 * p + d] -= dconc;
+                    if (tails >= 0)
+                        J[(3 * tails + c) * m + 3 * p + d] -= dtails;
+                }
+            }
+        }
+
+        for (int k = 0; k < m; ++k)
+            dx[k] = -r[k];
+        if (!solve_dense(J, dx, m))
+        {
+            iterations += iter;
+            return false;
+        }
+
+        // Damped step: halve until the residual decreases
+        double lambda = 1.0;
+        double trial_norm = res_norm;
+        for (int ls = 0; ls < 30; ++ls)
+        {
+            for (int k = 0; k < m; ++k)
+                x_trial[k] = std::max(x[k] + lambda * dx[k], 0.0);
+            trial_norm = residual(x_trial, r_trial);
+            if (trial_norm < res_norm || res_norm < 1e-12)
+                break;
+            lambda *= 0.5;
+        }
+
+        double max_rel_change = 0.0;
+        for (int k = 0; k < m; ++k)
+        {
+            double rel = std::abs(x_trial[k] - x[k]) /
+                         std::max(std::abs(x_trial[k]), Constants::Simulation::MIN_FLOW_RATE);
+            max_rel_change = std::max(max_rel_change, rel);
+        }
+
+        x.swap(x_trial);
+        r.swap(r_trial);
+        res_norm = trial_norm;
+
+        if (max_rel_change < tolerance)
+        {
+            iterations += iter + 1;
+            return true;
+        }
+    }
+    iterations += max_iterations;
+    return false; // not converged
+}
+
+/**
+ * @brief Apply one sweep of the fixed-point map to a recycle loop
+ *
+ * Processes every unit of the component with the given feeds and routes the
+ * outputs that stay inside the component, i.e. evaluates next = G(feeds)
+ * with the inflow from earlier components added. All units of the
+ * component are left processed at @p feeds.
+ *
+ * @param comp Index of the component
+ * @param feeds Unit feeds (P, G, W per unit of the component)
+ * @param next Routed feeds after the sweep
+ */
+void Circuit::sweep(int comp, const std::vector<double>& feeds, std::vector<double>& next)
+{
+    const CircuitTopology& topology = get_topology();
+    const int begin = topology.component_start[comp];
+    const int size = topology.component_start[comp + 1] - begin;
+
+    // Lay the feeds out by stream for the vectorised unit kernel
+    double* feed = slot_flows.data();
+    double* conc = feed + 3 * size;
+    double* tails = feed + 6 * size;
+    for (int s = 0; s < size; ++s)
+    {
+        for (int c = 0; c < 3; ++c)
+            feed[c * size + s] = feeds[3 * s + c];
+    }
+    const UnitKernels::Kinetics kinetics = {k_palusznium, k_gormanium, k_waste, rho, phi};
+    UnitKernels::process(kinetics, size, size, slot_volume.data(), feed, conc, tails);
+
+    for (int s = 0; s < size; ++s)
+    {
+        const int i = topology.component_units[begin + s];
+        feed_palusznium[i] = feed[s];
+        feed_gormanium[i] = feed[size + s];
+        feed_waste[i] = feed[2 * size + s];
+        conc_palusznium[i] = conc[s];
+        conc_gormanium[i] = conc[size + s];
+        conc_waste[i] = conc[2 * size + s];
+        tails_palusznium[i] = tails[s];
+        tails_gormanium[i] = tails[size + s];
+        tails_waste[i] = tails[2 * size + s];
+    }
+
+    // Route the flows that stay in the loop
+    std::copy(inflow.begin(), inflow.end(), next.begin());
+    const double* const outputs[2] = {conc, tails};
+    for (int k = topology.loop_start[comp]; k < topology.loop_start[comp + 1]; ++k)
+    {
+        const double* out = outputs[topology.loop_outlet[k] & 1] + topology.loop_source[k];
+        double* to = &next[3 * topology.loop_dest[k]];
+        for (int c = 0; c < 3; ++c)
+            to[c] += out[c * size];
     }
 }
 
+/**
+ * @brief Solve a recycle loop with Anderson acceleration
+ *
+ * Anderson mixing on the fixed-point map G of the plain loop: instead of
+ * x_{k+1} = G(x_k), the next iterate combines the last few map values,
+ *
+ *   x_{k+1} = G(x_k) - ΔG γ,   γ = argmin || f_k - ΔF γ ||,
+ *
+ * where f = G(x) - x and ΔF, ΔG hold the differences of the last
+ * anderson_depth residuals and map values. No Jacobian is needed; the
+ * history is restarted whenever the residual grows.
+ *
+ * @param comp Index of the component
+ * @param x Unit feeds of the component: initial guess, converged on return
+ * @param tolerance Tolerance for convergence
+ * @param max_iterations Maximum number of map evaluations
+ *
+ * @return true if mass balance converges, false otherwise
+ */
+bool Circuit::run_anderson(int comp, std::vector<double>& x, double tolerance, int max_iterations)
+{
+    const int size = get_topology().component_start[comp + 1] - get_topology().component_start[comp];
+    const int m = 3 * size;
+    // More columns than unknowns would make the least-squares problem singular
+    const int depth = std::max(std::min(anderson_depth, m), 1);
+
+    // Plain sweeps first: mixing only pays off once the transient has passed
+    const int predictor_sweeps = std::min(size + 2, max_iterations);
+    if (run_fixed_point(comp, x, tolerance, predictor_sweeps))
+        return true;
+
+    std::vector<double>& g = scratch.g;
+    std::vector<double>& f = scratch.f;
+    std::vector<double>& g_prev = scratch.g_prev;
+    std::vector<double>& f_prev = scratch.f_prev;
+    std::vector<double>& dG = scratch.dG;
+    std::vector<double>& dF = scratch.dF;
+    std::vector<double>& gram = scratch.gram;
+    std::vector<double>& normal = scratch.normal;
+    std::vector<double>& gamma = scratch.gamma;
+    for (auto* v : {&g, &f, &g_prev, &f_prev})
+        v->resize(m);
+    dG.resize(static_cast<size_t>(depth) * m);
+    dF.resize(dG.size());
+    gram.resize(static_cast<size_t>(depth) * depth);
+    normal.resize(gram.size());
+    gamma.resize(depth);
+    int history = 0; // columns stored in dG / dF
+    int oldest = 0;  // ring position of the oldest column
+    double last_norm = 0.0;
+
+    for (int iter = 0; iter < max_iterations - predictor_sweeps; ++iter)
+    {
+        sweep(comp, x, g);
+
+        double max_rel_change = UnitKernels::max_relative_change(m, g.data(), x.data());
+        double norm = 0.0;
+        for (int k = 0; k < m; ++k)
+        {
+            f[k] = g[k] - x[k];
+            norm += f[k] * f[k];
+        }
+
+        if (max_rel_change < tolerance)
+        {
+            iterations += iter + 1;
+            return true;
+        }
+
+        if (iter > 0)
+        {
+            // Residual no longer shrinking: leave the loop to the plain iteration
+            if (std::abs(norm - last_norm) < 1e-6 * last_norm)
+            {
+                iterations += iter + 1;
+                return false;
+            }
+            if (norm > last_norm)
+            {
+                history = 0; // extrapolation went the wrong way: restart
+                oldest = 0;
+            }
+            else
+            {
+                const int col = (history < depth) ? history++ : (oldest++ % depth);
+                for (int k = 0; k < m; ++k)
+                {
+                    dF[col * m + k] = f[k] - f_prev[k];
+                    dG[col * m + k] = g[k] - g_prev[k];
+                }
+                oldest %= depth;
+
+                // Only the Gram entries of the new column change
+                for (int a = 0; a < history; ++a)
+                {
+                    double dot = 0.0;
+                    for (int k = 0; k < m; ++k)
+                        dot += dF[a * m + k] * dF[col * m + k];
+                    gram[a * depth + col] = gram[col * depth + a] = dot;
+                }
+            }
+        }
+        f_prev.swap(f);
+        g_prev = g;
+        last_norm = norm;
+
+        // Least-squares coefficients from the (regularised) normal equations
+        bool mixed = false;
+        if (history > 0)
+        {
+            double trace = 0.0;
+            for (int a = 0; a < history; ++a)
+            {
+                for (int b = 0; b < history; ++b)
+                    normal[a * history + b] = gram[a * depth + b];
+                trace += normal[a * history + a];
+                double rhs = 0.0;
+                for (int k = 0; k < m; ++k)
+                    rhs += dF[a * m + k] * f_prev[k];
+                gamma[a] = rhs;
+            }
+            for (int a = 0; a < history; ++a)
+                normal[a * history + a] += 1e-12 * trace;
+            mixed = trace > 0.0 && solve_dense(normal, gamma, history);
+        }
+
+        for (int k = 0; k < m; ++k)
+        {
+            double next = g[k];
+            if (mixed)
+            {
+                for (int a = 0; a < history; ++a)
+                    next -= dG[a * m + k] * gamma[a];
+            }
+            x[k] = std::max(next, 0.0);
+        }
+    }
+    iterations += max_iterations - predictor_sweeps;
+    return false; // not converged
+}
+
+/**
+ * @brief Collect the final product streams
+ *
+ * Sums the concentrate and tailings outputs of all units that discharge to
+ * one of the three circuit outlets, gathered over the in-edges of the
+ * outlet nodes.
+ */
+void Circuit::collect_products()
+{
+    palusznium_product_palusznium = palusznium_product_gormanium = palusznium_product_waste = 0.0;
+    gormanium_product_palusznium = gormanium_product_gormanium = gormanium_product_waste = 0.0;
+    tailings_palusznium = tailings_gormanium = tailings_waste = 0.0;
+
+    const CircuitTopology& topology = get_topology();
+    const double* const outlet_flows[2][3] = {
+        {conc_palusznium.data(), conc_gormanium.data(), conc_waste.data()},
+        {tails_palusznium.data(), tails_gormanium.data(), tails_waste.data()}};
+
+    // Sum the outlets discharging into one circuit outlet node
+    auto gather = [&](int node, double& palusznium, double& gormanium, double& waste)
+    {
+        for (int k = topology.in_start[node]; k < topology.in_start[node + 1]; ++k)
+        {
+            const int e = topology.in_outlet[k];
+            palusznium += outlet_flows[e & 1][0][e >> 1];
+            gormanium += outlet_flows[e & 1][1][e >> 1];
+            waste += outlet_flows[e & 1][2][e >> 1];
+        }
+    };
+    gather(topology.palusznium_node(), palusznium_product_palusznium, palusznium_product_gormanium,
+           palusznium_product_waste);
+    gather(topology.gormanium_node(), gormanium_product_palusznium, gormanium_product_gormanium,
+           gormanium_product_waste);
+    gather(topology.tailings_node(), tailings_palusznium, tailings_gormanium, tailings_waste);
+}
+
+/**
+ * @brief Get the economic value of the circuit
+ *
+ * This function calculates the economic value of the circuit based on
+ * the product flow rates and the values of the materials.
+ *
+ * @return The economic value of the circuit
+ *
+ */
+double Circuit::get_economic_value() const
+{
+    double value = 0.0;
+
+    // Palusznium product
+    value += palusznium_product_palusznium * palusznium_value;
+    value += palusznium_product_gormanium * gormanium_value_in_palusznium;
+    value += palusznium_product_waste * waste_penalty_palusznium;
+
+    // Gormanium product
+    value += gormanium_product_gormanium * gormanium_value;
+    value += gormanium_product_palusznium * palusznium_value_in_gormanium;
+    value += gormanium_product_waste * waste_penalty_gormanium;
+
+    double total_volume = 0.0;
+    for (double v : volume)
+        total_volume += v;
+    double cost = Constants::Economic::COST_COEFFICIENT * std::pow(total_volume, 2.0 / 3.0);
+    if (total_volume >= Constants::Circuit::MAX_CIRCUIT_VOLUME)
+    {
+        cost += Constants::Economic::VOLUME_PENALTY_COEFFICIENT *
+                std::pow(total_volume - Constants::Circuit::MAX_CIRCUIT_VOLUME, 2.0);
+    }
+    value -= cost; // cost of the circuit
+    return value;
+}
+
+/**
+ * @brief Gradient of the economic value with respect to the volume parameters
+ *
+ * Adjoint sensitivities of the converged steady state. Every unit feed gets
+ * an adjoint λ, the value a kilogram per second more of each component in
+ * it would add: a kilogram sent to a product is worth its price, one sent
+ * to a unit is worth that unit's λ, and flow into the feed unit or the
+ * tailings is worth nothing. The components of the topology are visited in
+ * reverse order, so all units downstream of a component have their λ
+ * already. An acyclic unit gets its λ directly; a recycle loop needs one
+ * dense solve with the transpose of the Newton matrix I - ∂G/∂F of the
+ * loop. The sensitivity of the value to a unit volume is then local to the
+ * unit: the change in its recoveries, priced at the λ of its two
+ * destinations, less the change in the circuit cost.
+ *
+ * The gradient is exact for the steady state, so it matches finite
+ * differences up to the tolerance of the mass balance.
+ *
+ * @param gradient Output, ∂value/∂β_u for every unit (the volume is V_min + (V_max - V_min) β)
+ *
+ * @return false if the mass balance has not converged or a recycle loop is singular
+ */
+bool Circuit::get_economic_value_gradient(std::vector<double>& gradient)
+{
+    const CircuitTopology& topology = get_topology();
+    const int num_units = static_cast<int>(volume.size());
+    gradient.assign(num_units, 0.0);
+    if (!solved || topology.num_units != num_units)
+        return false;
+
+    const double k[3] = {k_palusznium, k_gormanium, k_waste};
+    const double price[3][3] = {
+        {palusznium_value, gormanium_value_in_palusznium, waste_penalty_palusznium},
+        {palusznium_value_in_gormanium, gormanium_value, waste_penalty_gormanium},
+        {0.0, 0.0, 0.0}};
+    std::vector<double>& lambda = scratch.g; // 3 per unit
+    lambda.assign(3 * static_cast<size_t>(num_units), 0.0);
+
+    // Value of a kilogram per second of each component leaving through outlet e; inside_loop
+    // drops the λ of units in the loop being solved, which are unknowns of the loop system
+    auto outlet_worth = [&](int e, bool inside_loop, double* worth)
+    {
+        const int dest = topology.outlet_node[e];
+        for (int c = 0; c < 3; ++c)
+            worth[c] = 0.0;
+        if (dest < num_units)
+        {
+            if (dest != topology.feed_unit && !inside_loop)
+            {
+                for (int c = 0; c < 3; ++c)
+                    worth[c] = lambda[3 * dest + c];
+            }
+        }
+        else if (dest < topology.discard_node())
+        {
+            for (int c = 0; c < 3; ++c)
+                worth[c] = price[dest - num_units][c];
+        }
+    };
+
+    // Recoveries of a unit and their derivatives: dconc[c][d] = ∂C_c/∂F_d, dvolume[c] = ∂C_c/∂V
+    auto linearise = [&](int i, double (*dconc)[3], double* dvolume)
+    {
+        const double F[3] = {feed_palusznium[i], feed_gormanium[i], feed_waste[i]};
+        const double Ftot = F[0] + F[1] + F[2];
+        const double tau = phi * volume[i] / (std::max(Ftot, 1e-10) / rho);
+        for (int c = 0; c < 3; ++c)
+        {
+            const double denom = 1.0 + k[c] * tau;
+            const double R = k[c] * tau / denom;
+            const double g = (Ftot > 1e-10) ? -F[c] * k[c] * tau / (denom * denom * Ftot) : 0.0;
+            for (int d = 0; d < 3; ++d)
+                dconc[c][d] = (c == d ? R : 0.0) + g;
+            dvolume[c] = F[c] * k[c] * tau / (denom * denom * volume[i]);
+        }
+    };
+
+    double dconc[3][3], dvolume[3], conc_worth[3], tails_worth[3];
+    const int num_components = static_cast<int>(topology.component_start.size()) - 1;
+    for (int comp = num_components - 1; comp >= 0; --comp)
+    {
+        const int begin = topology.component_start[comp];
+        const int size = topology.component_start[comp + 1] - begin;
+
+        // λ_d = tails_worth_d + Σ_c ∂C_c/∂F_d (conc_worth_c - tails_worth_c), with the worth of outlets into
+        // the loop as unknowns
+        if (!topology.component_cyclic[comp])
+        {
+            const int i = topology.component_units[begin];
+            linearise(i, dconc, dvolume);
+            outlet_worth(2 * i, false, conc_worth);
+            outlet_worth(2 * i + 1, false, tails_worth);
+            for (int d = 0; d < 3; ++d)
+            {
+                lambda[3 * i + d] = tails_worth[d];
+                for (int c = 0; c < 3; ++c)
+                    lambda[3 * i + d] += dconc[c][d] * (conc_worth[c] - tails_worth[c]);
+            }
+            continue;
+        }
+
+        // (I - ∂G/∂F)ᵀ λ = b over the loop
+        const int m = 3 * size;
+        std::vector<double>& A = scratch.J;
+        std::vector<double>& b = scratch.r;
+        A.assign(static_cast<size_t>(m) * m, 0.0);
+        b.assign(m, 0.0);
+        for (int q = 0; q < m; ++q)
+            A[q * m + q] = 1.0;
+        for (int p = 0; p < size; ++p)
+        {
+            const int i = topology.component_units[begin + p];
+            const int conc = topology.outlet_loop_slot[2 * i];
+            const int tails = topology.outlet_loop_slot[2 * i + 1];
+            linearise(i, dconc, dvolume);
+            outlet_worth(2 * i, conc >= 0, conc_worth);
+            outlet_worth(2 * i + 1, tails >= 0, tails_worth);
+            for (int d = 0; d < 3; ++d)
+            {
+                b[3 * p + d] = tails_worth[d];
+                for (int c = 0; c < 3; ++c)
+                {
+                    const double dtails = (c == d ? 1.0 : 0.0) - dconc[c][d];
+                    b[3 * p + d] += dconc[c][d] * (conc_worth[c] - tails_worth[c]);
+                    if (conc >= 0)
+                        A[(3 * p + d) * m + 3 * conc + c] -= dconc[c][d];
+                    if (tails >= 0)
+                        A[(3 * p + d) * m + 3 * tails + c] -= dtails;
+                }
+            }
+        }
+        if (!solve_dense(A, b, m))
+            return false;
+        for (int p = 0; p < size; ++p)
+        {
+            const int i = topology.component_units[begin + p];
+            for (int d = 0; d < 3; ++d)
+                lambda[3 * i + d] = b[3 * p + d];
+        }
+    }
+
+    // Sensitivity to each volume, with the derivative of the cost in get_economic_value
+    double total_volume = 0.0;
+    for (double v : volume)
+        total_volume += v;
+    double dcost = Constants::Economic::COST_COEFFICIENT * (2.0 / 3.0) * std::pow(total_volume, -1.0 / 3.0);
+    if (total_volume >= Constants::Circuit::MAX_CIRCUIT_VOLUME)
+        dcost += 2.0 * Constants::Economic::VOLUME_PENALTY_COEFFICIENT *
+                 (total_volume - Constants::Circuit::MAX_CIRCUIT_VOLUME);
+    for (int i = 0; i < num_units; ++i)
+    {
+        linearise(i, dconc, dvolume);
+        outlet_worth(2 * i, false, conc_worth);
+        outlet_worth(2 * i + 1, false, tails_worth);
+        double dvalue = -dcost;
+        for (int c = 0; c < 3; ++c)
+            dvalue += dvolume[c] * (conc_worth[c] - tails_worth[c]);
+        gradient[i] = dvalue * (V_max - V_min);
+    }
+    return true;
+}
+
+/**
+ * @brief Get the recovery of valuable materials
+ *
+ * This function calculates the recovery of valuable materials in the
+ * circuit based on the product flow rates and the feed rates.
+ *
+ * @return The recovery of valuable materials
+ *
+ */
+double Circuit::get_palusznium_recovery() const
+{
+
+    double total_feed = feed_palusznium_rate;
+    double recovered = palusznium_product_palusznium;
+    if (total_feed < 1e-12)
+        return 0.0;
+    return recovered / total_feed;
+}
+
+/**
+ * @brief Get the recovery of gormanium
+ *
+ * This function calculates the recovery of gormanium in the circuit
+ * based on the product flow rates and the feed rates.
+ *
+ * @return The recovery of gormanium
+ *
+ */
+double Circuit::get_gormanium_recovery() const
+{
+    double total_feed = feed_gormanium_rate;
+    double recovered = gormanium_product_gormanium;
+    if (total_feed < 1e-12)
+        return 0.0;
+    return recovered / total_feed;
+}
+
+/**
+ * @brief Get the grade of palusznium
+ *
+ * This function calculates the grade of palusznium in the circuit
+ * based on the product flow rates.
+ *
+ * @return The grade of palusznium
+ *
+ */
+double Circuit::get_palusznium_grade() const
+{
+    double total = palusznium_product_palusznium + palusznium_product_gormanium + palusznium_product_waste;
+    return (total > 0) ? (palusznium_product_palusznium / total) : 0.0;
+}
+
+/**
+ * @brief Get the grade of gormanium
+ *
+ * This function calculates the grade of gormanium in the circuit
+ * based on the product flow rates.
+ *
+ * @return The grade of gormanium
+ *
+ */
+double Circuit::get_gormanium_grade() const
+{
+    double total = gormanium_product_palusznium + gormanium_product_gormanium + gormanium_product_waste;
+    return (total > 0) ? (gormanium_product_gormanium / total) : 0.0;
+}
+
+/**
+ * @brief Get a copy of one unit
+ *
+ * Gathers the unit's destinations, constants and flows from the unit
+ * arrays into a CUnit, for output and tests. Changing the copy does not
+ * change the circuit.
+ *
+ * @param unit Index of the unit
+ *
+ * @return The unit's current state
+ */
+CUnit Circuit::get_unit(int unit) const
+{
+    CUnit u(conc_num[unit], tails_num[unit]);
+    const CircuitTopology& topology = get_topology();
+    u.mark = unit < topology.num_units && topology.unit_reachable[unit];
+    u.volume = volume[unit];
+    u.V_min = V_min;
+    u.V_max = V_max;
+    u.k_palusznium = k_palusznium;
+    u.k_gormanium = k_gormanium;
+    u.k_waste = k_waste;
+    u.rho = rho;
+    u.phi = phi;
+    u.feed_palusznium = feed_palusznium[unit];
+    u.feed_gormanium = feed_gormanium[unit];
+    u.feed_waste = feed_waste[unit];
+    u.process(); // fills in the recoveries
+    u.conc_palusznium = conc_palusznium[unit];
+    u.conc_gormanium = conc_gormanium[unit];
+    u.conc_waste = conc_waste[unit];
+    u.tails_palusznium = tails_palusznium[unit];
+    u.tails_gormanium = tails_gormanium[unit];
+    u.tails_waste = tails_waste[unit];
+    return u;
+}
+
+/**
+ * @brief Export the circuit to a DOT file
+ *
+ * This function exports the circuit to a DOT file for visualization.
+ *
+ * @param filename The name of the output DOT file
+ *
+ * @return true if export is successful, false otherwise
+ */
+bool Circuit::export_to_dot(const std::string& filename) const
+{
+    std::ofstream ofs(filename);
+    if (!ofs)
+        return false;
+    ofs << "digraph Circuit {\n";
+    const CircuitTopology& topology = get_topology();
+    const int num_units = topology.num_units;
+    for (int i = 0; i < num_units; ++i)
+    {
+        ofs << "  unit" << i << " [label=\"Unit " << i << "\"];\n";
+        for (int e = 2 * i; e < 2 * i + 2; ++e)
+        {
+            const char* label = (e & 1) ? "tails" : "conc";
+            const int dest = topology.outlet_node[e];
+            if (dest < num_units)
+                ofs << "  unit" << i << " -> unit" << dest << " [label=\"" << label << "\"];\n";
+            else if (dest == topology.palusznium_node())
+                ofs << "  unit" << i << " -> palusznium_product [label=\"" << label << "\"];\n";
+            else if (dest == topology.gormanium_node())
+                ofs << "  unit" << i << " -> gormanium_product [label=\"" << label << "\"];\n";
+            else if (dest == topology.tailings_node())
+                ofs << "  unit" << i << " -> tailings [label=\"" << label << "\"];\n";
+        }
+    }
+    ofs << "  palusznium_product [shape=box, label=\"Palusznium Product\"];\n";
+    ofs << "  gormanium_product [shape=box, label=\"Gormanium Product\"];\n";
+    ofs << "  tailings [shape=box, label=\"Tailings\"];\n";
+    ofs << "}\n";
+    return true;
+}
+
 /**
  * @brief Save the circuit output information to a CSV file
  *
@@ -825,14 +1913,15 @@ bool Circuit::save_all_units_to_csv(const std::string& filename)
     // output in a single line
     ofs << std::fixed << std::setprecision(2);
 
-    for (size_t i = 0; i < units.size(); ++i)
+    const int num_units = static_cast<int>(conc_num.size());
+    for (int i = 0; i < num_units; ++i)
     {
-        const CUnit& unit = units[i];
+        const CUnit unit = get_unit(i);
 
         ofs << unit.conc_palusznium + unit.conc_gormanium + unit.conc_waste << ","
             << unit.tails_palusznium + unit.tails_gormanium + unit.tails_waste;
 
-        if (i < units.size() - 1)
+        if (i < num_units - 1)
         {
             ofs << ",";
         }
@@ -862,7 +1951,7 @@ bool Circuit::save_vector_to_csv(const std::string& filename)
         return false;
     }
 
-    int length = static_cast<int>(units.size()) * 2 + 1;
+    int length = static_cast<int>(conc_num.size()) * 2 + 1;
 
     for (int i = 0; i < length; ++i)
     {
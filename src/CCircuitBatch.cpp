@@ -0,0 +1,431 @@
+/**
+ * @file CCircuitBatch.cpp
+ * @brief Implementation of the CircuitBatch class
+ *
+ * The batch runs the Gauss–Seidel mass balance of Circuit for a block of
+ * circuits at once: the slots are visited in order, and each unit's outputs
+ * are added to the feeds of their destinations as soon as it has been
+ * processed. The unit model, the convergence measure and the output
+ * differences run through UnitKernels across the circuits of the block;
+ * only the scatter to the destinations is a plain loop over the lanes.
+ * Circuits the sweeps do not settle are solved again by circuit_performance.
+ */
+#include "CCircuitBatch.h"
+#include "constants.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iterator>
+
+namespace
+{
+const double FEED_RATE[3] = {Constants::Feed::DEFAULT_PALUSZNIUM_FEED, Constants::Feed::DEFAULT_GORMANIUM_FEED,
+                             Constants::Feed::DEFAULT_WASTE_FEED};
+} // namespace
+
+/**
+ * @brief Constructor for the CircuitBatch class
+ *
+ * @param num_units Number of units in every circuit of the batch
+ * @param block_size Number of circuits iterated together
+ */
+CircuitBatch::CircuitBatch(int num_units, int block_size)
+    : n(num_units), block_size(block_size), active(0), iterations(0), vector_stride(2 * num_units + 1),
+      kinetics{Constants::Physical::K_PALUSZNIUM, Constants::Physical::K_GORMANIUM, Constants::Physical::K_WASTE,
+               Constants::Physical::MATERIAL_DENSITY, Constants::Physical::SOLIDS_CONTENT},
+      lane_circuit(block_size), lane_sweeps(block_size), lane_cost(block_size), lane_change(block_size),
+      conc_dest(static_cast<size_t>(num_units) * block_size), tails_dest(conc_dest.size()), volume(conc_dest.size()),
+      feed(3 * (num_units + 3) * static_cast<size_t>(block_size)), last_feed(3 * conc_dest.size()),
+      routed(6 * conc_dest.size()), conc(3 * block_size), tails(3 * block_size), slot_of(num_units),
+      unit_in(num_units)
+{
+}
+
+/**
+ * @brief Evaluate the economic value of a number of circuits
+ *
+ * Up to block_size circuits sweep in lockstep. A circuit leaves its lane as
+ * soon as its unit feeds have converged, or unsettled after max_iterations
+ * sweeps, and the next circuit takes the lane over, so the lanes stay full
+ * until the input runs out. The unsettled circuits are then solved one by
+ * one by circuit_performance, which counts its iterations per recycle loop
+ * and uses the solver of simulator_parameters.
+ *
+ * @param count Number of circuits
+ * @param circuit_vectors count circuit vectors of 2 * num_units + 1 entries, one after another
+ * @param betas count sets of num_units volume parameters, or nullptr for the default volume
+ * @param simulator_parameters Simulation parameters (tolerance and iteration limit, solver of the fallback)
+ * @param performances Output, count economic values
+ * @param same_vector circuit_vectors holds a single vector shared by all count circuits
+ */
+void CircuitBatch::evaluate(int count, const int* circuit_vectors, const double* betas,
+                            const Simulator_Parameters& simulator_parameters, double* performances, bool same_vector)
+{
+    iterations = 0;
+    vector_stride = same_vector ? 0 : 2 * n + 1;
+    if (!supports(simulator_parameters))
+    {
+        // The sweeps cannot honour the model; circuit_performance solves every circuit
+        for (int k = 0; k < count; ++k)
+        {
+            performances[k] = well_formed(circuit_vectors + static_cast<size_t>(k) * vector_stride)
+                                  ? solve_single(k, circuit_vectors, betas, simulator_parameters)
+                                  : -1e12;
+        }
+        return;
+    }
+    const double tolerance = simulator_parameters.tolerance;
+    const int max_iterations = simulator_parameters.max_iterations;
+    int next_circuit = 0;
+    unsettled.clear();
+
+    // Load the next well-formed circuit into a lane; false once the input is exhausted
+    auto refill = [&](int lane)
+    {
+        while (next_circuit < count)
+        {
+            const int k = next_circuit++;
+            if (load(lane, k, circuit_vectors, betas))
+                return true;
+            performances[k] = -1e12; // malformed vector
+        }
+        return false;
+    };
+
+    active = 0;
+    while (active < block_size && refill(active))
+        ++active;
+
+    while (active > 0)
+    {
+        std::fill_n(lane_change.begin(), active, 0.0);
+        sweep();
+        ++iterations;
+
+        for (int lane = active - 1; lane >= 0; --lane)
+        {
+            // The first sweep of a circuit only establishes its flows
+            if (lane_sweeps[lane] > 0 && lane_change[lane] < tolerance)
+                performances[lane_circuit[lane]] = economic_value(lane);
+            else if (++lane_sweeps[lane] >= max_iterations)
+                unsettled.push_back(lane_circuit[lane]); // circuit_performance decides below
+            else
+                continue;
+
+            // Hand the lane to the next circuit, or close the gap with the last active lane
+            if (refill(lane))
+                continue;
+            if (lane != active - 1)
+                move_lane(active - 1, lane);
+            --active;
+        }
+    }
+
+    for (int k : unsettled)
+        performances[k] = solve_single(k, circuit_vectors, betas, simulator_parameters);
+}
+
+/**
+ * @brief Check that the batch can honour simulation parameters
+ *
+ * The batch computes with the unit model, feed, volumes and prices of
+ * constants.h, which the defaults of Simulator_Parameters repeat. evaluate
+ * hands parameters it does not support to circuit_performance.
+ *
+ * @param simulator_parameters Simulation parameters
+ *
+ * @return true if none of those fields differs from its default
+ */
+bool CircuitBatch::supports(const Simulator_Parameters& simulator_parameters)
+{
+    const Simulator_Parameters& p = simulator_parameters;
+    const Simulator_Parameters d;
+    const double given[] = {p.material_density,
+                            p.solids_content,
+                            p.k_palusznium_high,
+                            p.k_palusznium_inter,
+                            p.k_gormanium_high,
+                            p.k_gormanium_inter,
+                            p.k_waste_high,
+                            p.k_waste_inter,
+                            p.feed_palusznium,
+                            p.feed_gormanium,
+                            p.feed_waste,
+                            p.palusznium_value_in_palusznium_stream,
+                            p.gormanium_value_in_palusznium_stream,
+                            p.waste_penalty_in_palusznium_stream,
+                            p.palusznium_value_in_gormanium_stream,
+                            p.gormanium_value_in_gormanium_stream,
+                            p.waste_penalty_in_gormanium_stream,
+                            p.fixed_unit_volume,
+                            p.min_unit_volume,
+                            p.max_unit_volume,
+                            p.max_circuit_volume,
+                            p.cost_coefficient,
+                            p.volume_penalty_coefficient};
+    const double defaults[] = {d.material_density,
+                               d.solids_content,
+                               d.k_palusznium_high,
+                               d.k_palusznium_inter,
+                               d.k_gormanium_high,
+                               d.k_gormanium_inter,
+                               d.k_waste_high,
+                               d.k_waste_inter,
+                               d.feed_palusznium,
+                               d.feed_gormanium,
+                               d.feed_waste,
+                               d.palusznium_value_in_palusznium_stream,
+                               d.gormanium_value_in_palusznium_stream,
+                               d.waste_penalty_in_palusznium_stream,
+                               d.palusznium_value_in_gormanium_stream,
+                               d.gormanium_value_in_gormanium_stream,
+                               d.waste_penalty_in_gormanium_stream,
+                               d.fixed_unit_volume,
+                               d.min_unit_volume,
+                               d.max_unit_volume,
+                               d.max_circuit_volume,
+                               d.cost_coefficient,
+                               d.volume_penalty_coefficient};
+    return std::equal(std::begin(given), std::end(given), std::begin(defaults));
+}
+
+/**
+ * @brief Get the iteration count of the last evaluation
+ *
+ * @return Lockstep sweeps taken by the last evaluate call
+ */
+long CircuitBatch::get_iterations() const
+{
+    return iterations;
+}
+
+/**
+ * @brief Check the ranges of a circuit vector
+ *
+ * The feed unit must be a unit and every destination a unit, one of the
+ * two product streams or the tailings, as Circuit::check_validity requires.
+ *
+ * @param vec Circuit vector of 2 * n + 1 entries
+ *
+ * @return true if every entry is in range
+ */
+bool CircuitBatch::well_formed(const int* vec) const
+{
+    if (vec[0] < 0 || vec[0] >= n)
+        return false;
+    for (int e = 1; e <= 2 * n; ++e)
+    {
+        if (vec[e] < 0 || vec[e] > n + 2)
+            return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Load a circuit into a lane of the batch
+ *
+ * The circuit's units are relabelled into slots in breadth-first order from
+ * the feed unit, which takes slot 0; units not reached from the feed follow
+ * in index order. The lane starts from the external feed at the feed unit
+ * and no flow elsewhere.
+ *
+ * @param lane Lane to load
+ * @param k Index of the circuit
+ * @param circuit_vectors All circuit vectors of the evaluation
+ * @param betas All volume parameters of the evaluation, or nullptr
+ *
+ * @return false if the circuit vector is malformed (feed unit or a destination out of range)
+ */
+bool CircuitBatch::load(int lane, int k, const int* circuit_vectors, const double* betas)
+{
+    const int* vec = circuit_vectors + static_cast<size_t>(k) * vector_stride;
+    if (!well_formed(vec))
+        return false;
+
+    // Breadth-first relabelling from the feed unit
+    std::fill(slot_of.begin(), slot_of.end(), -1);
+    int slots = 0;
+    slot_of[vec[0]] = slots;
+    unit_in[slots++] = vec[0];
+    for (int head = 0; head < slots; ++head)
+    {
+        for (int outlet = 1; outlet <= 2; ++outlet)
+        {
+            const int dest = vec[2 * unit_in[head] + outlet];
+            if (dest < n && slot_of[dest] < 0)
+            {
+                slot_of[dest] = slots;
+                unit_in[slots++] = dest;
+            }
+        }
+    }
+    for (int u = 0; u < n; ++u)
+    {
+        if (slot_of[u] < 0)
+        {
+            slot_of[u] = slots;
+            unit_in[slots++] = u;
+        }
+    }
+
+    auto slot_dest = [&](int dest)
+    {
+        if (dest < n)
+            return slot_of[dest] > 0 ? slot_of[dest] : n + 2; // flow into the feed unit is dropped
+        return dest;
+    };
+
+    const size_t stride = block_size;
+    lane_circuit[lane] = k;
+    lane_sweeps[lane] = 0;
+    for (int s = 0; s < n; ++s)
+    {
+        const int u = unit_in[s];
+        conc_dest[s * stride + lane] = slot_dest(vec[1 + 2 * u]);
+        tails_dest[s * stride + lane] = slot_dest(vec[2 + 2 * u]);
+        volume[s * stride + lane] = Constants::Circuit::DEFAULT_UNIT_VOLUME;
+        if (betas != nullptr)
+        {
+            volume[s * stride + lane] = Constants::Circuit::MIN_UNIT_VOLUME +
+                                        (Constants::Circuit::MAX_UNIT_VOLUME - Constants::Circuit::MIN_UNIT_VOLUME) *
+                                            betas[static_cast<size_t>(k) * n + u];
+        }
+    }
+
+    // Same operating cost as Circuit::get_economic_value, volumes summed in unit order
+    double total_volume = 0.0;
+    for (int u = 0; u < n; ++u)
+        total_volume += volume[slot_of[u] * stride + lane];
+    double cost = Constants::Economic::COST_COEFFICIENT * std::pow(total_volume, 2.0 / 3.0);
+    if (total_volume >= Constants::Circuit::MAX_CIRCUIT_VOLUME)
+    {
+        cost += Constants::Economic::VOLUME_PENALTY_COEFFICIENT *
+                std::pow(total_volume - Constants::Circuit::MAX_CIRCUIT_VOLUME, 2.0);
+    }
+    lane_cost[lane] = cost;
+
+    for (int row = 0; row < 3 * (n + 2); ++row)
+        feed[row * stride + lane] = (row < 3) ? FEED_RATE[row] : 0.0;
+    for (int row = 0; row < 3 * n; ++row)
+        last_feed[row * stride + lane] = 0.0;
+    for (int row = 0; row < 6 * n; ++row)
+        routed[row * stride + lane] = 0.0;
+    return true;
+}
+
+/**
+ * @brief Solve one circuit of the evaluation with circuit_performance
+ *
+ * @param k Index of the circuit
+ * @param circuit_vectors All circuit vectors of the evaluation
+ * @param betas All volume parameters of the evaluation, or nullptr
+ * @param simulator_parameters Simulation parameters
+ *
+ * @return Economic value of the circuit, -1e12 if it does not converge
+ */
+double CircuitBatch::solve_single(int k, const int* circuit_vectors, const double* betas,
+                                  const Simulator_Parameters& simulator_parameters)
+{
+    const int* vec = circuit_vectors + static_cast<size_t>(k) * vector_stride;
+    single_vector.assign(vec, vec + 2 * n + 1);
+    if (betas != nullptr)
+        single_beta.assign(betas + static_cast<size_t>(k) * n, betas + static_cast<size_t>(k + 1) * n);
+    return circuit_performance(2 * n + 1, single_vector.data(), n, betas != nullptr ? single_beta.data() : nullptr,
+                               simulator_parameters);
+}
+
+/**
+ * @brief Advance all active lanes by one Gauss–Seidel sweep
+ *
+ * Every slot is processed at its current feed, and the change of its
+ * outputs since they were last routed is added to their destinations, so
+ * later slots of the same sweep already see the new flows. The largest
+ * relative change of a unit feed since the previous sweep is tracked per
+ * lane in lane_change.
+ */
+void CircuitBatch::sweep()
+{
+    const size_t stride = block_size;
+    for (int s = 0; s < n; ++s)
+    {
+        // convergence check against the feed of the previous sweep
+        for (int c = 0; c < 3; ++c)
+            UnitKernels::track_relative_change(active, &feed[(3 * s + c) * stride], &last_feed[(3 * s + c) * stride],
+                                               lane_change.data());
+        UnitKernels::process(kinetics, active, block_size, &volume[s * stride], &feed[3 * s * stride], conc.data(),
+                             tails.data());
+
+        // Replace the outputs by their change since they were last routed
+        for (int c = 0; c < 3; ++c)
+        {
+            UnitKernels::exchange_difference(active, &conc[c * stride], &routed[(6 * s + c) * stride]);
+            UnitKernels::exchange_difference(active, &tails[c * stride], &routed[(6 * s + 3 + c) * stride]);
+        }
+
+        // ... and add the changes to the destinations
+        for (int lane = 0; lane < active; ++lane)
+        {
+            double* to_conc = &feed[3 * conc_dest[s * stride + lane] * stride + lane];
+            double* to_tails = &feed[3 * tails_dest[s * stride + lane] * stride + lane];
+            for (int c = 0; c < 3; ++c)
+            {
+                to_conc[c * stride] += conc[c * stride + lane];
+                to_tails[c * stride] += tails[c * stride + lane];
+            }
+        }
+    }
+}
+
+/**
+ * @brief Get the economic value of a lane
+ *
+ * Same formula as Circuit::get_economic_value, on the current product flows.
+ *
+ * @param lane Lane of the circuit
+ *
+ * @return Economic value of the circuit (£/s)
+ */
+double CircuitBatch::economic_value(int lane) const
+{
+    auto product = [&](int p, int c) { return feed[(3 * (n + p) + c) * static_cast<size_t>(block_size) + lane]; };
+
+    double value = 0.0;
+
+    // Palusznium product
+    value += product(0, 0) * Constants::Economic::PALUSZNIUM_VALUE_IN_PALUSZNIUM_STREAM;
+    value += product(0, 1) * Constants::Economic::GORMANIUM_VALUE_IN_PALUSZNIUM_STREAM;
+    value += product(0, 2) * Constants::Economic::WASTE_PENALTY_IN_PALUSZNIUM_STREAM;
+
+    // Gormanium product
+    value += product(1, 1) * Constants::Economic::GORMANIUM_VALUE_IN_GORMANIUM_STREAM;
+    value += product(1, 0) * Constants::Economic::PALUSZNIUM_VALUE_IN_GORMANIUM_STREAM;
+    value += product(1, 2) * Constants::Economic::WASTE_PENALTY_IN_GORMANIUM_STREAM;
+
+    return value - lane_cost[lane];
+}
+
+/**
+ * @brief Move the state of one lane to another
+ *
+ * @param from Source lane
+ * @param to Destination lane, overwritten
+ */
+void CircuitBatch::move_lane(int from, int to)
+{
+    const size_t stride = block_size;
+    lane_circuit[to] = lane_circuit[from];
+    lane_sweeps[to] = lane_sweeps[from];
+    lane_cost[to] = lane_cost[from];
+    for (int s = 0; s < n; ++s)
+    {
+        conc_dest[s * stride + to] = conc_dest[s * stride + from];
+        tails_dest[s * stride + to] = tails_dest[s * stride + from];
+        volume[s * stride + to] = volume[s * stride + from];
+    }
+    for (int row = 0; row < 3 * (n + 2); ++row)
+        feed[row * stride + to] = feed[row * stride + from];
+    for (int row = 0; row < 3 * n; ++row)
+        last_feed[row * stride + to] = last_feed[row * stride + from];
+    for (int row = 0; row < 6 * n; ++row)
+        routed[row * stride + to] = routed[row * stride + from];
+}
@@ -0,0 +1,120 @@
+/**
+ * @file CCircuitCanonical.cpp
+ * @brief Implementation of the canonical labelling of circuit vectors
+ *
+ * The labelling is a single breadth-first pass over the units, linear in
+ * the size of the vector. It writes into the vectors of the labelling and
+ * a per-thread scratch vector, so a labelling reused for circuits of the
+ * same size does not allocate.
+ */
+#include "CCircuitCanonical.h"
+
+/**
+ * @brief Renumber the units of a circuit vector canonically
+ *
+ * The feed unit becomes unit 0; every unit reached for the first time
+ * through an outlet takes the next number, in the order the units are
+ * visited and with the concentrate outlet first. The outlets of the
+ * canonical vector then point to the new numbers, the product and tailings
+ * destinations stay as they are.
+ *
+ * @param vector_size Size of the circuit vector
+ * @param circuit_vector Circuit vector
+ * @param labelling Output, canonical vector and renumbering
+ *
+ * @return true if the vector is well formed; otherwise labelling holds the vector and the identity
+ */
+bool canonical_labelling(int vector_size, const int* circuit_vector, Circuit_Labelling& labelling)
+{
+    const int n = (vector_size - 1) / 2;
+    std::vector<int>& canonical = labelling.circuit_vector;
+    std::vector<int>& unit_of = labelling.unit_of;
+    canonical.assign(circuit_vector, circuit_vector + vector_size);
+    unit_of.resize(n > 0 ? n : 0);
+    for (int u = 0; u < n; ++u)
+        unit_of[u] = u;
+
+    bool well_formed = n > 0 && vector_size == 2 * n + 1 && circuit_vector[0] >= 0 && circuit_vector[0] < n;
+    for (int e = 1; well_formed && e < vector_size; ++e)
+        well_formed = circuit_vector[e] >= 0 && circuit_vector[e] < n + 3;
+    if (!well_formed)
+        return false;
+
+    // Breadth-first from the feed unit
+    thread_local std::vector<int> label_of;
+    label_of.assign(n, -1);
+    int labelled = 0;
+    label_of[circuit_vector[0]] = labelled;
+    unit_of[labelled++] = circuit_vector[0];
+    for (int head = 0; head < labelled; ++head)
+    {
+        for (int outlet = 1; outlet <= 2; ++outlet)
+        {
+            const int dest = circuit_vector[2 * unit_of[head] + outlet];
+            if (dest < n && label_of[dest] < 0)
+            {
+                label_of[dest] = labelled;
+                unit_of[labelled++] = dest;
+            }
+        }
+    }
+    for (int u = 0; u < n; ++u)
+    {
+        if (label_of[u] < 0)
+        {
+            label_of[u] = labelled;
+            unit_of[labelled++] = u;
+        }
+    }
+
+    // Outlets of the units in canonical order, pointing to the new numbers
+    canonical[0] = 0;
+    for (int k = 0; k < n; ++k)
+    {
+        const int u = unit_of[k];
+        for (int outlet = 1; outlet <= 2; ++outlet)
+        {
+            const int dest = circuit_vector[2 * u + outlet];
+            canonical[2 * k + outlet] = dest < n ? label_of[dest] : dest;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Move per-unit values into canonical order
+ *
+ * @param labelling Labelling of the circuit
+ * @param values values_per_unit values per original unit
+ * @param values_per_unit Number of values per unit
+ * @param canonical_values Output, values_per_unit values per canonical unit
+ */
+void to_canonical_order(const Circuit_Labelling& labelling, const double* values, int values_per_unit,
+                        double* canonical_values)
+{
+    const int n = static_cast<int>(labelling.unit_of.size());
+    for (int k = 0; k < n; ++k)
+    {
+        for (int v = 0; v < values_per_unit; ++v)
+            canonical_values[k * values_per_unit + v] = values[labelling.unit_of[k] * values_per_unit + v];
+    }
+}
+
+/**
+ * @brief Move per-unit values from canonical order back to the original units
+ *
+ * @param labelling Labelling of the circuit
+ * @param canonical_values values_per_unit values per canonical unit
+ * @param values_per_unit Number of values per unit
+ * @param values Output, values_per_unit values per original unit
+ */
+void from_canonical_order(const Circuit_Labelling& labelling, const double* canonical_values, int values_per_unit,
+                          double* values)
+{
+    const int n = static_cast<int>(labelling.unit_of.size());
+    for (int k = 0; k < n; ++k)
+    {
+        for (int v = 0; v < values_per_unit; ++v)
+            values[labelling.unit_of[k] * values_per_unit + v] = canonical_values[k * values_per_unit + v];
+    }
+}
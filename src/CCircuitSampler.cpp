@@ -0,0 +1,238 @@
+/**
+ * @file CCircuitSampler.cpp
+ * @brief Implementation of the constructive sampling of valid circuit vectors
+ *
+ * Outlet o of unit u is entry 1 + 2u + o of the circuit vector (o = 0 for
+ * the concentrate, 1 for the tailings). The scratch vectors are per thread,
+ * so sampling circuits of the same size does not allocate.
+ */
+#include "CCircuitSampler.h"
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+namespace
+{
+
+// Random destination for an outlet of unit: a unit or terminal other than unit itself and other
+int random_destination(int n, int unit, int other, Philox& random)
+{
+    const int excluded = (other >= 0 && other <= n + 2 && other != unit) ? 2 : 1;
+    int d = std::uniform_int_distribution<int>(0, n + 2 - excluded)(random);
+    const int low = std::min(unit, other), high = std::max(unit, other);
+    if (excluded == 1)
+        return d >= unit ? d + 1 : d;
+    if (d >= low)
+        ++d;
+    if (d >= high)
+        ++d;
+    return d;
+}
+
+} // namespace
+
+/**
+ * @brief Repair a circuit vector to pass the structural rules
+ *
+ * Outlets breaking rules 3 to 5 are drawn again, and afterwards only outlets
+ * outside the spanning tree are changed: one for every unit the feed does
+ * not reach, and the outlets of the leaves that reach too few terminals. A
+ * vector that passes rules 1 to 8 is left as it is.
+ *
+ * @param num_units Number of units
+ * @param vec Circuit vector, 2 * num_units + 1 entries, repaired in place
+ * @param random Random numbers for the destinations drawn
+ */
+void repair_circuit(int num_units, int* vec, Philox& random)
+{
+    const int n = num_units;
+
+    // 1. Feed, range, self-loop and same-output rules
+    if (vec[0] < 0 || vec[0] >= n)
+        vec[0] = std::uniform_int_distribution<int>(0, n - 1)(random);
+    for (int u = 0; u < n; ++u)
+    {
+        int& conc = vec[1 + 2 * u];
+        int& tail = vec[2 + 2 * u];
+        if (conc < 0 || conc > n + 2 || conc == u)
+            conc = random_destination(n, u, tail, random);
+        if (tail < 0 || tail > n + 2 || tail == u || tail == conc)
+            tail = random_destination(n, u, conc, random);
+    }
+
+    // 2. Breadth-first tree from the feed, attaching the units it misses
+    thread_local std::vector<int> queue, unreached, mask;
+    thread_local std::vector<char> reached, tree_edge;
+    queue.clear();
+    reached.assign(n, 0);
+    tree_edge.assign(2 * n, 0);
+    size_t head = 0;
+    auto reach = [&](int u)
+    {
+        reached[u] = 1;
+        queue.push_back(u);
+        for (; head < queue.size(); ++head)
+        {
+            const int v = queue[head];
+            for (int o = 0; o < 2; ++o)
+            {
+                const int dest = vec[1 + 2 * v + o];
+                if (dest < n && !reached[dest])
+                {
+                    reached[dest] = 1;
+                    tree_edge[2 * v + o] = 1;
+                    queue.push_back(dest);
+                }
+            }
+        }
+    };
+    reach(vec[0]);
+    unreached.clear();
+    for (int u = 0; u < n; ++u)
+    {
+        if (!reached[u])
+            unreached.push_back(u);
+    }
+    while (static_cast<int>(queue.size()) < n)
+    {
+        // A random unit not reached yet; units reached since the list was made are dropped as they come up
+        const size_t i = std::uniform_int_distribution<size_t>(0, unreached.size() - 1)(random);
+        const int u = unreached[i];
+        unreached[i] = unreached.back();
+        unreached.pop_back();
+        if (reached[u])
+            continue;
+
+        // A random spare outlet of a reached unit: the tree over k units uses k - 1 of their 2k outlets,
+        // so more than half are spare
+        std::uniform_int_distribution<size_t> pick(0, 2 * queue.size() - 1);
+        int outlet;
+        do
+        {
+            const size_t r = pick(random);
+            outlet = 2 * queue[r / 2] + static_cast<int>(r % 2);
+        } while (tree_edge[outlet]);
+        vec[1 + outlet] = u; // the other outlet cannot lead to u, which was not reached
+        tree_edge[outlet] = 1;
+        reach(u);
+    }
+
+    // 3. Terminals reached by every unit, to a fixed point over the recycles
+    // (bits palusznium 1, gormanium 2, tailings 4); the terminals themselves reach their own bit
+    mask.assign(n + 3, 0);
+    mask[n] = 1;
+    mask[n + 1] = 2;
+    mask[n + 2] = 4;
+    auto update_masks = [&]()
+    {
+        for (bool changed = true; changed;)
+        {
+            changed = false;
+            for (int k = n - 1; k >= 0; --k)
+            {
+                const int u = queue[k];
+                const int m = mask[vec[1 + 2 * u]] | mask[vec[2 + 2 * u]];
+                changed |= m != mask[u];
+                mask[u] = m;
+            }
+        }
+    };
+    update_masks();
+    auto count = [](int m) { return (m & 1) + ((m >> 1) & 1) + ((m >> 2) & 1); };
+    auto is_leaf = [&](int u) { return !tree_edge[2 * u] && !tree_edge[2 * u + 1]; };
+
+    // Leaves reaching fewer than two terminals get two
+    bool changed = false;
+    for (int u = 0; u < n; ++u)
+    {
+        if (!is_leaf(u) || count(mask[u]) >= 2)
+            continue;
+        int& conc = vec[1 + 2 * u];
+        int& tail = vec[2 + 2 * u];
+        if (conc >= n || tail >= n)
+        {
+            // Keep the terminal, send the other outlet to another one
+            int& other = conc >= n ? tail : conc;
+            const int kept = conc >= n ? conc : tail;
+            other = n + (kept - n + std::uniform_int_distribution<int>(1, 2)(random)) % 3;
+        }
+        else
+        {
+            conc = n + std::uniform_int_distribution<int>(0, 2)(random);
+            tail = n + (conc - n + std::uniform_int_distribution<int>(1, 2)(random)) % 3;
+        }
+        changed = true;
+    }
+    if (changed)
+        update_masks();
+
+    // The feed reaches every unit, so its terminals are all those reached; a product always is
+    if ((mask[vec[0]] & 4) == 0)
+    {
+        unreached.clear(); // the leaves
+        for (int u = 0; u < n; ++u)
+        {
+            if (is_leaf(u))
+                unreached.push_back(u);
+        }
+        const int u = unreached[std::uniform_int_distribution<size_t>(0, unreached.size() - 1)(random)];
+        int& conc = vec[1 + 2 * u];
+        int& tail = vec[2 + 2 * u];
+        if (conc == n || conc == n + 1)
+            tail = n + 2;
+        else if (tail == n || tail == n + 1)
+            conc = n + 2;
+        else
+        {
+            conc = n + std::uniform_int_distribution<int>(0, 1)(random);
+            tail = n + 2;
+        }
+    }
+}
+
+/**
+ * @brief Sample a random structurally valid circuit vector
+ *
+ * A uniformly random feed unit and random outlets (none into its own unit,
+ * the two outlets of a unit apart), completed to pass the structural rules.
+ *
+ * @param num_units Number of units
+ * @param random Random number stream
+ * @param circuit_vector Output, 2 * num_units + 1 entries
+ */
+void sample_valid_circuit(int num_units, Philox& random, int* circuit_vector)
+{
+    const int n = num_units;
+    circuit_vector[0] = std::uniform_int_distribution<int>(0, n - 1)(random);
+    for (int u = 0; u < n; ++u)
+    {
+        circuit_vector[1 + 2 * u] = random_destination(n, u, -1, random);
+        circuit_vector[2 + 2 * u] = random_destination(n, u, circuit_vector[1 + 2 * u], random);
+    }
+    repair_circuit(n, circuit_vector, random);
+}
+
+/**
+ * @brief Vary a circuit vector and complete it to a structurally valid one
+ *
+ * @param num_units Number of units
+ * @param base Circuit vector to vary, valid or not
+ * @param changes Number of outlets given a random destination (the same outlet may be drawn twice)
+ * @param random Random number stream
+ * @param circuit_vector Output, 2 * num_units + 1 entries; may be base
+ */
+void vary_valid_circuit(int num_units, const int* base, int changes, Philox& random, int* circuit_vector)
+{
+    const int n = num_units;
+    if (base != circuit_vector)
+        std::copy(base, base + 2 * n + 1, circuit_vector);
+    for (int c = 0; c < changes; ++c)
+    {
+        const int pos = std::uniform_int_distribution<int>(1, 2 * n)(random);
+        const int unit = (pos - 1) / 2;
+        const int other = circuit_vector[pos % 2 == 1 ? pos + 1 : pos - 1];
+        circuit_vector[pos] = random_destination(n, unit, other, random);
+    }
+    repair_circuit(n, circuit_vector, random);
+}
@@ -0,0 +1,203 @@
+/**
+ * @file CCircuitScreen.cpp
+ * @brief Implementation of the CircuitScreen class
+ *
+ * Loading a batch writes one bit per circuit and outlet; every rule after
+ * that works on whole words. Reachability and the outlets each unit drains
+ * to are closures over the circuit graphs, computed by repeating the
+ * propagation along the outlets until no word changes: all 64 circuits
+ * take the same passes, and the batch is done when its slowest circuit is.
+ */
+#include "CCircuitScreen.h"
+
+#include <algorithm>
+
+/**
+ * @brief Constructor for the CircuitScreen class
+ *
+ * @param num_units Number of units in every circuit screened
+ */
+CircuitScreen::CircuitScreen(int num_units)
+    : n(num_units), dest(num_units + 3), conc_to(static_cast<size_t>(num_units) * dest), tails_to(conc_to.size()),
+      feed_at(num_units), reached(num_units), drains_to(3 * static_cast<size_t>(num_units))
+{
+}
+
+/**
+ * @brief Check the structure of up to 64 circuit vectors
+ *
+ * @param count Number of circuit vectors, at most LANES
+ * @param vector_size Size of every circuit vector
+ * @param circuit_vectors count circuit vectors of vector_size entries, one after another
+ *
+ * @return Mask of the circuits that pass all rules (bit k for vector k)
+ */
+uint64_t CircuitScreen::screen(int count, int vector_size, const int* circuit_vectors)
+{
+    count = std::min(count, LANES);
+    if (count <= 0 || n <= 0 || vector_size != 2 * n + 1) // 1. length must be 2*n+1
+        return 0;
+    const uint64_t lanes = (count == LANES) ? ~uint64_t(0) : (uint64_t(1) << count) - 1;
+
+    // 2., 3. feed and index checks
+    uint64_t rejected = load(count, circuit_vectors);
+
+    for (int u = 0; u < n; ++u)
+    {
+        uint64_t* conc = &conc_to[static_cast<size_t>(u) * dest];
+        uint64_t* tails = &tails_to[static_cast<size_t>(u) * dest];
+
+        // 4. no self-loop
+        rejected |= conc[u] | tails[u];
+
+        // 5. same output: both outlets in the same destination
+        for (int d = 0; d < dest; ++d)
+        {
+            rejected |= conc[d] & tails[d];
+            conc[d] |= tails[d]; // from here on conc_to holds both outlets
+        }
+    }
+
+    if ((lanes & ~rejected) == 0)
+        return 0;
+
+    // 6. reachability check: all units must be reachable from feed
+    propagate_reached();
+    for (int u = 0; u < n; ++u)
+        rejected |= ~reached[u];
+
+    // 7. two terminals check: each unit must reach at least 2 different terminals
+    propagate_drains();
+    uint64_t palusznium = 0, gormanium = 0, tailings = 0;
+    for (int u = 0; u < n; ++u)
+    {
+        const uint64_t p = drains_to[3 * u], g = drains_to[3 * u + 1], t = drains_to[3 * u + 2];
+        rejected |= ~((p & g) | (p & t) | (g & t));
+        palusznium |= p;
+        gormanium |= g;
+        tailings |= t;
+    }
+
+    // 8. final terminal check: P1/P2, TA must be present
+    rejected |= ~((palusznium | gormanium) & tailings);
+
+    return lanes & ~rejected;
+}
+
+/**
+ * @brief Bit-slice a batch of circuit vectors
+ *
+ * Entries of circuits that fail the feed or index rule are left out; those
+ * circuits are rejected anyway.
+ *
+ * @param count Number of circuit vectors
+ * @param circuit_vectors count circuit vectors of 2 * n + 1 entries, one after another
+ *
+ * @return Mask of the circuits failing the feed or index rule
+ */
+uint64_t CircuitScreen::load(int count, const int* circuit_vectors)
+{
+    std::fill(conc_to.begin(), conc_to.end(), 0);
+    std::fill(tails_to.begin(), tails_to.end(), 0);
+    std::fill(feed_at.begin(), feed_at.end(), 0);
+
+    uint64_t rejected = 0;
+    const int vector_size = 2 * n + 1;
+    for (int k = 0; k < count; ++k)
+    {
+        const int* vec = circuit_vectors + static_cast<size_t>(k) * vector_size;
+        const uint64_t bit = uint64_t(1) << k;
+        bool in_range = vec[0] >= 0 && vec[0] < n;
+        for (int e = 1; e < vector_size; ++e)
+            in_range = in_range && vec[e] >= 0 && vec[e] < dest;
+        if (!in_range)
+        {
+            rejected |= bit;
+            continue;
+        }
+
+        feed_at[vec[0]] |= bit;
+        for (int u = 0; u < n; ++u)
+        {
+            conc_to[static_cast<size_t>(u) * dest + vec[1 + 2 * u]] |= bit;
+            tails_to[static_cast<size_t>(u) * dest + vec[2 + 2 * u]] |= bit;
+        }
+    }
+    return rejected;
+}
+
+/**
+ * @brief Find the units the feed reaches in every circuit
+ *
+ * Starts from the feed units and passes the reached circuits of each unit
+ * on to its destinations, in unit order, until a pass adds nothing. Flow
+ * into the feed unit does not matter here, the feed unit is reached anyway.
+ */
+void CircuitScreen::propagate_reached()
+{
+    std::copy(feed_at.begin(), feed_at.end(), reached.begin());
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (int u = 0; u < n; ++u)
+        {
+            const uint64_t from = reached[u];
+            if (from == 0)
+                continue;
+            const uint64_t* to = &conc_to[static_cast<size_t>(u) * dest];
+            for (int d = 0; d < n; ++d)
+            {
+                const uint64_t add = from & to[d] & ~reached[d];
+                if (add != 0)
+                {
+                    reached[d] |= add;
+                    changed = true;
+                }
+            }
+        }
+    }
+}
+
+/**
+ * @brief Find the circuit outlets every unit drains to in every circuit
+ *
+ * Each unit starts with the outlets it discharges into directly and
+ * collects those of the units it discharges into, in reverse unit order,
+ * until a pass adds nothing. Unlike the topology's component passes this
+ * needs no special case for the feed unit: every edge is followed.
+ */
+void CircuitScreen::propagate_drains()
+{
+    for (int u = 0; u < n; ++u)
+    {
+        for (int o = 0; o < 3; ++o)
+            drains_to[3 * u + o] = conc_to[static_cast<size_t>(u) * dest + n + o];
+    }
+
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (int u = n - 1; u >= 0; --u)
+        {
+            const uint64_t* to = &conc_to[static_cast<size_t>(u) * dest];
+            uint64_t drains[3] = {drains_to[3 * u], drains_to[3 * u + 1], drains_to[3 * u + 2]};
+            for (int d = 0; d < n; ++d)
+            {
+                if (to[d] == 0)
+                    continue;
+                for (int o = 0; o < 3; ++o)
+                    drains[o] |= to[d] & drains_to[3 * d + o];
+            }
+            for (int o = 0; o < 3; ++o)
+            {
+                if (drains[o] != drains_to[3 * u + o])
+                {
+                    drains_to[3 * u + o] = drains[o];
+                    changed = true;
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,308 @@
+/**
+ * @file CCircuitTopology.cpp
+ * @brief Implementation of the CircuitTopology class
+ *
+ * compile() turns a circuit vector into the edge lists, recycle loops and
+ * routing indices of CircuitTopology, and the reachability the validity
+ * rules are checked on. All arrays are reused from one compile
+ * to the next, so a topology that is recompiled for circuits of the same
+ * size does not allocate.
+ */
+#include "CCircuitTopology.h"
+
+#include <algorithm>
+
+/**
+ * @brief Compile a circuit vector
+ *
+ * Destinations outside 0..n+2 discharge to the discard node. Flow into the
+ * feed unit is kept in the edge lists (validity checks follow it), but left
+ * out of the recycle loops and routing indices, since the mass balance
+ * fixes the feed unit's feed to the external feed.
+ *
+ * @param vector_size Size of the circuit vector
+ * @param vec Circuit vector
+ *
+ * @return false if the vector size is not 2n + 1 or the feed unit is out of range
+ */
+bool CircuitTopology::compile(int vector_size, const int* vec)
+{
+    const int n = (vector_size - 1) / 2;
+    if (vector_size != 2 * n + 1 || n <= 0 || vec[0] < 0 || vec[0] >= n)
+        return false;
+
+    num_units = n;
+    feed_unit = vec[0];
+    circuit_vector.assign(vec, vec + vector_size);
+
+    outlet_node.resize(2 * n);
+    for (int e = 0; e < 2 * n; ++e)
+    {
+        const int dest = vec[1 + e];
+        outlet_node[e] = (dest >= 0 && dest <= tailings_node()) ? dest : discard_node();
+    }
+
+    // Unit successors
+    succ_start.resize(n + 1);
+    succ_unit.clear();
+    for (int u = 0; u < n; ++u)
+    {
+        succ_start[u] = static_cast<int>(succ_unit.size());
+        for (int e = 2 * u; e < 2 * u + 2; ++e)
+        {
+            if (outlet_node[e] < n)
+                succ_unit.push_back(outlet_node[e]);
+        }
+    }
+    succ_start[n] = static_cast<int>(succ_unit.size());
+
+    // In-edges by counting sort, outlets in increasing order within each node
+    const int num_nodes = n + 4;
+    in_start.assign(num_nodes + 1, 0);
+    for (int e = 0; e < 2 * n; ++e)
+        ++in_start[outlet_node[e] + 1];
+    for (int v = 0; v < num_nodes; ++v)
+        in_start[v + 1] += in_start[v];
+    in_outlet.resize(2 * n);
+    queue.assign(in_start.begin(), in_start.end() - 1); // next free position of every node
+    for (int e = 0; e < 2 * n; ++e)
+        in_outlet[queue[outlet_node[e]]++] = e;
+
+    build_components();
+
+    // Routing indices, in slot order and concentrate before tailings
+    const int num_components = static_cast<int>(component_start.size()) - 1;
+    outlet_loop_slot.assign(2 * n, -1);
+    loop_start.assign(1, 0);
+    loop_outlet.clear();
+    loop_source.clear();
+    loop_dest.clear();
+    handover_start.assign(1, 0);
+    handover_outlet.clear();
+    handover_unit.clear();
+    for (int comp = 0; comp < num_components; ++comp)
+    {
+        const int begin = component_start[comp];
+        for (int s = begin; s < component_start[comp + 1]; ++s)
+        {
+            const int u = component_units[s];
+            for (int e = 2 * u; e < 2 * u + 2; ++e)
+            {
+                const int dest = outlet_node[e];
+                if (dest >= n || dest == feed_unit)
+                    continue;
+                if (unit_component[dest] == comp)
+                {
+                    outlet_loop_slot[e] = unit_slot[dest];
+                    loop_outlet.push_back(e);
+                    loop_source.push_back(s - begin);
+                    loop_dest.push_back(unit_slot[dest]);
+                }
+                else
+                {
+                    handover_outlet.push_back(e);
+                    handover_unit.push_back(dest);
+                }
+            }
+        }
+        loop_start.push_back(static_cast<int>(loop_outlet.size()));
+        handover_start.push_back(static_cast<int>(handover_outlet.size()));
+    }
+
+    build_reachability();
+    return true;
+}
+
+/**
+ * @brief Build the strongly connected components of the circuit graph
+ *
+ * Tarjan's algorithm on the unit graph, without the edges into the feed
+ * unit. The components are stored in topological order, so every unit only
+ * receives flow from its own component or from earlier ones. Within a
+ * component the units are sorted by breadth-first distance from the feed.
+ */
+void CircuitTopology::build_components()
+{
+    const int n = num_units;
+    auto successor = [&](int unit, int edge)
+    {
+        const int dest = outlet_node[2 * unit + edge];
+        return (dest < n && dest != feed_unit) ? dest : -1;
+    };
+
+    index.assign(n, -1);
+    low.assign(n, 0);
+    on_stack.assign(n, false);
+    stack.clear();
+    frames.clear(); // (unit, next outgoing edge)
+    order.clear();  // units, components sinks first
+    ends.clear();   // end of each component in order
+    int counter = 0;
+
+    for (int root = 0; root < n; ++root)
+    {
+        if (index[root] >= 0)
+            continue;
+        index[root] = low[root] = counter++;
+        stack.push_back(root);
+        on_stack[root] = true;
+        frames.push_back({root, 0});
+
+        while (!frames.empty())
+        {
+            const int v = frames.back().first;
+            const int edge = frames.back().second;
+            if (edge < 2)
+            {
+                ++frames.back().second;
+                const int w = successor(v, edge);
+                if (w < 0)
+                    continue;
+                if (index[w] < 0)
+                {
+                    index[w] = low[w] = counter++;
+                    stack.push_back(w);
+                    on_stack[w] = true;
+                    frames.push_back({w, 0});
+                }
+                else if (on_stack[w])
+                {
+                    low[v] = std::min(low[v], index[w]);
+                }
+                continue;
+            }
+
+            // All edges of v explored: v closes a component if it is its root
+            if (low[v] == index[v])
+            {
+                int w;
+                do
+                {
+                    w = stack.back();
+                    stack.pop_back();
+                    on_stack[w] = false;
+                    order.push_back(w);
+                } while (w != v);
+                ends.push_back(static_cast<int>(order.size()));
+            }
+            frames.pop_back();
+            if (!frames.empty())
+                low[frames.back().first] = std::min(low[frames.back().first], low[v]);
+        }
+    }
+
+    // Breadth-first rank from the feed; Gauss-Seidel sweeps follow it
+    rank.assign(n, n);
+    queue.clear();
+    rank[feed_unit] = 0;
+    queue.push_back(feed_unit);
+    for (size_t head = 0; head < queue.size(); ++head)
+    {
+        for (int edge = 0; edge < 2; ++edge)
+        {
+            const int w = successor(queue[head], edge);
+            if (w >= 0 && rank[w] == n)
+            {
+                rank[w] = static_cast<int>(queue.size());
+                queue.push_back(w);
+            }
+        }
+    }
+
+    // Tarjan finds the components in reverse topological order
+    const int num_components = static_cast<int>(ends.size());
+    component_units.clear();
+    component_start.assign(1, 0);
+    component_cyclic.assign(num_components, false);
+    unit_component.assign(n, 0);
+    unit_slot.assign(n, 0);
+    for (int comp = 0; comp < num_components; ++comp)
+    {
+        const int c = num_components - 1 - comp;
+        const int first = (c == 0) ? 0 : ends[c - 1];
+        const int u = order[first];
+        component_cyclic[comp] = (ends[c] - first > 1) || successor(u, 0) == u || successor(u, 1) == u;
+
+        const int start = component_start.back();
+        component_units.insert(component_units.end(), order.begin() + first, order.begin() + ends[c]);
+        std::sort(component_units.begin() + start, component_units.end(),
+                  [&](int a, int b) { return rank[a] < rank[b]; });
+        for (int k = start; k < static_cast<int>(component_units.size()); ++k)
+        {
+            unit_component[component_units[k]] = comp;
+            unit_slot[component_units[k]] = k - start;
+        }
+        component_start.push_back(static_cast<int>(component_units.size()));
+    }
+}
+
+/**
+ * @brief Work out which units the feed reaches and which outlets every unit drains to
+ *
+ * Both are single passes over the components instead of a search from every
+ * unit: all units of a component reach the same units and outlets, and the
+ * components are in topological order. Reachability is pushed forward from
+ * the feed unit's component; the outlet masks are collected backwards, from
+ * the last component to the first.
+ *
+ * The components leave out the edges into the feed unit, so the backward
+ * pass only records that a unit reaches the feed unit (bit 3). The feed
+ * unit's own mask is exact without those edges (a path from the feed unit
+ * that returns to it can be cut short), and a second pass adds it to every
+ * unit that reaches the feed unit.
+ */
+void CircuitTopology::build_reachability()
+{
+    const int n = num_units;
+    const int num_components = static_cast<int>(component_start.size()) - 1;
+    constexpr uint8_t REACHES_FEED = 0b1000;
+
+    unit_reachable.assign(n, false);
+    unit_reachable[feed_unit] = true;
+    reachable_units = 0;
+    for (int comp = 0; comp < num_components; ++comp)
+    {
+        const int begin = component_start[comp];
+        const int end = component_start[comp + 1];
+        if (std::none_of(component_units.begin() + begin, component_units.begin() + end,
+                         [&](int u) { return unit_reachable[u]; }))
+            continue;
+        reachable_units += end - begin;
+        for (int s = begin; s < end; ++s)
+        {
+            const int u = component_units[s];
+            unit_reachable[u] = true;
+            for (int k = succ_start[u]; k < succ_start[u + 1]; ++k)
+                unit_reachable[succ_unit[k]] = true;
+        }
+    }
+
+    unit_outlets.assign(n, 0);
+    for (int comp = num_components - 1; comp >= 0; --comp)
+    {
+        const int begin = component_start[comp];
+        const int end = component_start[comp + 1];
+        uint8_t mask = 0;
+        for (int s = begin; s < end; ++s)
+        {
+            const int u = component_units[s];
+            for (int e = 2 * u; e < 2 * u + 2; ++e)
+            {
+                const int dest = outlet_node[e];
+                if (dest < n)
+                    mask |= (dest == feed_unit) ? REACHES_FEED : unit_outlets[dest]; // own component still 0
+                else if (dest < discard_node())
+                    mask |= static_cast<uint8_t>(1u << (dest - n));
+            }
+        }
+        for (int s = begin; s < end; ++s)
+            unit_outlets[component_units[s]] = mask;
+    }
+
+    const uint8_t feed_outlets = unit_outlets[feed_unit] & ~REACHES_FEED;
+    for (int u = 0; u < n; ++u)
+    {
+        if (unit_outlets[u] & REACHES_FEED)
+            unit_outlets[u] = (unit_outlets[u] | feed_outlets) & ~REACHES_FEED;
+    }
+}
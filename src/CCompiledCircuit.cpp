@@ -0,0 +1,248 @@
+/**
+ * @file CCompiledCircuit.cpp
+ * @brief Implementation of the CompiledCircuit class
+ *
+ * Single evaluations reuse a Circuit per thread that shares the compiled
+ * topology, so they neither compile nor allocate. Batches of volume sets go
+ * through CircuitBatch with the one circuit vector in every lane.
+ */
+#include "CCompiledCircuit.h"
+#include "CCircuit.h"
+#include "CCircuitBatch.h"
+
+#include <algorithm>
+#include <cmath>
+
+/**
+ * @brief Constructor for the CompiledCircuit class
+ *
+ * @param vector_size Size of the circuit vector
+ * @param circuit_vector Circuit vector
+ * @param simulator_parameters Simulation parameters of every evaluation
+ */
+CompiledCircuit::CompiledCircuit(int vector_size, const int* circuit_vector,
+                                 Simulator_Parameters simulator_parameters)
+    : simulator_parameters(simulator_parameters)
+{
+    compile(vector_size, circuit_vector);
+}
+
+/**
+ * @brief Compile a circuit vector
+ *
+ * Compiles the topology and checks the structural rules of
+ * Circuit::check_validity. Whether the mass balance converges depends on
+ * the volumes, so it is left to each evaluation (see evaluate_circuit).
+ *
+ * @param vector_size Size of the circuit vector
+ * @param vec Circuit vector
+ */
+void CompiledCircuit::compile(int vector_size, const int* vec)
+{
+    if (matches(vector_size, vec))
+        return;
+
+    circuit_vector.assign(vec, vec + std::max(vector_size, 0));
+    compiled = topology.compile(vector_size, vec);
+    const int num_units = (vector_size - 1) / 2;
+    structure = (vector_size == 2 * num_units + 1 && num_units > 0) ? ValidityReason::Feed : ValidityReason::Length;
+    if (compiled)
+    {
+        thread_local Circuit checker(0);
+        checker.reset(topology, nullptr);
+        structure = checker.check_structure(vector_size, vec);
+    }
+}
+
+/**
+ * @brief Check whether a circuit vector is the compiled one
+ *
+ * @param vector_size Size of the circuit vector
+ * @param vec Circuit vector
+ *
+ * @return true if the vector equals the compiled vector
+ */
+bool CompiledCircuit::matches(int vector_size, const int* vec) const
+{
+    return vector_size == static_cast<int>(circuit_vector.size()) &&
+           std::equal(vec, vec + vector_size, circuit_vector.begin());
+}
+
+/**
+ * @brief Get the number of units
+ *
+ * @return Number of units of the compiled circuit, 0 if the vector is malformed
+ */
+int CompiledCircuit::get_num_units() const
+{
+    return compiled ? topology.num_units : 0;
+}
+
+/**
+ * @brief Get the structural validity of the circuit vector
+ *
+ * @return true if the circuit vector passed rules 1 to 8 of Circuit::check_validity
+ */
+bool CompiledCircuit::is_valid() const
+{
+    return structure == ValidityReason::Valid;
+}
+
+/**
+ * @brief Check the validity of the circuit with given volume parameters
+ *
+ * Same result as Circuit::check_validity with unit parameters, without
+ * rechecking the circuit vector, and without the convergence rule.
+ *
+ * @param beta_size Number of volume parameters
+ * @param beta Volume parameters, or nullptr for the default volumes
+ *
+ * @return true if the circuit is valid and every parameter lies in [0, 1]
+ */
+bool CompiledCircuit::check_validity(int beta_size, const double* beta) const
+{
+    if (!is_valid())
+        return false;
+    if (beta == nullptr)
+        return true;
+    if (beta_size != topology.num_units)
+        return false;
+    for (int i = 0; i < beta_size; ++i)
+    {
+        if (beta[i] < 0.0 || beta[i] > 1.0 || std::isnan(beta[i]))
+            return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Evaluate the economic value for one set of volumes
+ *
+ * @param beta Volume parameters, or nullptr for the default volumes
+ *
+ * @return Economic value of the circuit, -1e12 if the vector is malformed or
+ *         the mass balance does not converge
+ */
+double CompiledCircuit::evaluate(const double* beta) const
+{
+    return solve(beta, nullptr).fitness;
+}
+
+/**
+ * @brief Evaluate the economic value, warm-started from a flow state
+ *
+ * See circuit_performance with a flow state: the recycle loops start from
+ * the unit feeds in flow_state, which is replaced by the converged feeds if
+ * the mass balance converges.
+ *
+ * @param beta Volume parameters, or nullptr for the default volumes
+ * @param flow_state Unit feeds (3 per unit), empty for a cold start
+ *
+ * @return Economic value of the circuit, -1e12 if the vector is malformed or
+ *         the mass balance does not converge
+ */
+double CompiledCircuit::evaluate(const double* beta, std::vector<double>& flow_state) const
+{
+    return solve(beta, &flow_state).fitness;
+}
+
+/**
+ * @brief Check and evaluate the circuit for one set of volumes
+ *
+ * Same result as the free evaluate_circuit for the compiled vector: the
+ * structural rules were checked when compiling, so only the volume
+ * parameters are checked before the single, warm-started mass balance.
+ *
+ * @param beta_size Number of volume parameters
+ * @param beta Volume parameters, or nullptr for the default volumes
+ * @param flow_state Unit feeds (3 per unit), replaced by the converged ones if valid; empty for a cold start
+ *
+ * @return Validity, reason, economic value and iteration count
+ */
+Circuit_Evaluation CompiledCircuit::evaluate_circuit(int beta_size, const double* beta,
+                                                     std::vector<double>& flow_state) const
+{
+    if (!is_valid())
+    {
+        Circuit_Evaluation result;
+        result.reason = structure;
+        return result;
+    }
+    if (!check_validity(beta_size, beta))
+    {
+        Circuit_Evaluation result;
+        result.reason = ValidityReason::UnitParameters;
+        return result;
+    }
+    return solve(beta, &flow_state);
+}
+
+/**
+ * @brief Solve the mass balance for one set of volumes
+ *
+ * @param beta Volume parameters, or nullptr for the default volumes
+ * @param flow_state Initial unit feeds, replaced by the converged ones; nullptr for a cold start
+ *
+ * @return Economic value and iteration count; not valid (fitness -1e12) if
+ *         the vector is malformed or the mass balance does not converge
+ */
+Circuit_Evaluation CompiledCircuit::solve(const double* beta, std::vector<double>* flow_state) const
+{
+    Circuit_Evaluation result;
+    result.reason = structure;
+    if (!compiled)
+        return result;
+
+    // Every thread reuses one circuit, pointed at this topology
+    thread_local Circuit circuit(0);
+    circuit.reset(topology, beta);
+    circuit.set_solver(simulator_parameters.solver, simulator_parameters.anderson_depth);
+    const double tolerance = simulator_parameters.tolerance;
+    const int max_iterations = simulator_parameters.max_iterations;
+    const bool converged = flow_state ? circuit.run_mass_balance(*flow_state, tolerance, max_iterations)
+                                      : circuit.run_mass_balance(tolerance, max_iterations);
+    result.iterations = circuit.get_iterations();
+    if (!converged)
+    {
+        result.reason = ValidityReason::NotConverged; // Not converged, consider invalid
+        return result;
+    }
+    if (flow_state)
+        circuit.get_flow_state(*flow_state);
+    result.valid = result.reason == ValidityReason::Valid;
+    result.fitness = circuit.get_economic_value();
+    return result;
+}
+
+/**
+ * @brief Evaluate the economic value for many sets of volumes
+ *
+ * The volume sets are split into chunks shared among the OpenMP threads;
+ * each thread solves its chunks in lockstep with a CircuitBatch.
+ *
+ * @param count Number of volume sets
+ * @param betas count sets of get_num_units() volume parameters, one after another
+ * @param performances Output, economic value for each set
+ */
+void CompiledCircuit::evaluate_batch(int count, const double* betas, double* performances) const
+{
+    if (!compiled)
+    {
+        std::fill(performances, performances + count, -1e12);
+        return;
+    }
+
+    const int num_units = topology.num_units;
+    const int chunk = 1024;
+#pragma omp parallel
+    {
+        CircuitBatch batch(num_units);
+#pragma omp for schedule(dynamic)
+        for (int first = 0; first < count; first += chunk)
+        {
+            batch.evaluate(std::min(chunk, count - first), circuit_vector.data(),
+                           betas + static_cast<size_t>(first) * num_units, simulator_parameters, performances + first,
+                           true);
+        }
+    }
+}
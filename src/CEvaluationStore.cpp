@@ -0,0 +1,466 @@
+/**
+ * @file CEvaluationStore.cpp
+ * @brief Implementation of the EvaluationStore class
+ *
+ * A store file starts with a header recording what it was made for, followed
+ * by capacity slots of slot_bytes each:
+ *
+ *   tag (8 bytes) | stamp (8) | fitness (8) | valid, reason, iterations, flags (4 each) |
+ *   unit parameter hash (8) | unit feeds (8 per unit and component) |
+ *   circuit vector (4 per entry, padded to 8)
+ *
+ * The circuit vector, the unit parameters and the unit feeds are all in the
+ * canonical order of the units.
+ *
+ * A new file is created with ftruncate, so every tag starts out EMPTY. The
+ * header is written and checked under an exclusive flock, which is released
+ * once the file is mapped, after the header's run count has been raised;
+ * the slots themselves are only ever accessed through the atomic tags.
+ */
+#include "CEvaluationStore.h"
+
+#include <cstring>
+#include <sstream>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifndef CONSTANTS_H_SHA256
+#error "CONSTANTS_H_SHA256 (the SHA-256 of include/constants.h) is defined by src/CMakeLists.txt"
+#endif
+
+namespace
+{
+const uint64_t EMPTY = 0;   // tag of a slot never written
+const uint64_t CLAIMED = 1; // tag of a slot being written
+
+const char MAGIC[8] = {'C', 'I', 'R', 'C', 'E', 'V', 'A', 'L'};
+
+struct Store_Header
+{
+    char magic[8];
+    uint32_t version;
+    int32_t num_units;
+    uint64_t fingerprint;
+    uint64_t capacity;
+    uint64_t slot_bytes;
+    uint64_t runs; // openings of the file so far
+    char unused[16];
+};
+static_assert(sizeof(Store_Header) == 64, "the slots start on a cache line");
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "tags are shared between processes");
+
+const size_t STAMP_OFFSET = 8;
+const size_t FITNESS_OFFSET = 16;
+const size_t STATUS_OFFSET = 24;
+const size_t PARAMETERS_OFFSET = 40;
+const size_t FLOWS_OFFSET = 48;
+
+const int32_t HAS_FLOWS = 1; // flag: the converged unit feeds are stored
+
+// FNV-1a over a number of bytes, continuing from h
+uint64_t mix(uint64_t h, const void* data, size_t bytes)
+{
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < bytes; ++i)
+    {
+        h ^= p[i];
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+template <typename T> uint64_t mix(uint64_t h, T value)
+{
+    return mix(h, &value, sizeof(value));
+}
+} // namespace
+
+/**
+ * @brief Constructor for the EvaluationStore class
+ *
+ * The file is named after the number of units and the fingerprint, so a
+ * store opened with different simulator parameters or constants uses a
+ * different file. An existing file keeps the capacity it was created with.
+ *
+ * @param directory Directory of the store files, created if missing
+ * @param num_units Number of units of the circuits stored
+ * @param simulator_parameters Simulation parameters the circuits are evaluated with
+ * @param capacity Number of slots if the file is created
+ */
+EvaluationStore::EvaluationStore(const std::string& directory, int num_units,
+                                 const Simulator_Parameters& simulator_parameters, size_t capacity)
+    : vector_size(2 * num_units + 1), vector_offset(FLOWS_OFFSET + 24 * static_cast<size_t>(num_units)),
+      slot_bytes(vector_offset + (4 * (2 * num_units + 1) + 7) / 8 * 8), capacity(capacity)
+{
+    const uint64_t print = fingerprint(num_units, simulator_parameters);
+    std::ostringstream name;
+    name << directory << "/evaluations_n" << num_units << "_" << std::hex << print << ".bin";
+    path = name.str();
+    if (num_units > 0 && capacity > 0)
+        open_file(print);
+}
+
+/**
+ * @brief Destructor for the EvaluationStore class
+ *
+ * Unmaps the file; the entries stay on disk for the next run.
+ */
+EvaluationStore::~EvaluationStore()
+{
+#if !defined(_WIN32)
+    if (mapping != nullptr)
+        munmap(mapping, mapping_bytes);
+#endif
+}
+
+/**
+ * @brief Look up the evaluation of a circuit
+ *
+ * Only a cold start (an empty flow_state) is served; a lookup with carried
+ * flows misses, as the evaluation would depend on them. The entry is
+ * copied before its tag is checked again, so an entry replaced while it
+ * is read is not used. A hit stamps the entry with the current run. On a
+ * hit of a valid evaluation flow_state gets the stored unit feeds, as the
+ * evaluation itself would have left it.
+ *
+ * @param circuit_vector Circuit vector, 2 * num_units + 1 entries
+ * @param unit_parameters num_units unit parameters, or nullptr for the default volumes
+ * @param evaluation Output, the stored evaluation if found
+ * @param flow_state Unit feeds the evaluation would start from, replaced on a valid hit
+ *
+ * @return true if the circuit is in the store
+ */
+bool EvaluationStore::find(const int* circuit_vector, const double* unit_parameters, Circuit_Evaluation& evaluation,
+                           std::vector<double>& flow_state)
+{
+    if (slots == nullptr)
+        return false;
+    if (!flow_state.empty())
+    {
+        ++miss_count;
+        return false;
+    }
+    thread_local Circuit_Labelling labelling;
+    const uint64_t parameters_hash = label(circuit_vector, unit_parameters, labelling);
+    const int* key = labelling.circuit_vector.data();
+    const uint64_t h = hash(key, parameters_hash);
+
+    for (int probe = 0; probe < MAX_PROBES; ++probe)
+    {
+        const size_t slot = (h + probe) % capacity;
+        const uint64_t t = tag(slot).load(std::memory_order_acquire);
+        if (t == EMPTY)
+            break;
+        const unsigned char* s = slots + slot * slot_bytes;
+        if (t != h || std::memcmp(s + PARAMETERS_OFFSET, &parameters_hash, 8) != 0 ||
+            std::memcmp(s + vector_offset, key, sizeof(int) * vector_size) != 0)
+            continue;
+
+        int32_t status[4];
+        double fitness;
+        thread_local std::vector<double> flows;
+        std::memcpy(status, s + STATUS_OFFSET, sizeof(status));
+        std::memcpy(&fitness, s + FITNESS_OFFSET, sizeof(double));
+        const bool has_flows = status[3] & HAS_FLOWS;
+        flows.resize(3 * static_cast<size_t>(vector_size / 2));
+        if (has_flows)
+            std::memcpy(flows.data(), s + FLOWS_OFFSET, sizeof(double) * flows.size());
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (tag(slot).load(std::memory_order_relaxed) != t)
+            continue; // replaced while it was read
+
+        evaluation.valid = status[0] != 0;
+        evaluation.reason = static_cast<ValidityReason>(status[1]);
+        evaluation.fitness = fitness;
+        evaluation.iterations = status[2];
+        if (has_flows)
+        {
+            flow_state.resize(flows.size());
+            from_canonical_order(labelling, flows.data(), 3, flow_state.data());
+        }
+        if (stamp(slot).load(std::memory_order_relaxed) < run)
+            stamp(slot).store(run, std::memory_order_relaxed);
+        ++hit_count;
+        return true;
+    }
+    ++miss_count;
+    return false;
+}
+
+/**
+ * @brief Remember the evaluation of a circuit
+ *
+ * Only an evaluation started cold is stored. It claims the first empty
+ * slot of the key's probe sequence, unless the key is found on the way
+ * (another process stored it first), which only stamps that entry. If the
+ * probe sequence is full, the entry with the oldest stamp is replaced.
+ *
+ * @param circuit_vector Circuit vector, 2 * num_units + 1 entries
+ * @param unit_parameters num_units unit parameters, or nullptr for the default volumes
+ * @param evaluation Evaluation of the circuit
+ * @param cold_start The mass balance of the evaluation started cold
+ * @param flow_state Unit feeds after the evaluation, stored if the evaluation is valid
+ */
+void EvaluationStore::insert(const int* circuit_vector, const double* unit_parameters,
+                             const Circuit_Evaluation& evaluation, bool cold_start,
+                             const std::vector<double>& flow_state)
+{
+    if (slots == nullptr || !cold_start)
+        return;
+    thread_local Circuit_Labelling labelling;
+    const uint64_t parameters_hash = label(circuit_vector, unit_parameters, labelling);
+    const int* key = labelling.circuit_vector.data();
+    const uint64_t h = hash(key, parameters_hash);
+    const bool has_flows = evaluation.valid && flow_state.size() == 3 * static_cast<size_t>(vector_size / 2);
+
+    // Fill in a slot claimed by this thread and publish it
+    auto write = [&](size_t slot)
+    {
+        unsigned char* s = slots + slot * slot_bytes;
+        std::atomic_thread_fence(std::memory_order_release); // readers see the claim before the new contents
+        stamp(slot).store(run, std::memory_order_relaxed);
+        const int32_t status[4] = {evaluation.valid ? 1 : 0, static_cast<int32_t>(evaluation.reason),
+                                   evaluation.iterations, has_flows ? HAS_FLOWS : 0};
+        std::memcpy(s + FITNESS_OFFSET, &evaluation.fitness, sizeof(double));
+        std::memcpy(s + STATUS_OFFSET, status, sizeof(status));
+        std::memcpy(s + PARAMETERS_OFFSET, &parameters_hash, 8);
+        if (has_flows)
+        {
+            thread_local std::vector<double> flows;
+            flows.resize(flow_state.size());
+            to_canonical_order(labelling, flow_state.data(), 3, flows.data());
+            std::memcpy(s + FLOWS_OFFSET, flows.data(), sizeof(double) * flows.size());
+        }
+        std::memcpy(s + vector_offset, key, sizeof(int) * vector_size);
+        tag(slot).store(h, std::memory_order_release);
+    };
+
+    size_t oldest = capacity; // slot of the entry with the oldest stamp
+    uint64_t oldest_tag = EMPTY, oldest_stamp = ~uint64_t(0);
+    for (int probe = 0; probe < MAX_PROBES; ++probe)
+    {
+        const size_t slot = (h + probe) % capacity;
+        const unsigned char* s = slots + slot * slot_bytes;
+        uint64_t t = EMPTY;
+        if (tag(slot).compare_exchange_strong(t, CLAIMED, std::memory_order_acquire))
+        {
+            write(slot);
+            return;
+        }
+        // t now holds the slot's tag
+        if (t == CLAIMED)
+            continue;
+        if (t == h && std::memcmp(s + PARAMETERS_OFFSET, &parameters_hash, 8) == 0 &&
+            std::memcmp(s + vector_offset, key, sizeof(int) * vector_size) == 0)
+        {
+            if (stamp(slot).load(std::memory_order_relaxed) < run)
+                stamp(slot).store(run, std::memory_order_relaxed);
+            return;
+        }
+        const uint64_t age = stamp(slot).load(std::memory_order_relaxed);
+        if (age < oldest_stamp)
+        {
+            oldest = slot;
+            oldest_tag = t;
+            oldest_stamp = age;
+        }
+    }
+    // The probe sequence is full; another writer may replace the same entry first, and then this one is dropped
+    if (oldest < capacity && tag(oldest).compare_exchange_strong(oldest_tag, CLAIMED, std::memory_order_acquire))
+        write(oldest);
+}
+
+/**
+ * @brief Fingerprint the inputs of an evaluation other than the circuit
+ *
+ * Covers the store format, the number of units, every numerical simulator
+ * parameter and the contents of constants.h, through the SHA-256 of the
+ * header that the build computes when it is configured (so a constant
+ * added there is covered without a change here). The visualization
+ * options do not change an evaluation.
+ *
+ * @param num_units Number of units
+ * @param simulator_parameters Simulation parameters
+ *
+ * @return 64-bit fingerprint
+ */
+uint64_t EvaluationStore::fingerprint(int num_units, const Simulator_Parameters& simulator_parameters)
+{
+    const Simulator_Parameters& p = simulator_parameters;
+    uint64_t h = 14695981039346656037ull;
+    h = mix(h, FORMAT_VERSION);
+    h = mix(h, num_units);
+
+    h = mix(h, p.tolerance);
+    h = mix(h, p.max_iterations);
+    h = mix(h, static_cast<int>(p.solver));
+    h = mix(h, p.anderson_depth);
+    const double parameters[] = {p.material_density,
+                                 p.solids_content,
+                                 p.k_palusznium_high,
+                                 p.k_palusznium_inter,
+                                 p.k_gormanium_high,
+                                 p.k_gormanium_inter,
+                                 p.k_waste_high,
+                                 p.k_waste_inter,
+                                 p.feed_palusznium,
+                                 p.feed_gormanium,
+                                 p.feed_waste,
+                                 p.palusznium_value_in_palusznium_stream,
+                                 p.gormanium_value_in_palusznium_stream,
+                                 p.waste_penalty_in_palusznium_stream,
+                                 p.palusznium_value_in_gormanium_stream,
+                                 p.gormanium_value_in_gormanium_stream,
+                                 p.waste_penalty_in_gormanium_stream,
+                                 p.fixed_unit_volume,
+                                 p.min_unit_volume,
+                                 p.max_unit_volume,
+                                 p.max_circuit_volume,
+                                 p.cost_coefficient,
+                                 p.volume_penalty_coefficient};
+    h = mix(h, parameters, sizeof(parameters));
+
+    // constants.h as it was when the build was configured
+    return mix(h, CONSTANTS_H_SHA256, sizeof(CONSTANTS_H_SHA256) - 1);
+}
+
+/**
+ * @brief Map the store file
+ *
+ * Creates the directory and the file if needed. A new file is sized and
+ * given its header while holding an exclusive lock, so a second process
+ * opening it at the same time waits and then finds the header. A file
+ * whose header does not match is left alone and the store stays closed.
+ *
+ * @param print Fingerprint of the store
+ *
+ * @return true if the file is mapped
+ */
+bool EvaluationStore::open_file(uint64_t print)
+{
+#if defined(_WIN32)
+    (void)print;
+    return false;
+#else
+    const std::string directory = path.substr(0, path.rfind('/'));
+    mkdir(directory.c_str(), 0777); // fails harmlessly if it exists
+
+    const int fd = open(path.c_str(), O_RDWR | O_CREAT, 0666);
+    if (fd < 0)
+        return false;
+    flock(fd, LOCK_EX);
+
+    bool usable = false;
+    struct stat st;
+    Store_Header header{};
+    if (fstat(fd, &st) == 0 && st.st_size == 0)
+    {
+        std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+        header.version = FORMAT_VERSION;
+        header.num_units = vector_size / 2;
+        header.fingerprint = print;
+        header.capacity = capacity;
+        header.slot_bytes = slot_bytes;
+        header.runs = 1;
+        usable = ftruncate(fd, sizeof(Store_Header) + capacity * slot_bytes) == 0 &&
+                 pwrite(fd, &header, sizeof(header), 0) == static_cast<ssize_t>(sizeof(header));
+    }
+    else if (pread(fd, &header, sizeof(header), 0) == static_cast<ssize_t>(sizeof(header)))
+    {
+        usable = std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) == 0 && header.version == FORMAT_VERSION &&
+                 header.num_units == vector_size / 2 && header.fingerprint == print &&
+                 header.slot_bytes == slot_bytes && header.capacity > 0 &&
+                 static_cast<uint64_t>(st.st_size) == sizeof(Store_Header) + header.capacity * slot_bytes;
+        capacity = header.capacity;
+        ++header.runs;
+        usable = usable && pwrite(fd, &header, sizeof(header), 0) == static_cast<ssize_t>(sizeof(header));
+    }
+    run = header.runs;
+
+    if (usable)
+    {
+        mapping_bytes = sizeof(Store_Header) + capacity * slot_bytes;
+        mapping = mmap(nullptr, mapping_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (mapping == MAP_FAILED)
+            mapping = nullptr;
+        else
+            slots = static_cast<unsigned char*>(mapping) + sizeof(Store_Header);
+    }
+    flock(fd, LOCK_UN);
+    close(fd); // the mapping stays valid
+    return slots != nullptr;
+#endif
+}
+
+/**
+ * @brief Hash a key
+ *
+ * @param circuit_vector Canonical circuit vector
+ * @param parameters_hash Hash of the unit parameters
+ *
+ * @return Hash of the key, never EMPTY or CLAIMED
+ */
+uint64_t EvaluationStore::hash(const int* circuit_vector, uint64_t parameters_hash) const
+{
+    uint64_t h = mix(14695981039346656037ull, circuit_vector, sizeof(int) * vector_size);
+    h = mix(h, parameters_hash);
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    return h < 2 ? h + 2 : h;
+}
+
+/**
+ * @brief Bring a circuit into its canonical labelling
+ *
+ * The unit parameters are hashed in the canonical order of the units. The
+ * default volumes (no unit parameters) hash to 0, any unit parameters to
+ * an odd value.
+ *
+ * @param circuit_vector Circuit vector
+ * @param unit_parameters num_units unit parameters, or nullptr
+ * @param labelling Output, the canonical labelling of the circuit
+ *
+ * @return Hash of the unit parameters
+ */
+uint64_t EvaluationStore::label(const int* circuit_vector, const double* unit_parameters,
+                                Circuit_Labelling& labelling) const
+{
+    canonical_labelling(vector_size, circuit_vector, labelling);
+    if (unit_parameters == nullptr)
+        return 0;
+    thread_local std::vector<double> canonical_parameters;
+    canonical_parameters.resize(vector_size / 2);
+    to_canonical_order(labelling, unit_parameters, 1, canonical_parameters.data());
+    return mix(14695981039346656037ull, canonical_parameters.data(), sizeof(double) * canonical_parameters.size()) | 1;
+}
+
+/**
+ * @brief Get the tag of a slot
+ *
+ * @param slot Slot index
+ *
+ * @return Tag shared through the mapping
+ */
+std::atomic<uint64_t>& EvaluationStore::tag(size_t slot) const
+{
+    return *reinterpret_cast<std::atomic<uint64_t>*>(slots + slot * slot_bytes);
+}
+
+/**
+ * @brief Get the stamp of a slot
+ *
+ * @param slot Slot index
+ *
+ * @return Last run that stored or found the slot's entry, shared through the mapping
+ */
+std::atomic<uint64_t>& EvaluationStore::stamp(size_t slot) const
+{
+    return *reinterpret_cast<std::atomic<uint64_t>*>(slots + slot * slot_bytes + STAMP_OFFSET);
+}
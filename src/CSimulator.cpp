@@ -9,7 +9,9 @@
  */
 #include "CSimulator.h"
 #include "CCircuit.h"
+#include "CCircuitBatch.h"
 #include "CUnit.h"
+#include <algorithm>
 #include <cmath>
 #include <limits>
 
@@ -17,28 +19,26 @@
 struct Simulator_Parameters default_simulator_parameters = {1e-6, 100};
 
 /**
- * @brief Evaluate the circuit performance
+ * @brief Evaluate a circuit on this thread's workspace
  *
- * This function evaluates the performance of the circuit based on the
- * circuit vector and the unit parameters. It initializes the circuit,
- * runs the mass balance, and returns the economic value of the circuit.
+ * Initializes the circuit, runs the mass balance, and returns the economic
+ * value of the circuit. Every thread reuses one Circuit, so once it has seen
+ * the largest circuit an evaluation does not allocate.
  *
  * @param vector_size Size of the circuit vector
  * @param circuit_vector Circuit vector
- * @param unit_parameters_size Size of the unit parameters
- * @param unit_parameters Unit parameters
+ * @param unit_parameters Unit parameters, or nullptr for the default volumes
  * @param simulator_parameters Simulation parameters
  * @param testFlag Test flag to indicate whether to use test parameters
+ * @param flow_state Initial unit feeds, replaced by the converged ones; nullptr for a cold start
+ * @param gradient Output, gradient of the economic value with respect to the unit parameters; nullptr for none
  *
  * @return Economic value of the circuit
- *
  */
-double circuit_performance(int vector_size, int* circuit_vector,
-
-                           int unit_parameters_size, double* unit_parameters,
-                           struct Simulator_Parameters simulator_parameters, bool testFlag)
+static double simulate(int vector_size, int* circuit_vector, double* unit_parameters,
+                       const Simulator_Parameters& simulator_parameters, bool testFlag,
+                       std::vector<double>* flow_state, double* gradient = nullptr)
 {
-
     // Calculate the number of units
     int num_units = (vector_size - 1) / 2;
     // Check if the vector size is valid
@@ -48,28 +48,148 @@ double circuit_performance(int vector_size, int* circuit_vector,
         return -1e12;
     }
 
-    // Initialize the circuit
-    Circuit circuit(num_units, unit_parameters, testFlag);
-    if (!circuit.initialize_from_vector(vector_size, circuit_vector, unit_parameters, testFlag))
+    // Initialize the circuit in this thread's workspace, which keeps its
+    // storage from one evaluation to the next
+    thread_local Circuit circuit(0);
+    if (!circuit.reset(vector_size, circuit_vector, unit_parameters, testFlag))
     {
         // Invalid structure
         return -1e12;
     }
 
     // Run the mass balance
-    bool converged = circuit.run_mass_balance(simulator_parameters.tolerance, simulator_parameters.max_iterations);
+    circuit.set_solver(simulator_parameters.solver, simulator_parameters.anderson_depth);
+    bool converged = flow_state ? circuit.run_mass_balance(*flow_state, simulator_parameters.tolerance,
+                                                           simulator_parameters.max_iterations)
+                                : circuit.run_mass_balance(simulator_parameters.tolerance,
+                                                           simulator_parameters.max_iterations);
     if (!converged)
     {
         // Not converged, consider invalid
         return -1e12;
     }
 
+    if (flow_state)
+        circuit.get_flow_state(*flow_state);
+
+    if (gradient)
+    {
+        thread_local std::vector<double> value_gradient;
+        if (!circuit.get_economic_value_gradient(value_gradient))
+            return -1e12;
+        std::copy(value_gradient.begin(), value_gradient.end(), gradient);
+    }
+
     // Return performance
     return circuit.get_economic_value();
 }
 
+/**
+ * @brief Evaluate the circuit performance
+ *
+ * This function evaluates the performance of the circuit based on the
+ * circuit vector and the unit parameters. It initializes the circuit,
+ * runs the mass balance, and returns the economic value of the circuit.
+ *
+ * @param vector_size Size of the circuit vector
+ * @param circuit_vector Circuit vector
+ * @param unit_parameters_size Size of the unit parameters
+ * @param unit_parameters Unit parameters
+ * @param simulator_parameters Simulation parameters
+ * @param testFlag Test flag to indicate whether to use test parameters
+ *
+ * @return Economic value of the circuit
+ *
+ */
+double circuit_performance(int vector_size, int* circuit_vector,
+
+                           int unit_parameters_size, double* unit_parameters,
+                           struct Simulator_Parameters simulator_parameters, bool testFlag)
+{
+    return simulate(vector_size, circuit_vector, unit_parameters, simulator_parameters, testFlag, nullptr);
+}
+
+/**
+ * @brief Evaluate the circuit performance, warm-started from a flow state
+ *
+ * The recycle loops start from the unit feeds in flow_state (e.g. the
+ * converged state of the parent genome, or of the previous evaluation)
+ * rather than from zero. If the mass balance converges, flow_state is
+ * replaced by this circuit's converged unit feeds; otherwise it is left
+ * untouched.
+ *
+ * @param vector_size Size of the circuit vector
+ * @param circuit_vector Circuit vector
+ * @param unit_parameters_size Size of the unit parameters
+ * @param unit_parameters Unit parameters
+ * @param simulator_parameters Simulation parameters
+ * @param flow_state Unit feeds (3 per unit, see Circuit::get_flow_state); empty for a cold start
+ *
+ * @return Economic value of the circuit
+ */
+double circuit_performance(int vector_size, int* circuit_vector, [[maybe_unused]] int unit_parameters_size,
+                           double* unit_parameters, Simulator_Parameters simulator_parameters,
+                           std::vector<double>& flow_state)
+{
+    return simulate(vector_size, circuit_vector, unit_parameters, simulator_parameters, false, &flow_state);
+}
+
+/**
+ * @brief Evaluate the circuit performance and its gradient
+ *
+ * After the mass balance, the sensitivity of the economic value to every
+ * unit parameter comes from the adjoint of the steady state
+ * (Circuit::get_economic_value_gradient), which costs one linear solve per
+ * recycle loop rather than a mass balance per parameter.
+ *
+ * @param vector_size Size of the circuit vector
+ * @param circuit_vector Circuit vector
+ * @param unit_parameters_size Size of the unit parameters
+ * @param unit_parameters Unit parameters, or nullptr for the default volumes
+ * @param gradient Output, ∂value/∂unit_parameters[u] for every unit; zero if the circuit does not converge
+ * @param simulator_parameters Simulation parameters
+ *
+ * @return Economic value of the circuit
+ */
+double circuit_performance_with_gradient(int vector_size, int* circuit_vector,
+                                         [[maybe_unused]] int unit_parameters_size, double* unit_parameters,
+                                         double* gradient, Simulator_Parameters simulator_parameters)
+{
+    std::fill(gradient, gradient + std::max((vector_size - 1) / 2, 0), 0.0);
+    return simulate(vector_size, circuit_vector, unit_parameters, simulator_parameters, false, nullptr, gradient);
+}
+
+/**
+ * @brief Evaluate the circuit performance and its gradient, warm-started from a flow state
+ *
+ * @param vector_size Size of the circuit vector
+ * @param circuit_vector Circuit vector
+ * @param unit_parameters_size Size of the unit parameters
+ * @param unit_parameters Unit parameters, or nullptr for the default volumes
+ * @param gradient Output, ∂value/∂unit_parameters[u] for every unit; zero if the circuit does not converge
+ * @param simulator_parameters Simulation parameters
+ * @param flow_state Unit feeds (3 per unit), replaced by the converged ones; empty for a cold start
+ *
+ * @return Economic value of the circuit
+ */
+double circuit_performance_with_gradient(int vector_size, int* circuit_vector,
+                                         [[maybe_unused]] int unit_parameters_size, double* unit_parameters,
+                                         double* gradient, Simulator_Parameters simulator_parameters,
+                                         std::vector<double>& flow_state)
+{
+    std::fill(gradient, gradient + std::max((vector_size - 1) / 2, 0), 0.0);
+    return simulate(vector_size, circuit_vector, unit_parameters, simulator_parameters, false, &flow_state, gradient);
+}
+
 // Overloads for other input
 
+double circuit_performance(int vector_size, int* circuit_vector, int unit_parameters_size, double* unit_parameters,
+                           Simulator_Parameters simulator_parameters)
+{
+    return circuit_performance(vector_size, circuit_vector, unit_parameters_size, unit_parameters, simulator_parameters,
+                               false);
+}
+
 double circuit_performance(int vector_size, int* circuit_vector, int unit_parameters_size, double* unit_parameters)
 {
     return circuit_performance(vector_size, circuit_vector, unit_parameters_size, unit_parameters,
@@ -107,3 +227,161 @@ double circuit_performance(int vector_size, int* circuit_vector, bool testFlag)
     delete[] parameters;
     return result;
 }
+
+/**
+ * @brief Check and evaluate a circuit on this thread's workspace
+ *
+ * Runs the structural rules of Circuit::check_validity on the circuit that
+ * was just initialised from the vector, and then a single mass balance,
+ * which decides the convergence rule and gives the economic value.
+ *
+ * @param vector_size Size of the circuit vector
+ * @param circuit_vector Circuit vector
+ * @param unit_parameters_size Size of the unit parameters
+ * @param unit_parameters Unit parameters, or nullptr for the default volumes
+ * @param simulator_parameters Simulation parameters
+ * @param flow_state Initial unit feeds, replaced by the converged ones; nullptr for a cold start
+ *
+ * @return Validity, reason, economic value and iteration count
+ */
+static Circuit_Evaluation check_and_simulate(int vector_size, int* circuit_vector, int unit_parameters_size,
+                                             double* unit_parameters, const Simulator_Parameters& simulator_parameters,
+                                             std::vector<double>* flow_state)
+{
+    Circuit_Evaluation result;
+    const int num_units = (vector_size - 1) / 2;
+    if (vector_size != 2 * num_units + 1 || num_units <= 0)
+        return result; // ValidityReason::Length
+
+    thread_local Circuit circuit(0);
+    if (!circuit.reset(vector_size, circuit_vector, unit_parameters))
+    {
+        result.reason = ValidityReason::Feed;
+        return result;
+    }
+    result.reason = circuit.check_structure(vector_size, circuit_vector);
+    if (result.reason != ValidityReason::Valid)
+        return result;
+
+    if (unit_parameters != nullptr)
+    {
+        bool in_range = unit_parameters_size == num_units;
+        for (int i = 0; in_range && i < num_units; ++i)
+            in_range = unit_parameters[i] >= 0.0 && unit_parameters[i] <= 1.0;
+        if (!in_range)
+        {
+            result.reason = ValidityReason::UnitParameters;
+            return result;
+        }
+    }
+
+    circuit.set_solver(simulator_parameters.solver, simulator_parameters.anderson_depth);
+    const bool converged = flow_state ? circuit.run_mass_balance(*flow_state, simulator_parameters.tolerance,
+                                                                 simulator_parameters.max_iterations)
+                                      : circuit.run_mass_balance(simulator_parameters.tolerance,
+                                                                 simulator_parameters.max_iterations);
+    result.iterations = circuit.get_iterations();
+    if (!converged)
+    {
+        result.reason = ValidityReason::NotConverged;
+        return result;
+    }
+    if (flow_state)
+        circuit.get_flow_state(*flow_state);
+
+    result.valid = true;
+    result.fitness = circuit.get_economic_value();
+    return result;
+}
+
+/**
+ * @brief Check and evaluate a circuit with a single mass balance
+ *
+ * Replaces a validity check followed by circuit_performance, which build
+ * the circuit and solve its mass balance twice. The structural rules are
+ * checked once; the convergence rule is decided by the mass balance that
+ * also gives the economic value.
+ *
+ * @param vector_size Size of the circuit vector
+ * @param circuit_vector Circuit vector
+ * @param unit_parameters_size Size of the unit parameters
+ * @param unit_parameters Unit parameters, or nullptr for the default volumes
+ * @param simulator_parameters Simulation parameters
+ *
+ * @return Validity, reason, economic value and iteration count
+ */
+Circuit_Evaluation evaluate_circuit(int vector_size, int* circuit_vector, int unit_parameters_size,
+                                    double* unit_parameters, Simulator_Parameters simulator_parameters)
+{
+    return check_and_simulate(vector_size, circuit_vector, unit_parameters_size, unit_parameters,
+                              simulator_parameters, nullptr);
+}
+
+/**
+ * @brief Check and evaluate a circuit, warm-started from a flow state
+ *
+ * @param vector_size Size of the circuit vector
+ * @param circuit_vector Circuit vector
+ * @param unit_parameters_size Size of the unit parameters
+ * @param unit_parameters Unit parameters, or nullptr for the default volumes
+ * @param simulator_parameters Simulation parameters
+ * @param flow_state Unit feeds (3 per unit), replaced by the converged ones if valid; empty for a cold start
+ *
+ * @return Validity, reason, economic value and iteration count
+ */
+Circuit_Evaluation evaluate_circuit(int vector_size, int* circuit_vector, int unit_parameters_size,
+                                    double* unit_parameters, Simulator_Parameters simulator_parameters,
+                                    std::vector<double>& flow_state)
+{
+    return check_and_simulate(vector_size, circuit_vector, unit_parameters_size, unit_parameters,
+                              simulator_parameters, &flow_state);
+}
+
+/**
+ * @brief Evaluate the performance of many circuits at once
+ *
+ * The circuits must all have the same number of units. They are split into
+ * chunks that are shared among the OpenMP threads, and each thread solves
+ * its chunks in lockstep with a CircuitBatch. Each result matches circuit_performance
+ * for the same circuit up to the convergence tolerance (see CCircuitBatch.h for
+ * the iteration limit and the parameters the sweeps do not support).
+ *
+ * @param count Number of circuits
+ * @param vector_size Size of each circuit vector
+ * @param circuit_vectors count circuit vectors, one after another
+ * @param unit_parameters count sets of unit parameters, one after another, or nullptr
+ * @param performances Output, economic value of each circuit
+ * @param simulator_parameters Simulation parameters
+ */
+void circuit_performance_batch(int count, int vector_size, const int* circuit_vectors, const double* unit_parameters,
+                               double* performances, Simulator_Parameters simulator_parameters)
+{
+    const int num_units = (vector_size - 1) / 2;
+    if (vector_size != 2 * num_units + 1 || num_units <= 0)
+    {
+        // Invalid vector size
+        std::fill(performances, performances + count, -1e12);
+        return;
+    }
+
+    // Each thread streams chunks of circuits through its own batch
+    const int chunk = 1024;
+#pragma omp parallel
+    {
+        CircuitBatch batch(num_units);
+#pragma omp for schedule(dynamic)
+        for (int first = 0; first < count; first += chunk)
+        {
+            const double* beta =
+                unit_parameters ? unit_parameters + static_cast<size_t>(first) * num_units : nullptr;
+            batch.evaluate(std::min(chunk, count - first), circuit_vectors + static_cast<size_t>(first) * vector_size,
+                           beta, simulator_parameters, performances + first);
+        }
+    }
+}
+
+void circuit_performance_batch(int count, int vector_size, const int* circuit_vectors, double* performances)
+{
+    circuit_performance_batch(count, vector_size, circuit_vectors, nullptr, performances,
+                              default_simulator_parameters);
+}
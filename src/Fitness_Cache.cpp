@@ -0,0 +1,146 @@
+/**
+ * @file Fitness_Cache.cpp
+ * @brief Implementation of the Fitness_Cache class
+ *
+ * All storage is allocated by the constructor, so the cache never grows.
+ * A lookup hashes the key outside any lock and then compares at most WAYS
+ * entries of one set under the set's stripe mutex.
+ */
+#include "Fitness_Cache.h"
+
+#include <cstring>
+
+/**
+ * @brief Constructor for the Fitness_Cache class
+ *
+ * @param capacity Maximum number of cached genomes (rounded down to whole sets), 0 to disable the cache
+ * @param key_bytes Size of every key in bytes
+ */
+Fitness_Cache::Fitness_Cache(size_t capacity, size_t key_bytes)
+    : key_bytes(key_bytes), num_sets(capacity / WAYS), hashes(num_sets * WAYS, 0), fitnesses(num_sets * WAYS),
+      referenced(num_sets * WAYS, 0), keys(num_sets * WAYS * key_bytes), hands(num_sets, 0)
+{
+}
+
+/**
+ * @brief Look up the fitness of a genome
+ *
+ * @param key Genome, key_bytes bytes
+ * @param fitness Output, the cached fitness if found
+ *
+ * @return true if the genome is cached
+ */
+bool Fitness_Cache::find(const void* key, double& fitness)
+{
+    if (num_sets == 0)
+        return false;
+    const uint64_t h = hash(key);
+    const size_t set = h % num_sets;
+    {
+        std::lock_guard<std::mutex> lock(stripes[set % STRIPES]);
+        const int way = lookup(set, h, key);
+        if (way >= 0)
+        {
+            const size_t entry = set * WAYS + way;
+            referenced[entry] = 1;
+            fitness = fitnesses[entry];
+            ++hit_count;
+            return true;
+        }
+    }
+    ++miss_count;
+    return false;
+}
+
+/**
+ * @brief Remember the fitness of a genome
+ *
+ * A genome that is cached already gets the new fitness. Otherwise it takes
+ * an empty entry of its set, or the clock hand sweeps the set, clearing
+ * reference bits, until it finds an entry not used since its last pass.
+ * New entries start unreferenced: a genome that is scored once and never
+ * met again goes before any genome that has been found in the cache.
+ *
+ * @param key Genome, key_bytes bytes
+ * @param fitness Fitness of the genome
+ */
+void Fitness_Cache::insert(const void* key, double fitness)
+{
+    if (num_sets == 0)
+        return;
+    const uint64_t h = hash(key);
+    const size_t set = h % num_sets;
+    std::lock_guard<std::mutex> lock(stripes[set % STRIPES]);
+
+    int way = lookup(set, h, key);
+    if (way >= 0)
+    {
+        fitnesses[set * WAYS + way] = fitness;
+        return;
+    }
+    for (int w = 0; way < 0 && w < WAYS; ++w)
+    {
+        if (hashes[set * WAYS + w] == 0)
+            way = w;
+    }
+    while (way < 0)
+    {
+        const size_t entry = set * WAYS + hands[set];
+        if (referenced[entry])
+            referenced[entry] = 0;
+        else
+            way = hands[set];
+        hands[set] = (hands[set] + 1) % WAYS;
+    }
+
+    const size_t entry = set * WAYS + way;
+    hashes[entry] = h;
+    fitnesses[entry] = fitness;
+    referenced[entry] = 0;
+    std::memcpy(&keys[entry * key_bytes], key, key_bytes);
+}
+
+/**
+ * @brief Hash a key
+ *
+ * FNV-1a over the key's bytes, followed by a final mix so that the low
+ * bits used to pick the set depend on all bytes.
+ *
+ * @param key Genome, key_bytes bytes
+ *
+ * @return Hash of the key, never 0
+ */
+uint64_t Fitness_Cache::hash(const void* key) const
+{
+    const unsigned char* bytes = static_cast<const unsigned char*>(key);
+    uint64_t h = 14695981039346656037ull;
+    for (size_t i = 0; i < key_bytes; ++i)
+    {
+        h ^= bytes[i];
+        h *= 1099511628211ull;
+    }
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    return h | 1;
+}
+
+/**
+ * @brief Find a key within its set
+ *
+ * @param set Set of the key
+ * @param h Hash of the key
+ * @param key Genome, key_bytes bytes
+ *
+ * @return Way holding the key, or -1
+ */
+int Fitness_Cache::lookup(size_t set, uint64_t h, const void* key) const
+{
+    for (int w = 0; w < WAYS; ++w)
+    {
+        const size_t entry = set * WAYS + w;
+        if (hashes[entry] == h && std::memcmp(&keys[entry * key_bytes], key, key_bytes) == 0)
+            return w;
+    }
+    return -1;
+}
@@ -10,16 +10,37 @@
  */
 #include "Genetic_Algorithm.h"
 #include "CCircuit.h"
+#include "CCircuitCanonical.h"
+#include "CCircuitSampler.h"
+#include "Fitness_Cache.h"
+#include "Island_Model.h"
+#include "Local_Refinement.h"
+#include "Philox.h"
+#include "Population.h"
 #include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <cstring>
 #include <functional>
 #include <iostream>
+#include <numeric>
 #include <omp.h>
 #include <random>
 #include <set>
 #include <vector>
 
-static int g_random_seed = -1; // -1 means use random seed
+static int g_random_seed = -1;              // -1 means use random seed
+static std::atomic<unsigned> g_seed_epoch{0}; // raised by set_random_seed, restarting the generators
+
+// Counter words naming what a Philox stream is used for
+enum Random_Stream : uint32_t
+{
+    SETUP_STREAM = 0,     // serial parts: run keys, continuous initial population
+    OFFSPRING_STREAM = 1, // one stream per child pair: (generation, slot)
+    INITIAL_STREAM = 2,   // one stream per initial candidate: (0, slot)
+    REPAIR_STREAM = 3,    // one stream per repaired child: (generation, child slot)
+    MIGRATION_STREAM = 4  // one stream per island and generation: (generation, island)
+};
 
 /**
  * @brief Set the random seed for the random number generator
@@ -27,23 +48,35 @@ static int g_random_seed = -1; // -1 means use random seed
 void set_random_seed(int seed)
 {
     g_random_seed = seed;
+    ++g_seed_epoch;
 }
 
-// Modified rng() function - properly thread-safe
-static std::mt19937& rng()
+// Generator of the calling thread for the serial parts of the GA: a Philox stream keyed by the seed,
+// restarted by set_random_seed. Offspring are bred from streams of their own (see optimize_int).
+static Philox& rng()
 {
-    if (g_random_seed >= 0)
-    {
-        // Deterministic mode - use thread ID to ensure different seeds per thread
-        static thread_local std::mt19937 gen(g_random_seed + omp_get_thread_num());
-        return gen;
-    }
-    else
+    thread_local Philox gen;
+    thread_local unsigned epoch = ~0u;
+    if (epoch != g_seed_epoch.load())
     {
-        // Non-deterministic mode
-        static thread_local std::mt19937 gen(std::random_device{}());
-        return gen;
+        epoch = g_seed_epoch.load();
+        uint64_t key = static_cast<uint64_t>(g_random_seed);
+        if (g_random_seed < 0)
+        {
+            // Non-deterministic mode
+            std::random_device device;
+            key = (uint64_t(device()) << 32) | device();
+        }
+        gen = Philox(key, 0, omp_get_thread_num(), SETUP_STREAM);
     }
+    return gen;
+}
+
+// Key of the offspring streams of one optimizer run, drawn from the setup stream
+static uint64_t run_key()
+{
+    const uint64_t high = rng()();
+    return (high << 32) | rng()();
 }
 
 /**
@@ -106,114 +139,52 @@ std::vector<int> generate_valid_circuit_template(int num_units)
  * @brief Create a varied circuit based on a template
  *
  * This function creates a varied circuit based on a given template vector.
- * It modifies the template by changing a few connections while ensuring
- * the circuit remains valid.
+ * It gives between one and num_units random connections of the template a
+ * random destination, and completes the result to a structurally valid
+ * circuit (see CCircuitSampler.h), so no attempt is wasted on circuits that
+ * break the structural rules.
  *
  * @param template_vec The template vector to modify
  * @param num_units Number of units in the circuit
- * @param validity_check Function to check the validity of the circuit
- *
- * @return A vector representing the varied circuit
+ * @param random Random number stream
+ * @param circuit_vector Output, the varied circuit
  *
  */
-std::vector<int> create_varied_circuit(const std::vector<int>& template_vec, int num_units,
-                                       std::function<bool(int, int*)> validity_check)
+void create_varied_circuit(const std::vector<int>& template_vec, int num_units, Philox& random, int* circuit_vector)
 {
-    const int n = num_units;
-    std::vector<int> result = template_vec;
-
-    // Apply a few random changes
-    int num_changes = std::uniform_int_distribution<int>(1, n)(rng());
-
-    // Try multiple times to create a valid variation
-    for (int attempt = 0; attempt < 20; attempt++)
-    {
-        std::vector<int> candidate = template_vec;
-
-        for (int i = 0; i < num_changes; i++)
-        {
-            // Pick a random position to modify (excluding feed position)
-            int pos = std::uniform_int_distribution<int>(1, 2 * n)(rng());
-
-            // Determine which unit this connection belongs to
-            int unit_idx = (pos - 1) / 2;
-
-            // Pick a valid destination (any unit or terminal except self)
-            std::vector<int> valid_dests;
-            for (int dest = 0; dest < n + 3; dest++)
-            {
-                if (dest != unit_idx)
-                { // Avoid self-loop
-                    valid_dests.push_back(dest);
-                }
-            }
-
-            // Shuffle possible destinations
-            std::shuffle(valid_dests.begin(), valid_dests.end(), rng());
-
-            // Try each possible destination until we find one that works
-            bool found_valid = false;
-            for (int dest : valid_dests)
-            {
-                int old_val = candidate[pos];
-                candidate[pos] = dest;
-
-                // Check if both connections from this unit point to the same place
-                int other_conn = (pos % 2 == 1) ? pos + 1 : pos - 1;
-                if (other_conn < candidate.size() && candidate[other_conn] == dest)
-                {
-                    candidate[pos] = old_val; // Restore old value
-                    continue;                 // Can't have both connections to same place
-                }
-
-                // Check if the circuit is valid with this change
-                if (validity_check(candidate.size(), candidate.data()))
-                {
-                    found_valid = true;
-                    break;
-                }
-                else
-                {
-                    candidate[pos] = old_val; // Restore old value
-                }
-            }
-
-            if (!found_valid)
-            {
-                // If we couldn't find a valid change for this position, try another
-                continue;
-            }
-        }
-
-        // Check if the final candidate is valid
-        if (validity_check(candidate.size(), candidate.data()))
-        {
-            return candidate;
-        }
-    }
-
-    // If all attempts failed, return the original template
-    return template_vec;
+    const int num_changes = std::uniform_int_distribution<int>(1, num_units)(random);
+    vary_valid_circuit(num_units, template_vec.data(), num_changes, random, circuit_vector);
 }
 
 /**
  * @brief Generate an initial population of valid circuits
  *
- * This function generates an initial population of valid circuits
- * based on a set of templates.
+ * This function generates an initial population of valid circuits: the
+ * templates, variations of them and circuits sampled afresh, half and half.
+ * Circuits that only differ by the numbering of their units count as
+ * duplicates.
+ *
+ * The candidates are built in parallel, each from a random stream keyed by
+ * its slot, screened in blocks and labelled in parallel, and taken in slot
+ * order, so the population does not depend on the number of threads. Every
+ * candidate passes the structural rules by construction; the screen only
+ * rejects those failing any further rules it checks.
  *
  * @param population_size Size of the population to generate
  * @param num_units Number of units in the circuit
- * @param validity_check Function to check the validity of the circuit
+ * @param screen Function to screen circuits in batches
+ * @param report Whether to print the progress
  *
- * @return A vector of vectors representing the initial population
+ * @return The initial population
  *
  */
-std::vector<std::vector<int>> generate_initial_population(int population_size, int num_units,
-                                                          std::function<bool(int, int*)> validity_check)
+Population<int> generate_initial_population(int population_size, int num_units, const Discrete_Screen& screen,
+                                            bool report = true)
 {
-    std::vector<std::vector<int>> population;
-    std::set<std::vector<int>> unique_circuits; // To ensure uniqueness
+    const int size = 2 * num_units + 1;
+    Population<int> population(size, population_size);
+    std::set<std::vector<int>> unique_circuits; // Canonical vectors, to ensure uniqueness
+    Circuit_Labelling labelling;
 
     // Create base templates
     std::vector<std::vector<int>> templates;
@@ -236,7 +207,7 @@ std::vector<std::vector<int>> generate_initial_population(int population_size, i
             template2[2 * i + 2] = 0;             // and tailings back to first unit
         }
     }
-    if (validity_check(template2.size(), template2.data()))
+    if (screen(1, template2.size(), template2.data()) != 0)
     {
         templates.push_back(template2);
     }
@@ -256,7 +227,7 @@ std::vector<std::vector<int>> generate_initial_population(int population_size, i
             template3[2 * i + 2] = num_units + 1;
         }
     }
-    if (validity_check(template3.size(), template3.data()))
+    if (screen(1, template3.size(), template3.data()) != 0)
     {
         templates.push_back(template3);
     }
@@ -264,40 +235,68 @@ std::vector<std::vector<int>> generate_initial_population(int population_size, i
     // Add templates directly to population
     for (const auto& tmpl : templates)
     {
-        population.push_back(tmpl);
-        unique_circuits.insert(tmpl);
+        canonical_labelling(tmpl.size(), tmpl.data(), labelling);
+        if (unique_circuits.insert(labelling.circuit_vector).second)
+            population.push_back(tmpl.data(), {});
     }
 
-    // Generate variations until we have enough unique circuits
-    int max_attempts = population_size * 10;
-    int attempts = 0;
+    // Generate candidates in rounds until we have enough unique circuits
+    const size_t max_attempts = static_cast<size_t>(population_size) * 10;
+    const uint64_t run = run_key();
+    std::vector<int> candidates;             // circuit vectors of a round
+    std::vector<std::vector<int>> canonical; // canonical vector of every candidate, empty if screened out
+    std::vector<uint64_t> accepted;          // screen result of every block of 64 candidates
+    size_t attempts = 0;
 
-    std::cout << "Generating initial population of valid circuits..." << std::endl;
+    if (report)
+        std::cout << "Generating initial population of valid circuits..." << std::endl;
 
-    while (population.size() < population_size && attempts < max_attempts)
+    while (population.size() < static_cast<size_t>(population_size) && attempts < max_attempts)
     {
-        // Pick a random template
-        const auto& tmpl = templates[std::uniform_int_distribution<int>(0, templates.size() - 1)(rng())];
-
-        // Create a variation
-        auto candidate = create_varied_circuit(tmpl, num_units, validity_check);
+        const size_t count = std::min(population_size - population.size(), max_attempts - attempts);
+        const int blocks = static_cast<int>((count + 63) / 64);
+        candidates.resize(count * size);
+        canonical.resize(count);
+        accepted.resize(blocks);
 
-        // Check uniqueness
-        if (unique_circuits.find(candidate) == unique_circuits.end())
+#pragma omp parallel for schedule(dynamic)
+        for (int b = 0; b < blocks; ++b)
         {
-            population.push_back(candidate);
-            unique_circuits.insert(candidate);
+            const size_t first = b * size_t(64), last = std::min(count, first + 64);
+            for (size_t c = first; c < last; ++c)
+            {
+                Philox random(run, 0, static_cast<uint32_t>(attempts + c), INITIAL_STREAM);
+                int* candidate = candidates.data() + c * size;
+                if (random() & 1)
+                    sample_valid_circuit(num_units, random, candidate);
+                else
+                    create_varied_circuit(templates[random() % templates.size()], num_units, random, candidate);
+            }
+            accepted[b] = screen(static_cast<int>(last - first), size, candidates.data() + first * size);
 
-            if (population.size() % 10 == 0)
+            thread_local Circuit_Labelling block_labelling;
+            for (size_t c = first; c < last; ++c)
             {
-                std::cout << "Generated " << population.size() << " valid circuits" << std::endl;
+                canonical[c].clear();
+                if ((accepted[b] >> (c - first)) & 1)
+                {
+                    canonical_labelling(size, candidates.data() + c * size, block_labelling);
+                    canonical[c] = block_labelling.circuit_vector;
+                }
             }
         }
+        attempts += count;
 
-        attempts++;
+        // Check uniqueness, in slot order
+        for (size_t c = 0; c < count && population.size() < static_cast<size_t>(population_size); ++c)
+        {
+            if (!canonical[c].empty() && unique_circuits.insert(std::move(canonical[c])).second)
+                population.push_back(candidates.data() + c * size, {});
+        }
     }
 
-    std::cout << "Initial population: " << population.size() << " valid circuits" << std::endl;
+    if (report)
+        std::cout << "Initial population: " << population.size() << " valid circuits" << std::endl;
 
     return population;
 }
@@ -342,48 +341,268 @@ OptimizationResult get_last_optimization_result()
     return last_result;
 }
 
+/**
+ * @brief Run the GA as an island model
+ *
+ * The population is split evenly among params.island_count islands, and
+ * run_island evolves each one on a thread of an outer team, its parallel
+ * loops running on a nested thread group of its own (the threads are
+ * shared out evenly among the islands). The islands exchange migrants
+ * through an Archipelago (see Island_Model.h) and never wait for each
+ * other. Each island keeps its own fitness cache, with an even share of
+ * params.fitness_cache_size, so the run remembers as many genomes as a
+ * single population would and an island's hits do not depend on how far the
+ * others have got. The best genome of the fittest island is written to
+ * best, and last_result holds the statistics of all islands together.
+ *
+ * @param size Size of a genome
+ * @param best Output, the best genome found
+ * @param params Algorithm parameters of the whole run
+ * @param run_island Function running the GA on one island with its parameters, writing its best genome
+ */
+template <typename Gene>
+static void run_islands(int size, Gene* best, const Algorithm_Parameters& params,
+                        const std::function<void(Gene*, const Algorithm_Parameters&, Island<Gene>&)>& run_island)
+{
+    const int islands = params.island_count;
+    Archipelago<Gene> archipelago(islands, params.migration_topology == "random" ? Migration_Topology::Random
+                                                                                  : Migration_Topology::Ring);
+    std::vector<Island<Gene>> island;
+    island.reserve(islands);
+    for (int i = 0; i < islands; ++i)
+        island.emplace_back(i, archipelago, params.migration_interval, params.migration_count, size);
+    std::vector<Gene> bests(static_cast<size_t>(islands) * size);
+
+    Algorithm_Parameters island_params = params;
+    island_params.island_count = 1;
+    island_params.population_size = std::max(2, params.population_size / islands);
+    island_params.fitness_cache_size = params.fitness_cache_size / islands;
+    if (params.verbose)
+    {
+        std::cout << "[Islands] " << islands << " islands of " << island_params.population_size << " genomes, "
+                  << params.migration_count << " migrants every " << params.migration_interval << " generations ("
+                  << params.migration_topology << ")" << "\n";
+    }
+
+    const int threads = omp_get_max_threads();
+    const int levels = omp_get_max_active_levels();
+    omp_set_max_active_levels(std::max(levels, 2));
+#pragma omp parallel num_threads(islands)
+    {
+        // The thread group of the island; if the team is smaller than asked for, its threads take turns
+        omp_set_num_threads(std::max(1, threads / islands));
+        for (int i = omp_get_thread_num(); i < islands; i += omp_get_num_threads())
+        {
+            Algorithm_Parameters p = island_params;
+            p.verbose = params.verbose && i == 0; // island 0 reports for all
+            run_island(bests.data() + static_cast<size_t>(i) * size, p, island[i]);
+        }
+    }
+    omp_set_max_active_levels(levels);
+
+    // The fittest island, and the statistics of all of them
+    int winner = 0;
+    double failed = 0, repaired = 0;
+    OptimizationResult total;
+    for (int i = 0; i < islands; ++i)
+    {
+        const OptimizationResult& r = island[i].result;
+        if (r.best_fitness > island[winner].result.best_fitness)
+            winner = i;
+        total.generations = std::max(total.generations, r.generations);
+        total.cache_hits += r.cache_hits;
+        total.cache_misses += r.cache_misses;
+        total.children += r.children;
+        failed += r.rejection_rate * r.children;
+        repaired += r.repair_rate * r.rejection_rate * r.children;
+    }
+    total.best_fitness = island[winner].result.best_fitness;
+    total.refinement_gain = island[winner].result.refinement_gain;
+    total.rejection_rate = total.children > 0 ? failed / total.children : 0.0;
+    total.repair_rate = failed > 0 ? repaired / failed : 0.0;
+    last_result = total;
+    std::copy(bests.data() + static_cast<size_t>(winner) * size, bests.data() + static_cast<size_t>(winner + 1) * size,
+              best);
+
+    if (params.verbose)
+        std::cout << "[Islands] Best fitness " << total.best_fitness << " on island " << winner << "\n";
+}
+
 // ********************************************************************
 // 1) Discrete-only optimize with PARALLEL fitness evaluation
 // ********************************************************************
 
 /**
- * @brief Optimize a discrete vector using a genetic algorithm
+ * @brief Screen genomes one at a time with a validity function
  *
- * This function optimizes a discrete vector using a genetic algorithm.
- * It evaluates the fitness of the population in parallel and applies
- * selection, crossover, and mutation to generate new populations.
+ * Lets a check of one genome stand in for a batched screen, so optimize
+ * takes either.
+ *
+ * @param validity Function to check the validity of one circuit
+ *
+ * @return Screen calling validity once per genome
+ */
+Discrete_Screen::Batch Discrete_Screen::each(std::function<bool(int, int*)> validity)
+{
+    return [validity](int count, int size, const int* genomes)
+    {
+        uint64_t accepted = 0;
+        for (int k = 0; k < count; ++k)
+        {
+            if (validity(size, const_cast<int*>(genomes + static_cast<size_t>(k) * size)))
+                accepted |= uint64_t(1) << k;
+        }
+        return accepted;
+    };
+}
+
+/**
+ * @brief Cache key of a circuit
+ *
+ * The canonical circuit vector, followed by the volume parameters in
+ * canonical order if there are any, so circuits that only differ by the
+ * numbering of their units share a key.
+ *
+ * @param size Size of the circuit vector
+ * @param genome Circuit vector
+ * @param unit_parameters Volume parameters of the units, or nullptr for the default volumes
+ * @param key Output, the key
+ */
+static void circuit_key(int size, const int* genome, const double* unit_parameters, std::vector<unsigned char>& key)
+{
+    thread_local Circuit_Labelling labelling;
+    thread_local std::vector<double> canonical_parameters;
+    canonical_labelling(size, genome, labelling);
+    const size_t vector_bytes = size * sizeof(int);
+    const size_t num_units = labelling.unit_of.size();
+    key.resize(vector_bytes + (unit_parameters != nullptr ? num_units * sizeof(double) : 0));
+    std::memcpy(key.data(), labelling.circuit_vector.data(), vector_bytes);
+    if (unit_parameters != nullptr)
+    {
+        canonical_parameters.resize(num_units);
+        to_canonical_order(labelling, unit_parameters, 1, canonical_parameters.data());
+        std::memcpy(key.data() + vector_bytes, canonical_parameters.data(), num_units * sizeof(double));
+    }
+}
+
+/**
+ * @brief Genetic algorithm on a discrete vector
+ *
+ * Shared by the discrete optimize overloads. It evaluates the population
+ * in parallel and applies selection, crossover, and mutation to generate
+ * new populations. Every genome carries a state that is handed to evaluate
+ * with it; children start from the state of their first parent. A warm
+ * start can converge where a cold one does not (and the other way round),
+ * so the verdict of a warm evaluation is only kept for a genome that
+ * converges without becoming the best of the run. A genome that fails, or
+ * matches or beats the best fitness seen so far, is evaluated again from an
+ * empty state, and that cold evaluation decides; the winner is therefore
+ * always valid on its own. A state is dropped when the evaluation fails. Fitness
+ * values are remembered in a cache shared by the threads, so a genome met
+ * again (an elite, a child equal to a parent, or the same circuit with its
+ * units numbered differently) is not evaluated again; its state is left as
+ * it is. The generations are two Populations that swap roles, and children
+ * are bred in place in the screening blocks, so a generation allocates
+ * nothing once the populations have grown to full size.
+ *
+ * Children are bred and screened in parallel, each pair from a Philox
+ * stream of its own, so a fixed seed gives the same run on any number of
+ * threads.
+ *
+ * With params.island_count above 1 the run is an island model (see
+ * run_islands), and every island is a run of this function with island
+ * set: it then exchanges migrants once a generation, after the fitness
+ * evaluation, and reports its statistics to the island.
  *
  * @param int_vector_size Size of the integer vector
  * @param int_vector Pointer to the integer vector
- * @param func Function to evaluate the fitness of the circuit
- * @param validity Function to check the validity of the circuit
+ * @param evaluate Function to check the circuit and evaluate its fitness
+ * @param screen Function to screen new circuits in batches
  * @param params Algorithm parameters for the optimization process
+ * @param unit_parameters Volume parameters shared by all circuits, or nullptr for the default volumes
+ * @param island Island of an island-model run the population lives on, or nullptr
  *
  * @return The best fitness value found during optimization
  */
-int optimize(int int_vector_size, int* int_vector, std::function<double(int, int*)> func,
-             std::function<bool(int, int*)> validity, Algorithm_Parameters params)
+static int optimize_int(int int_vector_size, int* int_vector, const Discrete_Evaluation& evaluate,
+                        const Discrete_Screen& screen, Algorithm_Parameters params,
+                        const double* unit_parameters = nullptr, Island<int>* island = nullptr)
 {
+    if (island == nullptr && params.island_count > 1)
+    {
+        auto run_island = [&](int* best, const Algorithm_Parameters& island_params, Island<int>& island)
+        { optimize_int(int_vector_size, best, evaluate, screen, island_params, unit_parameters, &island); };
+        run_islands<int>(int_vector_size, int_vector, params, run_island);
+        return 0;
+    }
+    const bool report = island == nullptr || island->index == 0; // one island reports for all
+    OptimizationResult& result = island != nullptr ? island->result : last_result;
+
     using Clock = std::chrono::high_resolution_clock;
     auto t0 = Clock::now();
 
     // Print OpenMP info
-    std::cout << "OpenMP: Using " << omp_get_max_threads() << " threads for parallel fitness evaluation" << std::endl;
+    if (report)
+        std::cout << "OpenMP: Using " << omp_get_max_threads() << " threads for parallel fitness evaluation"
+                  << std::endl;
 
     // --- 1. Improved population initialization
     int n_units = (int_vector_size - 1) / 2;
-    std::cout << "Initializing population for " << n_units << " units..." << std::endl;
+    if (report)
+        std::cout << "Initializing population for " << n_units << " units..." << std::endl;
 
     // Generate valid initial population
-    std::vector<std::vector<int>> population = generate_initial_population(params.population_size, n_units, validity);
+    Population<int> population = generate_initial_population(params.population_size, n_units, screen, report);
 
     // If we couldn't generate enough valid circuits, adjust population size
-    if (population.size() < params.population_size)
+    if (population.size() < static_cast<size_t>(params.population_size))
     {
-        std::cout << "Warning: Could only generate " << population.size()
-                  << " valid circuits, adjusting population size" << std::endl;
-        params.population_size = population.size();
+        if (report)
+        {
+            std::cout << "Warning: Could only generate " << population.size()
+                      << " valid circuits, adjusting population size" << std::endl;
+        }
+        params.population_size = static_cast<int>(population.size());
     }
+    const size_t pop_size = population.size();
+    Population<int> next(int_vector_size, pop_size);
+    std::vector<int> children;        // children of a generation, screened in blocks
+    std::vector<size_t> child_parent; // parent whose state each child inherits
+    std::vector<uint64_t> accepted;   // screen result of every block
+    std::vector<uint64_t> failed;     // children of every block failing the screen as bred
+    long children_bred = 0, children_failed = 0, children_repaired = 0;
+    const size_t key_bytes =
+        int_vector_size * sizeof(int) + (unit_parameters != nullptr ? n_units * sizeof(double) : 0);
+    std::vector<unsigned char> keys(pop_size * key_bytes); // cache key of every genome
+    std::vector<char> cached(pop_size);                    // whether a genome's fitness came from the cache
+    Fitness_Cache cache(params.fitness_cache_size, key_bytes);
+    const uint64_t run = run_key();
+    double best_seen = -1e300; // best fitness of the generations evaluated so far
+
+    // Penalized fitness of a genome of the population, from the cache if possible. The cache is only read
+    // here and filled by the caller afterwards, in population order, so which genomes hit (and keep their
+    // state) does not depend on how the threads interleave. A warm evaluation that fails or reaches
+    // best_seen is repeated from a cold start, which decides.
+    auto fitness_of = [&](size_t i)
+    {
+        thread_local std::vector<unsigned char> key;
+        circuit_key(int_vector_size, population.genome(i), unit_parameters, key);
+        std::copy(key.begin(), key.end(), keys.begin() + i * key_bytes);
+        double fitness;
+        cached[i] = cache.find(key.data(), fitness);
+        if (cached[i])
+            return fitness;
+        const bool warm = !population.state(i).empty();
+        Genome_Evaluation e = evaluate(int_vector_size, population.genome(i), population.state(i));
+        if (warm && (!e.valid || e.fitness >= best_seen))
+        {
+            population.state(i).clear();
+            e = evaluate(int_vector_size, population.genome(i), population.state(i));
+        }
+        if (!e.valid)
+            population.state(i).clear();
+        return e.valid ? e.fitness : -1e9; // heavy penalty
+    };
 
     double best_overall = -1e300;              // best seen so far
     int stall_count = 0;                       // gens since last improvement
@@ -394,24 +613,30 @@ int optimize(int int_vector_size, int* int_vector, std::function<double(int, int
     for (int gen = 0; gen < params.max_iterations; ++gen)
     {
         // 2a) PARALLEL fitness evaluation - THIS IS THE KEY OPTIMIZATION!
-        std::vector<double> fitnesses(population.size());
+        const double* fitnesses = population.fitnesses();
 
 // Parallel fitness evaluation using OpenMP
 #pragma omp parallel for schedule(dynamic)
-        for (size_t i = 0; i < population.size(); ++i)
+        for (size_t i = 0; i < pop_size; ++i)
         {
-            int* gdata = population[i].data();
-            if (!validity(int_vector_size, gdata))
-            {
-                fitnesses[i] = -1e9; // heavy penalty
-            }
-            else
-            {
-                fitnesses[i] = func(int_vector_size, gdata);
-            }
+            population.fitness(i) = fitness_of(i);
+        }
+        for (size_t i = 0; i < pop_size; ++i)
+        {
+            if (!cached[i])
+                cache.insert(keys.data() + i * key_bytes, population.fitness(i));
+        }
+
+        // Migrants out to another island and in from the others
+        if (island != nullptr)
+        {
+            Philox random(run, gen, island->index, MIGRATION_STREAM);
+            island->migrate(gen, population, random);
         }
 
-        double gen_best = *std::max_element(fitnesses.begin(), fitnesses.end());
+        const size_t best_idx = population.best();
+        double gen_best = fitnesses[best_idx];
+        best_seen = std::max(best_seen, gen_best);
         if (gen_best > best_overall + eps)
         {
             best_overall = gen_best;
@@ -431,43 +656,41 @@ int optimize(int int_vector_size, int* int_vector, std::function<double(int, int
         }
 
         // 2b) Elitism: copy best genome to next generation
-        std::vector<std::vector<int>> next_gen;
-        {
-            auto best_it = std::max_element(fitnesses.begin(), fitnesses.end());
-            size_t best_idx = std::distance(fitnesses.begin(), best_it);
-            next_gen.push_back(population[best_idx]);
-        }
+        next.clear();
+        next.push_back(population, best_idx);
 
         // ----- TOURNAMENT SETUP -----
         int k = params.tournament_size > 0 ? params.tournament_size : 2;
-        std::uniform_int_distribution<size_t> pop_dist(0, population.size() - 1);
-        auto pick_parent = [&]()
+        auto pick_parent = [&](Philox& random)
         {
-            size_t best = pop_dist(rng());
+            std::uniform_int_distribution<size_t> pop_dist(0, pop_size - 1);
+            size_t best = pop_dist(random);
             double best_fit = fitnesses[best];
             for (int i = 1; i < k; ++i)
             {
-                size_t idx = pop_dist(rng());
+                size_t idx = pop_dist(random);
                 if (fitnesses[idx] > best_fit)
                 {
                     best = idx;
                     best_fit = fitnesses[idx];
                 }
             }
-            return population[best];
+            return best;
         };
 
-        // 2c) Fill rest via selection, crossover, mutation
-        std::uniform_real_distribution<double> u01(0.0, 1.0);
-        while (next_gen.size() < population.size())
+        // Two children of tournament-selected parents, by crossover and mutation, from random
+        auto breed = [&](Philox& random, int* c1, int* c2, size_t& p1, size_t& p2)
         {
+            std::uniform_real_distribution<double> u01(0.0, 1.0);
+
             // – Selection via k-way tournament
-            auto p1 = pick_parent();
-            auto p2 = pick_parent();
+            p1 = pick_parent(random);
+            p2 = pick_parent(random);
 
             // – Crossover
-            std::vector<int> c1 = p1, c2 = p2;
-            if (u01(rng()) < params.crossover_probability)
+            std::copy(population.genome(p1), population.genome(p1) + int_vector_size, c1);
+            std::copy(population.genome(p2), population.genome(p2) + int_vector_size, c2);
+            if (u01(random) < params.crossover_probability)
             {
                 // Adaptive crossover points: more early on, fewer later
                 double progress = static_cast<double>(gen) / params.max_iterations;
@@ -475,10 +698,11 @@ int optimize(int int_vector_size, int* int_vector, std::function<double(int, int
                 int num_cuts = static_cast<int>((1.0 - progress) * max_points);
                 num_cuts = std::max(1, num_cuts); // always at least 1 point
 
-                std::vector<bool> crossover_mask(int_vector_size, false);
+                thread_local std::vector<char> crossover_mask;
+                crossover_mask.assign(int_vector_size, 0);
                 for (int i = 0; i < num_cuts; ++i)
                 {
-                    int cut = std::uniform_int_distribution<int>(0, int_vector_size - 1)(rng());
+                    int cut = std::uniform_int_distribution<int>(0, int_vector_size - 1)(random);
                     crossover_mask[cut] = true;
                 }
 
@@ -499,15 +723,15 @@ int optimize(int int_vector_size, int* int_vector, std::function<double(int, int
                 int max_gene = n_units + 2;
                 int range = max_gene - min_gene + 1;
                 std::uniform_int_distribution<int> step_dist(-params.mutation_step_size, params.mutation_step_size);
-                for (auto* child : {&c1, &c2})
+                for (int* child : {c1, c2})
                 {
                     for (int j = 0; j < int_vector_size; ++j)
                     {
-                        if (u01(rng()) < params.mutation_probability)
+                        if (u01(random) < params.mutation_probability)
                         {
-                            int step = step_dist(rng());
-                            int val = (*child)[j] + step;
-                            (*child)[j] = min_gene + ((val - min_gene) % range + range) % range;
+                            int step = step_dist(random);
+                            int val = child[j] + step;
+                            child[j] = min_gene + ((val - min_gene) % range + range) % range;
                         }
                     }
                 }
@@ -517,40 +741,109 @@ int optimize(int int_vector_size, int* int_vector, std::function<double(int, int
                 {
                     // pick two indices a < b
                     std::uniform_int_distribution<int> a_dist(0, int_vector_size - 2);
-                    int a = a_dist(rng());
+                    int a = a_dist(random);
                     std::uniform_int_distribution<int> b_dist(a + 1, int_vector_size - 1);
-                    int b = b_dist(rng());
+                    int b = b_dist(random);
 
                     // reverse that slice in each child with its own probability
-                    if (u01(rng()) < params.inversion_probability)
+                    if (u01(random) < params.inversion_probability)
                     {
-                        std::reverse(c1.begin() + a, c1.begin() + b + 1);
+                        std::reverse(c1 + a, c1 + b + 1);
                     }
-                    if (u01(rng()) < params.inversion_probability)
+                    if (u01(random) < params.inversion_probability)
                     {
-                        std::reverse(c2.begin() + a, c2.begin() + b + 1);
+                        std::reverse(c2 + a, c2 + b + 1);
+                    }
+                }
+            }
+        };
+
+        // 2c) Fill rest via selection, crossover, mutation, in PARALLEL. Every pair of children is bred from
+        // its own random stream, keyed by the generation and the pair's slot, and the screen judges every
+        // circuit on its own, so the children come out the same on any number of threads however the
+        // blocks are split. Children failing the screen are repaired (see repair_circuit) with probability
+        // repair_probability, each from a stream of its own, and screened again. The valid children are added
+        // in slot order until the population is full; if too few pass, another round continues the slot
+        // numbers. The last round repairs every failing child, and if the screen still rejects some, the
+        // population is topped up with tournament-selected parents. Repairing every child would fill the
+        // population with the repaired ones, which are far worse on average than children valid as bred.
+        const int max_rounds = 8;
+        size_t slot = 0; // pairs bred in this generation
+        for (int round = 0; next.size() < pop_size; ++round)
+        {
+            if (round == max_rounds)
+            {
+                Philox random(run, gen, static_cast<uint32_t>(slot), OFFSPRING_STREAM);
+                while (next.size() < pop_size)
+                    next.push_back(population, pick_parent(random));
+                break;
+            }
+
+            const size_t missing = pop_size - next.size();
+            const size_t count = missing + (missing & 1); // children, in pairs
+            const size_t per_thread = (count + omp_get_max_threads() - 1) / omp_get_max_threads();
+            const size_t block = std::clamp<size_t>(per_thread + (per_thread & 1), 2, 64);
+            const int blocks = static_cast<int>((count + block - 1) / block);
+            children.resize(count * int_vector_size);
+            child_parent.resize(count);
+            accepted.resize(blocks);
+            failed.resize(blocks);
+
+#pragma omp parallel for schedule(dynamic)
+            for (int b = 0; b < blocks; ++b)
+            {
+                const size_t first = b * block, last = std::min(count, first + block);
+                for (size_t c = first; c < last; c += 2)
+                {
+                    Philox random(run, gen, static_cast<uint32_t>(slot + c / 2), OFFSPRING_STREAM);
+                    int* c1 = children.data() + c * int_vector_size;
+                    breed(random, c1, c1 + int_vector_size, child_parent[c], child_parent[c + 1]);
+                }
+                const int in_block = static_cast<int>(last - first);
+                int* block_children = children.data() + first * int_vector_size;
+                accepted[b] = screen(in_block, int_vector_size, block_children);
+                failed[b] = ~accepted[b] & (~uint64_t(0) >> (64 - in_block));
+                bool repaired = false;
+                for (size_t c = first; c < last; ++c)
+                {
+                    if ((failed[b] >> (c - first)) & 1)
+                    {
+                        Philox random(run, gen, static_cast<uint32_t>(2 * slot + c), REPAIR_STREAM);
+                        if (round == max_rounds - 1 ||
+                            std::uniform_real_distribution<double>(0.0, 1.0)(random) < params.repair_probability)
+                        {
+                            repair_circuit(n_units, children.data() + c * int_vector_size, random);
+                            repaired = true;
+                        }
                     }
                 }
+                if (repaired)
+                    accepted[b] = screen(in_block, int_vector_size, block_children);
             }
+            slot += count / 2;
 
-            // Check validity of children and add valid ones
-            if (validity(int_vector_size, c1.data()))
+            children_bred += count;
+            for (size_t c = 0; c < count; ++c)
             {
-                next_gen.push_back(std::move(c1));
+                const bool failed_as_bred = (failed[c / block] >> (c % block)) & 1;
+                children_failed += failed_as_bred;
+                children_repaired += failed_as_bred && ((accepted[c / block] >> (c % block)) & 1);
             }
 
-            if (next_gen.size() < population.size() && validity(int_vector_size, c2.data()))
+            // Add the children that pass the screen
+            for (size_t c = 0; c < count && next.size() < pop_size; ++c)
             {
-                next_gen.push_back(std::move(c2));
+                if ((accepted[c / block] >> (c % block)) & 1)
+                    next.push_back(children.data() + c * int_vector_size, population.state(child_parent[c]));
             }
         }
 
         // 2d) Replace population
-        population.swap(next_gen);
+        population.swap(next);
 
         if (params.verbose && gen % 10 == 0)
         {
-            std::cout << "[GA] Gen " << gen << " best fitness " << *std::max_element(fitnesses.begin(), fitnesses.end())
+            std::cout << "[GA] Gen " << gen << " best fitness " << gen_best
                       << " (thread utilization: " << omp_get_max_threads() << " cores)" << "\n";
         }
     }
@@ -559,33 +852,34 @@ int optimize(int int_vector_size, int* int_vector, std::function<double(int, int
     // (Re-evaluate final fitness to find the winner) - Also parallel!
     double best_fit = -1e12;
     size_t best_idx = 0;
-    std::vector<double> final_fitnesses(population.size());
 
 #pragma omp parallel for schedule(dynamic)
-    for (size_t i = 0; i < population.size(); ++i)
+    for (size_t i = 0; i < pop_size; ++i)
     {
-        final_fitnesses[i] = func(int_vector_size, population[i].data());
+        population.fitness(i) = fitness_of(i);
     }
 
     // Find best (sequential)
-    for (size_t i = 0; i < population.size(); ++i)
+    for (size_t i = 0; i < pop_size; ++i)
     {
-        if (final_fitnesses[i] > best_fit)
+        if (population.fitness(i) > best_fit)
         {
-            best_fit = final_fitnesses[i];
+            best_fit = population.fitness(i);
             best_idx = i;
         }
     }
 
     // Copy best solution
-    for (int i = 0; i < int_vector_size; ++i)
-    {
-        int_vector[i] = population[best_idx][i];
-    }
+    std::copy(population.genome(best_idx), population.genome(best_idx) + int_vector_size, int_vector);
 
     // Store optimization results
-    last_result.best_fitness = best_fit;
-    last_result.generations = params.max_iterations;
+    result.best_fitness = best_fit;
+    result.generations = params.max_iterations;
+    result.cache_hits = cache.hits();
+    result.cache_misses = cache.misses();
+    result.children = children_bred;
+    result.rejection_rate = children_bred > 0 ? static_cast<double>(children_failed) / children_bred : 0.0;
+    result.repair_rate = children_failed > 0 ? static_cast<double>(children_repaired) / children_failed : 0.0;
 
     auto t1 = Clock::now();
     if (params.verbose)
@@ -593,51 +887,315 @@ int optimize(int int_vector_size, int* int_vector, std::function<double(int, int
         double secs = std::chrono::duration<double>(t1 - t0).count();
         std::cout << "[GA] Completed in " << secs << "s, best_fitness=" << best_fit << " (using "
                   << omp_get_max_threads() << " parallel threads)" << "\n";
+        std::cout << "[GA] " << children_bred << " children, " << 100.0 * result.rejection_rate
+                  << "% failing the screen, " << 100.0 * result.repair_rate << "% of those repaired" << "\n";
     }
 
     return 0;
 }
 
+/**
+ * @brief Optimize a discrete vector using a genetic algorithm
+ *
+ * This function optimizes a discrete vector using a genetic algorithm.
+ * It evaluates the fitness of the population in parallel and applies
+ * selection, crossover, and mutation to generate new populations.
+ *
+ * Every genome carries a state for func: its parent's state for a new
+ * child (the child usually differs from it in a few genes), or its own for
+ * a survivor. With the converged flows of the mass balance as state, most
+ * evaluations start close to their steady state; a warm evaluation that
+ * fails or reaches the best fitness so far is repeated with an empty state
+ * (see optimize_int). New circuits are screened by validity, one at a time
+ * or in batches of up to 64 (e.g. with CircuitScreen). Unless func checks
+ * the circuits itself (a fused evaluation such as evaluate_circuit, which
+ * solves the mass balance once), every genome is also checked by validity
+ * before it is scored.
+ *
+ * @param int_vector_size Size of the integer vector
+ * @param int_vector Pointer to the integer vector
+ * @param func Function to evaluate the fitness of the circuit
+ * @param validity Function to check the validity of the circuit
+ * @param params Algorithm parameters for the optimization process
+ *
+ * @return The best fitness value found during optimization
+ */
+int optimize(int int_vector_size, int* int_vector, Discrete_Evaluator func, Discrete_Screen validity,
+             Algorithm_Parameters params)
+{
+    if (!validity)
+        validity = all_true_ints;
+    if (func.checks_validity)
+        return optimize_int(int_vector_size, int_vector, func.evaluate, validity, params);
+
+    auto evaluate = [&](int n, int* v, std::vector<double>& state)
+    { return (validity(1, n, v) & 1) ? func.evaluate(n, v, state) : Genome_Evaluation{false, 0.0}; };
+    return optimize_int(int_vector_size, int_vector, evaluate, validity, params);
+}
+
 // ********************************************************************
 // 2) Continuous-only optimize with PARALLEL fitness evaluation
 // ********************************************************************
 
+// Fitness of every genome of a population, from and updating the states carried with the genomes;
+// invalid genomes get -1e9 if check_validity is set
+using Population_Evaluator = std::function<void(Population<double>&, bool check_validity)>;
+
 /**
- * @brief Optimize a continuous vector using a genetic algorithm
+ * @brief Refine the best genomes of the final population by projected L-BFGS
  *
- * This function optimizes a continuous vector using a genetic algorithm.
- * It evaluates the fitness of the population in parallel and applies
- * selection, crossover, and mutation to generate new populations.
+ * The params.refine_elite_count best distinct valid genomes climb to their
+ * nearest local optimum on [0,1]^n (refine_in_box). With an analytic
+ * gradient the elites are refined in parallel. Without one, every gradient
+ * comes from central differences: the genome and its 2n neighbours are
+ * evaluated as one population, in parallel, and the elites take turns;
+ * points where the refinement only needs the value are evaluated alone.
+ *
+ * Every evaluation starts cold. The best genomes of a run tend to lie
+ * where a warm-started mass balance still converges and a cold one no
+ * longer does, and a refinement from warm states would climb straight out
+ * of the region the cold verdicts accept. A refined genome replaces its
+ * elite if its fitness is higher.
+ *
+ * @param size Number of genes
+ * @param population Final population with its cold-started fitnesses; refined genomes, states and fitnesses
+ *                   written back
+ * @param evaluate Population evaluator of the GA
+ * @param gradient Fitness and gradient of a genome, or empty for finite differences
+ * @param params Algorithm parameters (refine_elite_count, refine_iterations)
+ *
+ * @return Number of elites improved
+ */
+static int refine_elites(int size, Population<double>& population, const Population_Evaluator& evaluate,
+                         const Continuous_Gradient& gradient, const Algorithm_Parameters& params)
+{
+    // Best distinct valid genomes
+    std::vector<size_t> order(population.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(),
+              [&](size_t a, size_t b) { return population.fitness(a) > population.fitness(b); });
+    std::vector<size_t> elites;
+    for (size_t i : order)
+    {
+        if (static_cast<int>(elites.size()) >= params.refine_elite_count || population.fitness(i) <= -1e9)
+            break;
+        bool duplicate = false;
+        for (size_t e : elites)
+            duplicate =
+                duplicate || std::equal(population.genome(e), population.genome(e) + size, population.genome(i));
+        if (!duplicate)
+            elites.push_back(i);
+    }
+    const int count = static_cast<int>(elites.size());
+    Population<double> refined(size, count);
+    for (int k = 0; k < count; ++k)
+        refined.push_back(population.genome(elites[k]), {});
+
+    if (gradient)
+    {
+#pragma omp parallel for schedule(dynamic)
+        for (int k = 0; k < count; ++k)
+        {
+            std::vector<double> unused(size); // gradient of value-only evaluations
+            Box_Objective objective = [&, k](const double* x, double& value, double* grad)
+            {
+                refined.state(k).clear();
+                Genome_Evaluation e =
+                    gradient(size, const_cast<double*>(x), grad != nullptr ? grad : unused.data(), refined.state(k));
+                value = e.fitness;
+                return e.valid;
+            };
+            refine_in_box(size, refined.genome(k), objective, params.refine_iterations);
+        }
+    }
+    else
+    {
+        const double h = 1e-3; // well above the noise of a mass balance converged to its tolerance
+        Population<double> points(size, 2 * size + 1);
+        for (int k = 0; k < count; ++k)
+        {
+            Box_Objective objective = [&](const double* x, double& value, double* grad)
+            {
+                const int count = grad != nullptr ? 2 * size + 1 : 1;
+                points.resize(count);
+                for (int j = 0; j < count; ++j)
+                {
+                    std::copy(x, x + size, points.genome(j));
+                    points.state(j).clear();
+                }
+                for (int i = 0; grad != nullptr && i < size; ++i)
+                {
+                    points.genome(1 + 2 * i)[i] = std::min(x[i] + h, 1.0);
+                    points.genome(2 + 2 * i)[i] = std::max(x[i] - h, 0.0);
+                }
+                evaluate(points, true);
+                if (points.fitness(0) <= -1e9)
+                    return false;
+                value = points.fitness(0);
+                if (grad == nullptr)
+                    return true;
+
+                // Widest valid difference around each gene, one-sided at the bounds
+                for (int i = 0; i < size; ++i)
+                {
+                    const bool up = points.fitness(1 + 2 * i) > -1e9 && points.genome(1 + 2 * i)[i] > x[i];
+                    const bool down = points.fitness(2 + 2 * i) > -1e9 && points.genome(2 + 2 * i)[i] < x[i];
+                    const double right = up ? points.genome(1 + 2 * i)[i] : x[i];
+                    const double left = down ? points.genome(2 + 2 * i)[i] : x[i];
+                    const double f_right = up ? points.fitness(1 + 2 * i) : value;
+                    const double f_left = down ? points.fitness(2 + 2 * i) : value;
+                    grad[i] = right > left ? (f_right - f_left) / (right - left) : 0.0;
+                }
+                return true;
+            };
+            refine_in_box(size, refined.genome(k), objective, params.refine_iterations);
+        }
+    }
+
+    // Keep the refined genomes that are better
+    for (int k = 0; k < count; ++k)
+        refined.state(k).clear();
+    evaluate(refined, true);
+    int improved = 0;
+    for (int k = 0; k < count; ++k)
+    {
+        const size_t e = elites[k];
+        if (refined.fitness(k) > population.fitness(e))
+        {
+            std::copy(refined.genome(k), refined.genome(k) + size, population.genome(e));
+            population.state(e).swap(refined.state(k));
+            population.fitness(e) = refined.fitness(k);
+            ++improved;
+        }
+    }
+    return improved;
+}
+
+/**
+ * @brief Genetic algorithm on a continuous vector
+ *
+ * Shared by the continuous optimize overloads, which only differ in how a
+ * population is evaluated. Applies selection, crossover, and mutation to
+ * generate new populations. Every genome carries a state for the evaluator;
+ * children start from the state of their first parent, and as in
+ * optimize_int a warm evaluation that fails or reaches the best fitness seen
+ * so far is repeated from an empty state, which decides. Genomes whose
+ * fitness is in the cache are left out of the population handed to the
+ * evaluator, which then only sees the genomes it has not scored before.
+ * As in optimize_int, the generations are two Populations that swap roles,
+ * and children are bred in parallel from random streams of their own.
+ * After the final pass the best genomes can be refined by a local
+ * gradient method (refine_elites). Island-model runs go through
+ * run_islands as in optimize_int.
  *
  * @param real_vector_size Size of the real vector
  * @param real_vector Pointer to the real vector
- * @param func Function to evaluate the fitness of the circuit
+ * @param evaluate Function to evaluate the fitness of a population
+ * @param gradient Fitness and gradient of a genome for the refinement, or empty for finite differences
  * @param validity Function to check the validity of the circuit
  * @param params Algorithm parameters for the optimization process
+ * @param island Island of an island-model run the population lives on, or nullptr
  *
  * @return The best fitness value found during optimization
  */
-int optimize(int real_vector_size, double* real_vector, std::function<double(int, double*)> func,
-             std::function<bool(int, double*)> validity, Algorithm_Parameters params)
+static int optimize_real(int real_vector_size, double* real_vector, const Population_Evaluator& evaluate,
+                         const Continuous_Gradient& gradient, std::function<bool(int, double*)> validity,
+                         Algorithm_Parameters params, Island<double>* island = nullptr)
 {
+    if (island == nullptr && params.island_count > 1)
+    {
+        auto run_island = [&](double* best, const Algorithm_Parameters& island_params, Island<double>& island)
+        { optimize_real(real_vector_size, best, evaluate, gradient, validity, island_params, &island); };
+        run_islands<double>(real_vector_size, real_vector, params, run_island);
+        return 0;
+    }
+    OptimizationResult& result = island != nullptr ? island->result : last_result;
+
     using Clock = std::chrono::high_resolution_clock;
     auto t0 = Clock::now();
 
-    std::cout << "OpenMP: Using " << omp_get_max_threads() << " threads for continuous optimization" << std::endl;
+    if (island == nullptr || island->index == 0)
+        std::cout << "OpenMP: Using " << omp_get_max_threads() << " threads for continuous optimization"
+                  << std::endl;
 
-    std::uniform_real_distribution<double> dist01(0.0, 1.0);
-    std::vector<std::vector<double>> population;
+    const size_t pop_size = params.population_size;
+    Population<double> population(real_vector_size, pop_size), next(real_vector_size, pop_size);
 
     // --- 1. Initialise population
-    population.reserve(params.population_size);
-    while (population.size() < params.population_size)
+    std::uniform_real_distribution<double> dist01(0.0, 1.0);
+    std::vector<double> genome(real_vector_size);
+    while (population.size() < pop_size)
     {
-        std::vector<double> genome(real_vector_size);
         for (auto& g : genome)
             g = dist01(rng()); // all β_i in [0,1]
         if (validity(real_vector_size, genome.data()))
-            population.push_back(std::move(genome));
+            population.push_back(genome.data(), {});
     }
+    const uint64_t run = run_key();
+
+    // Evaluate a population, then the genomes whose warm evaluation failed or reached best_seen once more,
+    // as one population from empty states
+    double best_seen = -1e300; // best fitness of the generations evaluated so far
+    std::vector<char> warm;
+    Population<double> cold(real_vector_size, pop_size);
+    std::vector<size_t> cold_at;
+    auto evaluate_checked = [&](Population<double>& genomes, bool check_validity)
+    {
+        warm.resize(genomes.size());
+        for (size_t i = 0; i < genomes.size(); ++i)
+            warm[i] = !genomes.state(i).empty();
+        evaluate(genomes, check_validity);
+        cold.clear();
+        cold_at.clear();
+        for (size_t i = 0; i < genomes.size(); ++i)
+        {
+            if (warm[i] && (genomes.fitness(i) <= -1e9 || genomes.fitness(i) >= best_seen))
+            {
+                cold_at.push_back(i);
+                cold.push_back(genomes.genome(i), {});
+            }
+        }
+        if (cold.empty())
+            return;
+        evaluate(cold, check_validity);
+        for (size_t k = 0; k < cold.size(); ++k)
+        {
+            genomes.fitness(cold_at[k]) = cold.fitness(k);
+            genomes.state(cold_at[k]).swap(cold.state(k));
+        }
+    };
+
+    // Evaluate the genomes missing from the cache as one population, their states swapped in and out
+    Fitness_Cache cache(params.fitness_cache_size, real_vector_size * sizeof(double));
+    Population<double> missed(real_vector_size, pop_size);
+    std::vector<size_t> missed_at;
+    auto evaluate_cached = [&](bool check_validity)
+    {
+        if (!cache.enabled())
+        {
+            evaluate_checked(population, check_validity);
+            return;
+        }
+        missed.clear();
+        missed_at.clear();
+        for (size_t i = 0; i < pop_size; ++i)
+        {
+            if (cache.find(population.genome(i), population.fitness(i)))
+                continue;
+            missed_at.push_back(i);
+            missed.push_back(population.genome(i), {});
+            missed.state(missed.size() - 1).swap(population.state(i));
+        }
+        if (missed.empty())
+            return;
+        evaluate_checked(missed, check_validity);
+        for (size_t k = 0; k < missed.size(); ++k)
+        {
+            population.fitness(missed_at[k]) = missed.fitness(k);
+            population.state(missed_at[k]).swap(missed.state(k));
+            cache.insert(missed.genome(k), missed.fitness(k));
+        }
+    };
 
     double best_overall = -1e300;
     int stall_count = 0;
@@ -647,16 +1205,17 @@ int optimize(int real_vector_size, double* real_vector, std::function<double(int
     for (int gen = 0; gen < params.max_iterations; ++gen)
     {
         // PARALLEL fitness evaluation
-        std::vector<double> fitnesses(population.size());
-
-#pragma omp parallel for schedule(dynamic)
-        for (size_t i = 0; i < population.size(); ++i)
+        evaluate_cached(true);
+        if (island != nullptr)
         {
-            fitnesses[i] =
-                validity(real_vector_size, population[i].data()) ? func(real_vector_size, population[i].data()) : -1e9;
+            Philox random(run, gen, island->index, MIGRATION_STREAM);
+            island->migrate(gen, population, random);
         }
+        const double* fitnesses = population.fitnesses();
 
-        double gen_best = *std::max_element(fitnesses.begin(), fitnesses.end());
+        const size_t best_idx = population.best();
+        double gen_best = fitnesses[best_idx];
+        best_seen = std::max(best_seen, gen_best);
         if (gen_best > best_overall + eps)
         {
             best_overall = gen_best;
@@ -675,44 +1234,52 @@ int optimize(int real_vector_size, double* real_vector, std::function<double(int
         }
 
         // Elitism
-        std::vector<std::vector<double>> next_gen;
-        {
-            auto best_it = std::max_element(fitnesses.begin(), fitnesses.end());
-            size_t best_idx = std::distance(fitnesses.begin(), best_it);
-            next_gen.push_back(population[best_idx]);
-        }
+        next.clear();
+        next.push_back(population, best_idx);
 
         // Tournament selection
         int k = params.tournament_size > 0 ? params.tournament_size : 2;
-        std::uniform_int_distribution<size_t> pop_dist(0, population.size() - 1);
-        auto pick_parent = [&]()
+        auto pick_parent = [&](Philox& random)
         {
-            size_t best = pop_dist(rng());
+            std::uniform_int_distribution<size_t> pop_dist(0, pop_size - 1);
+            size_t best = pop_dist(random);
             double best_fit = fitnesses[best];
             for (int i = 1; i < k; ++i)
             {
-                size_t idx = pop_dist(rng());
+                size_t idx = pop_dist(random);
                 if (fitnesses[idx] > best_fit)
                 {
                     best = idx;
                     best_fit = fitnesses[idx];
                 }
             }
-            return population[best];
+            return best;
         };
 
-        // Crossover + Mutation
-        while (next_gen.size() < population.size())
+        // Crossover + Mutation, in PARALLEL: pair p breeds children 1 + 2p and 2 + 2p in place, from a
+        // random stream keyed by the generation and p as in optimize_int
+        next.resize(pop_size);
+        const int pairs = static_cast<int>(pop_size / 2);
+#pragma omp parallel for schedule(static)
+        for (int pair = 0; pair < pairs; ++pair)
         {
-            auto p1 = pick_parent();
-            auto p2 = pick_parent();
-            std::vector<double> c1 = p1, c2 = p2;
-
-            if (dist01(rng()) < params.crossover_probability)
+            Philox random(run, gen, pair, OFFSPRING_STREAM);
+            std::uniform_real_distribution<double> dist01(0.0, 1.0);
+            thread_local std::vector<double> spare; // second child of the last pair if the population is full
+            spare.resize(real_vector_size);
+            const size_t i1 = 1 + 2 * static_cast<size_t>(pair), i2 = i1 + 1;
+            double* c1 = next.genome(i1);
+            double* c2 = i2 < pop_size ? next.genome(i2) : spare.data();
+
+            size_t p1 = pick_parent(random);
+            size_t p2 = pick_parent(random);
+            std::copy(population.genome(p1), population.genome(p1) + real_vector_size, c1);
+            std::copy(population.genome(p2), population.genome(p2) + real_vector_size, c2);
+            if (dist01(random) < params.crossover_probability)
             {
                 for (int j = 0; j < real_vector_size; ++j)
                 {
-                    if (dist01(rng()) < 0.5)
+                    if (dist01(random) < 0.5)
                         std::swap(c1[j], c2[j]);
                 }
             }
@@ -720,15 +1287,15 @@ int optimize(int real_vector_size, double* real_vector, std::function<double(int
             // Mutation
             for (int j = 0; j < real_vector_size; ++j)
             {
-                if (dist01(rng()) < params.mutation_probability)
+                if (dist01(random) < params.mutation_probability)
                 {
-                    double step = dist01(rng()) * params.mutation_step_size;
-                    c1[j] = std::clamp(c1[j] + step * (dist01(rng()) < 0.5 ? -1 : 1), 0.0, 1.0);
+                    double step = dist01(random) * params.mutation_step_size;
+                    c1[j] = std::clamp(c1[j] + step * (dist01(random) < 0.5 ? -1 : 1), 0.0, 1.0);
                 }
-                if (dist01(rng()) < params.mutation_probability)
+                if (dist01(random) < params.mutation_probability)
                 {
-                    double step = dist01(rng()) * params.mutation_step_size;
-                    c2[j] = std::clamp(c2[j] + step * (dist01(rng()) < 0.5 ? -1 : 1), 0.0, 1.0);
+                    double step = dist01(random) * params.mutation_step_size;
+                    c2[j] = std::clamp(c2[j] + step * (dist01(random) < 0.5 ? -1 : 1), 0.0, 1.0);
                 }
             }
 
@@ -740,28 +1307,28 @@ int optimize(int real_vector_size, double* real_vector, std::function<double(int
                                                                   params.scaling_mutation_max);
 
                 // Child 1
-                if (dist01(rng()) < params.scaling_mutation_prob)
+                if (dist01(random) < params.scaling_mutation_prob)
                 {
-                    int idx = idx_dist(rng());
-                    double factor = scale_dist(rng());
+                    int idx = idx_dist(random);
+                    double factor = scale_dist(random);
                     c1[idx] = std::clamp(c1[idx] * factor, 0.0, 1.0);
                 }
 
                 // Child 2
-                if (dist01(rng()) < params.scaling_mutation_prob)
+                if (dist01(random) < params.scaling_mutation_prob)
                 {
-                    int idx = idx_dist(rng());
-                    double factor = scale_dist(rng());
+                    int idx = idx_dist(random);
+                    double factor = scale_dist(random);
                     c2[idx] = std::clamp(c2[idx] * factor, 0.0, 1.0);
                 }
             }
 
-            next_gen.push_back(std::move(c1));
-            if (next_gen.size() < population.size())
-                next_gen.push_back(std::move(c2));
+            next.state(i1) = population.state(p1);
+            if (i2 < pop_size)
+                next.state(i2) = population.state(p2);
         }
 
-        population.swap(next_gen);
+        population.swap(next);
 
         if (params.verbose && gen % (params.max_iterations / 10) == 0)
         {
@@ -773,33 +1340,39 @@ int optimize(int real_vector_size, double* real_vector, std::function<double(int
     // PARALLEL final evaluation
     double best_fit = -1e12;
     size_t best_idx = 0;
-    std::vector<double> final_fitnesses(population.size());
+    evaluate_cached(false);
 
-#pragma omp parallel for schedule(dynamic)
-    for (size_t i = 0; i < population.size(); ++i)
+    // Optional memetic step: climb the rest of the way from the best genomes
+    double refinement_gain = 0.0;
+    if (params.refine_elite_count > 0)
     {
-        final_fitnesses[i] = func(real_vector_size, population[i].data());
+        const double before = population.fitness(population.best());
+        const int improved = refine_elites(real_vector_size, population, evaluate, gradient, params);
+        refinement_gain = population.fitness(population.best()) - before;
+        if (params.verbose)
+            std::cout << "[GA-Real] Refined " << improved << " elites, best fitness " << before << " -> "
+                      << before + refinement_gain << "\n";
     }
 
     // Find best (sequential)
-    for (size_t i = 0; i < population.size(); ++i)
+    for (size_t i = 0; i < pop_size; ++i)
     {
-        if (final_fitnesses[i] > best_fit)
+        if (population.fitness(i) > best_fit)
         {
-            best_fit = final_fitnesses[i];
+            best_fit = population.fitness(i);
             best_idx = i;
         }
     }
 
     // Copy best solution
-    for (int i = 0; i < real_vector_size; ++i)
-    {
-        real_vector[i] = population[best_idx][i];
-    }
+    std::copy(population.genome(best_idx), population.genome(best_idx) + real_vector_size, real_vector);
 
     // Store optimization results
-    last_result.best_fitness = best_fit;
-    last_result.generations = params.max_iterations - stall_count;
+    result.best_fitness = best_fit;
+    result.generations = params.max_iterations - stall_count;
+    result.cache_hits = cache.hits();
+    result.cache_misses = cache.misses();
+    result.refinement_gain = refinement_gain;
 
     auto t1 = Clock::now();
     if (params.verbose)
@@ -812,6 +1385,82 @@ int optimize(int real_vector_size, double* real_vector, std::function<double(int
     return 0;
 }
 
+/**
+ * @brief Optimize a continuous vector using a genetic algorithm
+ *
+ * This function optimizes a continuous vector using a genetic algorithm.
+ * It evaluates the fitness of the population in parallel and applies
+ * selection, crossover, and mutation to generate new populations.
+ *
+ * A per-genome func is called in parallel with the state carried by the
+ * genome: its parent's state for a new child, or its own for a survivor.
+ * Children differ from their parents by small steps, so a mass balance
+ * started from the parent's converged flows needs far fewer iterations; a
+ * warm evaluation that fails or reaches the best fitness so far is repeated
+ * with an empty state (see optimize_real). A population func gets every
+ * generation in one call, as count genomes one after another, so it can
+ * evaluate them together (e.g. CompiledCircuit::evaluate_batch), while the
+ * validity of each genome is still checked in parallel. Invalid genomes get
+ * the -1e9 penalty. The refinement of the final elites
+ * (Algorithm_Parameters::refine_elite_count) uses the gradient of func if
+ * it has one, and finite differences otherwise.
+ *
+ * @param real_vector_size Size of the real vector
+ * @param real_vector Pointer to the real vector
+ * @param func Function to evaluate the fitness of the circuit
+ * @param validity Function to check the validity of the circuit
+ * @param params Algorithm parameters for the optimization process
+ *
+ * @return The best fitness value found during optimization
+ */
+int optimize(int real_vector_size, double* real_vector, Continuous_Evaluator func,
+             std::function<bool(int, double*)> validity, Algorithm_Parameters params)
+{
+    if (!validity)
+        validity = all_true_reals;
+
+    Population_Evaluator evaluate;
+    if (func.population)
+    {
+        evaluate = [&](Population<double>& population, bool check_validity)
+        {
+            const int count = static_cast<int>(population.size());
+            std::vector<char> valid(count, 1); // per call, as the islands of a run evaluate at the same time
+            if (check_validity)
+            {
+#pragma omp parallel for schedule(dynamic)
+                for (int i = 0; i < count; ++i)
+                    valid[i] = validity(real_vector_size, population.genome(i));
+            }
+
+            // The genomes already lie one after another
+            func.population(count, real_vector_size, population.genomes(), population.fitnesses());
+            for (int i = 0; i < count; ++i)
+            {
+                if (!valid[i])
+                    population.fitness(i) = -1e9;
+            }
+        };
+    }
+    else
+    {
+        evaluate = [&](Population<double>& population, bool)
+        {
+#pragma omp parallel for schedule(dynamic)
+            for (size_t i = 0; i < population.size(); ++i)
+            {
+                Genome_Evaluation e = func.checks_validity || validity(real_vector_size, population.genome(i))
+                                          ? func.evaluate(real_vector_size, population.genome(i), population.state(i))
+                                          : Genome_Evaluation{false, 0.0};
+                if (!e.valid)
+                    population.state(i).clear(); // not handed on to children
+                population.fitness(i) = e.valid ? e.fitness : -1e9;
+            }
+        };
+    }
+    return optimize_real(real_vector_size, real_vector, evaluate, func.gradient, validity, params);
+}
+
 // ********************************************************************
 // 3) Hybrid optimize with sequential approach but parallel evaluations
 // ********************************************************************
@@ -823,41 +1472,51 @@ int optimize(int real_vector_size, double* real_vector, std::function<double(int
  * algorithm. It evaluates the fitness of the population in parallel and applies
  * selection, crossover, and mutation to generate new populations.
  *
+ * The discrete phase optimizes the circuit at the current volumes, the
+ * continuous phase then the volumes of the best circuit; both carry a state
+ * with every genome as the discrete and continuous optimize do. The
+ * discrete phase screens new circuits with the screen of func if it has
+ * one (e.g. CircuitScreen), and with hybrid_validity otherwise.
+ *
  * @param int_vector_size Size of the integer vector
  * @param int_vector Pointer to the integer vector
  * @param real_vector_size Size of the real vector
  * @param real_vector Pointer to the real vector
- * @param hybrid_func Function to evaluate the fitness of the circuit
+ * @param func Function to evaluate the fitness of the circuit
  * @param hybrid_validity Function to check the validity of the circuit
  * @param params Algorithm parameters for the optimization process
  *
  * @return The best fitness value found during optimization
  */
-int optimize(int int_vector_size, int* int_vector, int real_vector_size, double* real_vector,
-             std::function<double(int, int*, int, double*)> hybrid_func,
+int optimize(int int_vector_size, int* int_vector, int real_vector_size, double* real_vector, Mixed_Evaluator func,
              std::function<bool(int, int*, int, double*)> hybrid_validity, Algorithm_Parameters params)
 {
-
     std::cout << "OpenMP: Using " << omp_get_max_threads() << " threads for hybrid optimization" << std::endl;
 
-    // Discrete step: optimize only int vector
-    auto wrapped_func_int = [&](int n, int* v)
+    if (!hybrid_validity)
+        hybrid_validity = all_true;
+
+    // Discrete step: optimize only int vector, at the current real_vector. The cache keys carry the
+    // volumes with the renumbered units; volumes that are not one per unit are left out of them.
+    auto wrapped_valid_int = [&](int n, int* v) { return hybrid_validity(n, v, real_vector_size, real_vector); };
+    Discrete_Evaluation evaluate_int = [&](int n, int* v, std::vector<double>& state)
     {
-        return hybrid_func(n, v, real_vector_size,
-                           real_vector); // current real_vector
+        if (!func.checks_validity && !wrapped_valid_int(n, v))
+            return Genome_Evaluation{false, 0.0};
+        return func.evaluate(n, v, real_vector_size, real_vector, state);
     };
-    auto wrapped_valid_int = [&](int n, int* v) { return hybrid_validity(n, v, real_vector_size, real_vector); };
+    Discrete_Screen screen = func.screen ? func.screen : Discrete_Screen(wrapped_valid_int);
 
-    optimize(int_vector_size, int_vector, wrapped_func_int, wrapped_valid_int, params);
+    optimize_int(int_vector_size, int_vector, evaluate_int, screen, params,
+                 real_vector_size == (int_vector_size - 1) / 2 ? real_vector : nullptr);
 
-    // Continuous step: optimize only real vector
-    auto wrapped_func_real = [&](int n, double* r)
-    {
-        return hybrid_func(int_vector_size, int_vector, n, r); // fixed int_vector
-    };
+    // Continuous step: optimize only real vector, for the fixed int_vector
+    Continuous_Evaluator evaluate_real([&](int n, double* r, std::vector<double>& state)
+                                       { return func.evaluate(int_vector_size, int_vector, n, r, state); });
+    evaluate_real.checks_validity = func.checks_validity;
     auto wrapped_valid_real = [&](int n, double* r) { return hybrid_validity(int_vector_size, int_vector, n, r); };
 
-    optimize(real_vector_size, real_vector, wrapped_func_real, wrapped_valid_real, params);
+    optimize(real_vector_size, real_vector, evaluate_real, wrapped_valid_real, params);
 
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,250 @@
+/**
+ * @file Local_Refinement.cpp
+ * @brief Implementation of the projected L-BFGS refinement on [0,1]^n
+ *
+ * The method minimises the negated objective. The direction comes from the
+ * two-loop recursion over the last few steps and gradient changes, applied
+ * to the gradient with the genes held at a bound removed; steps are
+ * projected onto the box and halved until the value decreases enough
+ * (Armijo condition on the projected step).
+ */
+#include "Local_Refinement.h"
+
+#include <algorithm>
+#include <cmath>
+#include <deque>
+#include <limits>
+#include <vector>
+
+/**
+ * @brief Maximise an objective over the box [0,1]^n
+ *
+ * The first step moves no gene by more than 0.1; later steps are scaled by
+ * the curvature of the last step and move no gene by more than twice as
+ * far as the last step did. Steps whose change of gradient shows no
+ * positive curvature (the value is not locally concave along them) are not
+ * remembered, so the quasi-Newton matrix stays positive definite.
+ *
+ * Points the objective cannot evaluate (e.g. volumes whose mass balance
+ * does not converge) bound the search like the box does, but the gradient
+ * does not show where. When a step leads to such a point, every gene is
+ * tried alone with its part of the step. A gene that fails alone is moved
+ * as close to where it fails as a short bisection finds and then held there
+ * for the rest of the refinement, so it does not keep cutting short the
+ * steps of the others.
+ *
+ * @param n Number of genes
+ * @param x Start point, replaced by the best point found (clamped into the box)
+ * @param objective Value and gradient of the objective
+ * @param max_iterations Maximum number of quasi-Newton steps
+ * @param memory Number of step and gradient-change pairs kept
+ * @param tolerance Projected gradient, and relative improvement of a step, at which the refinement stops
+ *
+ * @return Value at the refined point, steps taken and objective calls
+ */
+Refinement_Result refine_in_box(int n, double* x, const Box_Objective& objective, int max_iterations, int memory,
+                                double tolerance)
+{
+    Refinement_Result result{std::numeric_limits<double>::lowest(), 0, 0};
+    std::vector<double> g(n), x_trial(n), g_trial(n), d(n), probe(n);
+    std::vector<bool> free(n), held(n, false);
+    struct Pair
+    {
+        std::vector<double> s, y;
+        double rho, alpha;
+    };
+    std::deque<Pair> history; // newest last
+
+    // Negated objective, and its gradient unless grad is nullptr
+    auto evaluate = [&](const double* point, double& f, double* grad)
+    {
+        ++result.evaluations;
+        double value;
+        if (!objective(point, value, grad))
+            return false;
+        f = -value;
+        if (grad != nullptr)
+        {
+            for (int i = 0; i < n; ++i)
+                grad[i] = -grad[i];
+        }
+        return true;
+    };
+
+    for (int i = 0; i < n; ++i)
+        x[i] = std::clamp(x[i], 0.0, 1.0);
+    double f;
+    if (!evaluate(x, f, g.data()))
+        return result;
+    double last_move = 0.1; // largest gene change of the last accepted step
+
+    for (int iter = 0; iter < max_iterations; ++iter)
+    {
+        // Genes at a bound that the gradient pushes outwards stay where they are
+        double projected_gradient = 0.0;
+        for (int i = 0; i < n; ++i)
+        {
+            free[i] = !held[i] && !((x[i] <= 0.0 && g[i] > 0.0) || (x[i] >= 1.0 && g[i] < 0.0));
+            if (free[i])
+                projected_gradient = std::max(projected_gradient, std::abs(g[i]));
+        }
+        if (projected_gradient < tolerance)
+            break;
+
+        // Two-loop recursion over the free genes
+        for (int i = 0; i < n; ++i)
+            d[i] = free[i] ? g[i] : 0.0;
+        for (auto it = history.rbegin(); it != history.rend(); ++it)
+        {
+            double sd = 0.0;
+            for (int i = 0; i < n; ++i)
+                sd += it->s[i] * d[i];
+            it->alpha = it->rho * sd;
+            for (int i = 0; i < n; ++i)
+                d[i] -= it->alpha * it->y[i];
+        }
+        double gamma = 0.1 / projected_gradient;
+        if (!history.empty())
+        {
+            double yy = 0.0;
+            for (int i = 0; i < n; ++i)
+                yy += history.back().y[i] * history.back().y[i];
+            gamma = 1.0 / (history.back().rho * yy);
+        }
+        for (int i = 0; i < n; ++i)
+            d[i] *= gamma;
+        for (const Pair& pair : history)
+        {
+            double yd = 0.0;
+            for (int i = 0; i < n; ++i)
+                yd += pair.y[i] * d[i];
+            const double beta = pair.rho * yd;
+            for (int i = 0; i < n; ++i)
+                d[i] += pair.s[i] * (pair.alpha - beta);
+        }
+        double slope = 0.0;
+        for (int i = 0; i < n; ++i)
+        {
+            d[i] = free[i] ? -d[i] : 0.0;
+            slope += g[i] * d[i];
+        }
+
+        // Not a descent direction: start again from the scaled steepest descent
+        if (slope >= 0.0)
+        {
+            history.clear();
+            for (int i = 0; i < n; ++i)
+                d[i] = free[i] ? -0.1 * g[i] / projected_gradient : 0.0;
+        }
+
+        // Projected backtracking line search, moving no gene by more than twice the last step. The first
+        // trial also takes the gradient, later ones only the value; trial_gradient tells whether the
+        // gradient of the last trial is in g_trial.
+        double largest = 0.0;
+        for (int i = 0; i < n; ++i)
+            largest = std::max(largest, std::abs(d[i]));
+        bool accepted = false, with_gradient = true, trial_gradient = false;
+        double f_trial = f, failed_step = 0.0;
+        for (double step = std::min(1.0, 2.0 * last_move / largest); step > 1e-10 && !accepted; step *= 0.5)
+        {
+            double decrease = 0.0;
+            for (int i = 0; i < n; ++i)
+            {
+                x_trial[i] = std::clamp(x[i] + step * d[i], 0.0, 1.0);
+                decrease += g[i] * (x_trial[i] - x[i]);
+            }
+            if (decrease >= 0.0)
+                break; // the box stops every move
+            const bool evaluated = evaluate(x_trial.data(), f_trial, with_gradient ? g_trial.data() : nullptr);
+            trial_gradient = with_gradient;
+            with_gradient = false;
+            if (!evaluated)
+            {
+                if (failed_step == 0.0)
+                    failed_step = step;
+                continue;
+            }
+            accepted = f_trial <= f + 1e-4 * decrease;
+        }
+
+        // Hold the genes that cannot take their part of a failed step alone, after moving each as close to
+        // the point where it fails as bisection finds, if that improves the value
+        if (failed_step > 0.0)
+        {
+            bool newly_held = false;
+            for (int i = 0; i < n; ++i)
+            {
+                if (d[i] == 0.0)
+                    continue;
+                std::copy(x, x + n, probe.begin());
+                double inside = x[i], outside = std::clamp(x[i] + failed_step * d[i], 0.0, 1.0), f_inside = f;
+                probe[i] = outside;
+                double f_probe;
+                if (evaluate(probe.data(), f_probe, nullptr))
+                    continue;
+                held[i] = newly_held = true;
+                for (int halving = 0; halving < 12; ++halving)
+                {
+                    probe[i] = 0.5 * (inside + outside);
+                    if (evaluate(probe.data(), f_probe, nullptr))
+                    {
+                        inside = probe[i];
+                        f_inside = f_probe;
+                    }
+                    else
+                    {
+                        outside = probe[i];
+                    }
+                }
+                if (f_inside < f)
+                {
+                    x[i] = inside;
+                    f = f_inside;
+                }
+            }
+            if (newly_held)
+            {
+                // Start again from the moved point, without the curvature pairs of the old set of free genes
+                history.clear();
+                if (!evaluate(x, f, g.data()))
+                    break;
+                ++result.iterations;
+                continue;
+            }
+        }
+        if (!accepted)
+            break;
+        if (!trial_gradient && !evaluate(x_trial.data(), f_trial, g_trial.data()))
+            break;
+
+        // Remember the step if it shows positive curvature
+        Pair pair{std::vector<double>(n), std::vector<double>(n), 0.0, 0.0};
+        double sy = 0.0;
+        last_move = 0.0;
+        for (int i = 0; i < n; ++i)
+        {
+            pair.s[i] = x_trial[i] - x[i];
+            pair.y[i] = g_trial[i] - g[i];
+            sy += pair.s[i] * pair.y[i];
+            last_move = std::max(last_move, std::abs(pair.s[i]));
+        }
+        if (sy > 1e-12)
+        {
+            pair.rho = 1.0 / sy;
+            history.push_back(std::move(pair));
+            if (static_cast<int>(history.size()) > memory)
+                history.pop_front();
+        }
+
+        const bool stalled = f - f_trial < tolerance * std::max(1.0, std::abs(f));
+        std::copy(x_trial.begin(), x_trial.end(), x);
+        g.swap(g_trial);
+        f = f_trial;
+        ++result.iterations;
+        if (stalled)
+            break;
+    }
+
+    result.value = -f;
+    return result;
+}
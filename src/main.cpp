@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <cmath>
 #include <fstream>
 #include <iomanip>
@@ -5,6 +6,9 @@
 #include <vector>
 
 #include "CCircuit.h"
+#include "CCircuitScreen.h"
+#include "CCompiledCircuit.h"
+#include "CEvaluationStore.h"
 #include "CSimulator.h"
 #include "Config.h" // <— your new loader
 #include "Genetic_Algorithm.h"
@@ -13,6 +17,23 @@
 // static const int hard_circuit_10[2 * DEFAULT_UNITS + 1] = {1, 2, 4, 3,  5, 3, 0, 8, 11, 7, 12,
 //                                                            7, 0, 7, 11, 8, 6, 9, 7, 10, 3};
 
+// Compiled circuit vector of the calling thread. The hybrid optimizer keeps the
+// circuit vector fixed in its continuous phase, so there it is compiled only once.
+static const CompiledCircuit& compiled_circuit(int size, int* vec)
+{
+    thread_local CompiledCircuit compiled;
+    compiled.compile(size, vec);
+    return compiled;
+}
+
+// Structural screen of the calling thread; the optimizer screens blocks of new circuits on several
+// threads at once. Every run screens circuits of one size, the one the screen is made for.
+static CircuitScreen& circuit_screen(int num_units)
+{
+    thread_local CircuitScreen screen(num_units);
+    return screen;
+}
+
 int main()
 {
     // Save original cout buffer before we start
@@ -55,7 +76,8 @@ int main()
               << "  allow_mutation_wrapping     = " << std::boolalpha << params.allow_mutation_wrapping << "\n\n"
 
               << "  use_inversion               = " << std::boolalpha << params.use_inversion << "\n"
-              << "  inversion_probability       = " << params.inversion_probability << "\n\n"
+              << "  inversion_probability       = " << params.inversion_probability << "\n"
+              << "  repair_probability          = " << params.repair_probability << "\n\n"
 
               << "  use_scaling_mutation        = " << std::boolalpha << params.use_scaling_mutation << "\n"
               << "  scaling_mutation_prob       = " << params.scaling_mutation_prob << "\n"
@@ -63,7 +85,15 @@ int main()
               << "  scaling_mutation_max        = " << params.scaling_mutation_max << "\n\n"
 
               << "  convergence_threshold       = " << params.convergence_threshold << "\n"
-              << "  stall_generations           = " << params.stall_generations << "\n\n"
+              << "  stall_generations           = " << params.stall_generations << "\n"
+              << "  fitness_cache_size          = " << params.fitness_cache_size << "\n"
+              << "  fitness_store_directory     = " << params.fitness_store_directory << "\n"
+              << "  island_count                = " << params.island_count << "\n"
+              << "  migration_interval          = " << params.migration_interval << "\n"
+              << "  migration_count             = " << params.migration_count << "\n"
+              << "  migration_topology          = " << params.migration_topology << "\n"
+              << "  refine_elite_count          = " << params.refine_elite_count << "\n"
+              << "  refine_iterations           = " << params.refine_iterations << "\n\n"
 
               << "  verbose                     = " << std::boolalpha << params.verbose << "\n"
               << "  log_results                 = " << std::boolalpha << params.log_results << "\n"
@@ -81,25 +111,33 @@ int main()
     std::vector<int> circuit_vector(vector_size, 0);
     std::vector<double> volume_params(num_units, 0.5);
 
+    // Evaluations kept from earlier runs with the same number of units, simulator parameters and constants
+    EvaluationStore store(params.fitness_store_directory, num_units, default_simulator_parameters,
+                          params.fitness_store_directory.empty() ? 0 : EvaluationStore::DEFAULT_CAPACITY);
+
     if (mode == "d")
     {
         std::cout << "Running DISCRETE optimization...\n";
 
         // std::cout.rdbuf(null_stream.rdbuf());
 
-        auto discrete_fitness = [](int size, int* vec) -> double
+        // One structural check and one mass balance per genome. Children differ from their parent in a
+        // few genes, so their mass balance starts from the parent's flows; cold starts go through the store
+        Discrete_Evaluation discrete_fitness = [&store](int size, int* vec, std::vector<double>& flow_state)
         {
-            // Discrete-only overload
-            return circuit_performance(size, vec);
+            Circuit_Evaluation e;
+            const bool cold = flow_state.empty();
+            if (!store.find(vec, nullptr, e, flow_state))
+            {
+                e = evaluate_circuit(size, vec, (size - 1) / 2, nullptr, default_simulator_parameters, flow_state);
+                store.insert(vec, nullptr, e, cold, flow_state);
+            }
+            return Genome_Evaluation{e.valid, e.fitness};
         };
 
-        auto discrete_validity = [](int size, int* vec) -> bool
-        {
-            // Discrete-only constructor and validity
-            Circuit c(size / 2); // (2n + 1 → n units)
-            c.initialize_from_vector(size, vec);
-            return c.check_validity(size, vec);
-        };
+        // New children are screened structurally, 64 at a time; convergence is left to the evaluation
+        Discrete_Screen discrete_validity = [num_units](int count, int size, const int* vecs)
+        { return circuit_screen(num_units).screen(count, size, vecs); };
 
         optimize(vector_size, circuit_vector.data(), discrete_fitness, discrete_validity, params);
     }
@@ -113,16 +151,25 @@ int main()
         // Build a simple *valid* circuit of the requested size
         auto base = generate_valid_circuit_template(num_units); // function from Genetic_Algorithm.cpp
         std::copy(base.begin(), base.end(), circuit_vector.begin());
-        auto cont_fitness = [&](int r_size, double* rvec) -> double
-        { return circuit_performance(vector_size, circuit_vector.data(), r_size, rvec); };
 
-        auto cont_validity = [&](int r_size, double* rvec) -> bool
+        // Only the volumes change: compile the circuit once and evaluate whole generations in batches
+        CompiledCircuit compiled(vector_size, circuit_vector.data());
+        auto cont_validity = [&](int r_size, double* rvec) -> bool { return compiled.check_validity(r_size, rvec); };
+
+        // The best volumes found are refined along the adjoint gradient of the economic value
+        Continuous_Gradient cont_gradient = [&](int r_size, double* rvec, double* gradient, std::vector<double>& flows)
         {
-            Circuit c(num_units, rvec); // use volume constructor!
-            c.initialize_from_vector(vector_size, circuit_vector.data(), rvec);
-            return c.check_validity(vector_size, circuit_vector.data(), r_size, rvec);
+            if (!compiled.check_validity(r_size, rvec))
+                return Genome_Evaluation{false, 0.0};
+            double value = circuit_performance_with_gradient(vector_size, circuit_vector.data(), r_size, rvec,
+                                                             gradient, default_simulator_parameters, flows);
+            return Genome_Evaluation{value > -1e12, value};
         };
 
+        Population_Fitness cont_batch = [&](int count, int, const double* rvecs, double* fitnesses) // num_units each
+        { compiled.evaluate_batch(count, rvecs, fitnesses); };
+        Continuous_Evaluator cont_fitness(cont_batch, cont_gradient);
+
         optimize(num_units, volume_params.data(), cont_fitness, cont_validity, params);
     }
 
@@ -133,17 +180,33 @@ int main()
         // Redirect cout to null stream to silence debug output
         // std::cout.rdbuf(null_stream.rdbuf());
 
-        // Define hybrid fitness and validity functions
-        auto hybrid_fitness = [](int i_size, int* i_vec, int r_size, double* r_vec) -> double
-        { return circuit_performance(i_size, i_vec, r_size, r_vec); };
-
-        auto hybrid_validity = [num_units](int i_size, int* i_vec, int r_size, double* r_vec) -> bool
+        // Define hybrid fitness and validity functions. The store only keeps the discrete phase, which runs at
+        // the initial volumes: the volumes of the continuous phase are new in every run and would fill it
+        const std::vector<double> discrete_volumes = volume_params;
+        Mixed_Evaluation hybrid_evaluation = [&store, &discrete_volumes](int i_size, int* i_vec, int r_size,
+                                                                         double* r_vec, std::vector<double>& flow_state)
         {
-            Circuit c(num_units);
-            c.initialize_from_vector(i_size, i_vec);
-            return c.check_validity(i_size, i_vec, r_size, r_vec);
+            Circuit_Evaluation e;
+            const bool cold = flow_state.empty();
+            const bool stored = std::equal(r_vec, r_vec + r_size, discrete_volumes.begin(), discrete_volumes.end());
+            if (!stored || !store.find(i_vec, r_vec, e, flow_state))
+            {
+                e = compiled_circuit(i_size, i_vec).evaluate_circuit(r_size, r_vec, flow_state);
+                if (stored)
+                    store.insert(i_vec, r_vec, e, cold, flow_state);
+            }
+            return Genome_Evaluation{e.valid, e.fitness};
         };
 
+        auto hybrid_validity = [](int i_size, int* i_vec, int r_size, double* r_vec) -> bool
+        { return compiled_circuit(i_size, i_vec).check_validity(r_size, r_vec); };
+
+        // New circuits of the discrete phase are screened structurally, 64 at a time
+        Discrete_Screen discrete_screen = [num_units](int count, int size, const int* vecs)
+        { return circuit_screen(num_units).screen(count, size, vecs); };
+
+        Mixed_Evaluator hybrid_fitness(hybrid_evaluation, discrete_screen);
+
         // Run hybrid optimization (cout is redirected, so no debug output)
         optimize(vector_size, circuit_vector.data(), num_units, volume_params.data(), hybrid_fitness, hybrid_validity,
                  params);
@@ -268,6 +331,12 @@ int main()
     std::cout << "- Operating cost: £" << std::fixed << std::setprecision(2) << operating_cost << "/s\n";
     std::cout << "- Net profit: £" << std::fixed << std::setprecision(2) << performance << "/s\n";
 
+    if (store.is_open())
+    {
+        std::cout << "\nEvaluation store " << store.get_path() << ": " << store.hits() << " hits, " << store.misses()
+                  << " misses\n";
+    }
+
     // Save raw circuit data into a CSV:
     const std::string out_csv = "plotting/circuit_results.csv";
     if (circuit.save_output_info(out_csv))
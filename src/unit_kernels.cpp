@@ -0,0 +1,501 @@
+/**
+ * @file unit_kernels.cpp
+ * @brief Implementation of the vectorised separation-unit kernels
+ *
+ * Every kernel exists as a scalar loop and, on x86 with GCC or Clang, as
+ * AVX2 and AVX-512 versions compiled for their instruction set through
+ * function attributes. The rest of the library is built for the baseline
+ * instruction set; the dispatch below only calls a SIMD version if the CPU
+ * reports support for it. The SIMD versions perform the same operations in
+ * the same order as the scalar loop.
+ */
+#include "unit_kernels.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define UNIT_KERNELS_X86 1
+#include <immintrin.h>
+#else
+#define UNIT_KERNELS_X86 0
+#endif
+
+namespace UnitKernels
+{
+namespace
+{
+constexpr double MIN_TOTAL_FEED = 1e-10; // guard against division-by-zero / vanishing flow
+constexpr double MIN_REFERENCE = 1e-12;  // floor of the relative change denominator
+
+/* ------------------------------------------------------------------ */
+/*                              Scalar                                 */
+/* ------------------------------------------------------------------ */
+void process_scalar(const Kinetics& kin, int begin, int count, int stride, const double* volume, const double* feed,
+                    double* conc, double* tails)
+{
+    for (int s = begin; s < count; ++s)
+    {
+        const double fp = feed[s];
+        const double fg = feed[stride + s];
+        const double fw = feed[2 * stride + s];
+
+        const double tau = kin.phi * volume[s] / (std::max(fp + fg + fw, MIN_TOTAL_FEED) / kin.rho);
+        const double Rp = kin.k_palusznium * tau / (1.0 + kin.k_palusznium * tau);
+        const double Rg = kin.k_gormanium * tau / (1.0 + kin.k_gormanium * tau);
+        const double Rw = kin.k_waste * tau / (1.0 + kin.k_waste * tau);
+
+        conc[s] = fp * Rp;
+        conc[stride + s] = fg * Rg;
+        conc[2 * stride + s] = fw * Rw;
+        tails[s] = fp - fp * Rp;
+        tails[stride + s] = fg - fg * Rg;
+        tails[2 * stride + s] = fw - fw * Rw;
+    }
+}
+
+double max_relative_change_scalar(int begin, int count, const double* next, const double* prev)
+{
+    double max_rel_change = 0.0;
+    for (int k = begin; k < count; ++k)
+        max_rel_change = std::max(max_rel_change, std::abs(next[k] - prev[k]) / std::max(prev[k], MIN_REFERENCE));
+    return max_rel_change;
+}
+
+void track_relative_change_scalar(int begin, int count, const double* next, double* prev, double* max_change)
+{
+    for (int k = begin; k < count; ++k)
+    {
+        max_change[k] = std::max(max_change[k], std::abs(next[k] - prev[k]) / std::max(prev[k], MIN_REFERENCE));
+        prev[k] = next[k];
+    }
+}
+
+void exchange_difference_scalar(int begin, int count, double* flow, double* last)
+{
+    for (int k = begin; k < count; ++k)
+    {
+        const double difference = flow[k] - last[k];
+        last[k] = flow[k];
+        flow[k] = difference;
+    }
+}
+
+void process_scalar_all(const Kinetics& kin, int count, int stride, const double* volume, const double* feed,
+                        double* conc, double* tails)
+{
+    process_scalar(kin, 0, count, stride, volume, feed, conc, tails);
+}
+
+double max_relative_change_scalar_all(int count, const double* next, const double* prev)
+{
+    return max_relative_change_scalar(0, count, next, prev);
+}
+
+void track_relative_change_scalar_all(int count, const double* next, double* prev, double* max_change)
+{
+    track_relative_change_scalar(0, count, next, prev, max_change);
+}
+
+void exchange_difference_scalar_all(int count, double* flow, double* last)
+{
+    exchange_difference_scalar(0, count, flow, last);
+}
+
+#if UNIT_KERNELS_X86
+/* ------------------------------------------------------------------ */
+/*                         AVX2: 4 units at once                       */
+/* ------------------------------------------------------------------ */
+__attribute__((target("avx2"))) void process_avx2(const Kinetics& kin, int count, int stride, const double* volume,
+                                                  const double* feed, double* conc, double* tails)
+{
+    const __m256d one = _mm256_set1_pd(1.0);
+    const __m256d min_feed = _mm256_set1_pd(MIN_TOTAL_FEED);
+    const __m256d rho = _mm256_set1_pd(kin.rho);
+    const __m256d phi = _mm256_set1_pd(kin.phi);
+    const __m256d kp = _mm256_set1_pd(kin.k_palusznium);
+    const __m256d kg = _mm256_set1_pd(kin.k_gormanium);
+    const __m256d kw = _mm256_set1_pd(kin.k_waste);
+
+    int s = 0;
+    for (; s + 4 <= count; s += 4)
+    {
+        const __m256d fp = _mm256_loadu_pd(feed + s);
+        const __m256d fg = _mm256_loadu_pd(feed + stride + s);
+        const __m256d fw = _mm256_loadu_pd(feed + 2 * stride + s);
+
+        const __m256d total = _mm256_max_pd(_mm256_add_pd(_mm256_add_pd(fp, fg), fw), min_feed);
+        const __m256d tau =
+            _mm256_div_pd(_mm256_mul_pd(phi, _mm256_loadu_pd(volume + s)), _mm256_div_pd(total, rho));
+
+        const __m256d ktp = _mm256_mul_pd(kp, tau);
+        const __m256d ktg = _mm256_mul_pd(kg, tau);
+        const __m256d ktw = _mm256_mul_pd(kw, tau);
+        const __m256d cp = _mm256_mul_pd(fp, _mm256_div_pd(ktp, _mm256_add_pd(one, ktp)));
+        const __m256d cg = _mm256_mul_pd(fg, _mm256_div_pd(ktg, _mm256_add_pd(one, ktg)));
+        const __m256d cw = _mm256_mul_pd(fw, _mm256_div_pd(ktw, _mm256_add_pd(one, ktw)));
+
+        _mm256_storeu_pd(conc + s, cp);
+        _mm256_storeu_pd(conc + stride + s, cg);
+        _mm256_storeu_pd(conc + 2 * stride + s, cw);
+        _mm256_storeu_pd(tails + s, _mm256_sub_pd(fp, cp));
+        _mm256_storeu_pd(tails + stride + s, _mm256_sub_pd(fg, cg));
+        _mm256_storeu_pd(tails + 2 * stride + s, _mm256_sub_pd(fw, cw));
+    }
+    // Clear the upper register halves before returning to SSE code
+    _mm256_zeroupper();
+    process_scalar(kin, s, count, stride, volume, feed, conc, tails);
+}
+
+__attribute__((target("avx2"))) double max_relative_change_avx2(int count, const double* next, const double* prev)
+{
+    const __m256d sign = _mm256_set1_pd(-0.0);
+    const __m256d min_reference = _mm256_set1_pd(MIN_REFERENCE);
+    __m256d max_rel = _mm256_setzero_pd();
+
+    int k = 0;
+    for (; k + 4 <= count; k += 4)
+    {
+        const __m256d p = _mm256_loadu_pd(prev + k);
+        const __m256d change = _mm256_andnot_pd(sign, _mm256_sub_pd(_mm256_loadu_pd(next + k), p));
+        max_rel = _mm256_max_pd(max_rel, _mm256_div_pd(change, _mm256_max_pd(p, min_reference)));
+    }
+
+    __m128d half = _mm_max_pd(_mm256_castpd256_pd128(max_rel), _mm256_extractf128_pd(max_rel, 1));
+    half = _mm_max_sd(half, _mm_unpackhi_pd(half, half));
+    _mm256_zeroupper();
+    return std::max(_mm_cvtsd_f64(half), max_relative_change_scalar(k, count, next, prev));
+}
+
+__attribute__((target("avx2"))) void track_relative_change_avx2(int count, const double* next, double* prev,
+                                                                double* max_change)
+{
+    const __m256d sign = _mm256_set1_pd(-0.0);
+    const __m256d min_reference = _mm256_set1_pd(MIN_REFERENCE);
+
+    int k = 0;
+    for (; k + 4 <= count; k += 4)
+    {
+        const __m256d x = _mm256_loadu_pd(next + k);
+        const __m256d p = _mm256_loadu_pd(prev + k);
+        const __m256d change = _mm256_andnot_pd(sign, _mm256_sub_pd(x, p));
+        const __m256d rel = _mm256_div_pd(change, _mm256_max_pd(p, min_reference));
+        _mm256_storeu_pd(max_change + k, _mm256_max_pd(_mm256_loadu_pd(max_change + k), rel));
+        _mm256_storeu_pd(prev + k, x);
+    }
+    _mm256_zeroupper();
+    track_relative_change_scalar(k, count, next, prev, max_change);
+}
+
+__attribute__((target("avx2"))) void exchange_difference_avx2(int count, double* flow, double* last)
+{
+    int k = 0;
+    for (; k + 4 <= count; k += 4)
+    {
+        const __m256d f = _mm256_loadu_pd(flow + k);
+        const __m256d l = _mm256_loadu_pd(last + k);
+        _mm256_storeu_pd(last + k, f);
+        _mm256_storeu_pd(flow + k, _mm256_sub_pd(f, l));
+    }
+    _mm256_zeroupper();
+    exchange_difference_scalar(k, count, flow, last);
+}
+
+/* ------------------------------------------------------------------ */
+/*                        AVX-512: 8 units at once                     */
+/* ------------------------------------------------------------------ */
+// GCC's AVX-512 intrinsics pass _mm512_undefined_pd() as the unused merge source, which optimised builds of
+// GCC 12 report as (maybe) uninitialised once inlined here
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+__attribute__((target("avx512f"))) void process_avx512(const Kinetics& kin, int count, int stride,
+                                                       const double* volume, const double* feed, double* conc,
+                                                       double* tails)
+{
+    const __m512d one = _mm512_set1_pd(1.0);
+    const __m512d min_feed = _mm512_set1_pd(MIN_TOTAL_FEED);
+    const __m512d rho = _mm512_set1_pd(kin.rho);
+    const __m512d phi = _mm512_set1_pd(kin.phi);
+    const __m512d kp = _mm512_set1_pd(kin.k_palusznium);
+    const __m512d kg = _mm512_set1_pd(kin.k_gormanium);
+    const __m512d kw = _mm512_set1_pd(kin.k_waste);
+
+    // The last partial block is handled with masked loads and stores
+    for (int s = 0; s < count; s += 8)
+    {
+        const __mmask8 m = (count - s >= 8) ? __mmask8(0xFF) : __mmask8((1u << (count - s)) - 1);
+        const __m512d fp = _mm512_maskz_loadu_pd(m, feed + s);
+        const __m512d fg = _mm512_maskz_loadu_pd(m, feed + stride + s);
+        const __m512d fw = _mm512_maskz_loadu_pd(m, feed + 2 * stride + s);
+
+        const __m512d total = _mm512_max_pd(_mm512_add_pd(_mm512_add_pd(fp, fg), fw), min_feed);
+        const __m512d tau =
+            _mm512_div_pd(_mm512_mul_pd(phi, _mm512_maskz_loadu_pd(m, volume + s)), _mm512_div_pd(total, rho));
+
+        const __m512d ktp = _mm512_mul_pd(kp, tau);
+        const __m512d ktg = _mm512_mul_pd(kg, tau);
+        const __m512d ktw = _mm512_mul_pd(kw, tau);
+        const __m512d cp = _mm512_mul_pd(fp, _mm512_div_pd(ktp, _mm512_add_pd(one, ktp)));
+        const __m512d cg = _mm512_mul_pd(fg, _mm512_div_pd(ktg, _mm512_add_pd(one, ktg)));
+        const __m512d cw = _mm512_mul_pd(fw, _mm512_div_pd(ktw, _mm512_add_pd(one, ktw)));
+
+        _mm512_mask_storeu_pd(conc + s, m, cp);
+        _mm512_mask_storeu_pd(conc + stride + s, m, cg);
+        _mm512_mask_storeu_pd(conc + 2 * stride + s, m, cw);
+        _mm512_mask_storeu_pd(tails + s, m, _mm512_sub_pd(fp, cp));
+        _mm512_mask_storeu_pd(tails + stride + s, m, _mm512_sub_pd(fg, cg));
+        _mm512_mask_storeu_pd(tails + 2 * stride + s, m, _mm512_sub_pd(fw, cw));
+    }
+    _mm256_zeroupper();
+}
+
+__attribute__((target("avx512f"))) double max_relative_change_avx512(int count, const double* next,
+                                                                     const double* prev)
+{
+    const __m512d min_reference = _mm512_set1_pd(MIN_REFERENCE);
+    __m512d max_rel = _mm512_setzero_pd();
+
+    for (int k = 0; k < count; k += 8)
+    {
+        // Masked-off lanes load zeros and contribute 0 / 1e-12 = 0
+        const __mmask8 m = (count - k >= 8) ? __mmask8(0xFF) : __mmask8((1u << (count - k)) - 1);
+        const __m512d p = _mm512_maskz_loadu_pd(m, prev + k);
+        const __m512d change = _mm512_abs_pd(_mm512_sub_pd(_mm512_maskz_loadu_pd(m, next + k), p));
+        max_rel = _mm512_max_pd(max_rel, _mm512_div_pd(change, _mm512_max_pd(p, min_reference)));
+    }
+    const double result = _mm512_reduce_max_pd(max_rel);
+    _mm256_zeroupper();
+    return result;
+}
+
+__attribute__((target("avx512f"))) void track_relative_change_avx512(int count, const double* next, double* prev,
+                                                                     double* max_change)
+{
+    const __m512d min_reference = _mm512_set1_pd(MIN_REFERENCE);
+    for (int k = 0; k < count; k += 8)
+    {
+        const __mmask8 m = (count - k >= 8) ? __mmask8(0xFF) : __mmask8((1u << (count - k)) - 1);
+        const __m512d x = _mm512_maskz_loadu_pd(m, next + k);
+        const __m512d p = _mm512_maskz_loadu_pd(m, prev + k);
+        const __m512d rel = _mm512_div_pd(_mm512_abs_pd(_mm512_sub_pd(x, p)), _mm512_max_pd(p, min_reference));
+        _mm512_mask_storeu_pd(max_change + k, m, _mm512_max_pd(_mm512_maskz_loadu_pd(m, max_change + k), rel));
+        _mm512_mask_storeu_pd(prev + k, m, x);
+    }
+    _mm256_zeroupper();
+}
+
+__attribute__((target("avx512f"))) void exchange_difference_avx512(int count, double* flow, double* last)
+{
+    for (int k = 0; k < count; k += 8)
+    {
+        const __mmask8 m = (count - k >= 8) ? __mmask8(0xFF) : __mmask8((1u << (count - k)) - 1);
+        const __m512d f = _mm512_maskz_loadu_pd(m, flow + k);
+        const __m512d l = _mm512_maskz_loadu_pd(m, last + k);
+        _mm512_mask_storeu_pd(last + k, m, f);
+        _mm512_mask_storeu_pd(flow + k, m, _mm512_sub_pd(f, l));
+    }
+    _mm256_zeroupper();
+}
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+#endif
+
+/* ------------------------------------------------------------------ */
+/*                             Dispatch                                */
+/* ------------------------------------------------------------------ */
+using ProcessKernel = void (*)(const Kinetics&, int, int, const double*, const double*, double*, double*);
+using ChangeKernel = double (*)(int, const double*, const double*);
+using TrackKernel = void (*)(int, const double*, double*, double*);
+using DifferenceKernel = void (*)(int, double*, double*);
+
+Isa detect_isa()
+{
+#if UNIT_KERNELS_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+        return Isa::AVX512;
+    if (__builtin_cpu_supports("avx2"))
+        return Isa::AVX2;
+#endif
+    return Isa::Scalar;
+}
+
+struct Dispatch
+{
+    Isa isa = Isa::Scalar;
+    ProcessKernel process = process_scalar_all;
+    ChangeKernel max_relative_change = max_relative_change_scalar_all;
+    TrackKernel track_relative_change = track_relative_change_scalar_all;
+    DifferenceKernel exchange_difference = exchange_difference_scalar_all;
+};
+
+void select(Dispatch& dispatch, Isa isa)
+{
+    dispatch.isa = isa;
+    dispatch.process = process_scalar_all;
+    dispatch.max_relative_change = max_relative_change_scalar_all;
+    dispatch.track_relative_change = track_relative_change_scalar_all;
+    dispatch.exchange_difference = exchange_difference_scalar_all;
+#if UNIT_KERNELS_X86
+    if (isa == Isa::AVX2)
+    {
+        dispatch.process = process_avx2;
+        dispatch.max_relative_change = max_relative_change_avx2;
+        dispatch.track_relative_change = track_relative_change_avx2;
+        dispatch.exchange_difference = exchange_difference_avx2;
+    }
+    else if (isa == Isa::AVX512)
+    {
+        dispatch.process = process_avx512;
+        dispatch.max_relative_change = max_relative_change_avx512;
+        dispatch.track_relative_change = track_relative_change_avx512;
+        dispatch.exchange_difference = exchange_difference_avx512;
+    }
+#endif
+}
+
+// Detected once, on first use
+Isa detected_isa()
+{
+    static const Isa best = detect_isa();
+    return best;
+}
+
+Dispatch& dispatch()
+{
+    static Dispatch selected = []
+    {
+        Dispatch d;
+        select(d, detected_isa());
+        return d;
+    }();
+    return selected;
+}
+} // namespace
+
+/**
+ * @brief Get the best instruction set supported by the CPU
+ *
+ * @return AVX512 or AVX2 if the CPU supports them and the SIMD paths are
+ *         built for this target, Scalar otherwise
+ */
+Isa best_isa()
+{
+    return detected_isa();
+}
+
+/**
+ * @brief Get the instruction set currently used by the kernels
+ *
+ * @return The active instruction set
+ */
+Isa active_isa()
+{
+    return dispatch().isa;
+}
+
+/**
+ * @brief Select the instruction set used by the kernels
+ *
+ * Requests above best_isa() are capped, so an unsupported path is never run.
+ *
+ * @param isa Requested instruction set
+ *
+ * @return The instruction set actually selected
+ */
+Isa set_isa(Isa isa)
+{
+    if (static_cast<int>(isa) > static_cast<int>(detected_isa()))
+        isa = detected_isa();
+    select(dispatch(), isa);
+    return isa;
+}
+
+/**
+ * @brief Get the name of an instruction set
+ *
+ * @param isa Instruction set
+ *
+ * @return "scalar", "avx2" or "avx512"
+ */
+const char* isa_name(Isa isa)
+{
+    switch (isa)
+    {
+    case Isa::AVX2:
+        return "avx2";
+    case Isa::AVX512:
+        return "avx512";
+    default:
+        return "scalar";
+    }
+}
+
+/**
+ * @brief Process a block of units
+ *
+ * Same model as CUnit::process for every unit: the residence time
+ * τ = φV / (ΣF/ρ) gives the recoveries R_i = k_i τ / (1 + k_i τ), which
+ * split the feed into concentrate and tailings.
+ *
+ * @param kinetics Kinetic constants of the units
+ * @param count Number of units
+ * @param stride Distance between the palusznium, gormanium and waste blocks (at least count)
+ * @param volume Unit volumes (m³)
+ * @param feed Unit feeds: palusznium, gormanium and waste blocks of count values
+ * @param conc Concentrate flows, same layout as feed
+ * @param tails Tailings flows, same layout as feed
+ */
+void process(const Kinetics& kinetics, int count, int stride, const double* volume, const double* feed, double* conc,
+             double* tails)
+{
+    dispatch().process(kinetics, count, stride, volume, feed, conc, tails);
+}
+
+/**
+ * @brief Largest relative change between two flow vectors
+ *
+ * @param count Number of values
+ * @param next New flows
+ * @param prev Previous flows, the reference of the relative change
+ *
+ * @return max_k |next[k] - prev[k]| / max(prev[k], 1e-12)
+ */
+double max_relative_change(int count, const double* next, const double* prev)
+{
+    return dispatch().max_relative_change(count, next, prev);
+}
+/**
+ * @brief Track the relative change of flows, element by element
+ *
+ * For every k, raises max_change[k] to the relative change
+ * |next[k] - prev[k]| / max(prev[k], 1e-12) and stores next[k] in prev[k].
+ *
+ * @param count Number of values
+ * @param next New flows
+ * @param prev Previous flows, overwritten with next
+ * @param max_change Running maximum of the relative change of each element
+ */
+void track_relative_change(int count, const double* next, double* prev, double* max_change)
+{
+    dispatch().track_relative_change(count, next, prev, max_change);
+}
+
+/**
+ * @brief Replace flows by their change since the last call
+ *
+ * For every k, flow[k] becomes flow[k] - last[k] and last[k] the old flow[k].
+ *
+ * @param count Number of values
+ * @param flow Current flows, overwritten with their change
+ * @param last Flows of the last call, overwritten with the current flows
+ */
+void exchange_difference(int count, double* flow, double* last)
+{
+    dispatch().exchange_difference(count, flow, last);
+}
+} // namespace UnitKernels
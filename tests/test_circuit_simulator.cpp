@@ -6,16 +6,53 @@
  * performance tests and validity checks.
  *
  */
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <cmath>
+#include <cstdlib>
 #include <iostream>
+#include <new>
 
+#include "CCircuitBatch.h"
+#include "CCircuitCanonical.h"
+#include "CCompiledCircuit.h"
+#include "CEvaluationStore.h"
 #include "CSimulator.h"
+#include "unit_kernels.h"
 
 #include <gtest/gtest.h>
 #include <string>
 #include <utility>
 #include <vector>
 
+// Heap allocations made by this test program, counted by the global operator new below
+static std::atomic<long> allocation_count{0};
+
+// GCC sees free() on pointers it takes to come from operator new, though the replacement allocates with malloc
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+
+void* operator new(std::size_t size)
+{
+    ++allocation_count;
+    if (void* p = std::malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+#pragma GCC diagnostic pop
+
 /**
  * @brief Class for testing the circuit simulator.
  *
@@ -189,3 +226,1038 @@ TEST_F(CircuitSimulatorTest, SimpleValidN2)
     std::vector<int> vec = {0, 2, 1, 3, 4};
     run_performance_test(vec);
 }
+
+/**
+ * @brief Test that the Newton solver reproduces the fixed-point result.
+ *
+ * Both solvers must reach the same steady state on the circuits above,
+ * including the recycle-heavy ones.
+ */
+TEST_F(CircuitSimulatorTest, NewtonSolverMatchesFixedPoint)
+{
+    std::vector<std::vector<int>> circuits = {
+        {0, 3, 1, 3, 2, 3, 5, 4, 7, 6, 3, 3, 8},
+        {0, 1, 3},
+        {0, 4, 1, 4, 4},
+        {0, 2, 1, 3, 4},
+        {1, 2, 3, 0, 3, 4, 3, 0, 6},
+        {0, 1, 2, 3, 0, 0, 5},
+        {1, 2, 4, 3, 5, 3, 0, 8, 11, 7, 12, 7, 0, 7, 11, 8, 6, 9, 7, 10, 3},
+    };
+
+    Simulator_Parameters fixed_point;
+    fixed_point.solver = MassBalanceSolver::FixedPoint;
+    Simulator_Parameters newton;
+    newton.solver = MassBalanceSolver::Newton;
+
+    for (auto& vec : circuits)
+    {
+        int n = static_cast<int>(vec.size() - 1) / 2;
+        double expected = circuit_performance(static_cast<int>(vec.size()), vec.data(), n, nullptr, fixed_point);
+        double actual = circuit_performance(static_cast<int>(vec.size()), vec.data(), n, nullptr, newton);
+        ASSERT_NEAR(actual, expected, 1e-2);
+    }
+}
+
+/**
+ * @brief Test that Newton needs fewer iterations on a recycle-heavy circuit.
+ */
+TEST_F(CircuitSimulatorTest, NewtonSolverFewerIterationsOnRecycle)
+{
+    std::vector<int> vec = {1, 2, 4, 3, 5, 3, 0, 8, 11, 7, 12, 7, 0, 7, 11, 8, 6, 9, 7, 10, 3};
+    const int n = 10;
+
+    Circuit fixed_point(n);
+    fixed_point.initialize_from_vector(static_cast<int>(vec.size()), vec.data());
+    fixed_point.set_solver(MassBalanceSolver::FixedPoint);
+    ASSERT_TRUE(fixed_point.run_mass_balance(1e-6, 1000));
+
+    Circuit newton(n);
+    newton.initialize_from_vector(static_cast<int>(vec.size()), vec.data());
+    newton.set_solver(MassBalanceSolver::Newton);
+    ASSERT_TRUE(newton.run_mass_balance(1e-6, 1000));
+
+    std::cout << "Fixed point iterations: " << fixed_point.get_iterations()
+              << ", Newton iterations: " << newton.get_iterations() << std::endl;
+    EXPECT_LT(newton.get_iterations(), fixed_point.get_iterations());
+    EXPECT_NEAR(newton.get_economic_value(), fixed_point.get_economic_value(), 1e-2);
+}
+
+/**
+ * @brief Test that Anderson acceleration reproduces the fixed-point result.
+ */
+TEST_F(CircuitSimulatorTest, AndersonSolverMatchesFixedPoint)
+{
+    std::vector<std::vector<int>> circuits = {
+        {0, 3, 1, 3, 2, 3, 5, 4, 7, 6, 3, 3, 8},
+        {0, 1, 3},
+        {0, 4, 1, 4, 4},
+        {1, 2, 3, 0, 3, 4, 3, 0, 6},
+        {1, 2, 4, 3, 5, 3, 0, 8, 11, 7, 12, 7, 0, 7, 11, 8, 6, 9, 7, 10, 3},
+    };
+
+    Simulator_Parameters fixed_point;
+    fixed_point.solver = MassBalanceSolver::FixedPoint;
+    Simulator_Parameters anderson;
+    anderson.solver = MassBalanceSolver::Anderson;
+    anderson.anderson_depth = 3;
+
+    for (auto& vec : circuits)
+    {
+        int n = static_cast<int>(vec.size() - 1) / 2;
+        double expected = circuit_performance(static_cast<int>(vec.size()), vec.data(), n, nullptr, fixed_point);
+        double actual = circuit_performance(static_cast<int>(vec.size()), vec.data(), n, nullptr, anderson);
+        ASSERT_NEAR(actual, expected, 1e-2);
+    }
+}
+
+/**
+ * @brief Test that Anderson acceleration needs fewer iterations on a recycle-heavy circuit.
+ */
+TEST_F(CircuitSimulatorTest, AndersonSolverFewerIterationsOnRecycle)
+{
+    std::vector<int> vec = {1, 2, 4, 3, 5, 3, 0, 8, 11, 7, 12, 7, 0, 7, 11, 8, 6, 9, 7, 10, 3};
+    const int n = 10;
+
+    Circuit fixed_point(n);
+    fixed_point.initialize_from_vector(static_cast<int>(vec.size()), vec.data());
+    fixed_point.set_solver(MassBalanceSolver::FixedPoint);
+    ASSERT_TRUE(fixed_point.run_mass_balance(1e-6, 1000));
+
+    Circuit anderson(n);
+    anderson.initialize_from_vector(static_cast<int>(vec.size()), vec.data());
+    anderson.set_solver(MassBalanceSolver::Anderson);
+    ASSERT_TRUE(anderson.run_mass_balance(1e-6, 1000));
+
+    std::cout << "Fixed point iterations: " << fixed_point.get_iterations()
+              << ", Anderson iterations: " << anderson.get_iterations() << std::endl;
+    EXPECT_LT(anderson.get_iterations(), fixed_point.get_iterations());
+    EXPECT_NEAR(anderson.get_economic_value(), fixed_point.get_economic_value(), 1e-2);
+}
+
+/**
+ * @brief Test that a circuit without recycle is solved in a single topological pass.
+ */
+TEST_F(CircuitSimulatorTest, AcyclicCircuitSolvedInOnePass)
+{
+    // feed -> unit 0 -> unit 1 -> unit 2 -> palusznium product, all tailings to the tailings outlet
+    std::vector<int> vec = {0, 1, 5, 2, 5, 3, 5};
+    const int n = 3;
+
+    Circuit fixed_point(n);
+    fixed_point.initialize_from_vector(static_cast<int>(vec.size()), vec.data());
+    ASSERT_TRUE(fixed_point.run_mass_balance(1e-6, 1000));
+    EXPECT_EQ(fixed_point.get_iterations(), 1);
+
+    // No recycle loop is left for the selected solver to iterate
+    for (auto kind : {MassBalanceSolver::Newton, MassBalanceSolver::Anderson})
+    {
+        Circuit circuit(n);
+        circuit.initialize_from_vector(static_cast<int>(vec.size()), vec.data());
+        circuit.set_solver(kind);
+        ASSERT_TRUE(circuit.run_mass_balance(1e-6, 1000));
+        EXPECT_EQ(circuit.get_iterations(), 1);
+        EXPECT_DOUBLE_EQ(circuit.get_economic_value(), fixed_point.get_economic_value());
+    }
+}
+
+/**
+ * @brief Test that the unit view returned by get_unit() matches the circuit flow state.
+ */
+TEST_F(CircuitSimulatorTest, UnitViewMatchesFlowState)
+{
+    std::vector<int> vec = {0, 1, 2, 3, 0, 0, 4};
+    const int n = 3;
+
+    Circuit circuit(n);
+    circuit.initialize_from_vector(static_cast<int>(vec.size()), vec.data());
+    ASSERT_TRUE(circuit.run_mass_balance(1e-6, 1000));
+
+    // Outlets n, n + 1 and n + 2 are stored as -1, -2 and -3
+    auto stored = [&](int dest) { return dest < n ? dest : n - 1 - dest; };
+    for (int i = 0; i < n; ++i)
+    {
+        CUnit unit = circuit.get_unit(i);
+        EXPECT_EQ(unit.conc_num, stored(vec[2 * i + 1]));
+        EXPECT_EQ(unit.tails_num, stored(vec[2 * i + 2]));
+
+        // Each unit splits its feed between the two outlets
+        EXPECT_NEAR(unit.conc_palusznium + unit.tails_palusznium, unit.feed_palusznium, 1e-12);
+        EXPECT_NEAR(unit.conc_gormanium + unit.tails_gormanium, unit.feed_gormanium, 1e-12);
+        EXPECT_NEAR(unit.conc_waste + unit.tails_waste, unit.feed_waste, 1e-12);
+        EXPECT_NEAR(unit.conc_palusznium, unit.feed_palusznium * unit.Rp, 1e-12);
+    }
+}
+
+/**
+ * @brief Benchmark Gauss–Seidel against the Jacobi ordering on the circuits above.
+ *
+ * Prints sweeps and time per mass balance for both orderings. Both must reach
+ * the same steady state, and Gauss–Seidel must not need more sweeps overall.
+ */
+TEST_F(CircuitSimulatorTest, GaussSeidelBenchmarkAgainstJacobi)
+{
+    std::vector<std::vector<int>> circuits = {
+        {0, 3, 1, 3, 2, 3, 5, 4, 7, 6, 3, 3, 8},
+        {0, 1, 3},
+        {0, 4, 1, 4, 4},
+        {0, 2, 1},
+        {0, 2, 1, 3, 4},
+        {1, 2, 3, 0, 3, 4, 3, 0, 6},
+        {1, 2, 4, 3, 5, 3, 0, 8, 11, 7, 12, 7, 0, 7, 11, 8, 6, 9, 7, 10, 3},
+    };
+    const int repeats = 200;
+
+    // Returns the microseconds per mass balance; circuit holds the last result
+    auto time_solver = [&](Circuit& circuit, MassBalanceSolver kind)
+    {
+        circuit.set_solver(kind);
+        auto start = std::chrono::steady_clock::now();
+        for (int r = 0; r < repeats; ++r)
+        {
+            circuit.run_mass_balance(1e-6, 1000);
+        }
+        std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+        return elapsed.count() / repeats;
+    };
+
+    int jacobi_sweeps = 0;
+    int gauss_seidel_sweeps = 0;
+    for (auto& vec : circuits)
+    {
+        int n = static_cast<int>(vec.size() - 1) / 2;
+        Circuit jacobi(n);
+        jacobi.initialize_from_vector(static_cast<int>(vec.size()), vec.data());
+        double jacobi_time = time_solver(jacobi, MassBalanceSolver::FixedPoint);
+
+        Circuit gauss_seidel(n);
+        gauss_seidel.initialize_from_vector(static_cast<int>(vec.size()), vec.data());
+        double gauss_seidel_time = time_solver(gauss_seidel, MassBalanceSolver::GaussSeidel);
+
+        std::cout << "n=" << n << "  Jacobi: " << jacobi.get_iterations() << " sweeps, " << jacobi_time
+                  << " us  Gauss-Seidel: " << gauss_seidel.get_iterations() << " sweeps, " << gauss_seidel_time
+                  << " us" << std::endl;
+
+        ASSERT_NEAR(gauss_seidel.get_economic_value(), jacobi.get_economic_value(), 1e-2);
+        jacobi_sweeps += jacobi.get_iterations();
+        gauss_seidel_sweeps += gauss_seidel.get_iterations();
+    }
+    EXPECT_LT(gauss_seidel_sweeps, jacobi_sweeps);
+}
+
+/**
+ * @brief Benchmark warm-started mass balances against cold starts.
+ *
+ * Mimics the GA: each circuit is solved, one volume is then changed by a
+ * small step (continuous mutation) or one destination is changed (discrete
+ * mutation), and the child is solved from zero flows and from the parent's
+ * converged flow state. Prints the iterations per mass balance for every
+ * solver. Both starts must reach the same steady state, and the warm start
+ * must need fewer iterations overall.
+ */
+TEST_F(CircuitSimulatorTest, WarmStartBenchmarkAgainstColdStart)
+{
+    std::vector<std::vector<int>> circuits = {
+        {0, 3, 1, 3, 2, 3, 5, 4, 7, 6, 3, 3, 8},
+        {0, 4, 1, 4, 4},
+        {1, 2, 3, 0, 3, 4, 3, 0, 6},
+        {1, 2, 4, 3, 5, 3, 0, 8, 11, 7, 12, 7, 0, 7, 11, 8, 6, 9, 7, 10, 3},
+    };
+    const std::pair<MassBalanceSolver, const char*> solvers[] = {{MassBalanceSolver::FixedPoint, "fixed point"},
+                                                                 {MassBalanceSolver::GaussSeidel, "Gauss-Seidel"},
+                                                                 {MassBalanceSolver::Anderson, "Anderson"},
+                                                                 {MassBalanceSolver::Newton, "Newton"}};
+    const int children = 50;
+
+    long total_cold = 0;
+    long total_warm = 0;
+    for (const auto& solver : solvers)
+    {
+        long cold_iterations[2] = {0, 0};
+        long warm_iterations[2] = {0, 0};
+        int solved[2] = {0, 0};
+        for (const auto& vec : circuits)
+        {
+            const int size = static_cast<int>(vec.size());
+            const int n = (size - 1) / 2;
+            for (int k = 0; k < children; ++k)
+            {
+                std::vector<double> beta(n);
+                for (int i = 0; i < n; ++i)
+                    beta[i] = ((k * 7 + i * 13) % 19) / 18.0;
+                Circuit parent(n);
+                ASSERT_TRUE(parent.initialize_from_vector(size, vec.data(), beta.data()));
+                parent.set_solver(solver.first);
+                if (!parent.run_mass_balance(1e-6, 1000))
+                    continue;
+                std::vector<double> flow_state;
+                parent.get_flow_state(flow_state);
+                ASSERT_EQ(flow_state.size(), static_cast<size_t>(3 * n));
+
+                // kind 0: one volume changed by a small step; kind 1: one destination changed
+                for (int kind = 0; kind < 2; ++kind)
+                {
+                    std::vector<int> child_vec = vec;
+                    std::vector<double> child_beta = beta;
+                    if (kind == 0)
+                        child_beta[k % n] = std::clamp(child_beta[k % n] + ((k % 2) ? 0.05 : -0.05), 0.0, 1.0);
+                    else
+                        child_vec[1 + k % (2 * n)] = (child_vec[1 + k % (2 * n)] + 1 + k % 3) % (n + 3);
+
+                    Circuit child(n);
+                    if (!child.initialize_from_vector(size, child_vec.data(), child_beta.data()))
+                        continue;
+                    child.set_solver(solver.first);
+                    if (!child.run_mass_balance(1e-6, 1000))
+                        continue;
+                    const double cold_value = child.get_economic_value();
+                    const int cold = child.get_iterations();
+
+                    ASSERT_TRUE(child.run_mass_balance(flow_state, 1e-6, 1000));
+                    EXPECT_NEAR(child.get_economic_value(), cold_value, 1e-3 * std::max(1.0, std::abs(cold_value)));
+                    cold_iterations[kind] += cold;
+                    warm_iterations[kind] += child.get_iterations();
+                    ++solved[kind];
+                }
+            }
+        }
+        for (int kind = 0; kind < 2; ++kind)
+        {
+            std::cout << solver.second << (kind == 0 ? ", volume step: " : ", destination change: ") << "cold "
+                      << static_cast<double>(cold_iterations[kind]) / solved[kind] << " iterations, warm "
+                      << static_cast<double>(warm_iterations[kind]) / solved[kind] << " iterations" << std::endl;
+            total_cold += cold_iterations[kind];
+            total_warm += warm_iterations[kind];
+        }
+    }
+    EXPECT_LT(total_warm, total_cold);
+
+    // A state of the wrong size is ignored
+    std::vector<int> vec = circuits.back();
+    Circuit circuit(10);
+    ASSERT_TRUE(circuit.initialize_from_vector(static_cast<int>(vec.size()), vec.data()));
+    ASSERT_TRUE(circuit.run_mass_balance(1e-6, 1000));
+    const int cold = circuit.get_iterations();
+    ASSERT_TRUE(circuit.run_mass_balance(std::vector<double>(5, 1.0), 1e-6, 1000));
+    EXPECT_EQ(circuit.get_iterations(), cold);
+}
+
+/**
+ * @brief Test that the AVX2 / AVX-512 unit kernels match the scalar path.
+ *
+ * Runs every kernel path the CPU supports on the same block of units and on a
+ * full mass balance with recycle, and compares against the scalar results.
+ */
+TEST_F(CircuitSimulatorTest, UnitKernelPathsMatchScalar)
+{
+    using UnitKernels::Isa;
+    const UnitKernels::Kinetics kinetics = {Constants::Physical::K_PALUSZNIUM, Constants::Physical::K_GORMANIUM,
+                                            Constants::Physical::K_WASTE, Constants::Physical::MATERIAL_DENSITY,
+                                            Constants::Physical::SOLIDS_CONTENT};
+
+    // 13 units: full vectors plus a remainder for both vector widths, including a zero-feed unit
+    const int count = 13;
+    std::vector<double> volume(count), feed(3 * count), prev(3 * count);
+    for (int s = 0; s < count; ++s)
+    {
+        volume[s] = 2.5 + 1.3 * s;
+        for (int c = 0; c < 3; ++c)
+        {
+            feed[c * count + s] = (s == 5) ? 0.0 : 0.5 + 3.7 * c + 0.9 * s;
+            prev[c * count + s] = feed[c * count + s] * (1.0 + 0.01 * ((s * 7 + c) % 11));
+        }
+    }
+
+    std::vector<int> vec = {0, 1, 2, 3, 0, 0, 4};
+    const int n = 3;
+    auto run = [&](Isa isa, std::vector<double>& conc, std::vector<double>& tails, double& change, double& value)
+    {
+        UnitKernels::set_isa(isa);
+        conc.assign(3 * count, 0.0);
+        tails.assign(3 * count, 0.0);
+        UnitKernels::process(kinetics, count, count, volume.data(), feed.data(), conc.data(), tails.data());
+        change = UnitKernels::max_relative_change(3 * count, feed.data(), prev.data());
+
+        // Element-wise kernels of the batch evaluator, folded into the outputs
+        std::vector<double> last = prev, lane_change(count, 0.0);
+        for (int c = 0; c < 3; ++c)
+            UnitKernels::track_relative_change(count, &feed[c * count], &last[c * count], lane_change.data());
+        EXPECT_EQ(last, feed);
+        UnitKernels::exchange_difference(3 * count, tails.data(), last.data());
+        for (int k = 0; k < 3 * count; ++k)
+            tails[k] += lane_change[k % count];
+
+        Circuit circuit(n);
+        circuit.initialize_from_vector(static_cast<int>(vec.size()), vec.data());
+        ASSERT_TRUE(circuit.run_mass_balance(1e-6, 1000));
+        value = circuit.get_economic_value();
+    };
+
+    std::vector<double> conc_ref, tails_ref, conc, tails;
+    double change_ref = 0.0, value_ref = 0.0, change = 0.0, value = 0.0;
+    run(Isa::Scalar, conc_ref, tails_ref, change_ref, value_ref);
+
+    for (Isa isa : {Isa::AVX2, Isa::AVX512})
+    {
+        if (static_cast<int>(isa) > static_cast<int>(UnitKernels::best_isa()))
+            continue; // not supported on this CPU
+        run(isa, conc, tails, change, value);
+        std::cout << "Kernel path " << UnitKernels::isa_name(isa) << std::endl;
+        for (int k = 0; k < 3 * count; ++k)
+        {
+            EXPECT_NEAR(conc[k], conc_ref[k], 1e-12 * std::abs(conc_ref[k]));
+            EXPECT_NEAR(tails[k], tails_ref[k], 1e-12 * std::abs(tails_ref[k]));
+        }
+        EXPECT_NEAR(change, change_ref, 1e-12 * change_ref);
+        EXPECT_NEAR(value, value_ref, 1e-9 * std::abs(value_ref));
+    }
+    UnitKernels::set_isa(UnitKernels::best_isa());
+}
+
+/**
+ * @brief Test that the batch evaluator matches circuit_performance circuit by circuit.
+ *
+ * More circuits than one block, so lanes are refilled, with varied volumes
+ * and a few malformed vectors (feed unit or a destination out of range) in
+ * between.
+ */
+TEST_F(CircuitSimulatorTest, BatchMatchesPerGenome)
+{
+    std::vector<int> vec = {1, 2, 4, 3, 5, 3, 0, 8, 11, 7, 12, 7, 0, 7, 11, 8, 6, 9, 7, 10, 3};
+    const int vector_size = static_cast<int>(vec.size());
+    const int n = (vector_size - 1) / 2;
+    const int count = 150;
+
+    std::vector<int> vectors;
+    std::vector<double> betas;
+    for (int k = 0; k < count; ++k)
+    {
+        std::vector<int> circuit = vec;
+        if (k % 37 == 5)
+            circuit[0] = n; // feed unit out of range
+        if (k % 41 == 7)
+            circuit[2 * (k % n) + 2] = (k % 2 == 0) ? n + 3 : -1; // destination out of range
+        vectors.insert(vectors.end(), circuit.begin(), circuit.end());
+        for (int u = 0; u < n; ++u)
+            betas.push_back(((k * 13 + u * 7) % 29) / 28.0);
+    }
+
+    std::vector<double> performances(count);
+    circuit_performance_batch(count, vector_size, vectors.data(), betas.data(), performances.data(),
+                              default_simulator_parameters);
+
+    for (int k = 0; k < count; ++k)
+    {
+        if (k % 37 == 5 || k % 41 == 7)
+        {
+            EXPECT_EQ(performances[k], -1e12) << "circuit " << k;
+            continue;
+        }
+        const double expected =
+            circuit_performance(vector_size, &vectors[k * vector_size], n, &betas[k * n], default_simulator_parameters);
+        if (expected == -1e12)
+            EXPECT_EQ(performances[k], -1e12) << "circuit " << k;
+        else
+            EXPECT_NEAR(performances[k], expected, 1e-3 * std::max(1.0, std::abs(expected))) << "circuit " << k;
+    }
+
+    // Wrong vector size: every circuit is invalid
+    circuit_performance_batch(count, vector_size - 1, vectors.data(), performances.data());
+    for (double performance : performances)
+        EXPECT_EQ(performance, -1e12);
+
+    // Throughput against the per-genome path
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int k = 0; k < count; ++k)
+        circuit_performance(vector_size, &vectors[k * vector_size]);
+    auto middle = std::chrono::high_resolution_clock::now();
+    circuit_performance_batch(count, vector_size, vectors.data(), performances.data());
+    auto end = std::chrono::high_resolution_clock::now();
+    std::cout << "Per-genome: " << std::chrono::duration<double, std::micro>(middle - start).count() / count
+              << " us/circuit, batch: " << std::chrono::duration<double, std::micro>(end - middle).count() / count
+              << " us/circuit" << std::endl;
+}
+
+/**
+ * @brief Test that the batch evaluator follows the simulation parameters.
+ *
+ * With iteration limits around the iterations the circuits need, every
+ * circuit circuit_performance converges must get its value from the batch
+ * too, whatever the solver. Parameters changing the unit model leave every
+ * circuit to circuit_performance.
+ */
+TEST_F(CircuitSimulatorTest, BatchFollowsSimulatorParameters)
+{
+    std::vector<int> vec = {1, 2, 4, 3, 5, 3, 0, 8, 11, 7, 12, 7, 0, 7, 11, 8, 6, 9, 7, 10, 3};
+    const int vector_size = static_cast<int>(vec.size());
+    const int n = (vector_size - 1) / 2;
+    const int count = 80;
+    std::vector<int> vectors;
+    std::vector<double> betas;
+    for (int k = 0; k < count; ++k)
+    {
+        vectors.insert(vectors.end(), vec.begin(), vec.end());
+        for (int u = 0; u < n; ++u)
+            betas.push_back(((k * 11 + u * 5) % 23) / 22.0);
+    }
+
+    std::vector<double> performances(count);
+    int converged = 0, rejected = 0;
+    for (MassBalanceSolver solver : {MassBalanceSolver::FixedPoint, MassBalanceSolver::GaussSeidel})
+    {
+        for (int max_iterations : {5, 10, 20, 40})
+        {
+            Simulator_Parameters parameters = default_simulator_parameters;
+            parameters.solver = solver;
+            parameters.max_iterations = max_iterations;
+            circuit_performance_batch(count, vector_size, vectors.data(), betas.data(), performances.data(),
+                                      parameters);
+            for (int k = 0; k < count; ++k)
+            {
+                const double expected = circuit_performance(vector_size, vec.data(), n, &betas[k * n], parameters);
+                if (expected == -1e12)
+                {
+                    ++rejected;
+                    continue;
+                }
+                ++converged;
+                EXPECT_NEAR(performances[k], expected, 1e-3 * std::max(1.0, std::abs(expected)))
+                    << "circuit " << k << ", limit " << max_iterations;
+            }
+        }
+    }
+    EXPECT_GT(converged, 0);
+    EXPECT_GT(rejected, 0); // the limits do cut circuits off
+
+    Simulator_Parameters changed_model = default_simulator_parameters;
+    changed_model.feed_waste = 60.0;
+    EXPECT_FALSE(CircuitBatch::supports(changed_model));
+    EXPECT_TRUE(CircuitBatch::supports(default_simulator_parameters));
+    circuit_performance_batch(count, vector_size, vectors.data(), betas.data(), performances.data(), changed_model);
+    for (int k = 0; k < count; ++k)
+        EXPECT_EQ(performances[k], circuit_performance(vector_size, vec.data(), n, &betas[k * n], changed_model));
+}
+
+/**
+ * @brief Test that circuit_performance does not allocate once its workspace is warm.
+ *
+ * Every solver evaluates a set of circuits of different sizes once to warm
+ * the thread's workspace up; evaluating them again must not touch the heap.
+ */
+TEST_F(CircuitSimulatorTest, EvaluationAllocationFreeAfterWarmUp)
+{
+    std::vector<std::vector<int>> circuits = {
+        {0, 3, 1, 3, 2, 3, 5, 4, 7, 6, 3, 3, 8},
+        {0, 1, 2, 3, 0, 0, 4},
+        {1, 2, 4, 3, 5, 3, 0, 8, 11, 7, 12, 7, 0, 7, 11, 8, 6, 9, 7, 10, 3},
+    };
+    std::vector<double> beta(10, 0.3);
+
+    for (auto kind : {MassBalanceSolver::FixedPoint, MassBalanceSolver::GaussSeidel, MassBalanceSolver::Newton,
+                      MassBalanceSolver::Anderson})
+    {
+        Simulator_Parameters parameters;
+        parameters.solver = kind;
+        std::vector<double> warm, again;
+        warm.reserve(2 * circuits.size());
+        again.reserve(2 * circuits.size());
+
+        auto evaluate_all = [&](std::vector<double>& values)
+        {
+            for (auto& vec : circuits)
+            {
+                const int size = static_cast<int>(vec.size());
+                const int n = (size - 1) / 2;
+                values.push_back(circuit_performance(size, vec.data(), n, nullptr, parameters));
+                values.push_back(circuit_performance(size, vec.data(), n, beta.data(), parameters));
+            }
+        };
+
+        evaluate_all(warm);
+        const long before = allocation_count.load();
+        evaluate_all(again);
+        const long allocations = allocation_count.load() - before;
+
+        EXPECT_EQ(allocations, 0) << "solver " << static_cast<int>(kind);
+        EXPECT_EQ(again, warm);
+    }
+}
+
+/**
+ * @brief Test the compiled topology and its use by several circuits at once.
+ *
+ * Checks the edge lists of a small circuit, then evaluates many volume sets
+ * on one shared topology from several threads and compares against circuits
+ * initialised from the vector.
+ */
+TEST_F(CircuitSimulatorTest, SharedTopologyMatchesVector)
+{
+    // feed -> unit 0; unit 0 -> unit 1 / tailings; unit 1 -> palusznium / unit 0
+    std::vector<int> small = {0, 1, 4, 2, 0};
+    CircuitTopology topology;
+    ASSERT_TRUE(topology.compile(static_cast<int>(small.size()), small.data()));
+    EXPECT_EQ(topology.outlet_node, (std::vector<int>{1, 4, 2, 0}));
+    EXPECT_EQ(topology.succ_unit, (std::vector<int>{1, 0}));
+    EXPECT_EQ(topology.in_start, (std::vector<int>{0, 1, 2, 3, 3, 4, 4}));
+    EXPECT_EQ(topology.in_outlet, (std::vector<int>{3, 0, 2, 1}));
+    // Flow back into the feed unit is not routed: no recycle loop, one hand-over 0 -> 1
+    EXPECT_EQ(topology.component_cyclic, (std::vector<bool>{false, false}));
+    EXPECT_TRUE(topology.loop_outlet.empty());
+    EXPECT_EQ(topology.handover_outlet, (std::vector<int>{0}));
+    EXPECT_EQ(topology.handover_unit, (std::vector<int>{1}));
+    EXPECT_FALSE(topology.compile(4, small.data()));
+
+    std::vector<int> vec = {1, 2, 4, 3, 5, 3, 0, 8, 11, 7, 12, 7, 0, 7, 11, 8, 6, 9, 7, 10, 3};
+    const int size = static_cast<int>(vec.size());
+    const int n = (size - 1) / 2;
+    ASSERT_TRUE(topology.compile(size, vec.data()));
+
+    const int count = 64;
+    std::vector<double> betas(count * n), shared(count), own(count);
+    for (int k = 0; k < count * n; ++k)
+        betas[k] = ((k * 17) % 23) / 22.0;
+
+#pragma omp parallel
+    {
+        Circuit circuit(n);
+#pragma omp for
+        for (int k = 0; k < count; ++k)
+        {
+            circuit.reset(topology, &betas[k * n]);
+            shared[k] = circuit.run_mass_balance(1e-6, 100) ? circuit.get_economic_value() : -1e12;
+        }
+    }
+
+    for (int k = 0; k < count; ++k)
+    {
+        Circuit circuit(n, &betas[k * n]);
+        ASSERT_TRUE(circuit.initialize_from_vector(size, vec.data(), &betas[k * n]));
+        own[k] = circuit.run_mass_balance(1e-6, 100) ? circuit.get_economic_value() : -1e12;
+    }
+    EXPECT_EQ(shared, own);
+}
+
+TEST_F(CircuitSimulatorTest, CompiledCircuitMatchesCircuitPerformance)
+{
+    std::vector<int> vec = {1, 2, 4, 3, 5, 3, 0, 8, 11, 7, 12, 7, 0, 7, 11, 8, 6, 9, 7, 10, 3};
+    const int size = static_cast<int>(vec.size());
+    const int n = (size - 1) / 2;
+    CompiledCircuit compiled(size, vec.data());
+    ASSERT_TRUE(compiled.matches(size, vec.data()));
+    EXPECT_EQ(compiled.get_num_units(), n);
+
+    Circuit checker(n);
+    EXPECT_EQ(compiled.is_valid(), checker.check_validity(size, vec.data()));
+
+    const int count = 200;
+    std::vector<double> betas(count * n), batch(count);
+    for (int k = 0; k < count * n; ++k)
+        betas[k] = ((k * 17) % 23) / 22.0;
+
+    compiled.evaluate_batch(count, betas.data(), batch.data());
+    for (int k = 0; k < count; ++k)
+    {
+        const double expected = circuit_performance(size, vec.data(), n, &betas[k * n]);
+        EXPECT_EQ(compiled.evaluate(&betas[k * n]), expected) << "beta set " << k;
+        EXPECT_NEAR(batch[k], expected, 1e-3 * std::max(1.0, std::abs(expected))) << "beta set " << k;
+        EXPECT_EQ(compiled.check_validity(n, &betas[k * n]), compiled.is_valid());
+    }
+
+    std::vector<double> out_of_range(betas.begin(), betas.begin() + n);
+    out_of_range[n / 2] = 1.5;
+    EXPECT_FALSE(compiled.check_validity(n, out_of_range.data()));
+
+    // Recompiling for another vector replaces the circuit; a malformed one cannot be evaluated
+    std::vector<int> malformed = {7, 1, 2, 3, 4, 0};
+    compiled.compile(static_cast<int>(malformed.size()), malformed.data());
+    EXPECT_FALSE(compiled.matches(size, vec.data()));
+    EXPECT_FALSE(compiled.is_valid());
+    EXPECT_EQ(compiled.evaluate(betas.data()), -1e12);
+}
+
+TEST_F(CircuitSimulatorTest, EvaluateCircuitMatchesValidityAndPerformance)
+{
+    std::vector<std::vector<int>> circuits = {
+        {0, 3, 1, 3, 2, 3, 5, 4, 7, 6, 3, 3, 8},
+        {0, 4, 1, 4, 4},
+        {1, 2, 3, 0, 3, 4, 3, 0, 6},
+        {1, 2, 4, 3, 5, 3, 0, 8, 11, 7, 12, 7, 0, 7, 11, 8, 6, 9, 7, 10, 3},
+        {0, 1, 2, 0, 3, 0, 3},             // unit 1 and 2 reach one outlet only
+        {0, 0, 5, 1, 5, 2, 5, 3, 5, 4, 5}, // self-loop
+        {7, 1, 2, 0, 4, 1, 4},             // feed unit out of range
+    };
+    for (auto& vec : circuits)
+    {
+        const int size = static_cast<int>(vec.size());
+        const int n = (size - 1) / 2;
+        Circuit checker(n);
+        const bool valid = checker.check_validity(size, vec.data());
+
+        Circuit_Evaluation e = evaluate_circuit(size, vec.data(), n, nullptr);
+        EXPECT_EQ(e.valid, valid);
+        EXPECT_EQ(e.valid, e.reason == ValidityReason::Valid);
+        if (e.valid)
+        {
+            EXPECT_EQ(e.fitness, circuit_performance(size, vec.data()));
+            EXPECT_GE(e.iterations, 1);
+        }
+        else
+        {
+            EXPECT_EQ(e.fitness, -1e12);
+        }
+
+        // Warm-started from its own converged state, a valid circuit converges at once
+        std::vector<double> flow_state;
+        e = evaluate_circuit(size, vec.data(), n, nullptr, default_simulator_parameters, flow_state);
+        if (e.valid)
+        {
+            ASSERT_EQ(flow_state.size(), static_cast<size_t>(3 * n));
+            Circuit_Evaluation warm =
+                evaluate_circuit(size, vec.data(), n, nullptr, default_simulator_parameters, flow_state);
+            EXPECT_TRUE(warm.valid);
+            EXPECT_LE(warm.iterations, e.iterations);
+            EXPECT_NEAR(warm.fitness, e.fitness, 1e-3 * std::max(1.0, std::abs(e.fitness)));
+        }
+    }
+
+    std::vector<int> vec = circuits[3];
+    std::vector<double> beta(10, 0.5);
+    Circuit_Evaluation e = evaluate_circuit(21, vec.data(), 10, beta.data());
+    EXPECT_TRUE(e.valid);
+    EXPECT_EQ(e.fitness, circuit_performance(21, vec.data(), 10, beta.data()));
+    beta[3] = 1.5;
+    EXPECT_EQ(evaluate_circuit(21, vec.data(), 10, beta.data()).reason, ValidityReason::UnitParameters);
+    EXPECT_EQ(evaluate_circuit(20, vec.data(), 10, nullptr).reason, ValidityReason::Length);
+
+    // The compiled circuit gives the same evaluation
+    CompiledCircuit compiled(21, vec.data());
+    std::vector<double> flow_state;
+    beta[3] = 0.5;
+    Circuit_Evaluation c = compiled.evaluate_circuit(10, beta.data(), flow_state);
+    EXPECT_TRUE(c.valid);
+    EXPECT_EQ(c.fitness, circuit_performance(21, vec.data(), 10, beta.data()));
+    beta[3] = -0.5;
+    EXPECT_EQ(compiled.evaluate_circuit(10, beta.data(), flow_state).reason, ValidityReason::UnitParameters);
+}
+
+
+/**
+ * @brief Test single-gene changes against solving the changed circuit from scratch.
+ *
+ * A circuit walks through random gene changes with apply_gene_change. After
+ * every step the reason must match check_structure on the changed vector
+ * (a rejected change leaves the circuit as it was), and a valid circuit
+ * must have the economic value of a fresh, cold mass balance (the cap on
+ * iterations is generous, so that slow loops converge from either start).
+ * Re-solving only the units downstream of each change should take fewer
+ * iterations.
+ */
+TEST_F(CircuitSimulatorTest, GeneChangeMatchesFullSolve)
+{
+    std::vector<int> vec = {1, 2, 4, 3, 5, 3, 0, 8, 11, 7, 12, 7, 0, 7, 11, 8, 6, 9, 7, 10, 3};
+    const int size = static_cast<int>(vec.size());
+    const int n = (size - 1) / 2;
+    std::vector<double> beta(n);
+    for (int i = 0; i < n; ++i)
+        beta[i] = (i * 7 % 11) / 10.0;
+
+    Circuit circuit(n);
+    ASSERT_TRUE(circuit.initialize_from_vector(size, vec.data(), beta.data()));
+    ASSERT_TRUE(circuit.run_mass_balance(1e-6, 1000));
+
+    long incremental_iterations = 0, cold_iterations = 0;
+    int accepted = 0, rejected = 0;
+    unsigned state = 15;
+    for (int step = 0; step < 400; ++step)
+    {
+        state = state * 1103515245u + 12345u;
+        const int pos = (state >> 8) % size;
+        state = state * 1103515245u + 12345u;
+        const int new_dest = (pos == 0) ? (state >> 8) % n : (state >> 8) % (n + 3);
+
+        std::vector<int> changed = vec;
+        changed[pos] = new_dest;
+        Circuit reference(n);
+        const ValidityReason expected = reference.check_structure(size, changed.data());
+
+        const ValidityReason reason = circuit.apply_gene_change(pos, new_dest, 1e-6, 5000);
+        if (expected != ValidityReason::Valid)
+        {
+            EXPECT_EQ(reason, expected) << "step " << step;
+            EXPECT_EQ(circuit.get_topology().circuit_vector, vec) << "step " << step;
+            ++rejected;
+            continue;
+        }
+        vec = changed;
+        ASSERT_TRUE(reference.initialize_from_vector(size, vec.data(), beta.data()));
+        const bool converged = reference.run_mass_balance(1e-6, 5000);
+        ASSERT_EQ(reason == ValidityReason::Valid, converged) << "step " << step;
+        if (!converged)
+            continue;
+
+        const double value = reference.get_economic_value();
+        EXPECT_NEAR(circuit.get_economic_value(), value, 1e-3 * std::max(1.0, std::abs(value))) << "step " << step;
+        incremental_iterations += circuit.get_iterations();
+        cold_iterations += reference.get_iterations();
+        ++accepted;
+    }
+    std::cout << "Gene changes: " << accepted << " solved, " << rejected << " rejected; cold "
+              << static_cast<double>(cold_iterations) / accepted << " iterations, incremental "
+              << static_cast<double>(incremental_iterations) / accepted << " iterations" << std::endl;
+    EXPECT_GT(accepted, 20);
+    EXPECT_GT(rejected, 20);
+    EXPECT_LT(incremental_iterations, cold_iterations);
+}
+
+TEST_F(CircuitSimulatorTest, EvaluationStoreKeepsEvaluationsBetweenRuns)
+{
+    const std::string directory = ::testing::TempDir() + "evaluation_store_test";
+    const int n = 10;
+    std::vector<std::vector<int>> circuits = {
+        {1, 2, 4, 3, 5, 3, 0, 8, 11, 7, 12, 7, 0, 7, 11, 8, 6, 9, 7, 10, 3},
+        {0, 0, 11, 1, 11, 2, 11, 3, 11, 4, 11, 5, 11, 6, 11, 7, 11, 8, 11, 9, 12}, // self-loop
+    };
+    std::vector<double> betas(n, 0.5), other_betas(n, 0.25);
+    {
+        EvaluationStore stale(directory, n, default_simulator_parameters, 1024);
+        std::remove(stale.get_path().c_str()); // start from an empty file
+    }
+
+    std::vector<Circuit_Evaluation> expected;
+    std::vector<std::vector<double>> expected_flows;
+    {
+        // Two mappings of the same file, as two processes would have
+        EvaluationStore first(directory, n, default_simulator_parameters, 1024);
+        EvaluationStore second(directory, n, default_simulator_parameters, 1024);
+        ASSERT_TRUE(first.is_open()) << first.get_path();
+        ASSERT_EQ(first.get_path(), second.get_path());
+
+        Circuit_Evaluation e;
+        for (auto& vec : circuits)
+        {
+            std::vector<double> flows;
+            EXPECT_FALSE(first.find(vec.data(), betas.data(), e, flows));
+            expected.push_back(evaluate_circuit(static_cast<int>(vec.size()), vec.data(), n, betas.data(),
+                                                default_simulator_parameters, flows));
+            expected_flows.push_back(flows);
+            first.insert(vec.data(), betas.data(), expected.back(), true, flows);
+        }
+        for (size_t k = 0; k < circuits.size(); ++k)
+        {
+            std::vector<double> flows;
+            ASSERT_TRUE(second.find(circuits[k].data(), betas.data(), e, flows));
+            EXPECT_EQ(e.valid, expected[k].valid);
+            EXPECT_EQ(e.reason, expected[k].reason);
+            EXPECT_EQ(e.fitness, expected[k].fitness);
+            EXPECT_EQ(flows, expected_flows[k]); // the converged feeds of a valid circuit, nothing otherwise
+            EXPECT_FALSE(second.find(circuits[k].data(), other_betas.data(), e, flows));
+            EXPECT_FALSE(second.find(circuits[k].data(), nullptr, e, flows));
+        }
+        EXPECT_EQ(first.misses(), 2);
+        EXPECT_EQ(second.hits(), 2);
+
+        // A warm evaluation is not kept, and a lookup with carried flows misses even a stored circuit
+        std::vector<double> warm_betas(n, 0.75), cold_flows, warm_flows = expected_flows[0];
+        first.insert(circuits[0].data(), warm_betas.data(), expected[0], false, warm_flows);
+        EXPECT_FALSE(second.find(circuits[0].data(), warm_betas.data(), e, cold_flows));
+        EXPECT_FALSE(second.find(circuits[0].data(), betas.data(), e, warm_flows));
+        EXPECT_EQ(warm_flows, expected_flows[0]);
+    }
+
+    // A later run finds the evaluations; other simulator parameters use another file
+    EvaluationStore reopened(directory, n, default_simulator_parameters, 1024);
+    Circuit_Evaluation e;
+    std::vector<double> flows;
+    ASSERT_TRUE(reopened.find(circuits[0].data(), betas.data(), e, flows));
+    EXPECT_EQ(e.fitness, expected[0].fitness);
+
+    Simulator_Parameters tighter = default_simulator_parameters;
+    tighter.tolerance /= 10;
+    EvaluationStore changed(directory, n, tighter, 1024);
+    EXPECT_NE(changed.get_path(), reopened.get_path());
+    flows.clear();
+    EXPECT_FALSE(changed.find(circuits[0].data(), betas.data(), e, flows));
+    std::remove(changed.get_path().c_str());
+}
+
+TEST_F(CircuitSimulatorTest, EvaluationStoreReplacesStaleEntries)
+{
+    const std::string directory = ::testing::TempDir() + "evaluation_store_aging_test";
+    const int n = 10;
+    const size_t capacity = 2 * EvaluationStore::MAX_PROBES;
+    std::vector<int> circuit = {1, 2, 4, 3, 5, 3, 0, 8, 11, 7, 12, 7, 0, 7, 11, 8, 6, 9, 7, 10, 3};
+    auto key = [&](int k)
+    {
+        std::vector<double> betas(n, 0.5);
+        betas[0] = 0.001 * k;
+        return betas;
+    };
+    auto find = [&](EvaluationStore& store, int k)
+    {
+        Circuit_Evaluation e;
+        std::vector<double> betas = key(k), flows;
+        return store.find(circuit.data(), betas.data(), e, flows) && e.fitness == k;
+    };
+    auto insert = [&](EvaluationStore& store, int k)
+    {
+        Circuit_Evaluation e;
+        e.fitness = k;
+        std::vector<double> betas = key(k), flows;
+        store.insert(circuit.data(), betas.data(), e, true, flows);
+    };
+    {
+        EvaluationStore stale(directory, n, default_simulator_parameters, capacity);
+        std::remove(stale.get_path().c_str()); // start from an empty file
+    }
+
+    // A first run fills every slot, replacing its own entries once the probe sequences are full
+    {
+        EvaluationStore first(directory, n, default_simulator_parameters, capacity);
+        ASSERT_TRUE(first.is_open());
+        for (int k = 0; k < 2 * static_cast<int>(capacity); ++k)
+            insert(first, k);
+        ASSERT_TRUE(find(first, 2 * static_cast<int>(capacity) - 1)) << "a full store took no new entry";
+    }
+
+    // A second run uses a few of them and adds fewer new ones than half the slots, so every probe
+    // sequence still holds an entry of the first run: the entries used or added are all kept
+    EvaluationStore second(directory, n, default_simulator_parameters, capacity);
+    std::vector<int> used;
+    for (int k = 0; k < 2 * static_cast<int>(capacity) && used.size() < 8; ++k)
+        if (find(second, k))
+            used.push_back(k);
+    ASSERT_EQ(used.size(), 8u);
+    const int first_new = 10000, added = static_cast<int>(capacity / 2) - 8 - 1;
+    for (int k = first_new; k < first_new + added; ++k)
+        insert(second, k);
+    for (int k : used)
+        EXPECT_TRUE(find(second, k)) << "entry " << k << " was used in this run but replaced";
+    for (int k = first_new; k < first_new + added; ++k)
+        EXPECT_TRUE(find(second, k)) << "entry " << k << " was added in this run but replaced";
+    std::remove(second.get_path().c_str());
+}
+
+TEST_F(CircuitSimulatorTest, CanonicalLabellingIgnoresUnitNumbering)
+{
+    const int n = 10;
+    std::vector<int> circuit = {1, 2, 4, 3, 5, 3, 0, 8, 11, 7, 12, 7, 0, 7, 11, 8, 6, 9, 7, 10, 3};
+    const std::vector<int> new_number = {4, 9, 0, 7, 2, 5, 1, 8, 3, 6};
+    std::vector<double> betas(n);
+    for (int u = 0; u < n; ++u)
+        betas[u] = 0.3 + 0.05 * u;
+
+    // The same circuit with unit u renumbered new_number[u], keeping its volume
+    std::vector<int> renumbered(circuit.size());
+    std::vector<double> renumbered_betas(n);
+    renumbered[0] = new_number[circuit[0]];
+    for (int u = 0; u < n; ++u)
+    {
+        for (int outlet = 1; outlet <= 2; ++outlet)
+        {
+            const int dest = circuit[2 * u + outlet];
+            renumbered[2 * new_number[u] + outlet] = dest < n ? new_number[dest] : dest;
+        }
+        renumbered_betas[new_number[u]] = betas[u];
+    }
+    ASSERT_NE(renumbered, circuit);
+
+    Circuit_Labelling a, b;
+    ASSERT_TRUE(canonical_labelling(static_cast<int>(circuit.size()), circuit.data(), a));
+    ASSERT_TRUE(canonical_labelling(static_cast<int>(renumbered.size()), renumbered.data(), b));
+    EXPECT_EQ(a.circuit_vector, b.circuit_vector);
+    EXPECT_EQ(a.circuit_vector[0], 0);
+
+    std::vector<double> canonical_a(n), canonical_b(n), back(n);
+    to_canonical_order(a, betas.data(), 1, canonical_a.data());
+    to_canonical_order(b, renumbered_betas.data(), 1, canonical_b.data());
+    EXPECT_EQ(canonical_a, canonical_b);
+    from_canonical_order(a, canonical_a.data(), 1, back.data());
+    EXPECT_EQ(back, betas);
+
+    // A malformed vector keeps its numbering
+    std::vector<int> malformed = circuit;
+    malformed[3] = n + 3;
+    EXPECT_FALSE(canonical_labelling(static_cast<int>(malformed.size()), malformed.data(), a));
+    EXPECT_EQ(a.circuit_vector, malformed);
+
+    // The store serves the renumbered circuit from the entry of the original, with the feeds renumbered
+    const std::string directory = ::testing::TempDir() + "evaluation_store_canonical_test";
+    EvaluationStore store(directory, n, default_simulator_parameters, 1024);
+    ASSERT_TRUE(store.is_open());
+    std::remove(store.get_path().c_str()); // the mapping stays, later runs start empty
+    std::vector<double> flows, renumbered_flows;
+    Circuit_Evaluation expected = evaluate_circuit(static_cast<int>(circuit.size()), circuit.data(), n, betas.data(),
+                                                   default_simulator_parameters, flows);
+    ASSERT_TRUE(expected.valid);
+    store.insert(circuit.data(), betas.data(), expected, true, flows);
+
+    Circuit_Evaluation e;
+    ASSERT_TRUE(store.find(renumbered.data(), renumbered_betas.data(), e, renumbered_flows));
+    EXPECT_EQ(e.fitness, expected.fitness);
+    ASSERT_EQ(renumbered_flows.size(), flows.size());
+    for (int u = 0; u < n; ++u)
+        for (int c = 0; c < 3; ++c)
+            EXPECT_EQ(renumbered_flows[3 * new_number[u] + c], flows[3 * u + c]);
+    renumbered_flows.clear();
+    EXPECT_FALSE(store.find(renumbered.data(), betas.data(), e, renumbered_flows)); // volumes not moved along
+
+    // and simulating it gives the same result
+    renumbered_flows.clear();
+    Circuit_Evaluation direct = evaluate_circuit(static_cast<int>(renumbered.size()), renumbered.data(), n,
+                                                 renumbered_betas.data(), default_simulator_parameters,
+                                                 renumbered_flows);
+    EXPECT_NEAR(direct.fitness, expected.fitness, 1e-6 * std::fabs(expected.fitness));
+}
+
+TEST_F(CircuitSimulatorTest, PerformanceGradientMatchesFiniteDifferences)
+{
+    const int n = 10;
+    std::vector<int> circuit = {1, 2, 4, 3, 5, 3, 0, 8, 11, 7, 12, 7, 0, 7, 11, 8, 6, 9, 7, 10, 3};
+    const int size = static_cast<int>(circuit.size());
+
+    // Tight convergence, so the finite differences see the steady state and not the solver
+    Simulator_Parameters tight = default_simulator_parameters;
+    tight.solver = MassBalanceSolver::Newton;
+    tight.tolerance = 1e-13;
+    tight.max_iterations = 1000;
+
+    // Small volumes, and volumes beyond the circuit volume limit where its penalty applies
+    for (double base : {0.3, 0.9})
+    {
+        std::vector<double> betas(n);
+        for (int u = 0; u < n; ++u)
+            betas[u] = base + 0.01 * u;
+        std::vector<double> gradient(n, -1.0);
+        const double value =
+            circuit_performance_with_gradient(size, circuit.data(), n, betas.data(), gradient.data(), tight);
+        ASSERT_GT(value, -1e11);
+        EXPECT_NEAR(value, circuit_performance(size, circuit.data(), n, betas.data(), tight), 1e-9);
+
+        const double h = 1e-6;
+        for (int u = 0; u < n; ++u)
+        {
+            std::vector<double> up = betas, down = betas;
+            up[u] += h;
+            down[u] -= h;
+            const double fd = (circuit_performance(size, circuit.data(), n, up.data(), tight) -
+                               circuit_performance(size, circuit.data(), n, down.data(), tight)) /
+                              (2 * h);
+            EXPECT_NEAR(gradient[u], fd, 1e-4 * std::max(1.0, std::fabs(fd))) << "unit " << u << ", base " << base;
+        }
+
+        // Warm-started from the converged feeds, the same value and gradient
+        std::vector<double> flows, warm_gradient(n);
+        circuit_performance_with_gradient(size, circuit.data(), n, betas.data(), warm_gradient.data(), tight, flows);
+        EXPECT_EQ(flows.size(), static_cast<size_t>(3 * n));
+        circuit_performance_with_gradient(size, circuit.data(), n, betas.data(), warm_gradient.data(), tight, flows);
+        for (int u = 0; u < n; ++u)
+            EXPECT_NEAR(warm_gradient[u], gradient[u], 1e-6 * std::max(1.0, std::fabs(gradient[u])));
+    }
+
+    // No gradient for a circuit that cannot be evaluated
+    std::vector<int> broken = circuit;
+    broken[0] = n + 5;
+    std::vector<double> betas(n, 0.5), gradient(n, 1.0);
+    EXPECT_EQ(circuit_performance_with_gradient(size, broken.data(), n, betas.data(), gradient.data()), -1e12);
+    EXPECT_EQ(gradient, std::vector<double>(n, 0.0));
+}
@@ -8,11 +8,20 @@
  * validity checks, and performance evaluation.
  */
 #include "CCircuit.h"   // For Circuit class and check_validity
+#include "CCircuitScreen.h"
 #include "CSimulator.h" // For circuit_performance
+#include "Fitness_Cache.h"
 #include "Genetic_Algorithm.h"
+#include "Island_Model.h"
+#include "Local_Refinement.h"
+#include "Population.h"
+#include <algorithm>
+#include <atomic>
 #include <cmath>
 #include <gtest/gtest.h>
 #include <iostream>
+#include <mutex>
+#include <omp.h>
 #include <vector>
 
 // Test parameters
@@ -307,6 +316,99 @@ TEST_F(GeneticAlgorithmTest, OptimizeSimpleContinuousVariables)
     std::cout << std::endl;
 }
 
+TEST_F(GeneticAlgorithmTest, OptimizeContinuousWithPopulationFitness)
+{
+    const int L_continuous = target_beta_values_for_cont_test.size();
+    std::vector<double> initial_continuous_guess(L_continuous, 0.1);
+
+    int calls = 0;
+    params.fitness_cache_size = 0; // cached genomes would be left out of the call
+    Population_Fitness batch_fitness = [&](int count, int size, const double* genomes, double* fitnesses)
+    {
+        // The whole population in one call
+        EXPECT_EQ(count, params.population_size);
+        ++calls;
+        std::vector<double> genome(size);
+        for (int k = 0; k < count; ++k)
+        {
+            genome.assign(genomes + k * size, genomes + (k + 1) * size);
+            fitnesses[k] = simple_continuous_fitness_adapter(size, genome.data());
+        }
+    };
+
+    int status = optimize(L_continuous, initial_continuous_guess.data(), batch_fitness,
+                          dummy_validity_continuous_adapter, params);
+
+    ASSERT_EQ(status, 0) << "Optimization failed (population fitness).";
+    OptimizationResult result = get_last_optimization_result();
+    EXPECT_GT(calls, 0);
+    EXPECT_LE(calls, params.max_iterations + 1);
+    ASSERT_NEAR(result.best_fitness, 0.0, EPSILON * EPSILON * L_continuous);
+    for (int i = 0; i < L_continuous; ++i)
+        ASSERT_NEAR(initial_continuous_guess[i], target_beta_values_for_cont_test[i], EPSILON);
+}
+
+TEST_F(GeneticAlgorithmTest, OptimizeContinuousCarriesWarmState)
+{
+    const int L_continuous = target_beta_values_for_cont_test.size();
+    std::vector<double> initial_continuous_guess(L_continuous, 0.1);
+
+    // The state is the genome it was computed for, so a child arrives with its parent's genome and a
+    // survivor with its own. Without the cache the survivors are evaluated again every generation.
+    params.fitness_cache_size = 0;
+    std::atomic<int> cold_calls{0}, inherited_calls{0}, own_calls{0}, bad_states{0};
+    auto warm_fitness = [&](int size, double* genome, std::vector<double>& state)
+    {
+        if (state.empty())
+            ++cold_calls;
+        else if (static_cast<int>(state.size()) != size)
+            ++bad_states;
+        else if (std::equal(state.begin(), state.end(), genome))
+            ++own_calls;
+        else
+            ++inherited_calls;
+        state.assign(genome, genome + size);
+        return simple_continuous_fitness_adapter(size, genome);
+    };
+
+    int status = optimize(L_continuous, initial_continuous_guess.data(), warm_fitness,
+                          dummy_validity_continuous_adapter, params);
+
+    ASSERT_EQ(status, 0) << "Optimization failed (warm state).";
+    // The first generation starts cold, as do the checks of new bests
+    EXPECT_GT(cold_calls, params.population_size);
+    EXPECT_GT(inherited_calls, 0);
+    EXPECT_GT(own_calls, 0);
+    EXPECT_EQ(bad_states, 0);
+    for (int i = 0; i < L_continuous; ++i)
+        ASSERT_NEAR(initial_continuous_guess[i], target_beta_values_for_cont_test[i], EPSILON);
+}
+
+TEST_F(GeneticAlgorithmTest, OptimizeContinuousWithFusedEvaluation)
+{
+    const int L_continuous = target_beta_values_for_cont_test.size();
+    std::vector<double> initial_continuous_guess(L_continuous, 0.1);
+
+    // Genomes past 0.55 in the first gene are invalid, so the best valid genome sits on that bound
+    std::atomic<int> screened{0};
+    Continuous_Evaluation evaluation = [](int size, double* genome, std::vector<double>&)
+    { return Genome_Evaluation{genome[0] <= 0.55, simple_continuous_fitness_adapter(size, genome)}; };
+    auto screen = [&](int size, double* genome)
+    {
+        ++screened;
+        return dummy_validity_continuous_adapter(size, genome);
+    };
+
+    int status = optimize(L_continuous, initial_continuous_guess.data(), evaluation, screen, params);
+
+    ASSERT_EQ(status, 0) << "Optimization failed (fused evaluation).";
+    // The screen only sees the initial population, evaluation decides validity afterwards
+    EXPECT_EQ(screened, params.population_size);
+    EXPECT_LE(initial_continuous_guess[0], 0.55);
+    for (int i = 0; i < L_continuous; ++i)
+        ASSERT_NEAR(initial_continuous_guess[i], target_beta_values_for_cont_test[i], EPSILON);
+}
+
 /**
  * @brief Fitness function for matching the real test answer.
  *
@@ -374,6 +476,93 @@ TEST_F(GeneticAlgorithmTest, OptimizeContinuousToMatchRealTestAnswerL21)
     std::cout << std::endl;
 }
 
+TEST_F(GeneticAlgorithmTest, OptimizeContinuousRefinesElites)
+{
+    // Too few generations to get close; genomes past 0.3 in the second gene are invalid, so the
+    // optimum sits on that bound, 0.1 short of the answer
+    const int L_continuous = real_test_answer.size();
+    params.max_iterations = 10;
+    params.refine_elite_count = 3;
+    const double best_valid = -0.1 * 0.1;
+
+    // Finite differences of the fused evaluation
+    Continuous_Evaluation evaluation = [](int size, double* genome, std::vector<double>&)
+    { return Genome_Evaluation{genome[1] <= 0.3, match_real_test_answer_fitness_adapter(size, genome)}; };
+    std::vector<double> by_differences(L_continuous, 0.5);
+    ASSERT_EQ(optimize(L_continuous, by_differences.data(), evaluation, dummy_validity_continuous_adapter, params), 0);
+    OptimizationResult result = get_last_optimization_result();
+    EXPECT_GT(result.refinement_gain, 0.0);
+    EXPECT_NEAR(result.best_fitness, best_valid, 1e-3);
+    EXPECT_LE(by_differences[1], 0.3);
+
+    // Analytic gradient, next to whole-population evaluation
+    std::atomic<int> gradient_calls{0};
+    Population_Fitness batch_fitness = [&](int count, int size, const double* genomes, double* fitnesses)
+    {
+        std::vector<double> genome(size);
+        for (int k = 0; k < count; ++k)
+        {
+            genome.assign(genomes + k * size, genomes + (k + 1) * size);
+            fitnesses[k] = genome[1] <= 0.3 ? match_real_test_answer_fitness_adapter(size, genome.data()) : -1e9;
+        }
+    };
+    Continuous_Gradient gradient = [&](int size, double* genome, double* grad, std::vector<double>&)
+    {
+        ++gradient_calls;
+        for (int i = 0; i < size; ++i)
+            grad[i] = -2.0 * (genome[i] - real_test_answer[i]);
+        return Genome_Evaluation{genome[1] <= 0.3, match_real_test_answer_fitness_adapter(size, genome)};
+    };
+    std::vector<double> by_gradient(L_continuous, 0.5);
+    ASSERT_EQ(optimize(L_continuous, by_gradient.data(), Continuous_Evaluator(batch_fitness, gradient),
+                       dummy_validity_continuous_adapter, params),
+              0);
+    result = get_last_optimization_result();
+    EXPECT_GT(gradient_calls, 0);
+    EXPECT_GT(result.refinement_gain, 0.0);
+    EXPECT_NEAR(result.best_fitness, best_valid, 1e-3);
+    EXPECT_LE(by_gradient[1], 0.3);
+    for (int i = 2; i < L_continuous; ++i)
+        EXPECT_NEAR(by_gradient[i], real_test_answer[i], 1e-3);
+}
+
+/**
+ * @brief Test that the refinement takes the gradient of a point only once.
+ *
+ * The first trial of a line search takes the gradient with the value; if
+ * that trial is accepted, the step must not ask for the gradient again.
+ */
+TEST(LocalRefinementTest, TakesOneGradientPerStep)
+{
+    const std::vector<double> optimum = {0.3, 0.6, 0.45, 0.7};
+    const int n = static_cast<int>(optimum.size());
+    std::vector<double> last_point(n, -1.0);
+    bool last_gradient = false;
+    int repeated = 0; // gradients asked for at the point whose gradient the last call took
+    Box_Objective objective = [&](const double* x, double& value, double* gradient)
+    {
+        if (gradient != nullptr && last_gradient && std::equal(x, x + n, last_point.begin()))
+            ++repeated;
+        last_point.assign(x, x + n);
+        last_gradient = gradient != nullptr;
+        value = 0.0;
+        for (int i = 0; i < n; ++i)
+        {
+            value -= (i + 1) * (x[i] - optimum[i]) * (x[i] - optimum[i]);
+            if (gradient != nullptr)
+                gradient[i] = -2.0 * (i + 1) * (x[i] - optimum[i]);
+        }
+        return true;
+    };
+
+    std::vector<double> x(n, 0.5);
+    Refinement_Result result = refine_in_box(n, x.data(), objective, 50);
+    EXPECT_GT(result.iterations, 0);
+    EXPECT_EQ(repeated, 0);
+    for (int i = 0; i < n; ++i)
+        EXPECT_NEAR(x[i], optimum[i], 1e-3);
+}
+
 /**
  * @brief Test for optimizing discrete variables for a circuit with N=10.
  *
@@ -412,6 +601,474 @@ TEST_F(GeneticAlgorithmTest, OptimizeDiscreteWithN10Circuit)
     ASSERT_TRUE(c_final.check_validity(L_discrete, initial_guess.data())) << "GA found an invalid N10 solution.";
 }
 
+/**
+ * @brief Test the discrete GA with a fused evaluation and a batched screen.
+ *
+ * New circuits reach the GA through CircuitScreen in batches of at most 64;
+ * the result must be a valid circuit.
+ */
+TEST_F(GeneticAlgorithmTest, OptimizeDiscreteWithBatchedScreen)
+{
+    const int n_units = 5;
+    const int L_discrete = 2 * n_units + 1;
+    std::vector<int> initial_guess(L_discrete, 0);
+
+    Discrete_Evaluation evaluation = [](int size, int* vec, std::vector<double>& flow_state)
+    {
+        Circuit_Evaluation e =
+            evaluate_circuit(size, vec, (size - 1) / 2, nullptr, default_simulator_parameters, flow_state);
+        return Genome_Evaluation{e.valid, e.fitness};
+    };
+    std::atomic<int> batches{0}, largest_batch{0};
+    Discrete_Screen screen = [&](int count, int size, const int* vecs)
+    {
+        thread_local CircuitScreen circuit_screen(n_units); // screens run on several threads
+        ++batches;
+        for (int seen = largest_batch; count > seen && !largest_batch.compare_exchange_weak(seen, count);)
+        {
+        }
+        return circuit_screen.screen(count, size, vecs);
+    };
+
+    int status = optimize(L_discrete, initial_guess.data(), evaluation, screen, params);
+
+    ASSERT_EQ(status, 0) << "Optimization failed (batched screen).";
+    EXPECT_GT(batches, 0);
+    EXPECT_LE(largest_batch, CircuitScreen::LANES);
+    EXPECT_GT(get_last_optimization_result().best_fitness, -1e9);
+
+    Circuit c_final(n_units);
+    ASSERT_TRUE(c_final.check_validity(L_discrete, initial_guess.data())) << "GA found an invalid solution.";
+}
+
+/**
+ * @brief Test that the discrete GA takes its best circuits from cold starts.
+ *
+ * Children start from their parent's flows, but a warm evaluation that
+ * fails or reaches the best fitness so far is repeated from a cold start.
+ * The best fitness of the run must therefore be the value of a cold
+ * evaluation, and the winner must be valid on its own.
+ */
+TEST_F(GeneticAlgorithmTest, OptimizeDiscreteJudgesBestCircuitsCold)
+{
+    const int n_units = 5;
+    const int L_discrete = 2 * n_units + 1;
+    std::vector<int> initial_guess(L_discrete, 0);
+    params.fitness_cache_size = 0;
+
+    std::atomic<int> warm_calls{0};
+    std::mutex best_mutex;
+    double best_cold = -1e300; // best valid fitness of a cold evaluation
+    Discrete_Evaluation evaluation = [&](int size, int* vec, std::vector<double>& flow_state)
+    {
+        const bool cold = flow_state.empty();
+        warm_calls += !cold;
+        Circuit_Evaluation e =
+            evaluate_circuit(size, vec, (size - 1) / 2, nullptr, default_simulator_parameters, flow_state);
+        if (cold && e.valid)
+        {
+            std::lock_guard<std::mutex> lock(best_mutex);
+            best_cold = std::max(best_cold, e.fitness);
+        }
+        return Genome_Evaluation{e.valid, e.fitness};
+    };
+    Discrete_Screen screen = [&](int count, int size, const int* vecs)
+    {
+        thread_local CircuitScreen circuit_screen(n_units); // screens run on several threads
+        return circuit_screen.screen(count, size, vecs);
+    };
+
+    int status = optimize(L_discrete, initial_guess.data(), evaluation, screen, params);
+
+    ASSERT_EQ(status, 0) << "Optimization failed (cold verdicts).";
+    EXPECT_GT(warm_calls, 0);
+    EXPECT_EQ(get_last_optimization_result().best_fitness, best_cold);
+    std::vector<double> cold;
+    EXPECT_TRUE(
+        evaluate_circuit(L_discrete, initial_guess.data(), n_units, nullptr, default_simulator_parameters, cold).valid);
+}
+
+/**
+ * @brief Test the fitness cache on its own.
+ *
+ * Keys are compared exactly, the number of cached genomes never exceeds the
+ * capacity, and genomes used since the clock hand passed survive eviction.
+ * Several threads then share one cache.
+ */
+TEST(FitnessCacheTest, BoundedExactAndShared)
+{
+    Fitness_Cache cache(64, sizeof(int) * 3);
+    double fitness = 0.0;
+    int a[3] = {1, 2, 3}, b[3] = {1, 2, 4};
+    EXPECT_FALSE(cache.find(a, fitness));
+    cache.insert(a, 7.5);
+    ASSERT_TRUE(cache.find(a, fitness));
+    EXPECT_EQ(fitness, 7.5);
+    EXPECT_FALSE(cache.find(b, fitness));
+    EXPECT_EQ(cache.hits(), 1);
+    EXPECT_EQ(cache.misses(), 2);
+
+    // Far more genomes than fit: a genome looked up before every insert is never evicted
+    int cached = 0;
+    for (int k = 0; k < 1000; ++k)
+    {
+        int key[3] = {k, -k, 42};
+        cache.insert(key, k);
+        ASSERT_TRUE(cache.find(a, fitness)) << "evicted a genome in use after " << k << " inserts";
+    }
+    for (int k = 0; k < 1000; ++k)
+    {
+        int key[3] = {k, -k, 42};
+        if (cache.find(key, fitness))
+        {
+            EXPECT_EQ(fitness, k);
+            ++cached;
+        }
+    }
+    EXPECT_GT(cached, 0);
+    EXPECT_LT(cached, 64);
+
+    Fitness_Cache disabled(0, sizeof(int) * 3);
+    disabled.insert(a, 1.0);
+    EXPECT_FALSE(disabled.find(a, fitness));
+
+    // Every thread reads back the fitness it stored (capacity for all keys, so nothing is evicted)
+    Fitness_Cache shared(1 << 16, sizeof(int) * 2);
+    std::atomic<int> wrong{0};
+#pragma omp parallel for
+    for (int k = 0; k < 4000; ++k)
+    {
+        int key[2] = {k % 500, 17};
+        double f;
+        if (shared.find(key, f))
+        {
+            if (f != 3.0 * (k % 500))
+                ++wrong;
+        }
+        else
+            shared.insert(key, 3.0 * (k % 500));
+    }
+    EXPECT_EQ(wrong, 0);
+    EXPECT_EQ(shared.hits() + shared.misses(), 4000);
+    for (int k = 0; k < 500; ++k)
+    {
+        int key[2] = {k, 17};
+        double f;
+        ASSERT_TRUE(shared.find(key, f));
+        EXPECT_EQ(f, 3.0 * k);
+    }
+}
+
+/**
+ * @brief Test the flat population container on its own.
+ *
+ * Genomes lie one after another in an aligned buffer, copies carry their
+ * state and fitness, and swapping two generations and clearing one keeps
+ * every buffer, so a refilled population does not move.
+ */
+TEST(PopulationTest, FlatDoubleBufferedGenerations)
+{
+    Population<double> current(3, 4), next(3, 4);
+    ASSERT_EQ(reinterpret_cast<uintptr_t>(current.genomes()) % 64, 0u);
+    const double a[3] = {0.1, 0.2, 0.3}, b[3] = {0.4, 0.5, 0.6};
+    EXPECT_EQ(current.push_back(a, {1.0, 2.0}), 0u);
+    EXPECT_EQ(current.push_back(b, {}), 1u);
+    current.fitness(0) = -1.0;
+    current.fitness(1) = 5.0;
+    EXPECT_EQ(current.best(), 1u);
+    EXPECT_EQ(current.genome(1), current.genomes() + 3);
+    EXPECT_EQ(current.genome(1)[2], 0.6);
+
+    next.push_back(current, 1);
+    next.push_back(current, 0);
+    EXPECT_EQ(next.fitness(0), 5.0);
+    EXPECT_EQ(next.genome(1)[0], 0.1);
+    EXPECT_EQ(next.state(1), std::vector<double>({1.0, 2.0}));
+
+    // Swap the generations, then refill the old one in place
+    const double* old_genomes = current.genomes();
+    const double* old_state = current.state(0).data();
+    current.swap(next);
+    EXPECT_EQ(current.size(), 2u);
+    EXPECT_EQ(next.genomes(), old_genomes);
+    next.clear();
+    EXPECT_TRUE(next.empty());
+    next.push_back(b, {3.0, 4.0});
+    EXPECT_EQ(next.genomes(), old_genomes);
+    EXPECT_EQ(next.state(0).data(), old_state);
+
+    // Growing past the capacity keeps the genomes
+    for (int i = 0; i < 10; ++i)
+        next.push_back(a, {});
+    EXPECT_EQ(next.size(), 11u);
+    EXPECT_EQ(next.genome(0)[1], 0.5);
+    EXPECT_EQ(next.genome(10)[2], 0.3);
+    ASSERT_EQ(reinterpret_cast<uintptr_t>(next.genomes()) % 64, 0u);
+}
+
+/**
+ * @brief Test that the discrete GA skips genomes it has scored before.
+ *
+ * Elites and children identical to a parent come up in every generation,
+ * so the cache must be hit, and every genome it misses is evaluated once,
+ * plus once more from a cold start if its warm evaluation is checked.
+ */
+TEST_F(GeneticAlgorithmTest, OptimizeDiscreteReusesCachedFitness)
+{
+    const int n_units = 5;
+    const int L_discrete = 2 * n_units + 1;
+    std::vector<int> initial_guess(L_discrete, 0);
+
+    std::atomic<long> evaluations{0}, warm_evaluations{0};
+    Discrete_Evaluation evaluation = [&](int size, int* vec, std::vector<double>& flow_state)
+    {
+        ++evaluations;
+        warm_evaluations += !flow_state.empty();
+        Circuit_Evaluation e =
+            evaluate_circuit(size, vec, (size - 1) / 2, nullptr, default_simulator_parameters, flow_state);
+        return Genome_Evaluation{e.valid, e.fitness};
+    };
+    Discrete_Screen screen = [&](int count, int size, const int* vecs)
+    {
+        thread_local CircuitScreen circuit_screen(n_units); // screens run on several threads
+        return circuit_screen.screen(count, size, vecs);
+    };
+
+    int status = optimize(L_discrete, initial_guess.data(), evaluation, screen, params);
+
+    ASSERT_EQ(status, 0) << "Optimization failed (fitness cache).";
+    OptimizationResult result = get_last_optimization_result();
+    EXPECT_GT(result.cache_hits, 0);
+    EXPECT_LE(result.cache_misses, evaluations);
+    EXPECT_LE(evaluations, result.cache_misses + warm_evaluations);
+    EXPECT_GT(result.best_fitness, -1e9);
+}
+
+/**
+ * @brief Test that the discrete GA repairs children failing the screen.
+ *
+ * Crossover and mutation break the structure of many children. With a
+ * repair probability of 1, every child the structural screen rejects is
+ * repaired into one it accepts; with 0, only the children still missing in
+ * the last round of a generation are.
+ */
+TEST_F(GeneticAlgorithmTest, OptimizeDiscreteRepairsInvalidChildren)
+{
+    const int n_units = 8;
+    const int L_discrete = 2 * n_units + 1;
+
+    Discrete_Evaluation evaluation = [&](int size, int* vec, std::vector<double>& flow_state)
+    {
+        Circuit_Evaluation e =
+            evaluate_circuit(size, vec, (size - 1) / 2, nullptr, default_simulator_parameters, flow_state);
+        return Genome_Evaluation{e.valid, e.fitness};
+    };
+    Discrete_Screen screen = [&](int count, int size, const int* vecs)
+    {
+        thread_local CircuitScreen circuit_screen(n_units); // screens run on several threads
+        return circuit_screen.screen(count, size, vecs);
+    };
+
+    for (double repair : {1.0, 0.0})
+    {
+        params.repair_probability = repair;
+        std::vector<int> best(L_discrete, 0);
+        ASSERT_EQ(optimize(L_discrete, best.data(), evaluation, screen, params), 0);
+
+        OptimizationResult result = get_last_optimization_result();
+        EXPECT_GT(result.children, 0);
+        EXPECT_GT(result.rejection_rate, 0.0) << "repair=" << repair;
+        if (repair == 1.0)
+            EXPECT_EQ(result.repair_rate, 1.0);
+        else
+            EXPECT_LT(result.repair_rate, 0.5);
+        EXPECT_GT(result.best_fitness, -1e9);
+
+        Circuit circuit(n_units);
+        EXPECT_EQ(circuit.check_structure(L_discrete, best.data()), ValidityReason::Valid);
+    }
+}
+
+/**
+ * @brief Test the mailboxes migrants travel between islands through.
+ *
+ * Four threads post batches to islands drawn at random while taking in
+ * their own mail, with no lock between them. Every batch must arrive
+ * exactly once, at an island other than its sender, and the batches from
+ * one sender in the order they were posted. Migrants received then replace
+ * the worst genomes of an island, never its best.
+ */
+TEST(ArchipelagoTest, LockFreeMailboxes)
+{
+    const int islands = 4, batches = 2000;
+    Archipelago<int> archipelago(islands, Migration_Topology::Random);
+    std::vector<std::vector<int>> received(islands); // (sender, number) pairs in the order received
+
+#pragma omp parallel num_threads(islands)
+    for (int island = omp_get_thread_num(); island < islands; island += omp_get_num_threads())
+    {
+        Philox random(7, island);
+        Population<int> mail(2);
+        for (int k = 0; k < batches; ++k)
+        {
+            const int to = archipelago.destination(island, random);
+            EXPECT_NE(to, island);
+            Population<int> batch(2, 1);
+            const int migrant[2] = {island, k};
+            batch.push_back(migrant, {});
+            archipelago.send(to, std::move(batch));
+
+            if (k % 16 == 0 && archipelago.receive(island, mail))
+            {
+                for (size_t i = 0; i < mail.size(); ++i)
+                    received[island].insert(received[island].end(), mail.genome(i), mail.genome(i) + 2);
+            }
+        }
+    }
+
+    Population<int> mail(2);
+    long total = 0;
+    for (int island = 0; island < islands; ++island)
+    {
+        if (archipelago.receive(island, mail))
+        {
+            for (size_t i = 0; i < mail.size(); ++i)
+                received[island].insert(received[island].end(), mail.genome(i), mail.genome(i) + 2);
+        }
+        std::vector<int> last(islands, -1);
+        for (size_t i = 0; i < received[island].size(); i += 2)
+        {
+            const int sender = received[island][i], number = received[island][i + 1];
+            EXPECT_NE(sender, island);
+            EXPECT_GT(number, last[sender]);
+            last[sender] = number;
+            ++total;
+        }
+    }
+    EXPECT_EQ(total, islands * batches);
+    EXPECT_FALSE(archipelago.receive(0, mail));
+
+    // Two islands on a ring: the best genome of one replaces the worst of the other
+    Archipelago<int> ring(2, Migration_Topology::Ring);
+    Island<int> first(0, ring, 1, 1, 1), second(1, ring, 1, 1, 1);
+    Population<int> a(1), b(1);
+    for (int i = 0; i < 3; ++i)
+    {
+        a.push_back(&i, {});
+        a.fitness(i) = i;
+        const int gene = 10 + i;
+        b.push_back(&gene, {double(i)});
+        b.fitness(i) = 10.0 * i;
+    }
+    Philox random(1);
+    EXPECT_EQ(ring.destination(1, random), 0);
+    second.migrate(0, b, random); // sends 12 to the first island
+    first.migrate(0, a, random);  // takes it in, sends 2 to the second
+    EXPECT_EQ(a.genome(0)[0], 12);
+    EXPECT_EQ(a.fitness(0), 20.0);
+    EXPECT_EQ(a.state(0), std::vector<double>({2.0}));
+    EXPECT_EQ(a.genome(2)[0], 2);
+}
+
+/**
+ * @brief Test the discrete and continuous GAs as island models.
+ *
+ * Four islands of a quarter of the population each, exchanging migrants
+ * every two generations, must still give a valid circuit and reach the
+ * continuous target.
+ */
+TEST_F(GeneticAlgorithmTest, OptimizeOnIslands)
+{
+    params.island_count = 4;
+    params.migration_interval = 2;
+    params.population_size = 100;
+
+    const int n_units = 8;
+    const int L_discrete = 2 * n_units + 1;
+    Discrete_Evaluation evaluation = [&](int size, int* vec, std::vector<double>& flow_state)
+    {
+        Circuit_Evaluation e =
+            evaluate_circuit(size, vec, (size - 1) / 2, nullptr, default_simulator_parameters, flow_state);
+        return Genome_Evaluation{e.valid, e.fitness};
+    };
+    Discrete_Screen screen = [&](int count, int size, const int* vecs)
+    {
+        thread_local CircuitScreen circuit_screen(n_units); // screens run on several threads
+        return circuit_screen.screen(count, size, vecs);
+    };
+    std::vector<int> best(L_discrete, 0);
+    ASSERT_EQ(optimize(L_discrete, best.data(), evaluation, screen, params), 0);
+    OptimizationResult result = get_last_optimization_result();
+    EXPECT_GT(result.children, 0);
+    EXPECT_GT(result.best_fitness, -1e9);
+    Circuit circuit(n_units);
+    EXPECT_EQ(circuit.check_structure(L_discrete, best.data()), ValidityReason::Valid);
+
+    const int L_continuous = target_beta_values_for_cont_test.size();
+    std::vector<double> betas(L_continuous, 0.1);
+    params.migration_topology = "random";
+    ASSERT_EQ(optimize(L_continuous, betas.data(), simple_continuous_fitness_adapter,
+                       dummy_validity_continuous_adapter, params),
+              0);
+    result = get_last_optimization_result();
+    ASSERT_NEAR(result.best_fitness, 0.0, EPSILON * EPSILON * L_continuous);
+    for (int i = 0; i < L_continuous; ++i)
+        ASSERT_NEAR(betas[i], target_beta_values_for_cont_test[i], EPSILON);
+}
+
+/**
+ * @brief Test that a seeded run gives the same result on any number of threads.
+ *
+ * Children are bred from random streams keyed by their generation and slot,
+ * and the cache is filled in population order, so one thread and four
+ * threads must find the same circuit, bit for bit, with warm-started
+ * evaluations; the same holds for the continuous GA.
+ */
+TEST_F(GeneticAlgorithmTest, SeededRunIndependentOfThreadCount)
+{
+    const int n_units = 5;
+    const int L_discrete = 2 * n_units + 1;
+    Discrete_Evaluation evaluation = [](int size, int* vec, std::vector<double>& flow_state)
+    {
+        Circuit_Evaluation e =
+            evaluate_circuit(size, vec, (size - 1) / 2, nullptr, default_simulator_parameters, flow_state);
+        return Genome_Evaluation{e.valid, e.fitness};
+    };
+    Discrete_Screen screen = [&](int count, int size, const int* vecs)
+    {
+        thread_local CircuitScreen circuit_screen(n_units);
+        return circuit_screen.screen(count, size, vecs);
+    };
+    Continuous_Evaluation quadratic = [](int size, double* x, std::vector<double>& state)
+    {
+        double f = 0.0;
+        for (int i = 0; i < size; ++i)
+            f -= (x[i] - 0.3 * (i % 3)) * (x[i] - 0.3 * (i % 3));
+        state.assign(x, x + size);
+        return Genome_Evaluation{true, f};
+    };
+
+    const int threads_before = omp_get_max_threads();
+    std::vector<int> circuits[2];
+    std::vector<double> volumes[2];
+    double fitness[2];
+    for (int run = 0; run < 2; ++run)
+    {
+        omp_set_num_threads(run == 0 ? 1 : 4);
+        set_random_seed(123);
+        circuits[run].assign(L_discrete, 0);
+        ASSERT_EQ(optimize(L_discrete, circuits[run].data(), evaluation, screen, params), 0);
+        fitness[run] = get_last_optimization_result().best_fitness;
+        volumes[run].assign(8, 0.5);
+        ASSERT_EQ(optimize(8, volumes[run].data(), quadratic, all_true_reals, params), 0);
+    }
+    omp_set_num_threads(threads_before);
+
+    EXPECT_EQ(circuits[0], circuits[1]);
+    EXPECT_EQ(fitness[0], fitness[1]);
+    EXPECT_EQ(volumes[0], volumes[1]);
+}
+
 /**
  * @brief Test for optimizing mixed discrete-continuous variables for a
  * circuit with N=10.
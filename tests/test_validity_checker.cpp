@@ -5,8 +5,13 @@
  *
  */
 #include "CCircuit.h"
+#include "CCircuitSampler.h"
+#include "CCircuitScreen.h"
 #include <cmath>
 #include <gtest/gtest.h>
+#include <queue>
+#include <random>
+#include <set>
 #include <vector>
 
 /**
@@ -272,6 +277,26 @@ TEST_F(ValidityCheckerTest, DISABLED_MassBalanceNotConverge)
     ASSERT_FALSE(c.check_validity((int)cv.size(), cv.data()));
 }
 
+/**
+ * @brief Test that rule 9 holds the recycle loops to one iteration budget.
+ *
+ * Each recycle loop of this circuit settles within 100 iterations, but they
+ * need more than 100 together, so the circuit fails the convergence check
+ * although run_mass_balance with the same limit succeeds.
+ */
+TEST_F(ValidityCheckerTest, MassBalanceBudgetCoversAllLoops)
+{
+    const int n = 6;
+    std::vector<int> v = {1, 3, 1, 4, 8, 8, 1, 0, 6, 2, 5, 3, 4};
+    std::vector<double> beta(n, 0.5);
+    Circuit c(n);
+    ASSERT_TRUE(c.initialize_from_vector((int)v.size(), v.data(), beta.data()));
+    ASSERT_EQ(c.check_structure((int)v.size(), v.data()), ValidityReason::Valid);
+    ASSERT_TRUE(c.run_mass_balance(1e-6, 100));
+    ASSERT_GT(c.get_iterations() - 1, 100);
+    EXPECT_FALSE(c.check_validity((int)v.size(), v.data()));
+}
+
 /**
  * @brief Test for a valid circuit vector with unit parameters.
  *
@@ -412,3 +437,243 @@ TEST_F(ValidityCheckerTest, MissingTailingsTerminal)
     std::vector<int> v = {0, 2, 1, 2, 3};
     ASSERT_FALSE(c.check_validity((int)v.size(), v.data()));
 }
+
+/**
+ * @brief Test that check_structure reports the rule a circuit fails.
+ *
+ * Uses the circuits of the tests above, one per structural rule, and checks
+ * that check_validity agrees with check_structure on all of them.
+ */
+TEST_F(ValidityCheckerTest, StructureReasons)
+{
+    struct Case
+    {
+        int n;
+        std::vector<int> v;
+        ValidityReason reason;
+    };
+    std::vector<Case> cases = {
+        {6, {0, 3, 1, 3, 2, 3, 5, 4, 7, 6, 3, 3, 8}, ValidityReason::Valid},
+        {5, std::vector<int>(9, 0), ValidityReason::Length},
+        {5, {5, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0}, ValidityReason::Feed},
+        {5, {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10}, ValidityReason::Index},
+        {5, {0, 0, 5, 1, 5, 2, 5, 3, 5, 4, 5}, ValidityReason::SelfLoop},
+        {5, {0, 1, 1, 2, 5, 3, 5, 4, 5, 5, 6}, ValidityReason::SameOutput},
+        {5, {0, 7, 5, 2, 5, 3, 5, 4, 5, 6, 5}, ValidityReason::Unreachable},
+        {3, {0, 1, 2, 0, 3, 0, 3}, ValidityReason::TwoTerminals},
+        {2, {0, 2, 1, 2, 3}, ValidityReason::MissingOutlet},
+    };
+    for (auto& c : cases)
+    {
+        Circuit circuit(c.n);
+        EXPECT_EQ(circuit.check_structure((int)c.v.size(), c.v.data()), c.reason) << "n=" << c.n;
+        if (c.reason != ValidityReason::Valid)
+        {
+            EXPECT_FALSE(circuit.check_validity((int)c.v.size(), c.v.data())) << "n=" << c.n;
+        }
+    }
+}
+
+
+/**
+ * @brief Test the reachability rules against a search from every unit.
+ *
+ * Random vectors that pass rules 1-5, with circuits of more than 64 units
+ * among them, must get the same reason as a plain breadth-first search
+ * from the feed and from every unit gives.
+ */
+TEST_F(ValidityCheckerTest, ReachabilityMatchesSearchFromEveryUnit)
+{
+    std::mt19937 rng(13);
+    int counts[4] = {0, 0, 0, 0};
+    for (int n : {3, 6, 12, 70, 130})
+    {
+        std::uniform_int_distribution<int> unit(0, n - 1), dest(0, n + 2);
+        for (int trial = 0; trial < 300; ++trial)
+        {
+            std::vector<int> v(2 * n + 1);
+            v[0] = unit(rng);
+            for (int u = 0; u < n; ++u)
+            {
+                do
+                {
+                    v[1 + 2 * u] = dest(rng);
+                    // mostly unit destinations, so that long chains and loops form
+                    if (v[1 + 2 * u] >= n && rng() % 4 != 0)
+                        v[1 + 2 * u] = unit(rng);
+                } while (v[1 + 2 * u] == u);
+                do
+                    v[2 + 2 * u] = dest(rng);
+                while (v[2 + 2 * u] == u || v[2 + 2 * u] == v[1 + 2 * u]);
+            }
+
+            // Units (and outlets n..n+2) reachable from a start unit
+            auto search = [&](int start)
+            {
+                std::vector<bool> seen(n + 3, false);
+                std::queue<int> q;
+                q.push(start);
+                seen[start] = true;
+                while (!q.empty())
+                {
+                    const int u = q.front();
+                    q.pop();
+                    for (int e = 1; e <= 2; ++e)
+                    {
+                        const int d = v[2 * u + e];
+                        if (!seen[d])
+                        {
+                            seen[d] = true;
+                            if (d < n)
+                                q.push(d);
+                        }
+                    }
+                }
+                return seen;
+            };
+
+            ValidityReason expected = ValidityReason::Valid;
+            std::vector<bool> from_feed = search(v[0]);
+            std::vector<bool> global(3, false);
+            for (int u = 0; u < n && expected == ValidityReason::Valid; ++u)
+            {
+                if (!from_feed[u])
+                    expected = ValidityReason::Unreachable;
+            }
+            for (int u = 0; u < n && expected == ValidityReason::Valid; ++u)
+            {
+                std::vector<bool> seen = search(u);
+                int reached = 0;
+                for (int t = 0; t < 3; ++t)
+                {
+                    reached += seen[n + t];
+                    global[t] = global[t] || seen[n + t];
+                }
+                if (reached < 2)
+                    expected = ValidityReason::TwoTerminals;
+            }
+            if (expected == ValidityReason::Valid && (!(global[0] || global[1]) || !global[2]))
+                expected = ValidityReason::MissingOutlet;
+
+            Circuit circuit(n);
+            ASSERT_EQ(circuit.check_structure((int)v.size(), v.data()), expected) << "n=" << n << " trial=" << trial;
+            ++counts[expected == ValidityReason::Valid          ? 0
+                     : expected == ValidityReason::Unreachable  ? 1
+                     : expected == ValidityReason::TwoTerminals ? 2
+                                                                : 3];
+        }
+    }
+    // Every outcome should have come up
+    EXPECT_GT(counts[0], 0);
+    EXPECT_GT(counts[1], 0);
+    EXPECT_GT(counts[2], 0);
+}
+
+/**
+ * @brief Test the bit-sliced screen against check_structure.
+ *
+ * Batches of random vectors, with out-of-range entries, self-loops and
+ * repeated outlets among them, must pass the screen exactly where
+ * check_structure accepts them; partial batches leave the unused bits clear.
+ */
+TEST_F(ValidityCheckerTest, ScreenMatchesCheckStructure)
+{
+    std::mt19937 rng(14);
+    int accepted_total = 0;
+    for (int n : {1, 2, 3, 6, 12, 70})
+    {
+        const int size = 2 * n + 1;
+        std::uniform_int_distribution<int> unit(0, n - 1), dest(-1, n + 3);
+        CircuitScreen screen(n);
+        Circuit circuit(n);
+        for (int batch = 0; batch < 40; ++batch)
+        {
+            const int count = (batch % 4 == 3) ? 1 + batch % 63 : CircuitScreen::LANES;
+            std::vector<int> vectors(static_cast<size_t>(count) * size);
+            for (int k = 0; k < count; ++k)
+            {
+                int* v = &vectors[static_cast<size_t>(k) * size];
+                v[0] = (rng() % 50 == 0) ? n : unit(rng);
+                for (int e = 1; e < size; ++e)
+                {
+                    // mostly in range and distinct from the unit itself, so that many vectors pass
+                    v[e] = (rng() % 8 == 0) ? dest(rng) : unit(rng);
+                    if (rng() % 3 == 0)
+                        v[e] = n + static_cast<int>(rng() % 3);
+                }
+            }
+
+            const uint64_t mask = screen.screen(count, size, vectors.data());
+            for (int k = 0; k < count; ++k)
+            {
+                const bool valid = circuit.check_structure(size, &vectors[static_cast<size_t>(k) * size]) ==
+                                   ValidityReason::Valid;
+                ASSERT_EQ(((mask >> k) & 1) != 0, valid) << "n=" << n << " batch=" << batch << " k=" << k;
+                accepted_total += valid;
+            }
+            if (count < CircuitScreen::LANES)
+            {
+                EXPECT_EQ(mask >> count, 0u);
+            }
+        }
+        // The length rule applies to the whole batch
+        std::vector<int> short_vectors(2 * size, 0);
+        EXPECT_EQ(screen.screen(2, size - 1, short_vectors.data()), 0u);
+    }
+    EXPECT_GT(accepted_total, 0);
+}
+
+/**
+ * @brief Test the constructive sampler against check_structure.
+ *
+ * Sampled circuits, and random variations of them, must all pass the
+ * structural rules. A valid vector varied by no changes comes back as it
+ * was, and for two units every valid circuit must come out of the sampler.
+ */
+TEST_F(ValidityCheckerTest, SampledCircuitsPassStructure)
+{
+    for (int n : {1, 2, 3, 6, 12, 31})
+    {
+        const int size = 2 * n + 1;
+        Circuit circuit(n);
+        Philox random(7, static_cast<uint32_t>(n));
+        std::vector<int> v(size), w(size);
+        for (int trial = 0; trial < 2000; ++trial)
+        {
+            sample_valid_circuit(n, random, v.data());
+            ASSERT_EQ(circuit.check_structure(size, v.data()), ValidityReason::Valid) << "n=" << n << " trial=" << trial;
+
+            vary_valid_circuit(n, v.data(), 0, random, w.data());
+            ASSERT_EQ(w, v);
+            vary_valid_circuit(n, v.data(), 1 + trial % size, random, w.data());
+            ASSERT_EQ(circuit.check_structure(size, w.data()), ValidityReason::Valid) << "n=" << n << " trial=" << trial;
+
+            // Any vector, in range or not, is completed
+            for (int& e : w)
+                e = static_cast<int>(random() % (n + 5)) - 1;
+            vary_valid_circuit(n, w.data(), 0, random, w.data());
+            ASSERT_EQ(circuit.check_structure(size, w.data()), ValidityReason::Valid) << "n=" << n << " trial=" << trial;
+        }
+    }
+
+    // Enumerate the valid circuits of two units and sample until all have come up
+    const int n = 2, size = 5;
+    Circuit circuit(n);
+    std::set<std::vector<int>> valid, sampled;
+    std::vector<int> v(size);
+    for (int code = 0; code < n * 625; ++code)
+    {
+        v[0] = code / 625;
+        for (int e = 1, rest = code % 625; e < size; ++e, rest /= 5)
+            v[e] = rest % 5;
+        if (circuit.check_structure(size, v.data()) == ValidityReason::Valid)
+            valid.insert(v);
+    }
+    Philox random(11);
+    for (int trial = 0; trial < 20000; ++trial)
+    {
+        sample_valid_circuit(n, random, v.data());
+        sampled.insert(v);
+    }
+    EXPECT_EQ(sampled, valid);
+}